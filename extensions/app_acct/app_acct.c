@@ -50,6 +50,10 @@ static int acct_cb( struct msg ** msg, struct avp * avp, struct session * sess,
 	struct msg * m;
 	struct avp * a = NULL;
 	struct avp_hdr * art=NULL, *arn=NULL; /* We keep a pointer on the Accounting-Record-{Type, Number} AVPs from the query */
+	struct msg_avp_search srch[] = {
+		{ acct_dict.Accounting_Record_Type,   -1, NULL },
+		{ acct_dict.Accounting_Record_Number, -1, NULL }
+	};
 	struct acct_record_list rl;
 	
 	TRACE_ENTRY("%p %p %p %p", msg, avp, sess, act);
@@ -75,13 +79,12 @@ static int acct_cb( struct msg ** msg, struct avp * avp, struct session * sess,
 	/* OK, we can send a positive reply now */
 	
 	/* Get Accounting-Record-{Number,Type} values */
-	CHECK_FCT( fd_msg_search_avp ( m, acct_dict.Accounting_Record_Type, &a) );
-	if (a) {
-		CHECK_FCT( fd_msg_avp_hdr( a, &art )  );
+	CHECK_FCT( fd_msg_search_avps ( m, srch, sizeof(srch) / sizeof(srch[0]) ) );
+	if (srch[0].avp) {
+		CHECK_FCT( fd_msg_avp_hdr( srch[0].avp, &art )  );
 	}
-	CHECK_FCT( fd_msg_search_avp ( m, acct_dict.Accounting_Record_Number, &a) );
-	if (a) {
-		CHECK_FCT( fd_msg_avp_hdr( a, &arn )  );
+	if (srch[1].avp) {
+		CHECK_FCT( fd_msg_avp_hdr( srch[1].avp, &arn )  );
 	}
 	
 	/* Create the answer message */
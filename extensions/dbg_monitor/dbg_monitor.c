@@ -127,6 +127,12 @@ static void * mn_thr(void * arg)
 		TRACE_DEBUG(INFO, "[dbg_monitor] Dumping servers information");
 		TRACE_DEBUG(INFO, "%s", fd_servers_dump(&buf, &len, NULL, 1));
 		
+		TRACE_DEBUG(INFO, "[dbg_monitor] Dumping rate limits");
+		TRACE_DEBUG(INFO, "%s", fd_rt_limits_dump(&buf, &len, NULL));
+		
+		TRACE_DEBUG(INFO, "[dbg_monitor] Dumping messages pools statistics");
+		TRACE_DEBUG(INFO, "%s", fd_msg_pools_dump(&buf, &len, NULL));
+		
 		sleep(1);
 	}
 	
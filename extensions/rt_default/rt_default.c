@@ -77,6 +77,11 @@ static int rtd_entry(char * conffile)
 	/* Register the callback */
 	CHECK_FCT( fd_rt_out_register( rtd_out, NULL, 5, &rtd_hdl ) );
 	
+	/* Let the daemon cache the routing decisions if our rules allow it */
+	if (rtd_is_cacheable()) {
+		CHECK_FCT( fd_rt_out_set_cacheable( rtd_hdl, 1 ) );
+	}
+	
 	/* We're done */
 	return 0;
 }
@@ -79,6 +79,9 @@ enum rtd_targ_type {
 /* Add a rule */
 int rtd_add(enum rtd_crit_type ct, char * criteria, enum rtd_targ_type tt, char * target, int score, int flags);
 
+/* Check if the rules depend only on Destination-Host and Destination-Realm (see fd_rt_out_set_cacheable) */
+int rtd_is_cacheable(void);
+
 /* Process a message & peer list through the rules repository, updating the scores */
 int rtd_process( struct msg * msg, struct fd_list * candidates );
 
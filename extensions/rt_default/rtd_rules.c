@@ -494,6 +494,26 @@ int rtd_add(enum rtd_crit_type ct, char * criteria, enum rtd_targ_type tt, char
 	return 0;
 }
 
+/* Check if the rules only use criteria that the daemon can cache its routing decisions on (Destination-Host / Destination-Realm) */
+int rtd_is_cacheable(void)
+{
+	int i;
+	
+	for (i = 0; i < RTD_TAR_MAX; i++) {
+		struct fd_list * li;
+		for (li = TARGETS[i].next; li != &TARGETS[i]; li = li->next) {
+			struct target * trg = (struct target *)li;
+			if (!FD_IS_LIST_EMPTY(&trg->rules[RTD_CRI_OH])
+			 || !FD_IS_LIST_EMPTY(&trg->rules[RTD_CRI_OR])
+			 || !FD_IS_LIST_EMPTY(&trg->rules[RTD_CRI_UN])
+			 || !FD_IS_LIST_EMPTY(&trg->rules[RTD_CRI_SI]))
+				return 0;
+		}
+	}
+	
+	return 1;
+}
+
 /* Check if a message and list of eligible candidate match any of our rules, and update its score according to it. */
 int rtd_process( struct msg * msg, struct fd_list * candidates )
 {
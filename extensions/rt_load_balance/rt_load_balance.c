@@ -29,17 +29,156 @@
 * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                                                             *
 *********************************************************************************************************/
 
-#include <freeDiameter/extension.h>
+#include "rt_load_balance.h"
 
 /*
  * Load balancing extension. Send request to least-loaded node.
+ *
+ * Among the candidates that have the best score (as attributed by the other routing extensions), two peers are
+ * picked at random in proportion of their configured weight, and the one with the lowest expected delay
+ * (number of pending requests times average answer delay, divided by the weight) is preferred
+ * ("power of two choices"). The other candidates of the same score are lowered by FD_SCORE_LOAD_BALANCE.
+ * Peers that answered DIAMETER_TOO_BUSY are avoided during BusyBackoff seconds.
  */
 
+/* The configuration */
+struct rtlb_conf rtlb_conf = { .BusyBackoff = 10, .weights = FD_LIST_INITIALIZER(rtlb_conf.weights) };
+
+/* The state of a peer: its configured weight and busy status. The entries are only added (until the extension is unloaded),
+ so the table is read without lock for each message. The peer itself is taken from the candidates list. */
+struct rtlb_peer {
+	struct rtlb_peer *	next;	/* next entry in the hash bucket, set before the entry is published */
+	uint32_t		hash;
+	DiamId_t		diamid;
+	size_t			diamidlen;
+	int			weight;
+	time_t			busy_until; /* the peer is avoided until this time (atomic access) */
+};
+
+/* Size of the hash table of peers (pow of 2) */
+#define RTLB_HASH_SIZE	6
+#define RTLB_H_MASK( __hash ) ((__hash) & (( 1 << RTLB_HASH_SIZE ) - 1))
+
+static struct rtlb_peer * rtlb_peers[1 << RTLB_HASH_SIZE];
+static pthread_mutex_t	 rtlb_lock = PTHREAD_MUTEX_INITIALIZER; /* serializes the additions in the table */
+
+/* Save a weight from the configuration */
+int rtlb_conf_add_weight(char * diamid, int weight)
+{
+	struct rtlb_weight * w;
+	
+	CHECK_MALLOC( w = malloc(sizeof(struct rtlb_weight)) );
+	memset(w, 0, sizeof(struct rtlb_weight));
+	fd_list_init(&w->chain, w);
+	w->diamid = diamid;
+	w->diamidlen = strlen(diamid);
+	w->weight = weight;
+	fd_list_insert_before(&rtlb_conf.weights, &w->chain);
+	
+	return 0;
+}
+
+/* Search a peer in the table, no lock needed */
+static struct rtlb_peer * rtlb_find(DiamId_t diamid, size_t diamidlen, uint32_t hash)
+{
+	struct rtlb_peer * p;
+	
+	for (p = __atomic_load_n(&rtlb_peers[RTLB_H_MASK(hash)], __ATOMIC_ACQUIRE); p; p = p->next) {
+		if ((p->hash == hash) && !fd_os_cmp(p->diamid, p->diamidlen, diamid, diamidlen))
+			return p;
+	}
+	return NULL;
+}
+
+/* Search or create a peer in the table, rtlb_lock must be held */
+static int rtlb_get(DiamId_t diamid, size_t diamidlen, struct rtlb_peer ** found)
+{
+	uint32_t hash = fd_os_hash((uint8_t *)diamid, diamidlen);
+	struct rtlb_peer * p;
+	struct fd_list * li;
+	
+	p = rtlb_find(diamid, diamidlen, hash);
+	if (!p) {
+		CHECK_MALLOC( p = malloc(sizeof(struct rtlb_peer)) );
+		memset(p, 0, sizeof(struct rtlb_peer));
+		p->hash = hash;
+		CHECK_MALLOC_DO( p->diamid = os0dup(diamid, diamidlen), { free(p); return ENOMEM; } );
+		p->diamidlen = diamidlen;
+		p->weight = 1;
+		for (li = rtlb_conf.weights.next; li != &rtlb_conf.weights; li = li->next) {
+			struct rtlb_weight * w = li->o;
+			if (!fd_os_almostcasesrch(w->diamid, w->diamidlen, diamid, diamidlen, NULL)) {
+				p->weight = w->weight;
+				break;
+			}
+		}
+		/* Publish the entry once it is complete */
+		p->next = rtlb_peers[RTLB_H_MASK(hash)];
+		__atomic_store_n(&rtlb_peers[RTLB_H_MASK(hash)], p, __ATOMIC_RELEASE);
+	}
+	
+	*found = p;
+	return 0;
+}
+
+/* Make sure all the candidates are in the table, before any score is changed. The entries are never removed. */
+static int rtlb_add_candidates(struct fd_list * candidates)
+{
+	struct fd_list * li;
+	int missing = 0, ret = 0;
+	
+	for (li = candidates->next; li != candidates; li = li->next) {
+		struct rtd_candidate * c = (struct rtd_candidate *) li;
+		if (!rtlb_find(c->diamid, c->diamidlen, fd_os_hash((uint8_t *)c->diamid, c->diamidlen))) {
+			missing = 1;
+			break;
+		}
+	}
+	
+	if (!missing)
+		return 0;
+	
+	CHECK_POSIX( pthread_mutex_lock(&rtlb_lock) );
+	for (li = candidates->next; li != candidates; li = li->next) {
+		struct rtd_candidate * c = (struct rtd_candidate *) li;
+		struct rtlb_peer * p;
+		
+		CHECK_FCT_DO( ret = rtlb_get(c->diamid, c->diamidlen, &p), break );
+	}
+	CHECK_POSIX( pthread_mutex_unlock(&rtlb_lock) );
+	
+	return ret;
+}
+
+/* The expected delay of a peer, the lower the better */
+static long long rtlb_cost(struct rtd_candidate * c, struct rtlb_peer * p)
+{
+	struct peer_hdr * peer = c->peer;
+	long to_receive = 0, delay = 0;
+	
+	/* The peer object is saved in the candidate by the daemon, except when the message is routed again */
+	if (!peer) {
+		CHECK_FCT_DO( fd_peer_getbyid(c->diamid, c->diamidlen, 0, &peer), return LLONG_MAX );
+		if (!peer)
+			return LLONG_MAX;
+	}
+	CHECK_FCT_DO( fd_peer_get_load_pending(peer, &to_receive, NULL), return LLONG_MAX );
+	CHECK_FCT_DO( fd_peer_get_answer_delay(peer, &delay), return LLONG_MAX );
+	
+	/* Peers that never answered yet are considered as fast as possible, so that they get a chance */
+	return (long long)(to_receive + 1) * (delay ?: 1) / p->weight;
+}
+
 /* The callback for load balancing the requests across the peers */
 static int rt_load_balancing(void * cbdata, struct msg ** pmsg, struct fd_list * candidates)
 {
 	struct fd_list *lic;
 	struct msg * msg = *pmsg;
+	struct timespec now;
+	struct rtd_candidate * chosen[2] = { NULL, NULL };
+	struct rtlb_peer * chosen_p[2] = { NULL, NULL };
+	unsigned long long total, r;
+	int best = INT_MIN, i;
 	
 	TRACE_ENTRY("%p %p %p", cbdata, msg, candidates);
 	
@@ -48,42 +187,154 @@ static int rt_load_balancing(void * cbdata, struct msg ** pmsg, struct fd_list *
 	/* Check if it is worth processing the message */
 	if (FD_IS_LIST_EMPTY(candidates))
 		return 0;
-
-	/* load balancing */
+	
+	CHECK_SYS( clock_gettime(CLOCK_REALTIME, &now) );
+	
+	/* Candidates never seen before are added first, so that the scores are changed in a single pass */
+	CHECK_FCT( rtlb_add_candidates(candidates) );
+	
+	/* Lower the busy peers, and find the best score among the others */
 	for (lic = candidates->next; lic != candidates; lic = lic->next) {
 		struct rtd_candidate * cand = (struct rtd_candidate *) lic;
-		struct peer_hdr *peer;
-		long to_receive, to_send, load;
-		int score;
-		CHECK_FCT(fd_peer_getbyid(cand->diamid, cand->diamidlen, 0, &peer));
-		CHECK_FCT(fd_peer_get_load_pending(peer, &to_receive, &to_send));
-                load = to_receive + to_send;
-		/* other routing mechanisms need to add to the
-		 * appropriate entries so their base value is high
-		 * enough that they are considered */
-
-		/* logarithmic scaling */
-                int load_log = 0;
-                while (load > 0) {
-                    load_log++;
-                    load /= 2;
-                }
-		score = cand->score;
-		cand->score -= load_log;
-		TRACE_DEBUG(FULL, "evaluated peer `%.*s', score was %d, now %d", (int)cand->diamidlen, cand->diamid, score, cand->score);
+		struct rtlb_peer * p = rtlb_find(cand->diamid, cand->diamidlen, fd_os_hash((uint8_t *)cand->diamid, cand->diamidlen));
+		if (!p)
+			continue;
+		if (now.tv_sec < __atomic_load_n(&p->busy_until, __ATOMIC_RELAXED)) {
+			cand->score -= 2 * FD_SCORE_LOAD_BALANCE;
+			TRACE_DEBUG(FULL, "peer `%.*s' answered TOO_BUSY recently, score now %d", (int)cand->diamidlen, cand->diamid, cand->score);
+			continue;
+		}
+		if (cand->score > best)
+			best = cand->score;
+	}
+	
+	/* Pick two of the best candidates at random, in proportion of their weights */
+	for (i = 0; (i < 2) && (best >= 0); i++) {
+		for (total = 0, lic = candidates->next; lic != candidates; lic = lic->next) {
+			struct rtd_candidate * cand = (struct rtd_candidate *) lic;
+			struct rtlb_peer * p;
+			if ((cand->score != best) || (cand == chosen[0]))
+				continue;
+			p = rtlb_find(cand->diamid, cand->diamidlen, fd_os_hash((uint8_t *)cand->diamid, cand->diamidlen));
+			if (p && (now.tv_sec >= __atomic_load_n(&p->busy_until, __ATOMIC_RELAXED)))
+				total += p->weight;
+		}
+		if (!total)
+			break;
+		
+		r = ((unsigned long long)rand() * ((unsigned long long)RAND_MAX + 1) + rand()) % total;
+		for (lic = candidates->next; lic != candidates; lic = lic->next) {
+			struct rtd_candidate * cand = (struct rtd_candidate *) lic;
+			struct rtlb_peer * p;
+			if ((cand->score != best) || (cand == chosen[0]))
+				continue;
+			p = rtlb_find(cand->diamid, cand->diamidlen, fd_os_hash((uint8_t *)cand->diamid, cand->diamidlen));
+			if (!p || (now.tv_sec < __atomic_load_n(&p->busy_until, __ATOMIC_RELAXED)))
+				continue;
+			if (r < (unsigned long long)p->weight) {
+				chosen[i] = cand;
+				chosen_p[i] = p;
+				break;
+			}
+			r -= p->weight;
+		}
+	}
+	
+	/* Keep the one with the lowest expected delay */
+	if (chosen[1] && (rtlb_cost(chosen[1], chosen_p[1]) < rtlb_cost(chosen[0], chosen_p[0])))
+		chosen[0] = chosen[1];
+	
+	/* And lower all the other candidates with the same score */
+	if (chosen[0]) {
+		for (lic = candidates->next; lic != candidates; lic = lic->next) {
+			struct rtd_candidate * cand = (struct rtd_candidate *) lic;
+			if ((cand->score == best) && (cand != chosen[0]))
+				cand->score -= FD_SCORE_LOAD_BALANCE;
+		}
+		TRACE_DEBUG(FULL, "load balancing chose peer `%.*s' among the candidates with score %d", (int)chosen[0]->diamidlen, chosen[0]->diamid, best);
 	}
+	
+	return 0;
+}
 
+/* Catch the DIAMETER_TOO_BUSY errors sent by our direct peers */
+static int rt_load_balancing_busy(void * cbdata, struct msg ** pmsg)
+{
+	struct msg_hdr * hdr;
+	struct avp * avp;
+	union avp_value *a_rc = NULL, *a_oh = NULL;
+	DiamId_t sentby = NULL;
+	size_t sentbylen;
+	struct rtlb_peer * p;
+	
+	CHECK_FCT( fd_msg_hdr(*pmsg, &hdr) );
+	if ((hdr->msg_flags & CMD_FLAG_REQUEST) || !(hdr->msg_flags & CMD_FLAG_ERROR))
+		return 0;
+	
+	CHECK_FCT( fd_msg_source_get( *pmsg, &sentby, &sentbylen ) );
+	if (!sentby)
+		return 0;
+	
+	CHECK_FCT(  fd_msg_browse(*pmsg, MSG_BRW_FIRST_CHILD, &avp, NULL)  );
+	while (avp && !(a_rc && a_oh)) {
+		struct avp_hdr * ahdr;
+		
+		CHECK_FCT(  fd_msg_avp_hdr( avp, &ahdr )  );
+		if (! (ahdr->avp_flags & AVP_FLAG_VENDOR)) {
+			switch (ahdr->avp_code) {
+				case AC_ORIGIN_HOST:
+					CHECK_FCT( fd_msg_parse_dict ( avp, fd_g_config->cnf_dict, NULL ) );
+					ASSERT( ahdr->avp_value );
+					a_oh = ahdr->avp_value;
+					break;
+					
+				case AC_RESULT_CODE:
+					CHECK_FCT( fd_msg_parse_dict ( avp, fd_g_config->cnf_dict, NULL ) );
+					ASSERT( ahdr->avp_value );
+					a_rc = ahdr->avp_value;
+					if (a_rc->u32 != ER_DIAMETER_TOO_BUSY)
+						return 0;
+					break;
+			}
+		}
+		CHECK_FCT(  fd_msg_browse(avp, MSG_BRW_NEXT, &avp, NULL)  );
+	}
+	
+	/* Only the peer that is itself busy is avoided, not a relay that forwarded the error */
+	if (!a_rc || !a_oh || fd_os_almostcasesrch(a_oh->os.data, a_oh->os.len, sentby, sentbylen, NULL))
+		return 0;
+	
+	CHECK_POSIX( pthread_mutex_lock(&rtlb_lock) );
+	CHECK_FCT_DO( rtlb_get(sentby, sentbylen, &p), p = NULL );
+	CHECK_POSIX( pthread_mutex_unlock(&rtlb_lock) );
+	if (p) {
+		struct timespec now;
+		CHECK_SYS( clock_gettime(CLOCK_REALTIME, &now) );
+		__atomic_store_n(&p->busy_until, now.tv_sec + rtlb_conf.BusyBackoff, __ATOMIC_RELAXED);
+	}
+	
+	TRACE_DEBUG(INFO, "Peer '%s' is busy, avoiding it for %d seconds", sentby, rtlb_conf.BusyBackoff);
+	
 	return 0;
 }
 
-/* handler */
+/* handlers */
 static struct fd_rt_out_hdl * rt_load_balancing_hdl = NULL;
+static struct fd_rt_fwd_hdl * rt_load_balancing_busy_hdl = NULL;
 
 /* entry point */
 static int rt_load_balance_entry(char * conffile)
 {
-	/* Register the callback */
-	CHECK_FCT(fd_rt_out_register(rt_load_balancing, NULL, 10, &rt_load_balancing_hdl));
+	/* The configuration file is optional */
+	if (conffile) {
+		CHECK_FCT( rtlb_conf_handle(conffile) );
+	}
+	
+	/* Register the callbacks. We are called late, so that the other extensions have given their scores. */
+	CHECK_FCT(fd_rt_out_register(rt_load_balancing, NULL, 2, &rt_load_balancing_hdl));
+	if (rtlb_conf.BusyBackoff) {
+		CHECK_FCT(fd_rt_fwd_register(rt_load_balancing_busy, NULL, RT_FWD_ANS, &rt_load_balancing_busy_hdl));
+	}
 
 	TRACE_DEBUG(INFO, "Extension 'Load Balancing' initialized");
 	return 0;
@@ -92,8 +343,29 @@ static int rt_load_balance_entry(char * conffile)
 /* Unload */
 void fd_ext_fini(void)
 {
+	int i;
+	
 	/* Unregister the callbacks */
+	if (rt_load_balancing_busy_hdl) {
+		CHECK_FCT_DO(fd_rt_fwd_unregister(rt_load_balancing_busy_hdl, NULL), /* continue */);
+	}
 	CHECK_FCT_DO(fd_rt_out_unregister(rt_load_balancing_hdl, NULL), /* continue */);
+	
+	/* Destroy the data */
+	for (i = 0; i < sizeof(rtlb_peers) / sizeof(rtlb_peers[0]); i++) {
+		while (rtlb_peers[i]) {
+			struct rtlb_peer * p = rtlb_peers[i];
+			rtlb_peers[i] = p->next;
+			free(p->diamid);
+			free(p);
+		}
+	}
+	while (!FD_IS_LIST_EMPTY(&rtlb_conf.weights)) {
+		struct rtlb_weight * w = rtlb_conf.weights.next->o;
+		fd_list_unlink(&w->chain);
+		free(w->diamid);
+		free(w);
+	}
 	return ;
 }
 
@@ -97,6 +97,8 @@ struct ta_mess_info {
 
 static my_sem_t ta_sem; /* To handle the concurrency */
 
+static struct msg_tmpl * ta_tmpl = NULL; /* The AVPs that are identical in all the test messages */
+
 /* Cb called when an answer is received */
 static void ta_cb_ans(void * data, struct msg ** msg)
 {
@@ -164,6 +166,52 @@ end:
 	return;
 }
 
+/* Create the template of the constant AVPs of the test messages */
+static int ta_bench_tmpl_new(void)
+{
+	struct msg * skel = NULL;
+	struct avp * avp;
+	union avp_value val;
+	int ret = 0;
+	
+	CHECK_FCT( fd_msg_new( NULL, 0, &skel ) );
+	
+	/* Set the Destination-Realm AVP */
+	{
+		CHECK_FCT_DO( ret = fd_msg_avp_new ( ta_dest_realm, 0, &avp ), goto out  );
+		val.os.data = (unsigned char *)(ta_conf->dest_realm);
+		val.os.len  = strlen(ta_conf->dest_realm);
+		CHECK_FCT_DO( ret = fd_msg_avp_setvalue( avp, &val ), goto out  );
+		CHECK_FCT_DO( ret = fd_msg_avp_add( skel, MSG_BRW_LAST_CHILD, avp ), goto out  );
+	}
+	
+	/* Set the Destination-Host AVP if needed*/
+	if (ta_conf->dest_host) {
+		CHECK_FCT_DO( ret = fd_msg_avp_new ( ta_dest_host, 0, &avp ), goto out  );
+		val.os.data = (unsigned char *)(ta_conf->dest_host);
+		val.os.len  = strlen(ta_conf->dest_host);
+		CHECK_FCT_DO( ret = fd_msg_avp_setvalue( avp, &val ), goto out  );
+		CHECK_FCT_DO( ret = fd_msg_avp_add( skel, MSG_BRW_LAST_CHILD, avp ), goto out  );
+	}
+	
+	/* Set Origin-Host & Origin-Realm */
+	CHECK_FCT_DO( ret = fd_msg_add_origin ( skel, 0 ), goto out  );
+	
+	/* Set the User-Name AVP if needed*/
+	if (ta_conf->user_name) {
+		CHECK_FCT_DO( ret = fd_msg_avp_new ( ta_user_name, 0, &avp ), goto out  );
+		val.os.data = (unsigned char *)(ta_conf->user_name);
+		val.os.len  = strlen(ta_conf->user_name);
+		CHECK_FCT_DO( ret = fd_msg_avp_setvalue( avp, &val ), goto out  );
+		CHECK_FCT_DO( ret = fd_msg_avp_add( skel, MSG_BRW_LAST_CHILD, avp ), goto out  );
+	}
+	
+	CHECK_FCT_DO( ret = fd_msg_tmpl_new( skel, &ta_tmpl ), goto out );
+out:
+	fd_msg_free(skel);
+	return ret;
+}
+
 /* Create a test message */
 static void ta_bench_test_message()
 {
@@ -190,37 +238,8 @@ static void ta_bench_test_message()
 	
 	mi->randval = (int32_t)random();
 	
-	/* Now set all AVPs values */
-	
-	/* Set the Destination-Realm AVP */
-	{
-		CHECK_FCT_DO( fd_msg_avp_new ( ta_dest_realm, 0, &avp ), goto out  );
-		val.os.data = (unsigned char *)(ta_conf->dest_realm);
-		val.os.len  = strlen(ta_conf->dest_realm);
-		CHECK_FCT_DO( fd_msg_avp_setvalue( avp, &val ), goto out  );
-		CHECK_FCT_DO( fd_msg_avp_add( req, MSG_BRW_LAST_CHILD, avp ), goto out  );
-	}
-	
-	/* Set the Destination-Host AVP if needed*/
-	if (ta_conf->dest_host) {
-		CHECK_FCT_DO( fd_msg_avp_new ( ta_dest_host, 0, &avp ), goto out  );
-		val.os.data = (unsigned char *)(ta_conf->dest_host);
-		val.os.len  = strlen(ta_conf->dest_host);
-		CHECK_FCT_DO( fd_msg_avp_setvalue( avp, &val ), goto out  );
-		CHECK_FCT_DO( fd_msg_avp_add( req, MSG_BRW_LAST_CHILD, avp ), goto out  );
-	}
-	
-	/* Set Origin-Host & Origin-Realm */
-	CHECK_FCT_DO( fd_msg_add_origin ( req, 0 ), goto out  );
-	
-	/* Set the User-Name AVP if needed*/
-	if (ta_conf->user_name) {
-		CHECK_FCT_DO( fd_msg_avp_new ( ta_user_name, 0, &avp ), goto out  );
-		val.os.data = (unsigned char *)(ta_conf->user_name);
-		val.os.len  = strlen(ta_conf->user_name);
-		CHECK_FCT_DO( fd_msg_avp_setvalue( avp, &val ), goto out  );
-		CHECK_FCT_DO( fd_msg_avp_add( req, MSG_BRW_LAST_CHILD, avp ), goto out  );
-	}
+	/* Add the constant AVPs */
+	CHECK_FCT_DO( fd_msg_tmpl_add( ta_tmpl, req ), goto out  );
 	
 	/* Set the Test-AVP AVP */
 	{
@@ -255,6 +274,9 @@ static void ta_bench_start() {
 	memcpy(&start, &ta_conf->stats, sizeof(struct ta_stats));
 	CHECK_POSIX_DO( pthread_mutex_unlock(&ta_conf->stats_lock), );
 	
+	/* The constant AVPs are encoded once for all the messages */
+	CHECK_FCT_DO( ta_bench_tmpl_new(), return );
+	
 	/* We will run for ta_conf->bench_duration seconds */
 	LOG_N("Starting benchmark client, %ds", ta_conf->bench_duration);
 	CHECK_SYS_DO( clock_gettime(CLOCK_REALTIME, &end_time), );
@@ -313,6 +335,9 @@ static void ta_bench_start() {
 		sleep(1);
 	} while ( (end.nb_sent - start.nb_sent) > (end.nb_errs - start.nb_errs) + (end.nb_recv - start.nb_recv) );
 	LOG_N( "--------------- Test Complete --------------");
+	
+	CHECK_FCT_DO( fd_msg_tmpl_free( ta_tmpl ), );
+	ta_tmpl = NULL;
 
 }
 
@@ -58,6 +58,12 @@ static void ta_cb_ans(void * data, struct msg ** msg)
 	struct session * sess;
 	struct avp * avp;
 	struct avp_hdr * hdr;
+	struct msg_avp_search srch[] = {
+		{ ta_avp,          -1, NULL },
+		{ ta_res_code,     -1, NULL },
+		{ ta_origin_host,  -1, NULL },
+		{ ta_origin_realm, -1, NULL }
+	};
 	unsigned long dur;
 	int error = 0;
 	
@@ -74,10 +80,11 @@ static void ta_cb_ans(void * data, struct msg ** msg)
 	}
 	
 	/* Now log content of the answer */
+	CHECK_FCT_DO( fd_msg_search_avps ( *msg, srch, sizeof(srch) / sizeof(srch[0]) ), return );
 	fprintf(stderr, "RECV ");
 	
 	/* Value of Test-AVP */
-	CHECK_FCT_DO( fd_msg_search_avp ( *msg, ta_avp, &avp), return );
+	avp = srch[0].avp;
 	if (avp) {
 		CHECK_FCT_DO( fd_msg_avp_hdr( avp, &hdr ), return );
 		if (hdr->avp_value->i32 == mi->randval) {
@@ -92,7 +99,7 @@ static void ta_cb_ans(void * data, struct msg ** msg)
 	}
 	
 	/* Value of Result Code */
-	CHECK_FCT_DO( fd_msg_search_avp ( *msg, ta_res_code, &avp), return );
+	avp = srch[1].avp;
 	if (avp) {
 		CHECK_FCT_DO( fd_msg_avp_hdr( avp, &hdr ), return );
 		fprintf(stderr, "Status: %d ", hdr->avp_value->i32);
@@ -104,7 +111,7 @@ static void ta_cb_ans(void * data, struct msg ** msg)
 	}
 	
 	/* Value of Origin-Host */
-	CHECK_FCT_DO( fd_msg_search_avp ( *msg, ta_origin_host, &avp), return );
+	avp = srch[2].avp;
 	if (avp) {
 		CHECK_FCT_DO( fd_msg_avp_hdr( avp, &hdr ), return );
 		fprintf(stderr, "From '%.*s' ", (int)hdr->avp_value->os.len, hdr->avp_value->os.data);
@@ -114,7 +121,7 @@ static void ta_cb_ans(void * data, struct msg ** msg)
 	}
 	
 	/* Value of Origin-Realm */
-	CHECK_FCT_DO( fd_msg_search_avp ( *msg, ta_origin_realm, &avp), return );
+	avp = srch[3].avp;
 	if (avp) {
 		CHECK_FCT_DO( fd_msg_avp_hdr( avp, &hdr ), return );
 		fprintf(stderr, "('%.*s') ", (int)hdr->avp_value->os.len, hdr->avp_value->os.data);
@@ -99,12 +99,9 @@ static int do_duplicates()
 				struct process_item * npi;
 				struct msg * nm;
 				struct msg_hdr * nh;
-				unsigned char * buf;
-				size_t len;
 				
 				/* Duplicate the message */
-				CHECK_FCT( fd_msg_bufferize(m, &buf, &len) );
-				CHECK_FCT( fd_msg_parse_buffer(&buf, len, &nm) );
+				CHECK_FCT( fd_msg_clone(m, &nm) );
 				CHECK_FCT( fd_msg_source_set(nm, src, srclen) );
 				CHECK_FCT( fd_msg_hdr(nm, &nh) );
 				nh->msg_flags |= CMD_FLAG_RETRANSMIT; /* Add the 'T' flag */
@@ -47,6 +47,7 @@ static void * catch_signals(void * arg);
 static pthread_t signals_thr;
 
 static char *conffile = NULL;
+static char *dictsnap = NULL;
 static int gnutls_debug = 0;
 
 /* gnutls debug */
@@ -89,6 +90,14 @@ int main(int argc, char * argv[])
 	/* Parse the configuration file */
 	CHECK_FCT_DO( fd_core_parseconf(conffile), goto error );
 	
+	/* Only save the dictionary built by the extensions? */
+	if (dictsnap) {
+		ret = fd_dict_snapshot_save(fd_g_config->cnf_dict, dictsnap);
+		CHECK_FCT_DO( fd_core_shutdown(),  );
+		CHECK_FCT_DO( fd_core_wait_shutdown_complete(),  );
+		return ret;
+	}
+	
 	/* Start the servers */
 	CHECK_FCT_DO( fd_core_start(), goto error );
 	
@@ -137,7 +146,9 @@ static void main_help( void )
 	printf( "  -h, --help             Print help and exit\n"
   		"  -V, --version          Print version and exit\n"
   		"  -c, --config=filename  Read configuration from this file instead of the \n"
-		"                           default location (" DEFAULT_CONF_PATH "/" FD_DEFAULT_CONF_FILENAME ").\n");
+		"                           default location (" DEFAULT_CONF_PATH "/" FD_DEFAULT_CONF_FILENAME ").\n"
+  		"  -s, --save-dict=file   Load the configuration and extensions, save the resulting\n"
+		"                           dictionary in a snapshot file (see DictionarySnapshot) and exit.\n");
  	printf( "\nDebug:\n"
   		"  These options are mostly useful for developers\n"
   		"  -l, --dbglocale         Set the locale for error messages\n"
@@ -160,6 +171,7 @@ static int main_cmdline(int argc, char *argv[])
 		{ "help",	no_argument, 		NULL, 'h' },
 		{ "version",	no_argument, 		NULL, 'V' },
 		{ "config",	required_argument, 	NULL, 'c' },
+		{ "save-dict",	required_argument, 	NULL, 's' },
 		{ "debug",	no_argument, 		NULL, 'd' },
 		{ "quiet",	no_argument, 		NULL, 'q' },
 		{ "dbglocale",	optional_argument, 	NULL, 'l' },
@@ -171,7 +183,7 @@ static int main_cmdline(int argc, char *argv[])
 	
 	/* Loop on arguments */
 	while (1) {
-		c = getopt_long (argc, argv, "hVc:dql:f:F:g:", long_options, &option_index);
+		c = getopt_long (argc, argv, "hVc:s:dql:f:F:g:", long_options, &option_index);
 		if (c == -1) 
 			break;	/* Exit from the loop.  */
 		
@@ -192,6 +204,10 @@ static int main_cmdline(int argc, char *argv[])
 				conffile = optarg;
 				break;
 
+			case 's':	/* Save the dictionary in a snapshot and exit.  */
+				dictsnap = optarg;
+				break;
+
 			case 'l':	/* Change the locale.  */
 				locale = setlocale(LC_ALL, optarg?:"");
 				if (!locale) {
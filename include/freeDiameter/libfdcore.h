@@ -134,6 +134,8 @@ struct fd_config {
 	int		 cnf_thr_srv;	/* Number of threads per servers handling the connection state machines */
 	struct fd_list	 cnf_apps;	/* Applications locally supported (except relay, see flags). Use fd_disp_app_support to add one. list of struct fd_app. */
 	uint16_t	 cnf_dispthr;	/* Number of dispatch threads to create */
+	uint16_t	 cnf_flow_high;	/* High watermark of the incoming messages queue for flow control, 0 to disable (see p_flow.c) */
+	uint16_t	 cnf_flow_low;	/* Low watermark, < cnf_flow_high */
 	struct {
 		unsigned no_fwd : 1;	/* the peer does not relay messages (0xffffff app id) */
 		unsigned no_ip4 : 1;	/* disable IP */
@@ -142,6 +144,8 @@ struct fd_config {
 		unsigned no_sctp: 1;	/* disable the use of SCTP */
 		unsigned pr_tcp	: 1;	/* prefer TCP over SCTP */
 		unsigned tls_alg: 1;	/* TLS algorithm for initiated cnx. 0: separate port. 1: inband-security (old) */
+		unsigned tls_ktls: 1;	/* let the kernel process the TLS records of TCP connections when possible (kTLS) */
+		unsigned flow_busy: 1;	/* answer DIAMETER_TOO_BUSY to the requests of throttled peers instead of holding them */
 	} 		 cnf_flags;
 	
 	struct {
@@ -162,6 +166,7 @@ struct fd_config {
 		/* GNUTLS parameters */
 		gnutls_priority_t 		 prio_cache;
 		gnutls_dh_params_t 		 dh_cache;
+		gnutls_datum_t			 ticket_key; /* encrypts the session tickets given to the clients, for resumption */
 		
 		/* GNUTLS server credential(s) */
 		gnutls_certificate_credentials_t credentials; /* contains local cert + trust anchors */
@@ -173,7 +178,8 @@ struct fd_config {
 	
 	uint32_t	 cnf_orstateid;	/* The value to use in Origin-State-Id, default to random value */
 	struct dictionary *cnf_dict;	/* pointer to the global dictionary */
-	struct fifo	  *cnf_main_ev;	/* events for the daemon's main (struct fd_event items) */
+	char		  *cnf_dict_snap;	/* dictionary snapshot loaded before the extensions, if any (see fd_dict_snapshot_load) */
+	struct fifo	  *cnf_main_ev;	/* events for the daemon's main (tagged items, see fd_event_send) */
 };
 extern struct fd_config *fd_g_config; /* The pointer to access the global configuration, initalized in main */
 
@@ -434,6 +440,23 @@ int fd_peer_cnx_proto_info(struct peer_hdr *peer, char * buf, size_t len);
  */
 int fd_peer_get_load_pending(struct peer_hdr *peer, long * to_receive, long * to_send);
 
+/* 
+ * FUNCTION:	fd_peer_get_answer_delay
+ *
+ * PARAMETERS:
+ *  peer	: The peer which answer delay to read
+ *  delay_us    : (out) moving average of the time between sending a request to this peer and receiving its answer, in microseconds.
+ *
+ * DESCRIPTION: 
+ *   Returns the average answer delay measured on the requests sent to this peer. The average gives more weight
+ *  to the recent answers. The value is 0 if no answer has been received from the peer yet.
+ *
+ * RETURN VALUE:
+ *  0  : The delay_us parameter has been updated.
+ * !0  : An error occurred
+ */
+int fd_peer_get_answer_delay(struct peer_hdr *peer, long * delay_us);
+
 /*
  * FUNCTION:	fd_peer_validate_register
  *
@@ -799,11 +822,34 @@ int fd_rt_out_register ( int (*rt_out_cb)(void * cbdata, struct msg ** pmsg, str
  */
 int fd_rt_out_unregister ( struct fd_rt_out_hdl * handler, void ** cbdata );
 
+/*
+ * FUNCTION:	fd_rt_out_set_cacheable
+ *
+ * PARAMETERS:
+ *  handler     : The handler of a registered OUT callback.
+ *  cacheable	: 1 if the scores given by this callback can be cached, 0 otherwise (default).
+ *
+ * DESCRIPTION: 
+ *   Declare that the callback only adds scores to the candidates, that these scores depend only on the
+ *  Application-Id, Destination-Realm and Destination-Host of the message and on the candidate's identity,
+ *  realm and supported applications, and that the callback never modifies or disposes of the message.
+ *   When all registered OUT callbacks are cacheable, the daemon saves the resulting scores per
+ *  (Application-Id, Destination-Realm, Destination-Host) and reuses them for the next messages instead of calling
+ *  the callbacks, until a peer changes state or the list of callbacks changes.
+ *
+ * RETURN VALUE:
+ *  0      	: The flag is updated.
+ *  EINVAL 	: A parameter is invalid.
+ */
+int fd_rt_out_set_cacheable ( struct fd_rt_out_hdl * handler, int cacheable );
+
 
 /*============================================================*/
 /*                         EVENTS                             */
 /*============================================================*/
 
+/* The events are not allocated: fd_event_send stores the code, size and data inline in the fifo item (fd_fifo_post_tagged),
+ and fd_event_get returns them. This structure only groups the three values. */
 struct fd_event {
 	int	 code; /* codespace depends on the queue */
 	size_t 	 size;
@@ -840,6 +886,7 @@ DECLARE_FD_DUMP_PROTOTYPE_simple(fd_ext_dump);
 DECLARE_FD_DUMP_PROTOTYPE(fd_servers_dump, int details);
 DECLARE_FD_DUMP_PROTOTYPE(fd_peer_dump_list, int details);
 DECLARE_FD_DUMP_PROTOTYPE(fd_peer_dump, struct peer_hdr * p, int details);
+DECLARE_FD_DUMP_PROTOTYPE(fd_rt_limits_dump);
 
 /*============================================================*/
 /*                         ENDPOINTS                          */
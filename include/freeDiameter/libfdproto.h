@@ -1036,6 +1036,52 @@ int fd_dict_getlistof(int criteria, void * parent, struct fd_list ** sentinel);
   In such case, the children must be removed first. */
 int fd_dict_delete(struct dict_object * obj);
 
+/*
+ * FUNCTION:	fd_dict_snapshot_save, fd_dict_snapshot_load
+ *
+ * PARAMETERS:
+ *  dict	: Pointer to a dictionary.
+ *  path	: The file containing the snapshot.
+ *
+ * DESCRIPTION: 
+ *  fd_dict_snapshot_save writes the contents of a dictionary in a binary file. fd_dict_snapshot_load maps such
+ * a file and adds its contents in a dictionary, much faster than the dict_* extensions that created it.
+ *  The objects that already exist in the dictionary (e.g. the base protocol) are kept, as long as they are identical.
+ * The types with callbacks (encode, interpret, dump) must be already defined when a snapshot is loaded, since 
+ * callbacks are not saved. The dispatch callbacks are not saved either.
+ *  The file is only valid for the version of the library and the host architecture that created it.
+ *
+ * RETURN VALUE:
+ *  0      	: The operation was successful.
+ *  EINVAL 	: A parameter is invalid, or the file is not a valid snapshot.
+ *  EEXIST 	: An object in the snapshot conflicts with an object in the dictionary.
+ *  ENOTSUP	: A type with callbacks in the snapshot is not defined in the dictionary.
+ *  (other standard errors may be returned, too, with their standard meaning. Example:
+ *    ENOMEM 	: Memory allocation for the new object element failed.)
+ */
+int fd_dict_snapshot_save(struct dictionary * dict, const char * path);
+int fd_dict_snapshot_load(struct dictionary * dict, const char * path);
+
+/*
+ * FUNCTION:	fd_dict_bulk_begin, fd_dict_bulk_commit
+ *
+ * PARAMETERS:
+ *  dict	: Pointer to a dictionary.
+ *
+ * DESCRIPTION: 
+ *  Between these two calls, the AVPs and enumerated values created with fd_dict_new are not inserted in order
+ * in their lists, they are all ordered at once by the outermost fd_dict_bulk_commit. This speeds up the loading
+ * of large dictionaries (e.g. several dict_* extensions). The duplicates are still reported by fd_dict_new, and
+ * fd_dict_search can be used as usual, but the lists returned by fd_dict_getlistof are not ordered until the commit.
+ *  The calls can be nested, each fd_dict_bulk_begin must be matched by one fd_dict_bulk_commit.
+ *
+ * RETURN VALUE:
+ *  0      	: The operation was successful.
+ *  EINVAL 	: A parameter is invalid, or fd_dict_bulk_commit was called without fd_dict_bulk_begin.
+ */
+int fd_dict_bulk_begin(struct dictionary * dict);
+int fd_dict_bulk_commit(struct dictionary * dict);
+
 /*
  ***************************************************************************
  *
@@ -2134,12 +2180,15 @@ struct rt_data;
 int  fd_rtd_init(struct rt_data ** rtd);
 void fd_rtd_free(struct rt_data ** rtd);
 
-/* Add a peer to the candidates list. */
-int  fd_rtd_candidate_add(struct rt_data * rtd, DiamId_t peerid, size_t peeridlen, DiamId_t realm, size_t realmlen);
+/* Add a peer to the candidates list. The peer object (struct peer_hdr *) may be saved in the candidate, or NULL. */
+int  fd_rtd_candidate_add(struct rt_data * rtd, DiamId_t peerid, size_t peeridlen, DiamId_t realm, size_t realmlen, void * peer);
 
 /* Remove a peer from the candidates (if it is found). The search is case-insensitive. */
 void fd_rtd_candidate_del(struct rt_data * rtd, uint8_t * id, size_t idsz);
 
+/* Remove a set of peers (e.g. all the Route-Record values of a message) from the candidates in a single pass. The search is case-insensitive. */
+int  fd_rtd_candidate_del_set(struct rt_data * rtd, uint8_t ** ids, size_t * idsz, int nb);
+
 /* Extract the list of valid candidates, and initialize their scores to 0 */
 void fd_rtd_candidate_extract(struct rt_data * rtd, struct fd_list ** candidates, int ini_score);
 
@@ -2157,6 +2206,7 @@ struct rtd_candidate {
 	DiamId_t	realm;	/* the diameter realm of the peer */
 	size_t		realmlen; /* cached size of realm */
 	int		score;	/* the current routing score for this peer, see fd_rt_out_register definition for details */
+	void *		peer;	/* the peer object (struct peer_hdr *) if known, valid only during the first routing of the message. NULL otherwise. */
 };
 
 /* Reorder the list of peers by score */
@@ -2309,6 +2359,108 @@ int fd_msg_new_appl ( struct dict_object * model, struct dict_object * appl, int
  */
 int fd_msg_new_answer_from_req ( struct dictionary * dict, struct msg ** msg, int flag );
 
+/* A prebuilt list of constant AVPs (opaque) */
+struct msg_tmpl;
+
+/*
+ * FUNCTION:	fd_msg_tmpl_new
+ *
+ * PARAMETERS:
+ *  skel	: A message containing the constant AVPs of the template. All AVPs must have a model and a value.
+ *  tmpl	: Upon success, the new template is stored here.
+ *
+ * DESCRIPTION:
+ *   Create a template from the AVPs of a message (the header of the message is ignored). The AVPs are
+ *  encoded once in wire format; the message can be freed after this call. The template is read-only
+ *  and can be used concurrently by several threads.
+ *
+ * RETURN VALUE:
+ *  0      	: The template is created.
+ *  EINVAL 	: A parameter is invalid, or an AVP has no model or value.
+ *  ENOMEM	: Memory allocation failed.
+ */
+int fd_msg_tmpl_new ( struct msg * skel, struct msg_tmpl ** tmpl );
+
+/*
+ * FUNCTION:	fd_msg_tmpl_add
+ *
+ * PARAMETERS:
+ *  tmpl	: The template to apply.
+ *  msg		: The message to which the AVPs are added.
+ *
+ * DESCRIPTION:
+ *   Add a copy of the AVPs of the template at the end of the message. The OctetString values are copied with
+ *  a single memcpy into a buffer owned by the message, and the dictionary models are already resolved.
+ *  The new AVPs can be modified with fd_msg_avp_setvalue. Their values are copied when they are removed from the
+ *  message with fd_msg_avp_unlink, so that they can be moved to another message.
+ *
+ * RETURN VALUE:
+ *  0      	: The AVPs have been added.
+ *  EINVAL 	: A parameter is invalid.
+ *  ENOMEM	: Memory allocation failed.
+ */
+int fd_msg_tmpl_add ( struct msg_tmpl * tmpl, struct msg * msg );
+
+/*
+ * FUNCTION:	fd_msg_tmpl_free
+ *
+ * PARAMETERS:
+ *  tmpl	: The template to destroy.
+ *
+ * DESCRIPTION:
+ *   Free a template. The messages created from it are not affected.
+ *
+ * RETURN VALUE:
+ *  0      	: The template has been freed.
+ *  EINVAL 	: A parameter is invalid.
+ */
+int fd_msg_tmpl_free ( struct msg_tmpl * tmpl );
+
+/*
+ * FUNCTION:	fd_msg_clone
+ *
+ * PARAMETERS:
+ *  msg		: The message to copy.
+ *  clone	: Upon success, the new message is stored here.
+ *
+ * DESCRIPTION:
+ *   Create a copy of a message (header and AVPs), for example to send it again or deliver it twice.
+ *  Unlike fd_msg_bufferize followed by fd_msg_parse_buffer, the dictionary models and values already
+ *  resolved are kept, and so are the cached lengths. The source, session, routing data, callbacks and
+ *  query / answer association of the original message are not copied. Both messages are then independent.
+ *   The AVPs are not copied by this function: they are shared by the messages (copy-on-write). They are
+ *  read in place by fd_msg_browse, fd_msg_search_avp(s), fd_msg_avp_hdr, fd_msg_parse_dict, fd_msg_parse_rules,
+ *  fd_msg_update_length and fd_msg_bufferize. A message gets its own copy of the AVPs when it is modified
+ *  (fd_msg_avp_add on the message, ...) or with fd_msg_unshare; the last message that shares them takes them.
+ *  The shared AVPs themselves are read-only: fd_msg_avp_setvalue, fd_msg_avp_add, fd_msg_avp_unlink and
+ *  fd_msg_free return EBUSY for them, including the AVPs retrieved from the original message before the call.
+ *  Call fd_msg_unshare, then retrieve the AVPs again, to modify them.
+ *
+ * RETURN VALUE:
+ *  0      	: The message has been copied.
+ *  EINVAL 	: A parameter is invalid.
+ *  ENOMEM	: Memory allocation failed.
+ */
+int fd_msg_clone ( struct msg * msg, struct msg ** clone );
+
+/*
+ * FUNCTION:	fd_msg_unshare
+ *
+ * PARAMETERS:
+ *  msg		: A message that may share its AVPs with other messages (see fd_msg_clone).
+ *
+ * DESCRIPTION:
+ *   Give its own copy of the AVPs to a message, so that they can be modified. The AVPs retrieved from the
+ *  message before this call must be retrieved again, they may still be shared by the other messages.
+ *  Nothing is done if the AVPs of the message are not shared.
+ *
+ * RETURN VALUE:
+ *  0      	: The AVPs of the message can be modified.
+ *  EINVAL 	: A parameter is invalid.
+ *  ENOMEM	: Memory allocation failed.
+ */
+int fd_msg_unshare ( struct msg * msg );
+
 /*
  * FUNCTION:	fd_msg_browse
  *
@@ -2356,6 +2508,25 @@ int fd_msg_browse_internal ( msg_or_avp * reference, enum msg_brw_dir dir, msg_o
  */
 int fd_msg_avp_add ( msg_or_avp * reference, enum msg_brw_dir dir, struct avp *avp);
 
+/*
+ * FUNCTION:	fd_msg_avp_unlink
+ *
+ * PARAMETERS:
+ *  avp         : pointer to the AVP object that must be removed from its parent.
+ *
+ * DESCRIPTION: 
+ *   Removes an AVP (and its children) from the message or grouped AVP that contains it, so that it can be
+ * added to another object with fd_msg_avp_add. The data of the AVP that was still referenced in buffers owned
+ * by the message (values created by fd_msg_tmpl_add, data not interpreted yet) is copied in the AVP first.
+ * The AVP must then be added to another object or freed with fd_msg_free.
+ *
+ * RETURN VALUE:
+ *  0      	: The AVP has been removed.
+ *  EINVAL 	: A parameter is invalid.
+ *  ENOMEM	: Memory allocation failed.
+ */
+int fd_msg_avp_unlink ( struct avp *avp );
+
 /*
  * FUNCTION:	fd_msg_search_avp
  *
@@ -2377,6 +2548,33 @@ int fd_msg_avp_add ( msg_or_avp * reference, enum msg_brw_dir dir, struct avp *a
  */
 int fd_msg_search_avp ( struct msg * msg, struct dict_object * what, struct avp ** avp );
 
+/* An AVP to search with fd_msg_search_avps */
+struct msg_avp_search {
+	struct dict_object *	model;	/* The dictionary model of the AVP to search. */
+	int			parent;	/* -1 to search a top-level AVP, or the index in the array of the grouped AVP to search into (it must come first). */
+	struct avp *		avp;	/* Set to the AVP found, or NULL. */
+};
+
+/*
+ * FUNCTION:	fd_msg_search_avps
+ *
+ * PARAMETERS:
+ *  msg 	: The message structure in which to search the AVPs.
+ *  items 	: Array of the AVPs to search.
+ *  nb		: Number of items in the array.
+ *
+ * DESCRIPTION: 
+ *   Search the first instance of several AVPs in a message, with a single pass over the top-level AVPs instead of
+ * one call to fd_msg_search_avp for each AVP. An item may also refer to a grouped AVP earlier in the array, to
+ * search inside it (each grouped AVP is browsed once). The AVPs found are parsed as with fd_msg_search_avp.
+ * All models must belong to the same dictionary.
+ *
+ * RETURN VALUE:
+ *  0      	: The search was performed, items[i].avp is NULL for the AVPs that were not found.
+ *  EINVAL 	: A parameter is invalid.
+ */
+int fd_msg_search_avps ( struct msg * msg, struct msg_avp_search * items, int nb );
+
 /*
  * FUNCTION:	fd_msg_free
  *
@@ -2420,6 +2618,12 @@ DECLARE_FD_DUMP_PROTOTYPE( fd_msg_dump_summary, msg_or_avp *obj, struct dictiona
 DECLARE_FD_DUMP_PROTOTYPE( fd_msg_dump_full, msg_or_avp *obj, struct dictionary *dict, int force_parsing, int recurse );
 /* multi-line human-readable dump similar to wireshark output */
 DECLARE_FD_DUMP_PROTOTYPE( fd_msg_dump_treeview, msg_or_avp *obj, struct dictionary *dict, int force_parsing, int recurse );
+/* statistics of the pools of messages, AVPs and small values (objects created and released, magazines in the depots) */
+#ifndef SWIG
+DECLARE_FD_DUMP_PROTOTYPE( fd_msg_pools_dump );
+#else /* SWIG */
+DECLARE_FD_DUMP_PROTOTYPE_simple( fd_msg_pools_dump );
+#endif /* SWIG */
 
 
 /*********************************************/
@@ -2466,7 +2670,8 @@ int fd_msg_hdr ( struct msg *msg, struct msg_hdr ** pdata );
  *  pdata 	: Upon success, pointer to the avp_hdr structure of this avp. The fields may be modified.
  *
  * DESCRIPTION: 
- *   Retrieve location of modifiable data of an avp. 
+ *   Retrieve location of modifiable data of an avp. The AVPs shared by cloned messages (see fd_msg_clone)
+ *  must not be modified through this pointer.
  *
  * RETURN VALUE:
  *  0      	: The location has been written.
@@ -3129,6 +3334,8 @@ int fd_fifo_length ( struct fifo * queue );
  *
  * Note that the callbacks are called synchronously, during fd_fifo_post or fd_fifo_get. Their operation should be quick.
  *
+ * Calling the function with high = 0 and data = NULL removes the thresholds, for example before fd_fifo_del.
+ *
  * RETURN VALUE:
  *  0		: The thresholds have been set
  *  EINVAL 	: A parameter is invalid.
@@ -3221,6 +3428,57 @@ int fd_fifo_timedget_int ( struct fifo * queue, void ** item, const struct times
 #define fd_fifo_timedget(queue, item, abstime) \
 	fd_fifo_timedget_int((queue), (void *)(item), (abstime))
 
+/*
+ * FUNCTION:	fd_fifo_post_tagged
+ *
+ * PARAMETERS:
+ *  queue	: The queue in which the element must be posted.
+ *  tag		: An integer stored with the element.
+ *  size	: A size stored with the element.
+ *  data	: A pointer stored with the element, may be NULL.
+ *
+ * DESCRIPTION: 
+ *  This function is similar to fd_fifo_post, except that the three values are stored inline
+ * in the queue's own list item, so the caller does not have to allocate a container for them.
+ * The list items are recycled by the queue, so in steady state posting does not allocate memory.
+ * Items posted with this function must be retrieved with the fd_fifo_*_tagged functions below.
+ *
+ * RETURN VALUE:
+ *  0		: The element is queued.
+ *  EINVAL 	: A parameter is invalid.
+ *  ENOMEM  	: Not enough memory to complete the operation.
+ */
+int fd_fifo_post_tagged ( struct fifo * queue, int tag, size_t size, void * data );
+/* Non-blocking version, same restrictions as fd_fifo_post_noblock */
+int fd_fifo_post_tagged_noblock ( struct fifo * queue, int tag, size_t size, void * data );
+/* Non-blocking version that respects the maximum: returns EWOULDBLOCK (and does not post) when the queue is full */
+int fd_fifo_trypost_tagged ( struct fifo * queue, int tag, size_t size, void * data );
+/* Same as fd_fifo_post_tagged and fd_fifo_trypost_tagged, with a limit (if not 0) that replaces the maximum of the queue for
+ this item only: some producers can be paused before the queue is full, while the others are not. The producers that wait
+ on a queue should all use the same limit, since each item pulled from the queue wakes up a single one of them. */
+int fd_fifo_post_tagged_lim ( struct fifo * queue, int limit, int tag, size_t size, void * data );
+int fd_fifo_trypost_tagged_lim ( struct fifo * queue, int limit, int tag, size_t size, void * data );
+
+/*
+ * FUNCTION:	fd_fifo_get_tagged, fd_fifo_tryget_tagged, fd_fifo_timedget_tagged
+ *
+ * PARAMETERS:
+ *  queue	: The queue from which the element must be retrieved.
+ *  tag		: On return, the tag of the element (if not NULL).
+ *  size	: On return, the size of the element (if not NULL).
+ *  data	: On return, the pointer of the element.
+ *  abstime	: (timedget only) the absolute time until which we allow waiting for an item.
+ *
+ * DESCRIPTION: 
+ *  Counterparts of fd_fifo_get, fd_fifo_tryget and fd_fifo_timedget for the items posted with fd_fifo_post_tagged.
+ *
+ * RETURN VALUE:
+ *  Same as fd_fifo_get, fd_fifo_tryget and fd_fifo_timedget, respectively.
+ */
+int fd_fifo_get_tagged ( struct fifo * queue, int * tag, size_t * size, void ** data );
+int fd_fifo_tryget_tagged ( struct fifo * queue, int * tag, size_t * size, void ** data );
+int fd_fifo_timedget_tagged ( struct fifo * queue, int * tag, size_t * size, void ** data, const struct timespec *abstime );
+
 
 /*
  * FUNCTION:	fd_fifo_select
@@ -40,6 +40,10 @@
 #include <ifaddrs.h> /* for getifaddrs */
 #include <sys/uio.h> /* writev */
 
+#ifdef GNUTLS_VERSION_373
+#include <gnutls/socket.h> /* gnutls_transport_is_ktls_enabled */
+#endif /* GNUTLS_VERSION_373 */
+
 /* The maximum size of Diameter message we accept to receive (<= 2^24) to avoid too big mallocs in case of trashed headers */
 #ifndef DIAMETER_MSG_SIZE_MAX
 #define DIAMETER_MSG_SIZE_MAX	65535	/* in bytes */
@@ -67,6 +71,7 @@
  * 3) Usage
  *    - fd_cnx_receive, fd_cnx_send : exchange messages on this connection (send is synchronous, receive is not, but blocking).
  *    - fd_cnx_recv_setaltfifo : when a message is received, the event is sent to an external fifo list. fd_cnx_receive does not work when the alt_fifo is set.
+ *    - fd_cnx_recv_setfastpath : a callback may consume the received messages directly in the receiver thread, instead of the event.
  *    - fd_cnx_getid : retrieve a descriptive string for the connection (for debug)
  *    - fd_cnx_getremoteid : identification of the remote peer (IP address or fqdn)
  *    - fd_cnx_getcred : get the remote peer TLS credentials, after handshake
@@ -216,6 +221,22 @@ int fd_cnx_serv_listen(struct cnxctx * conn)
 	return 0;
 }
 
+#ifndef DISABLE_SCTP
+/* Retrieve the number of streams of a new association (and optionally its primary address), and prepare the per-stream counters */
+static int fd_cnx_sctp_streams(struct cnxctx * conn, sSS * primary)
+{
+	CHECK_FCT( fd_sctp_get_str_info( conn->cc_socket, &conn->cc_sctp_para.str_in, &conn->cc_sctp_para.str_out, primary ) );
+	if (conn->cc_sctp_para.str_out < conn->cc_sctp_para.str_in)
+		conn->cc_sctp_para.pairs = conn->cc_sctp_para.str_out;
+	else
+		conn->cc_sctp_para.pairs = conn->cc_sctp_para.str_in;
+	
+	CHECK_MALLOC( conn->cc_sctp_para.stats_in  = calloc(conn->cc_sctp_para.str_in  ?: 1, sizeof(struct fd_sctp_strstats)) );
+	CHECK_MALLOC( conn->cc_sctp_para.stats_out = calloc(conn->cc_sctp_para.str_out ?: 1, sizeof(struct fd_sctp_strstats)) );
+	return 0;
+}
+#endif /* DISABLE_SCTP */
+
 /* Accept a client (blocking until a new client connects) -- cancelable */
 struct cnxctx * fd_cnx_serv_accept(struct cnxctx * serv)
 {
@@ -267,11 +288,7 @@ struct cnxctx * fd_cnx_serv_accept(struct cnxctx * serv)
 	/* SCTP-specific handlings */
 	if (cli->cc_proto == IPPROTO_SCTP) {
 		/* Retrieve the number of streams */
-		CHECK_FCT_DO( fd_sctp_get_str_info( cli->cc_socket, &cli->cc_sctp_para.str_in, &cli->cc_sctp_para.str_out, NULL ), {fd_cnx_destroy(cli); return NULL;} );
-		if (cli->cc_sctp_para.str_out < cli->cc_sctp_para.str_in)
-			cli->cc_sctp_para.pairs = cli->cc_sctp_para.str_out;
-		else
-			cli->cc_sctp_para.pairs = cli->cc_sctp_para.str_in;
+		CHECK_FCT_DO( fd_cnx_sctp_streams( cli, NULL ), {fd_cnx_destroy(cli); return NULL;} );
 
 		LOG_A( "%s : client '%s' (SCTP:%d, %d/%d streams)", fd_cnx_getid(serv), fd_cnx_getid(cli), cli->cc_socket, cli->cc_sctp_para.str_in, cli->cc_sctp_para.str_out);
 	}
@@ -370,11 +387,7 @@ struct cnxctx * fd_cnx_cli_connect_sctp(int no_ip6, uint16_t port, struct fd_lis
 	fd_cnx_s_setto(cnx->cc_socket);
 
 	/* Retrieve the number of streams and primary address */
-	CHECK_FCT_DO( fd_sctp_get_str_info( sock, &cnx->cc_sctp_para.str_in, &cnx->cc_sctp_para.str_out, &primary ), goto error );
-	if (cnx->cc_sctp_para.str_out < cnx->cc_sctp_para.str_in)
-		cnx->cc_sctp_para.pairs = cnx->cc_sctp_para.str_out;
-	else
-		cnx->cc_sctp_para.pairs = cnx->cc_sctp_para.str_in;
+	CHECK_FCT_DO( fd_cnx_sctp_streams( cnx, &primary ), goto error );
 
 	fd_sa_sdump_numeric(sa_buf, (sSA *)&primary);
 
@@ -483,6 +496,51 @@ int fd_cnx_getTLS(struct cnxctx * conn)
 	return fd_cnx_teststate(conn, CC_STATUS_TLS);
 }
 
+/* Provide session data of a previous connection to resume (client side), and a callback to receive the data of this session. Must be called before fd_cnx_handshake */
+int fd_cnx_tls_setresume(struct cnxctx * conn, gnutls_datum_t * data, void (*save)(void *, gnutls_datum_t *), void * save_data)
+{
+	TRACE_ENTRY( "%p %p %p %p", conn, data, save, save_data);
+	CHECK_PARAMS( conn && (!fd_cnx_teststate(conn, CC_STATUS_TLS)) );
+	
+	free(conn->cc_tls_para.resume.data);
+	memset(&conn->cc_tls_para.resume, 0, sizeof(gnutls_datum_t));
+	if (data && data->data && data->size) {
+		CHECK_MALLOC( conn->cc_tls_para.resume.data = malloc(data->size) );
+		memcpy(conn->cc_tls_para.resume.data, data->data, data->size);
+		conn->cc_tls_para.resume.size = data->size;
+	}
+	conn->cc_tls_para.resume_save = save;
+	conn->cc_tls_para.resume_save_data = save_data;
+	return 0;
+}
+
+/* Did the TLS handshake resume a previous session? */
+int fd_cnx_tls_isresumed(struct cnxctx * conn)
+{
+	CHECK_PARAMS_DO( conn, return 0 );
+	return fd_cnx_teststate(conn, CC_STATUS_TLS) && conn->cc_tls_para.resumed;
+}
+
+/* Hand the current session data to the save callback, if any (client side only) */
+static void fd_cnx_tls_save(struct cnxctx * conn)
+{
+	gnutls_datum_t d = { NULL, 0 };
+	
+	if ((!conn->cc_tls_para.resume_save) || (conn->cc_tls_para.mode != GNUTLS_CLIENT) || (!conn->cc_tls_para.session))
+		return;
+	if (!fd_cnx_teststate(conn, CC_STATUS_TLS))
+		return;
+	
+	CHECK_GNUTLS_DO( gnutls_session_get_data2(conn->cc_tls_para.session, &d), return );
+	if (!d.size) {
+		gnutls_free(d.data);
+		return;
+	}
+	
+	/* The callback takes ownership of d.data (to be released with gnutls_free) */
+	(*conn->cc_tls_para.resume_save)(conn->cc_tls_para.resume_save_data, &d);
+}
+
 /* Mark the connection to tell if OOO delivery is permitted (only for SCTP) */
 int fd_cnx_unordered_delivery(struct cnxctx * conn, int is_allowed)
 {
@@ -837,7 +895,7 @@ static void * rcvthr_notls_tcp(void * arg)
 		fd_hook_call(HOOK_DATA_RECEIVED, NULL, NULL, &rcv_data, pmdl);
 
 		/* We have received a complete message, pass it to the daemon */
-		CHECK_FCT_DO( fd_event_send( fd_cnx_target_queue(conn), FDEVP_CNX_MSG_RECV, rcv_data.length, rcv_data.buffer),
+		CHECK_FCT_DO( fd_cnx_recv_deliver( conn, &rcv_data, 0, NULL ),
 			{
 				free_rcvdata(&rcv_data);
 				goto fatal;
@@ -856,15 +914,125 @@ fatal:
 }
 
 #ifndef DISABLE_SCTP
-/* Receiver thread (SCTP & noTLS) : incoming message is directly saved into cc_incoming, no need to care for the stream ID */
+/* The threads delivering in parallel the messages received on an SCTP association. The messages of a stream are always handled by
+ the same worker, so they are delivered in the order they were sent (and so are the messages of a session, see fd_cnx_sctp_stream) */
+struct sctp_rcvworker {
+	struct cnxctx	*conn;
+	int		 id;
+	pthread_t	 thr;
+	struct fifo	*queue;		/* FDEVP_CNX_MSG_RECV events, and FDEVP_CNX_ERROR to terminate */
+};
+
+static void * rcvthr_sctp_worker(void * arg)
+{
+	struct sctp_rcvworker * w = arg;
+	struct fd_cnx_rcvdata rcv_data;
+	int	  event, ret;
+
+	/* Set the thread name */
+	{
+		char buf[48];
+		snprintf(buf, sizeof(buf), "Receiver (%d) SCTP/noTLS #%d", w->conn->cc_socket, w->id);
+		fd_log_threadname ( buf );
+	}
+
+	do {
+		struct fd_msg_pmdl *pmdl=NULL;
+		CHECK_FCT_DO( fd_event_get(w->queue, &event, &rcv_data.length, (void *)&rcv_data.buffer), goto fatal );
+		if (event != FDEVP_CNX_MSG_RECV)
+			break;
+
+		CHECK_MALLOC_DO( rcv_data.buffer = fd_cnx_realloc_msg_buffer(rcv_data.buffer, rcv_data.length, &pmdl), goto fatal );
+		fd_hook_call(HOOK_DATA_RECEIVED, NULL, NULL, &rcv_data, pmdl);
+		
+		/* The fast path does not block, but we may be canceled (sctp_rcvworkers_abort) while waiting for room in the target queue */
+		pthread_cleanup_push(free_rcvdata, &rcv_data);
+		CHECK_FCT_DO( ret = fd_cnx_recv_deliver( w->conn, &rcv_data, 0, NULL ), );
+		pthread_cleanup_pop(0);
+		if (ret)
+			goto fatal;
+	} while (1);
+
+	TRACE_DEBUG(FULL, "Thread terminated");
+	return NULL;
+
+fatal:
+	/* An unrecoverable error occurred, stop the daemon */
+	CHECK_FCT_DO(fd_core_shutdown(), );
+	return NULL;
+}
+
+/* Start the workers, if the association has several incoming streams. *nb is 0 if the receiver thread delivers the messages itself.
+ On error, *nb is the number of workers already running (sctp_rcvworkers_abort also frees the queue of the failed one) */
+static int sctp_rcvworkers_start(struct cnxctx * conn, struct sctp_rcvworker * w, int * nb)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, n;
+
+	*nb = 0;
+	n = conn->cc_sctp_para.str_in;
+	if (n > ncpu)
+		n = ncpu;
+	if (n > SCTP_RCV_WORKERS_MAX)
+		n = SCTP_RCV_WORKERS_MAX;
+	if (n <= 1)
+		return 0;
+
+	memset(w, 0, n * sizeof(struct sctp_rcvworker));
+	for (i = 0; i < n; i++) {
+		w[i].conn = conn;
+		w[i].id = i;
+		CHECK_FCT( fd_fifo_new(&w[i].queue, 20) );
+		CHECK_POSIX( pthread_create(&w[i].thr, NULL, rcvthr_sctp_worker, &w[i]) );
+		*nb = i + 1;
+	}
+	return 0;
+}
+
+/* Cleanup handler of the receiver thread: abort the workers, the messages they did not deliver yet are lost */
+static void sctp_rcvworkers_abort(void * arg)
+{
+	struct sctp_rcvworker * w = arg;
+	int i;
+
+	for (i = 0; (i < SCTP_RCV_WORKERS_MAX) && w[i].queue; i++) {
+		CHECK_FCT_DO( fd_thr_term(&w[i].thr), /* continue */ );
+		fd_event_destroy(&w[i].queue, free);
+	}
+}
+
+/* Let the workers deliver the messages already queued, then stop them */
+static void sctp_rcvworkers_stop(struct sctp_rcvworker * w, int nb)
+{
+	int i;
+
+	for (i = 0; i < nb; i++) {
+		if (!w[i].queue)
+			continue;
+		CHECK_FCT_DO( fd_event_send(w[i].queue, FDEVP_CNX_ERROR, 0, NULL), fd_thr_term(&w[i].thr) );
+	}
+	for (i = 0; i < nb; i++) {
+		if (w[i].thr != (pthread_t)NULL) {
+			CHECK_POSIX_DO( pthread_join(w[i].thr, NULL), /* continue */ );
+			w[i].thr = (pthread_t)NULL;
+		}
+	}
+	sctp_rcvworkers_abort(w);
+}
+
+/* Receiver thread (SCTP & noTLS) : incoming message is saved into cc_incoming, or passed to a worker according to its stream */
 static void * rcvthr_notls_sctp(void * arg)
 {
 	struct cnxctx * conn = arg;
 	struct fd_cnx_rcvdata rcv_data;
 	int	  event;
+	uint16_t  strid;
+	struct sctp_rcvworker workers[SCTP_RCV_WORKERS_MAX];
+	int	  nb_workers = 0;
+	int	  closed = 0, fatal = 0;
 
 	TRACE_ENTRY("%p", arg);
-	CHECK_PARAMS_DO(conn && (conn->cc_socket > 0), goto fatal);
+	CHECK_PARAMS_DO(conn && (conn->cc_socket > 0), { CHECK_FCT_DO(fd_core_shutdown(), ); return NULL; } );
 
 	/* Set the thread name */
 	{
@@ -877,12 +1045,20 @@ static void * rcvthr_notls_sctp(void * arg)
 	ASSERT( ! fd_cnx_teststate(conn, CC_STATUS_TLS ) );
 	ASSERT( fd_cnx_target_queue(conn) );
 
-	do {
+	memset(workers, 0, sizeof(workers));
+	pthread_cleanup_push(sctp_rcvworkers_abort, workers);
+
+	/* Once the connection is established, the messages of the different streams are delivered in parallel */
+	if (conn->cc_loop) {
+		CHECK_FCT_DO( sctp_rcvworkers_start(conn, workers, &nb_workers), fatal = 1 );
+	}
+
+	if (!fatal) do {
 		struct fd_msg_pmdl *pmdl=NULL;
-		CHECK_FCT_DO( fd_sctp_recvmeta(conn, NULL, &rcv_data.buffer, &rcv_data.length, &event), goto fatal );
+		CHECK_FCT_DO( fd_sctp_recvmeta(conn, &strid, &rcv_data.buffer, &rcv_data.length, &event), { fatal = 1; break; } );
 		if (event == FDEVP_CNX_ERROR) {
-			fd_cnx_markerror(conn);
-			goto out;
+			closed = 1;
+			break;
 		}
 
 		if (event == FDEVP_CNX_SHUTDOWN) {
@@ -891,21 +1067,34 @@ static void * rcvthr_notls_sctp(void * arg)
 		}
 
 		if (event == FDEVP_CNX_MSG_RECV) {
-			CHECK_MALLOC_DO( rcv_data.buffer = fd_cnx_realloc_msg_buffer(rcv_data.buffer, rcv_data.length, &pmdl), goto fatal );
+			FD_SCTP_STRSTATS_ADD(conn->cc_sctp_para.stats_in, conn->cc_sctp_para.str_in, strid, rcv_data.length);
+			if (nb_workers) {
+				CHECK_FCT_DO( fd_event_send( workers[strid % nb_workers].queue, event, rcv_data.length, rcv_data.buffer), { fatal = 1; break; } );
+				continue;
+			}
+			CHECK_MALLOC_DO( rcv_data.buffer = fd_cnx_realloc_msg_buffer(rcv_data.buffer, rcv_data.length, &pmdl), { fatal = 1; break; } );
 			fd_hook_call(HOOK_DATA_RECEIVED, NULL, NULL, &rcv_data, pmdl);
+			CHECK_FCT_DO( fd_cnx_recv_deliver( conn, &rcv_data, 0, NULL ), { fatal = 1; break; } );
+		} else {
+			CHECK_FCT_DO( fd_event_send( fd_cnx_target_queue(conn), event, rcv_data.length, rcv_data.buffer), { fatal = 1; break; } );
 		}
-		CHECK_FCT_DO( fd_event_send( fd_cnx_target_queue(conn), event, rcv_data.length, rcv_data.buffer), goto fatal );
 
 	} while (conn->cc_loop || (event != FDEVP_CNX_MSG_RECV));
 
-out:
+	/* The messages received before the error are delivered before it is signaled */
+	sctp_rcvworkers_stop(workers, nb_workers);
+	pthread_cleanup_pop(0);
+
+	if (closed)
+		fd_cnx_markerror(conn);
+
+	if (fatal) {
+		/* An unrecoverable error occurred, stop the daemon */
+		CHECK_FCT_DO(fd_core_shutdown(), );
+	}
+
 	TRACE_DEBUG(FULL, "Thread terminated");
 	return NULL;
-
-fatal:
-	/* An unrecoverable error occurred, stop the daemon */
-	CHECK_FCT_DO(fd_core_shutdown(), );
-	goto out;
 }
 #endif /* DISABLE_SCTP */
 
@@ -1098,7 +1287,7 @@ int fd_tls_rcvthr_core(struct cnxctx * conn, gnutls_session_t session)
 		fd_hook_call(HOOK_DATA_RECEIVED, NULL, NULL, &rcv_data, pmdl);
 
 		/* We have received a complete message, pass it to the daemon */
-		CHECK_FCT_DO( ret = fd_event_send( fd_cnx_target_queue(conn), FDEVP_CNX_MSG_RECV, rcv_data.length, rcv_data.buffer),
+		CHECK_FCT_DO( ret = fd_cnx_recv_deliver( conn, &rcv_data, 0, NULL ),
 			{
 				free_rcvdata(&rcv_data);
 				CHECK_FCT_DO(fd_core_shutdown(), );
@@ -1111,6 +1300,109 @@ out:
 	return ENOTCONN;
 }
 
+/* Same as fd_tls_rcvthr_core, for a session whose pull function does not block (returns EAGAIN when no data is available).
+ The partially received message is kept in st between calls. Returns 0 when all available data was processed, ENOTCONN once the session is closed.
+ If stats is not NULL, the messages received are counted there.
+ The caller may not be canceled, so this never waits for room in the target queue: when it is full, the complete message is moved to full
+ and EWOULDBLOCK is returned; the caller must send it (fd_cnx_recv_post with full->limit) before calling again. If full is NULL, the message is posted anyway. */
+int fd_tls_rcv_inline(struct cnxctx * conn, gnutls_session_t session, struct fd_tls_rcvstate * st, struct fd_sctp_strstats * stats, struct fd_tls_rcvstate * full)
+{
+	do {
+		ssize_t ret;
+		
+		if (!st->rcv_data.buffer) {
+			ret = gnutls_record_recv(session, &st->header[st->received], sizeof(st->header) - st->received);
+		} else {
+			ret = gnutls_record_recv(session, st->rcv_data.buffer + st->received, st->rcv_data.length - st->received);
+		}
+		
+		if (ret < 0) {
+			switch (ret) {
+				case GNUTLS_E_AGAIN:
+					/* We will be called again when more data is received */
+					return 0;
+				
+				case GNUTLS_E_INTERRUPTED:
+					continue;
+				
+				default:
+					if (gnutls_error_is_fatal (ret) == 0) {
+						LOG_N("Ignoring non-fatal GNU TLS error: %s", gnutls_strerror (ret));
+						continue;
+					}
+					LOG_E("Fatal GNUTLS error: %s", gnutls_strerror (ret));
+					goto out;
+			}
+		}
+		if (ret == 0) {
+			/* The remote peer closed the session */
+			CHECK_GNUTLS_DO( gnutls_bye(session, GNUTLS_SHUT_WR),  );
+			goto out;
+		}
+		st->received += ret;
+		
+		if (!st->rcv_data.buffer) {
+			if (st->received < sizeof(st->header))
+				continue;
+			
+			st->rcv_data.length = ((size_t)st->header[1] << 16) + ((size_t)st->header[2] << 8) + (size_t)st->header[3];
+			
+			/* Check the received word is a valid beginning of a Diameter message */
+			if ((st->header[0] != DIAMETER_VERSION)	/* defined in <libfreeDiameter.h> */
+			   || (st->rcv_data.length > DIAMETER_MSG_SIZE_MAX)) { /* to avoid too big mallocs */
+				/* The message is suspect */
+				LOG_E( "Received suspect header [ver: %d, size: %zd] from '%s', assume disconnection", (int)st->header[0], st->rcv_data.length, conn->cc_remid);
+				goto out;
+			}
+			
+			CHECK_MALLOC_DO(  st->rcv_data.buffer = fd_cnx_alloc_msg_buffer( st->rcv_data.length, &st->pmdl ), goto out );
+			memcpy(st->rcv_data.buffer, st->header, sizeof(st->header));
+		}
+		
+		if (st->received < st->rcv_data.length)
+			continue;
+		
+		fd_hook_call(HOOK_DATA_RECEIVED, NULL, NULL, &st->rcv_data, st->pmdl);
+		
+		if (stats) {
+			stats->msgs++;
+			stats->bytes += st->rcv_data.length;
+		}
+		
+		/* We have received a complete message, pass it to the daemon */
+		ret = fd_cnx_recv_deliver( conn, &st->rcv_data, 1, &st->limit );
+		if (ret == EWOULDBLOCK) {
+			if (full) {
+				memcpy(full, st, sizeof(struct fd_tls_rcvstate));
+				memset(st, 0, sizeof(struct fd_tls_rcvstate));
+				return EWOULDBLOCK;
+			}
+			ret = fd_fifo_post_tagged_noblock(fd_cnx_target_queue(conn), FDEVP_CNX_MSG_RECV, st->rcv_data.length, st->rcv_data.buffer);
+		}
+		CHECK_FCT_DO( ret,
+			{
+				fd_tls_rcvstate_clear(st);
+				CHECK_FCT_DO(fd_core_shutdown(), );
+				return ret;
+			} );
+		memset(st, 0, sizeof(struct fd_tls_rcvstate));
+	
+	} while (1);
+	
+out:
+	fd_tls_rcvstate_clear(st);
+	fd_cnx_markerror(conn);
+	return ENOTCONN;
+}
+
+/* Free a partially received message */
+void fd_tls_rcvstate_clear(struct fd_tls_rcvstate * st)
+{
+	if (st->rcv_data.buffer)
+		free_rcvdata(&st->rcv_data);
+	memset(st, 0, sizeof(struct fd_tls_rcvstate));
+}
+
 /* Receiver thread (TLS & 1 stream SCTP or TCP)  */
 static void * rcvthr_tls_single(void * arg)
 {
@@ -1164,6 +1456,18 @@ int fd_tls_prepare(gnutls_session_t * session, int mode, int dtls, char * priori
 		gnutls_certificate_server_set_request (*session, GNUTLS_CERT_REQUIRE);
 	}
 
+	#ifdef GNUTLS_VERSION_210
+	/* Session tickets, so that reconnecting peers can resume instead of a full handshake */
+	if ((mode == GNUTLS_SERVER) && fd_g_config->cnf_sec_data.ticket_key.data) {
+		CHECK_GNUTLS_DO( gnutls_session_ticket_enable_server(*session, &fd_g_config->cnf_sec_data.ticket_key), /* continue without */ );
+	}
+	#ifndef GNUTLS_VERSION_300
+	if (mode == GNUTLS_CLIENT) {
+		CHECK_GNUTLS_DO( gnutls_session_ticket_enable_client(*session), /* continue without */ );
+	}
+	#endif /* GNUTLS_VERSION_300 */
+	#endif /* GNUTLS_VERSION_210 */
+
 	return 0;
 }
 
@@ -1647,6 +1951,12 @@ int fd_cnx_handshake(struct cnxctx * conn, int mode, int algo, char * priority,
 		/* Initialize the wrapper, start the demux thread */
 		CHECK_FCT( fd_sctp3436_init(conn) );
 #endif /* DISABLE_SCTP */
+	#ifdef GNUTLS_VERSION_373
+	} else if (fd_g_config->cnf_flags.tls_ktls && (conn->cc_proto == IPPROTO_TCP)) {
+		/* GnuTLS can only hand the keys to the kernel if it owns the socket, so we do not use our push & pull callbacks here.
+		 The socket timeouts are then reported as GNUTLS_E_AGAIN and handled in fd_tls_(recv|send)_handle_error */
+		GNUTLS_TRACE( gnutls_transport_set_int( conn->cc_tls_para.session, conn->cc_socket ) );
+	#endif /* GNUTLS_VERSION_373 */
 	} else {
 		/* Set the transport pointer passed to push & pull callbacks */
 		GNUTLS_TRACE( gnutls_transport_set_ptr( conn->cc_tls_para.session, (gnutls_transport_ptr_t) conn ) );
@@ -1686,6 +1996,11 @@ int fd_cnx_handshake(struct cnxctx * conn, int mode, int algo, char * priority,
 	GNUTLS_TRACE( gnutls_handshake_set_timeout( conn->cc_tls_para.session, GNUTLS_DEFAULT_HANDSHAKE_TIMEOUT));
 	#endif /* GNUTLS_VERSION_310 */
 
+	/* Try to resume the previous session with this peer; the server falls back to a full handshake if it does not know it anymore */
+	if ((mode == GNUTLS_CLIENT) && conn->cc_tls_para.resume.data) {
+		CHECK_GNUTLS_DO( gnutls_session_set_data(conn->cc_tls_para.session, conn->cc_tls_para.resume.data, conn->cc_tls_para.resume.size), /* full handshake */ );
+	}
+
 	/* Mark the connection as protected from here, so that the gnutls credentials will be freed */
 	fd_cnx_addstate(conn, CC_STATUS_TLS);
 
@@ -1711,6 +2026,20 @@ int fd_cnx_handshake(struct cnxctx * conn, int mode, int algo, char * priority,
 				return EINVAL;
 			});
 		#endif /* GNUTLS_VERSION_300 */
+		
+		conn->cc_tls_para.resumed = gnutls_session_is_resumed(conn->cc_tls_para.session) ? 1 : 0;
+		fd_cnx_tls_save(conn);
+		
+		#ifdef GNUTLS_VERSION_373
+		if (fd_g_config->cnf_flags.tls_ktls && (conn->cc_proto == IPPROTO_TCP)) {
+			/* When the reception is offloaded, gnutls_record_recv only reads the clear data (and control records) from the socket */
+			gnutls_transport_ktls_enable_flags_t ktls = gnutls_transport_is_ktls_enabled(conn->cc_tls_para.session);
+			conn->cc_tls_para.ktls_send = (ktls & GNUTLS_KTLS_SEND) ? 1 : 0;
+			LOG_D("%s: kernel TLS offload: recv %s, send %s", conn->cc_id, 
+				(ktls & GNUTLS_KTLS_RECV) ? "yes" : "no (GnuTLS)", 
+				(ktls & GNUTLS_KTLS_SEND) ? "yes" : "no (GnuTLS)");
+		}
+		#endif /* GNUTLS_VERSION_373 */
 	}
 
 	/* Multi-stream TLS: handshake other streams as well */
@@ -1814,6 +2143,69 @@ struct fifo * fd_cnx_target_queue(struct cnxctx * conn)
 	return q;
 }
 
+/* Pass a received message to the fast path callback if any, or send it as FDEVP_CNX_MSG_RECV event to the target queue.
+ When the callback returns EBUSY, the event is sent once the target queue holds less than the limit given with the callback.
+ With noblock, EWOULDBLOCK is returned instead of waiting, and limit receives the value to pass to fd_cnx_recv_post;
+ the message was not consumed by the callback then. */
+int fd_cnx_recv_deliver(struct cnxctx * conn, struct fd_cnx_rcvdata * rcv_data, int noblock, int * limit)
+{
+	int (*cb)(void *, struct fd_cnx_rcvdata *);
+	void * data;
+	struct fifo * q;
+	int lim = 0;
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&state_lock), { ASSERT(0); } );
+	cb = conn->cc_fastpath;
+	data = conn->cc_fastpath_data;
+	q = conn->cc_alt ?: conn->cc_incoming;
+	CHECK_POSIX_DO( pthread_mutex_unlock(&state_lock), { ASSERT(0); } );
+	
+	if (cb) {
+		int ret, oldstate;
+		
+		/* The callback takes locks of the peer, the thread must not be canceled in the middle */
+		CHECK_POSIX_DO( pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate), );
+		ret = (*cb)(data, rcv_data);
+		CHECK_POSIX_DO( pthread_setcancelstate(oldstate, NULL), );
+		
+		if (ret == EBUSY)
+			lim = conn->cc_fastpath_lim;
+		else if (ret != EAGAIN)
+			return ret;
+	}
+	
+	if (noblock) {
+		if (limit)
+			*limit = lim;
+		return fd_fifo_trypost_tagged_lim(q, lim, FDEVP_CNX_MSG_RECV, rcv_data->length, rcv_data->buffer);
+	}
+	
+	return fd_fifo_post_tagged_lim(q, lim, FDEVP_CNX_MSG_RECV, rcv_data->length, rcv_data->buffer);
+}
+
+/* Send a message that fd_cnx_recv_deliver could not deliver without waiting, as FDEVP_CNX_MSG_RECV event */
+int fd_cnx_recv_post(struct cnxctx * conn, struct fd_cnx_rcvdata * rcv_data, int limit)
+{
+	return fd_fifo_post_tagged_lim(fd_cnx_target_queue(conn), limit, FDEVP_CNX_MSG_RECV, rcv_data->length, rcv_data->buffer);
+}
+
+/* Set a callback that may consume the received messages in the receiver thread. It returns 0 when the message is consumed, EAGAIN to send the event as usual,
+ EBUSY to send the event once the target queue holds less than limit events (so that the receiver stops reading the connection meanwhile).
+ The callback runs with the cancellation disabled, so it must never block (fd_cnx_destroy would wait for it forever). */
+int fd_cnx_recv_setfastpath(struct cnxctx * conn, int (*cb)(void *, struct fd_cnx_rcvdata *), void * data, int limit)
+{
+	TRACE_ENTRY( "%p %p %p %d", conn, cb, data, limit );
+	CHECK_PARAMS( conn && (limit >= 0) );
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&state_lock), { ASSERT(0); } );
+	conn->cc_fastpath = cb;
+	conn->cc_fastpath_data = data;
+	conn->cc_fastpath_lim = limit;
+	CHECK_POSIX_DO( pthread_mutex_unlock(&state_lock), { ASSERT(0); } );
+	
+	return 0;
+}
+
 /* Set an alternate FIFO list to send FDEVP_CNX_* events to */
 int fd_cnx_recv_setaltfifo(struct cnxctx * conn, struct fifo * alt_fifo)
 {
@@ -1836,9 +2228,10 @@ static int send_simple(struct cnxctx * conn, unsigned char * buf, size_t len)
 	size_t sent = 0;
 	TRACE_ENTRY("%p %p %zd", conn, buf, len);
 	do {
-		if (fd_cnx_teststate(conn, CC_STATUS_TLS)) {
+		if (fd_cnx_teststate(conn, CC_STATUS_TLS) && !conn->cc_tls_para.ktls_send) {
 			CHECK_GNUTLS_DO( ret = fd_tls_send_handle_error(conn, conn->cc_tls_para.session, buf + sent, len - sent),  );
 		} else {
+			/* Clear connection, or the kernel encrypts the data as TLS application records (kTLS) */
 			struct iovec iov;
 			iov.iov_base = buf + sent;
 			iov.iov_len  = len - sent;
@@ -1852,6 +2245,37 @@ static int send_simple(struct cnxctx * conn, unsigned char * buf, size_t len)
 	return 0;
 }
 
+#ifndef DISABLE_SCTP
+/* Choose the stream to send a message on. When unordered delivery is allowed, all the messages of a session use the same stream
+ so that they are still delivered in order; the messages without Session-Id are spread over the streams in round-robin. */
+static uint16_t fd_cnx_sctp_stream(struct cnxctx * conn, unsigned char * buf, size_t len)
+{
+	uint16_t limit;
+
+	if (!conn->cc_sctp_para.unordered)
+		return 0;
+
+	if (fd_cnx_teststate(conn, CC_STATUS_TLS))
+		limit = conn->cc_sctp_para.pairs;
+	else
+		limit = conn->cc_sctp_para.str_out;
+
+	if (limit <= 1)
+		return 0;
+
+	/* The Session-Id AVP, when present, immediately follows the 20 bytes of the message header (RFC 6733, section 8.8) */
+	if ((len > 28) && (buf[20] == 0) && (buf[21] == 0) && ((((uint32_t)buf[22] << 8) | buf[23]) == AC_SESSION_ID) && !(buf[24] & AVP_FLAG_VENDOR)) {
+		size_t avplen = ((size_t)buf[25] << 16) | ((size_t)buf[26] << 8) | (size_t)buf[27];
+		if ((avplen > 8) && (avplen <= len - 20))
+			return fd_os_hash(buf + 28, avplen - 8) % limit;
+	}
+
+	conn->cc_sctp_para.next += 1;
+	conn->cc_sctp_para.next %= limit;
+	return conn->cc_sctp_para.next;
+}
+#endif /* DISABLE_SCTP */
+
 /* Send a message -- this is synchronous -- and we assume it's never called by several threads at the same time (on the same conn), so we don't protect. */
 int fd_cnx_send(struct cnxctx * conn, unsigned char * buf, size_t len)
 {
@@ -1870,20 +2294,7 @@ int fd_cnx_send(struct cnxctx * conn, unsigned char * buf, size_t len)
 		case IPPROTO_SCTP: {
 			int dtls = fd_cnx_uses_dtls(conn);
 			if (!dtls) {
-				int stream = 0;
-				if (conn->cc_sctp_para.unordered) {
-					int limit;
-					if (fd_cnx_teststate(conn, CC_STATUS_TLS))
-						limit = conn->cc_sctp_para.pairs;
-					else
-						limit = conn->cc_sctp_para.str_out;
-
-					if (limit > 1) {
-						conn->cc_sctp_para.next += 1;
-						conn->cc_sctp_para.next %= limit;
-						stream = conn->cc_sctp_para.next;
-					}
-				}
+				uint16_t stream = fd_cnx_sctp_stream(conn, buf, len);
 
 				if (stream == 0) {
 					/* We can use default function, it sends over stream #0 */
@@ -1909,6 +2320,7 @@ int fd_cnx_send(struct cnxctx * conn, unsigned char * buf, size_t len)
 						} while ( sent < len );
 					}
 				}
+				FD_SCTP_STRSTATS_ADD(conn->cc_sctp_para.stats_out, conn->cc_sctp_para.str_out, stream, len);
 			} else {
 				/* DTLS */
 				/* Multistream is handled at lower layer in the push/pull function */
@@ -1927,6 +2339,77 @@ int fd_cnx_send(struct cnxctx * conn, unsigned char * buf, size_t len)
 	return 0;
 }
 
+/* Send several messages (at most FD_CNX_SEND_BATCH), in this order. Same as fd_cnx_send on each buffer, except that
+ the messages for an SCTP association in clear are passed to the kernel with a single system call.
+ On return, sent is the number of messages that were sent, the first ones; it is less than count only on error. */
+int fd_cnx_send_batch(struct cnxctx * conn, unsigned char ** bufs, size_t * lens, int count, int * sent)
+{
+	int i;
+
+	TRACE_ENTRY("%p %p %p %d %p", conn, bufs, lens, count, sent);
+
+	CHECK_PARAMS(sent);
+	*sent = 0;
+	CHECK_PARAMS(conn && (conn->cc_socket > 0) && (! fd_cnx_teststate(conn, CC_STATUS_ERROR)) && bufs && lens && (count > 0) && (count <= FD_CNX_SEND_BATCH));
+
+#ifndef DISABLE_SCTP
+	if ((conn->cc_proto == IPPROTO_SCTP) && (!fd_cnx_teststate(conn, CC_STATUS_TLS)) && (count > 1)) {
+		uint16_t strids[FD_CNX_SEND_BATCH];
+		struct iovec iov[FD_CNX_SEND_BATCH];
+		ssize_t ret;
+
+		for (i = 0; i < count; i++) {
+			strids[i] = fd_cnx_sctp_stream(conn, bufs[i], lens[i]);
+			iov[i].iov_base = bufs[i];
+			iov[i].iov_len  = lens[i];
+		}
+
+		TRACE_DEBUG(FULL, "Sending %d messages on connection %s", count, conn->cc_id);
+
+		CHECK_SYS_DO( ret = fd_sctp_sendstrmv(conn, strids, iov, count), { fd_cnx_markerror(conn); return ENOTCONN; } );
+
+		for (i = 0; i < ret; i++) {
+			FD_SCTP_STRSTATS_ADD(conn->cc_sctp_para.stats_out, conn->cc_sctp_para.str_out, strids[i], lens[i]);
+		}
+		*sent = ret;
+		if (ret < count) {
+			fd_cnx_markerror(conn);
+			return ENOTCONN;
+		}
+		return 0;
+	}
+#endif /* DISABLE_SCTP */
+
+	for (i = 0; i < count; i++) {
+		CHECK_FCT( fd_cnx_send(conn, bufs[i], lens[i]) );
+		*sent = i + 1;
+	}
+
+	return 0;
+}
+
+/* Dump the messages counters of each stream of an SCTP association; nothing for other connections */
+DECLARE_FD_DUMP_PROTOTYPE(fd_cnx_dump_streams, struct cnxctx * conn)
+{
+	FD_DUMP_HANDLE_OFFSET();
+
+#ifndef DISABLE_SCTP
+	if (conn && (conn->cc_proto == IPPROTO_SCTP) && conn->cc_sctp_para.stats_in && conn->cc_sctp_para.stats_out) {
+		struct fd_sctp_strstats none = { 0, 0 };
+		uint16_t i;
+		for (i = 0; (i < conn->cc_sctp_para.str_in) || (i < conn->cc_sctp_para.str_out); i++) {
+			struct fd_sctp_strstats * in  = (i < conn->cc_sctp_para.str_in)  ? &conn->cc_sctp_para.stats_in[i]  : &none;
+			struct fd_sctp_strstats * out = (i < conn->cc_sctp_para.str_out) ? &conn->cc_sctp_para.stats_out[i] : &none;
+			if (!in->msgs && !out->msgs)
+				continue;
+			CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, " str#%d[in:%lu,%llub out:%lu,%llub]", i, in->msgs, in->bytes, out->msgs, out->bytes), return NULL);
+		}
+	}
+#endif /* DISABLE_SCTP */
+
+	return *buf;
+}
+
 
 /**************************************/
 /*     Destruction of connection      */
@@ -1966,6 +2449,7 @@ void fd_cnx_destroy(struct cnxctx * conn)
 
 			/* Deinit gnutls resources */
 			fd_sctp3436_gnutls_deinit_others(conn);
+			fd_cnx_tls_save(conn);
 			if (conn->cc_tls_para.session) {
 				GNUTLS_TRACE( gnutls_deinit(conn->cc_tls_para.session) );
 				conn->cc_tls_para.session = NULL;
@@ -1994,6 +2478,7 @@ void fd_cnx_destroy(struct cnxctx * conn)
 			}
 
 			/* Free the resources of the TLS session */
+			fd_cnx_tls_save(conn);
 			if (conn->cc_tls_para.session) {
 				GNUTLS_TRACE( gnutls_deinit(conn->cc_tls_para.session) );
 				conn->cc_tls_para.session = NULL;
@@ -2017,6 +2502,13 @@ void fd_cnx_destroy(struct cnxctx * conn)
 	if (conn->cc_incoming) {
 		fd_event_destroy( &conn->cc_incoming, free );
 	}
+	
+	free(conn->cc_tls_para.resume.data);
+#ifndef DISABLE_SCTP
+	fd_sctp_rcvbatch_free(conn);
+#endif /* DISABLE_SCTP */
+	free(conn->cc_sctp_para.stats_in);
+	free(conn->cc_sctp_para.stats_out);
 
 	/* Free the object */
 	free(conn);
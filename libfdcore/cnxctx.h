@@ -41,6 +41,21 @@
 /* Maximum time we allow a connection to be blocked because of head-of-the-line buffers. After this delay, connection is considered in error. */
 #define MAX_HOTL_BLOCKING_TIME	1000	/* ms */
 
+/* Maximum number of threads delivering in parallel the messages received on the different streams of one SCTP association */
+#define SCTP_RCV_WORKERS_MAX	4
+
+/* Counters of the Diameter messages exchanged on one SCTP stream */
+struct fd_sctp_strstats {
+	unsigned long		msgs;
+	unsigned long long	bytes;
+};
+#define FD_SCTP_STRSTATS_ADD(_tab, _nb, _strid, _len) {		\
+	if ((_tab) && ((_strid) < (_nb))) {				\
+		(_tab)[_strid].msgs++;					\
+		(_tab)[_strid].bytes += (_len);				\
+	}								\
+}
+
 /* The connection context structure */
 struct cnxctx {
 	char		cc_id[60];	/* The name of this connection. the first 5 chars are reserved for flags display (cc_state). */
@@ -62,6 +77,9 @@ struct cnxctx {
 	
 	struct fifo *	cc_incoming;	/* FIFO queue of events received on the connection, FDEVP_CNX_* */
 	struct fifo *	cc_alt;		/* alternate fifo to send FDEVP_CNX_* events to. */
+	int	     (*	cc_fastpath)(void *, struct fd_cnx_rcvdata *); /* if set, tried on each received message before sending the FDEVP_CNX_MSG_RECV event */
+	void *		cc_fastpath_data; /* opaque parameter of cc_fastpath */
+	int		cc_fastpath_lim; /* when cc_fastpath returns EBUSY, the event is sent once the target queue holds less events than this */
 
 	/* If cc_tls == true */
 	struct {
@@ -69,6 +87,11 @@ struct cnxctx {
 		int				 mode; 		/* GNUTLS_CLIENT / GNUTLS_SERVER */
 		int				 algo;		/* ALGO_HANDSHAKE_DEFAULT / ALGO_HANDSHAKE_3436 */
 		gnutls_session_t 		 session;	/* Session object (stream #0 in case of SCTP) */
+		int				 resumed;	/* The handshake resumed a previous session */
+		gnutls_datum_t			 resume;	/* GNUTLS_CLIENT: session data of a previous connection, to attempt resumption */
+		void			       (*resume_save)(void *, gnutls_datum_t *); /* GNUTLS_CLIENT: receives the session data to resume this connection later */
+		void				*resume_save_data;
+		int				 ktls_send;	/* The kernel encrypts the records we send (kTLS), so we can write to the socket directly */
 	}		cc_tls_para;
 
 	/* If cc_proto == SCTP */
@@ -78,6 +101,9 @@ struct cnxctx {
 		uint16_t pairs;		/* max number of pairs ( = min(in, out)) */
 		uint16_t next;		/* # of stream the next message will be sent to */
 		int	 unordered;	/* boolean telling if use of streams > 0 is permitted */
+		struct fd_sctp_strstats *stats_in;	/* str_in counters, of the messages received on each stream */
+		struct fd_sctp_strstats *stats_out;	/* str_out counters, of the messages sent on each stream */
+		struct sctp_rcvbatch	*rcvbatch;	/* messages read from the socket by fd_sctp_recvmeta and not consumed yet */
 	} 		cc_sctp_para;
 
 	/* If both conditions */
@@ -93,6 +119,8 @@ int  fd_cnx_teststate(struct cnxctx * conn, uint32_t flag);
 void fd_cnx_addstate(struct cnxctx * conn, uint32_t orstate);
 void fd_cnx_setstate(struct cnxctx * conn, uint32_t abstate);
 struct fifo * fd_cnx_target_queue(struct cnxctx * conn);
+int fd_cnx_recv_deliver(struct cnxctx * conn, struct fd_cnx_rcvdata * rcv_data, int noblock, int * limit);
+int fd_cnx_recv_post(struct cnxctx * conn, struct fd_cnx_rcvdata * rcv_data, int limit);
 
 
 /* Socket */
@@ -101,6 +129,16 @@ void fd_cnx_s_setto(int sock);
 
 /* TLS */
 int fd_tls_rcvthr_core(struct cnxctx * conn, gnutls_session_t session);
+/* A Diameter message being rebuilt from the data of a TLS session */
+struct fd_tls_rcvstate {
+	uint8_t			 header[4];	/* the header, until it is fully received */
+	size_t			 received;	/* bytes received so far */
+	struct fd_cnx_rcvdata	 rcv_data;	/* buffer is allocated once the header is received */
+	struct fd_msg_pmdl	*pmdl;
+	int			 limit;		/* limit of the target queue for this message, see fd_cnx_recv_deliver */
+};
+int fd_tls_rcv_inline(struct cnxctx * conn, gnutls_session_t session, struct fd_tls_rcvstate * st, struct fd_sctp_strstats * stats, struct fd_tls_rcvstate * full);
+void fd_tls_rcvstate_clear(struct fd_tls_rcvstate * st);
 int fd_tls_prepare(gnutls_session_t * session, int mode, int dtls, char * priority, void * alt_creds);
 #ifndef GNUTLS_VERSION_300
 int fd_tls_verify_credentials(gnutls_session_t session, struct cnxctx * conn, int verbose);
@@ -122,20 +160,27 @@ int fd_sctp_get_local_ep(int sock,  struct fd_list * list);
 int fd_sctp_get_remote_ep(int sock, struct fd_list * list);
 int fd_sctp_get_str_info( int sock, uint16_t *in, uint16_t *out, sSS *primary );
 ssize_t fd_sctp_sendstrv(struct cnxctx * conn, uint16_t strid, const struct iovec *iov, int iovcnt);
+ssize_t fd_sctp_sendstrmv(struct cnxctx * conn, const uint16_t * strids, const struct iovec *iov, int count);
 int fd_sctp_recvmeta(struct cnxctx * conn, uint16_t * strid, uint8_t ** buf, size_t * len, int *event);
+void fd_sctp_rcvbatch_free(struct cnxctx * conn);
 
 /* TLS over SCTP (multi-stream) */
 struct sctp3436_ctx {
 	struct cnxctx 	*parent; 	/* for info such as socket, conn name, event list */
 	uint16_t	 strid;		/* Stream # of this session */
-	struct fifo	*raw_recv;	/* Raw data received on this stream, for demux */
+	struct fifo	*raw_recv;	/* Raw data received on this stream during the handshake, for demux */
 	struct {
 		uint8_t *buf;
 		size_t   bufsz;
 		size_t   offset;
 	} 		 partial;	/* If the pull function did not read the full content of first message in raw, it stores it here for next read call. */
-	pthread_t	 thr;		/* Thread to decrypt raw data in this pair of streams */
+	pthread_t	 thr;		/* Thread performing the resumed handshake on this pair of streams */
 	gnutls_session_t session;	/* TLS context using this pair of streams -- except if strid == 0, in that case session is outside the array */
+	
+	pthread_mutex_t	 lock;		/* Serializes the demuxer and the thread completing the handshake on the session */
+	int		 direct;	/* once the handshake is complete, the demuxer decrypts the data itself (the pull function does not block anymore) */
+	int		 closed;	/* the session was closed or failed */
+	struct fd_tls_rcvstate rcv;	/* message being received, when direct */
 };
 
 int fd_sctp3436_init(struct cnxctx * conn);
@@ -100,6 +100,17 @@ DECLARE_FD_DUMP_PROTOTYPE(fd_conf_dump)
 	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "  Number of SCTP streams . : %hu\n", fd_g_config->cnf_sctp_str), return NULL);
 	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "  Number of clients thr .. : %d\n", fd_g_config->cnf_thr_srv), return NULL);
 	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "  Number of app threads .. : %hu\n", fd_g_config->cnf_dispthr), return NULL);
+	if (fd_g_config->cnf_flow_high) {
+		CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "  Throttling thresholds .. : %hu, %hu (%s)\n", fd_g_config->cnf_flow_high, fd_g_config->cnf_flow_low, fd_g_config->cnf_flags.flow_busy ? "TOO_BUSY" : "hold"), return NULL);
+	} else {
+		CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "  Throttling thresholds .. : DISABLED\n"), return NULL);
+	}
+	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "  Rate limits ............ : "), return NULL);
+	CHECK_MALLOC_DO( fd_rt_limits_dump( FD_DUMP_STD_PARAMS ), return NULL);
+	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "\n"), return NULL);
+	if (fd_g_config->cnf_dict_snap) {
+		CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "  Dictionary snapshot .... : %s\n", fd_g_config->cnf_dict_snap), return NULL);
+	}
 	if (FD_IS_LIST_EMPTY(&fd_g_config->cnf_endpoints)) {
 		CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "  Local endpoints ........ : Default (use all available)\n"), return NULL);
 	} else {
@@ -133,6 +144,7 @@ DECLARE_FD_DUMP_PROTOTYPE(fd_conf_dump)
 	#endif /* DISABLE_SCTP */
 	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "          - Pref. proto .. : %s\n", fd_g_config->cnf_flags.pr_tcp ? "TCP" : "SCTP"), return NULL);
 	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "          - TLS method ... : %s\n", fd_g_config->cnf_flags.tls_alg ? "INBAND" : "Separate port"), return NULL);
+	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "          - Kernel TLS ... : %s\n", fd_g_config->cnf_flags.tls_ktls ? "Enabled" : "DISABLED"), return NULL);
 	
 	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "  TLS :   - Certificate .. : %s\n", fd_g_config->cnf_sec_data.cert_file ?: "(NONE)"), return NULL);
 	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "          - Private key .. : %s\n", fd_g_config->cnf_sec_data.key_file ?: "(NONE)"), return NULL);
@@ -280,6 +292,13 @@ int fd_conf_parse()
 		}
 	}
 	
+	#ifndef GNUTLS_VERSION_373
+	if (fd_g_config->cnf_flags.tls_ktls) {
+		LOG_N("TLS_kTLS is not supported by the GnuTLS version this was compiled with, ignored.");
+		fd_g_config->cnf_flags.tls_ktls = 0;
+	}
+	#endif /* GNUTLS_VERSION_373 */
+	
 	/* Resolve hostname if not provided */
 	if (fd_g_config->cnf_diamid == NULL) {
 		char buf[HOST_NAME_MAX + 1];
@@ -591,7 +610,13 @@ int fd_conf_parse()
 						fd_g_config->cnf_sec_data.dh_bits ?: GNUTLS_DEFAULT_DHBITS),
 						 { TRACE_ERROR("Error in DH bits value : %d", fd_g_config->cnf_sec_data.dh_bits ?: GNUTLS_DEFAULT_DHBITS); return EINVAL; } );
 		}			
-	
+		
+		#ifdef GNUTLS_VERSION_210
+		/* Key protecting the session tickets we issue; peers reconnecting within this process lifetime can resume their session */
+		CHECK_GNUTLS_DO( gnutls_session_ticket_key_generate(&fd_g_config->cnf_sec_data.ticket_key), 
+				 { LOG_N("Unable to generate the TLS session ticket key, session resumption is disabled"); 
+				   memset(&fd_g_config->cnf_sec_data.ticket_key, 0, sizeof(gnutls_datum_t)); } );
+		#endif /* GNUTLS_VERSION_210 */
 	}
 	
 	return 0;
@@ -615,6 +640,10 @@ int fd_conf_deinit()
 #endif /* GNUTLS_VERSION_300 */
 	gnutls_priority_deinit(fd_g_config->cnf_sec_data.prio_cache);
 	gnutls_dh_params_deinit(fd_g_config->cnf_sec_data.dh_cache);
+	if (fd_g_config->cnf_sec_data.ticket_key.data) {
+		gnutls_free(fd_g_config->cnf_sec_data.ticket_key.data);
+		memset(&fd_g_config->cnf_sec_data.ticket_key, 0, sizeof(gnutls_datum_t));
+	}
 	gnutls_certificate_free_credentials(fd_g_config->cnf_sec_data.credentials);
 	
 	free(fd_g_config->cnf_sec_data.cert_file); fd_g_config->cnf_sec_data.cert_file = NULL;
@@ -637,6 +666,7 @@ int fd_conf_deinit()
 	/* Destroy the local identity */	
 	free(fd_g_config->cnf_diamid); fd_g_config->cnf_diamid = NULL;
 	free(fd_g_config->cnf_diamrlm); fd_g_config->cnf_diamrlm = NULL;
+	free(fd_g_config->cnf_dict_snap); fd_g_config->cnf_dict_snap = NULL;
 	
 	return 0;
 }
@@ -107,6 +107,7 @@ static void core_shutdown(void)
 	
 	CHECK_FCT_DO( fd_ext_term(), /* Cleanup all extensions */ );
 	CHECK_FCT_DO( fd_rtdisp_cleanup(), /* destroy remaining handlers */ );
+	CHECK_FCT_DO( fd_msg_fini(), /* destroy the messages templates */ );
 	
 	GNUTLS_TRACE( gnutls_global_deinit() );
 	
@@ -234,7 +235,7 @@ static int fd_core_parseconf_int(const char * conffile)
 {
 	char * buf = NULL, *b;
 	size_t len = 0, offset=0;
-	
+	int ret;
 	
 	TRACE_ENTRY("%p", conffile);
 	
@@ -246,9 +247,17 @@ static int fd_core_parseconf_int(const char * conffile)
 	
 	/* The following module use data from the configuration */
 	CHECK_FCT( fd_rtdisp_init() );
+	CHECK_FCT( fd_p_flow_init() );
+	
+	/* Load the dictionary snapshot, so that the extensions find its objects */
+	if (fd_g_config->cnf_dict_snap) {
+		CHECK_FCT(  fd_dict_snapshot_load(fd_g_config->cnf_dict, fd_g_config->cnf_dict_snap)  );
+	}
 	
-	/* Now, load all dynamic extensions */
-	CHECK_FCT(  fd_ext_load()  );
+	/* Now, load all dynamic extensions. The dictionary objects they create are ordered once, at the end */
+	CHECK_FCT(  fd_dict_bulk_begin(fd_g_config->cnf_dict)  );
+	CHECK_FCT_DO(  ret = fd_ext_load(),  { fd_dict_bulk_commit(fd_g_config->cnf_dict); return ret; }  );
+	CHECK_FCT(  fd_dict_bulk_commit(fd_g_config->cnf_dict)  );
 	
 	/* Display configuration */
 	b = fd_conf_dump(&buf, &len, NULL);
@@ -36,37 +36,28 @@
 #include "fdcore-internal.h"
 
 /* Events are a subset of fifo queues, with a known type */
+/* The code, size and data are stored inline in the queue items (see fd_fifo_post_tagged), so sending an event does not allocate memory */
 
 int fd_event_send(struct fifo *queue, int code, size_t datasz, void * data)
 {
-	struct fd_event * ev;
-	CHECK_MALLOC( ev = malloc(sizeof(struct fd_event)) );
-	ev->code = code;
-	ev->size = datasz;
-	ev->data = data;
-	CHECK_FCT( fd_fifo_post(queue, &ev) );
+	CHECK_FCT( fd_fifo_post_tagged(queue, code, datasz, data) );
 	return 0;
 }
 
 int fd_event_get(struct fifo *queue, int *code, size_t *datasz, void ** data)
 {
-	struct fd_event * ev;
-	CHECK_FCT( fd_fifo_get(queue, &ev) );
-	if (code)
-		*code = ev->code;
-	if (datasz)
-		*datasz = ev->size;
+	void * d;
+	CHECK_FCT( fd_fifo_get_tagged(queue, code, datasz, &d) );
 	if (data)
-		*data = ev->data;
-	free(ev);
+		*data = d;
 	return 0;
 }
 
 int fd_event_timedget(struct fifo *queue, struct timespec * timeout, int timeoutcode, int *code, size_t *datasz, void ** data)
 {
-	struct fd_event * ev;
+	void * d;
 	int ret = 0;
-	ret = fd_fifo_timedget(queue, &ev, timeout);
+	ret = fd_fifo_timedget_tagged(queue, code, datasz, &d, timeout);
 	if (ret == ETIMEDOUT) {
 		if (code)
 			*code = timeoutcode;
@@ -76,24 +67,18 @@ int fd_event_timedget(struct fifo *queue, struct timespec * timeout, int timeout
 			*data = NULL;
 	} else {
 		CHECK_FCT( ret );
-		if (code)
-			*code = ev->code;
-		if (datasz)
-			*datasz = ev->size;
 		if (data)
-			*data = ev->data;
-		free(ev);
+			*data = d;
 	}
 	return 0;
 }
 
 void fd_event_destroy(struct fifo **queue, void (*free_cb)(void * data))
 {
-	struct fd_event * ev;
+	void * data;
 	/* Purge all events, and free the associated data if any */
-	while (fd_fifo_tryget( *queue, &ev ) == 0) {
-		(*free_cb)(ev->data);
-		free(ev);
+	while (fd_fifo_tryget_tagged( *queue, NULL, NULL, &data ) == 0) {
+		(*free_cb)(data);
 	}
 	CHECK_FCT_DO( fd_fifo_del(queue), /* continue */ );
 	return ;
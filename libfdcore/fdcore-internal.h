@@ -97,6 +97,7 @@ int fd_ext_term(void);
 
 /* Messages */
 int fd_msg_init(void);
+int fd_msg_fini(void);
 extern struct dict_object * fd_dict_avp_OSI; /* Origin-State-Id */
 extern struct dict_object * fd_dict_cmd_CER; /* Capabilities-Exchange-Request */
 extern struct dict_object * fd_dict_cmd_DWR; /* Device-Watchdog-Request */
@@ -123,6 +124,32 @@ int fd_rtdisp_init(void);
 int fd_rtdisp_cleanstop(void);
 int fd_rtdisp_fini(void);
 int fd_rtdisp_cleanup(void);
+void fd_rtdisp_cache_invalidate(void);
+
+/* The key of a cached OUT routing decision (routing_cache.c) */
+struct rtc_key {
+	application_id_t appid;
+	uint8_t * 	dr;	/* Destination-Realm, NULL if absent */
+	size_t		drlen;
+	uint8_t * 	dh;	/* Destination-Host, NULL if absent */
+	size_t		dhlen;
+	uint32_t	hash;
+};
+int  fd_rtc_get_key(struct msg * msg, struct rtc_key * key);
+uint32_t fd_rtc_gen(void);
+int  fd_rtc_apply(struct rtc_key * key, struct fd_list * candidates);
+void fd_rtc_save(struct rtc_key * key, uint32_t gen, struct fd_list * candidates, int ini_score);
+void fd_rtc_fini(void);
+
+int fd_rtredir_init(void);
+int fd_rtredir_fini(void);
+int fd_rtredir_learn(struct msg * answer);
+int fd_rtredir_apply(struct msg * req, struct fd_list * candidates);
+int fd_rtlim_add(int out, char * kind, char * key, int rate, int burst);
+int fd_rtlim_init(void);
+int fd_rtlim_fini(void);
+int fd_rtlim_in(struct msg * msg, union avp_value * dr, application_id_t appid);
+int fd_rtlim_out(struct msg * msg, application_id_t appid);
 
 /* Sentinel for the sent requests list */
 struct sr_list {
@@ -131,6 +158,7 @@ struct sr_list {
 	long            cnt; /* number of requests in the srs list */
 	long		cnt_lost; /* number of requests that have not been answered in time. 
 				     It is decremented when an unexpected answer is received, so this may not be accurate. */
+	long		delay_avg; /* moving average of the delay before receiving answers, in microseconds (0 until the first answer) */
 	pthread_mutex_t	mtx; /* mutex to protect these lists */
 	pthread_cond_t  cnd; /* cond var used by the thread that handles timeouts */
 	pthread_t       thr; /* the thread that handles timeouts (expirecb called in separate forked threads) */
@@ -190,6 +218,26 @@ struct fd_peer { /* The "real" definition of the peer structure */
 	/* Pending received requests not yet answered (count only) */
 	long		 p_reqin_count; /* We use p_state_mtx to protect this value */
 	
+	/* Routable messages received in OPEN state directly by the receiver thread (see fd_psm_fastpath) */
+	unsigned long	 p_fastrcv_count; /* Also protected by p_state_mtx */
+	unsigned long	 p_fastrcv_seen;  /* Value at the previous watchdog timeout, only used by the PSM thread */
+	
+	/* Flow control of the received messages (see p_flow.c). Protected by p_state_mtx */
+	unsigned long	 p_flow_rcvd;	/* Messages received since the previous congestion step */
+	int		 p_flow_paused;	/* The congestion level at which the peer was throttled, 0 if it is not */
+	int		 p_flow_tosend;	/* Number of high watermarks reached by p_tosend (protected by the lock of p_flow.c instead) */
+	unsigned long	 p_flow_pauses;	/* Number of times the peer was throttled */
+	unsigned long	 p_flow_held;	/* Number of requests held until the peer was resumed */
+	struct fifo	*p_flow_heldq;	/* The requests currently held */
+	unsigned long	 p_flow_busy;	/* Number of requests answered with DIAMETER_TOO_BUSY */
+	struct timespec	 p_flow_since;	/* When the peer was throttled */
+	struct timespec	 p_flow_total;	/* Cumulated time the peer was throttled */
+	
+	/* TLS session resumption: data of the last session we initiated with this peer, and handshakes counters. Protected by p_state_mtx */
+	gnutls_datum_t	 p_tls_session;
+	unsigned long	 p_tls_full;
+	unsigned long	 p_tls_resumed;
+	
 	/* Data for transitional states before the peer is in OPEN state */
 	struct {
 		struct cnxctx * p_receiver;	/* Only used in case of election */
@@ -288,6 +336,19 @@ int fd_p_expi_init(void);
 int fd_p_expi_fini(void);
 int fd_p_expi_update(struct fd_peer * peer );
 
+/* Flow control of the received messages */
+#define FD_FLOW_EVENTS_MAX	50	/* The connection of a throttled peer is not read while its PSM has that many events to process */
+int  fd_p_flow_init(void);
+int  fd_p_flow_peer_init(struct fd_peer * peer);
+void fd_p_flow_peer_fini(struct fd_peer * peer);
+int  fd_p_flow_check(struct fd_peer * peer, struct fd_cnx_rcvdata * rcv_data);
+int  fd_p_flow_incoming(struct fd_peer * peer, struct msg ** msg, int noblock);
+DECLARE_FD_DUMP_PROTOTYPE(fd_p_flow_dump, struct fd_peer * peer);
+
+/* Rate limits of the requests sent to a peer (ratelimit.c) */
+int fd_rtlim_out_peer(struct fd_peer * peer);
+void fd_rtlim_out_peer_cancel(struct fd_peer * peer);
+
 /* Peer state machine */
 int  fd_psm_start();
 int  fd_psm_begin(struct fd_peer * peer );
@@ -296,6 +357,7 @@ void fd_psm_abord(struct fd_peer * peer );
 void fd_psm_next_timeout(struct fd_peer * peer, int add_random, int delay);
 int fd_psm_change_state(struct fd_peer * peer, int new_state);
 void fd_psm_cleanup(struct fd_peer * peer, int terminate);
+int fd_psm_fastpath(void * data, struct fd_cnx_rcvdata * rcv_data);
 
 /* Peer out */
 int fd_out_send(struct msg ** msg, struct cnxctx * cnx, struct fd_peer * peer, int update_reqin_cnt);
@@ -319,6 +381,7 @@ int fd_p_ce_handle_newCER(struct msg ** msg, struct fd_peer * peer, struct cnxct
 int fd_p_ce_handle_newcnx(struct fd_peer * peer, struct cnxctx * initiator);
 int fd_p_ce_process_receiver(struct fd_peer * peer);
 void fd_p_ce_clear_cnx(struct fd_peer * peer, struct cnxctx ** cnx_kept);
+int fd_p_ce_tls_resume(struct fd_peer * peer, struct cnxctx * cnx);
 int fd_p_dw_handle(struct msg ** msg, int req, struct fd_peer * peer);
 int fd_p_dw_timeout(struct fd_peer * peer);
 int fd_p_dw_reopen(struct fd_peer * peer);
@@ -359,7 +422,13 @@ int             fd_cnx_getremoteeps(struct cnxctx * conn, struct fd_list * eps);
 char *          fd_cnx_getremoteid(struct cnxctx * conn);
 int             fd_cnx_receive(struct cnxctx * conn, struct timespec * timeout, unsigned char **buf, size_t * len);
 int             fd_cnx_recv_setaltfifo(struct cnxctx * conn, struct fifo * alt_fifo); /* send FDEVP_CNX_MSG_RECV event to the fifo list */
+int             fd_cnx_tls_setresume(struct cnxctx * conn, gnutls_datum_t * data, void (*save)(void *, gnutls_datum_t *), void * save_data);
+int             fd_cnx_tls_isresumed(struct cnxctx * conn);
+int             fd_cnx_recv_setfastpath(struct cnxctx * conn, int (*cb)(void *, struct fd_cnx_rcvdata *), void * data, int limit); /* cb returns EAGAIN to let the event be sent, EBUSY to send it under limit */
 int             fd_cnx_send(struct cnxctx * conn, unsigned char * buf, size_t len);
+#define FD_CNX_SEND_BATCH	16	/* Maximum number of messages in a fd_cnx_send_batch call */
+int             fd_cnx_send_batch(struct cnxctx * conn, unsigned char ** bufs, size_t * lens, int count, int * sent);
+DECLARE_FD_DUMP_PROTOTYPE(fd_cnx_dump_streams, struct cnxctx * conn);
 void            fd_cnx_destroy(struct cnxctx * conn);
 #ifdef GNUTLS_VERSION_300
 int             fd_tls_verify_credentials_2(gnutls_session_t session);
@@ -92,6 +92,7 @@ struct peer_info fddpi;
 %token <integer> INTEGER
 
 %type <string> 	extconf
+%type <integer>	ratelimitdir
 
 %token		IDENTITY
 %token		REALM
@@ -107,12 +108,17 @@ struct peer_info fddpi;
 %token		NOTLS
 %token		SCTPSTREAMS
 %token		APPSERVTHREADS
+%token		THROTTLETHRS
+%token		THROTTLEBUSY
+%token		RATELIMITIN
+%token		RATELIMITOUT
 %token		LISTENON
 %token		THRPERSRV
 %token		TCTIMER
 %token		TWTIMER
 %token		NORELAY
 %token		LOADEXT
+%token		DICTSNAP
 %token		CONNPEER
 %token		CONNTO
 %token		TLS_CRED
@@ -121,6 +127,7 @@ struct peer_info fddpi;
 %token		TLS_PRIO
 %token		TLS_DH_BITS
 %token		TLS_DH_FILE
+%token		TLS_KTLS
 
 
 /* -------------------------------------- */
@@ -140,6 +147,9 @@ conffile:		/* Empty is OK -- for simplicity here, we reject in daemon later */
 			| conffile thrpersrv
 			| conffile norelay
 			| conffile appservthreads
+			| conffile throttlethrs
+			| conffile throttlebusy
+			| conffile ratelimit
 			| conffile noip
 			| conffile noip6
 			| conffile notcp
@@ -147,12 +157,14 @@ conffile:		/* Empty is OK -- for simplicity here, we reject in daemon later */
 			| conffile prefertcp
 			| conffile oldtls
 			| conffile loadext
+			| conffile dictsnap
 			| conffile connpeer
 			| conffile tls_cred
 			| conffile tls_ca
 			| conffile tls_crl
 			| conffile tls_prio
 			| conffile tls_dh
+			| conffile tls_ktls
 			| conffile errors
 			{
 				yyerror(&yylloc, conf, "An error occurred while parsing the configuration file");
@@ -262,6 +274,40 @@ appservthreads:		APPSERVTHREADS '=' INTEGER ';'
 			}
 			;
 
+throttlethrs:		THROTTLETHRS '=' INTEGER ',' INTEGER ';'
+			{
+				CHECK_PARAMS_DO( (($3 == 0) && ($5 == 0)) || (($5 >= 0) && ($3 > $5) && ($3 < 65536)),
+					{ yyerror (&yylloc, conf, "Invalid value"); YYERROR; } );
+				conf->cnf_flow_high = (uint16_t)$3;
+				conf->cnf_flow_low = (uint16_t)$5;
+			}
+			;
+
+throttlebusy:		THROTTLEBUSY ';'
+			{
+				conf->cnf_flags.flow_busy = 1;
+			}
+			;
+
+ratelimitdir:		RATELIMITIN
+			{
+				$$ = 0;
+			}
+			| RATELIMITOUT
+			{
+				$$ = 1;
+			}
+			;
+
+ratelimit:		ratelimitdir '=' QSTRING ',' QSTRING ',' INTEGER ',' INTEGER ';'
+			{
+				CHECK_FCT_DO( fd_rtlim_add( $1, $3, $5, $7, $9 ),
+					{ free($3); free($5); yyerror (&yylloc, conf, "Invalid rate limit"); YYERROR; } );
+				free($3);
+				free($5);
+			}
+			;
+
 noip:			NOIP ';'
 			{
 				if (got_peer_noipv6) { 
@@ -328,6 +374,13 @@ oldtls:			OLDTLS ';'
 			}
 			;
 
+dictsnap:		DICTSNAP '=' QSTRING ';'
+			{
+				free(conf->cnf_dict_snap);
+				conf->cnf_dict_snap = $3;
+			}
+			;
+
 loadext:		LOADEXT '=' QSTRING extconf ';'
 			{
 				char * fname;
@@ -665,3 +718,9 @@ tls_dh:			TLS_DH_BITS '=' INTEGER ';'
 				fclose(fd);
 			}
 			;
+			
+tls_ktls:		TLS_KTLS ';'
+			{
+				conf->cnf_flags.tls_ktls = 1;
+			}
+			;
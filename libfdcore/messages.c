@@ -48,9 +48,16 @@ struct dict_object * fd_dict_cmd_DWR = NULL; /* Device-Watchdog-Request */
 struct dict_object * fd_dict_avp_DC  = NULL; /* Disconnect-Cause */
 struct dict_object * fd_dict_cmd_DPR = NULL; /* Disconnect-Peer-Request */
 
+/* Templates of the Origin-Host, Origin-Realm (and Origin-State-Id for index 1) AVPs, which do not change once the configuration is parsed */
+static struct msg_tmpl * tmpl_origin[2] = { NULL, NULL };
+
+static int add_origin_avps ( struct msg * msg, int osi );
+
 /* Resolve the dictionary objects */
 int fd_msg_init(void)
 {
+	int i;
+	
 	TRACE_ENTRY("");
 	
 	/* Initialize the dictionary objects that we may use frequently */
@@ -70,21 +77,56 @@ int fd_msg_init(void)
 	CHECK_FCT( fd_dict_search ( fd_g_config->cnf_dict, DICT_COMMAND, CMD_BY_NAME, "Device-Watchdog-Request", &fd_dict_cmd_DWR, ENOENT ) );
 	CHECK_FCT( fd_dict_search ( fd_g_config->cnf_dict, DICT_COMMAND, CMD_BY_NAME, "Disconnect-Peer-Request", &fd_dict_cmd_DPR, ENOENT ) );
 	
+	/* Prepare the templates of the origin AVPs */
+	for (i = 0; i < 2; i++) {
+		struct msg * skel = NULL;
+		int ret;
+		CHECK_FCT(  fd_msg_new( NULL, 0, &skel )  );
+		CHECK_FCT_DO(  ret = add_origin_avps( skel, i ), { fd_msg_free(skel); return ret; }  );
+		CHECK_FCT_DO(  ret = fd_msg_tmpl_new( skel, &tmpl_origin[i] ), { fd_msg_free(skel); return ret; }  );
+		CHECK_FCT(  fd_msg_free(skel)  );
+	}
+	
+	return 0;
+}
+
+/* Free the templates */
+int fd_msg_fini(void)
+{
+	int i;
+	
+	TRACE_ENTRY("");
+	
+	for (i = 0; i < 2; i++) {
+		if (tmpl_origin[i]) {
+			CHECK_FCT_DO(  fd_msg_tmpl_free(tmpl_origin[i]), /* continue */  );
+			tmpl_origin[i] = NULL;
+		}
+	}
 	
 	return 0;
 }
 
 /* Add Origin-Host, Origin-Realm, Origin-State-Id AVPS at the end of the message */
 int fd_msg_add_origin ( struct msg * msg, int osi )
+{
+	TRACE_ENTRY("%p", msg);
+	CHECK_PARAMS(  msg  );
+	
+	if (tmpl_origin[osi ? 1 : 0])
+		return fd_msg_tmpl_add( tmpl_origin[osi ? 1 : 0], msg );
+	
+	return add_origin_avps( msg, osi );
+}
+
+/* Create the origin AVPs one by one (used to build the templates) */
+static int add_origin_avps ( struct msg * msg, int osi )
 {
 	union avp_value val;
 	struct avp * avp_OH  = NULL;
 	struct avp * avp_OR  = NULL;
 	struct avp * avp_OSI = NULL;
 	
-	TRACE_ENTRY("%p", msg);
-	CHECK_PARAMS(  msg  );
-	
 	/* Create the Origin-Host AVP */
 	CHECK_FCT( fd_msg_avp_new( dict_avp_OH, 0, &avp_OH ) );
 	
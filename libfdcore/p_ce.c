@@ -37,6 +37,49 @@
 
 /* This file contains code to handle Capabilities Exchange messages (CER and CEA) and election process */
 
+/* Receive the TLS session data of a connection with the peer, for resuming it on the next connection */
+static void tls_session_save(void * data, gnutls_datum_t * session)
+{
+	struct fd_peer * peer = data;
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&peer->p_state_mtx), { gnutls_free(session->data); return; } );
+	gnutls_free(peer->p_tls_session.data);
+	peer->p_tls_session = *session;
+	CHECK_POSIX_DO( pthread_mutex_unlock(&peer->p_state_mtx), /* continue */ );
+}
+
+/* Offer the session data saved from a previous connection with this peer to a new client connection */
+int fd_p_ce_tls_resume(struct fd_peer * peer, struct cnxctx * cnx)
+{
+	int ret;
+	
+	TRACE_ENTRY("%p %p", peer, cnx);
+	CHECK_PARAMS( CHECK_PEER(peer) && cnx );
+	
+	CHECK_POSIX( pthread_mutex_lock(&peer->p_state_mtx) );
+	ret = fd_cnx_tls_setresume(cnx, &peer->p_tls_session, tls_session_save, peer);
+	CHECK_POSIX( pthread_mutex_unlock(&peer->p_state_mtx) );
+	
+	return ret;
+}
+
+/* Account for a completed TLS handshake with the peer */
+static void tls_count(struct fd_peer * peer)
+{
+	int resumed = fd_cnx_tls_isresumed(peer->p_cnxctx);
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&peer->p_state_mtx), return );
+	if (resumed)
+		peer->p_tls_resumed++;
+	else
+		peer->p_tls_full++;
+	CHECK_POSIX_DO( pthread_mutex_unlock(&peer->p_state_mtx), /* continue */ );
+	
+	if (resumed) {
+		LOG_D("'%s': TLS session resumed", peer->p_hdr.info.pi_diamid);
+	}
+}
+
 /* Save a connection as peer's principal */
 static int set_peer_cnx(struct fd_peer * peer, struct cnxctx **cnx)
 {
@@ -49,9 +92,13 @@ static int set_peer_cnx(struct fd_peer * peer, struct cnxctx **cnx)
 	/* Set the events to be sent to the PSM */
 	CHECK_FCT( fd_cnx_recv_setaltfifo(peer->p_cnxctx, peer->p_events) );
 	
+	/* Routable messages received once the peer is open do not need the PSM thread */
+	CHECK_FCT( fd_cnx_recv_setfastpath(peer->p_cnxctx, fd_psm_fastpath, peer, FD_FLOW_EVENTS_MAX) );
+	
 	/* Read the credentials if possible */
 	if (fd_cnx_getTLS(peer->p_cnxctx)) {
 		CHECK_FCT( fd_cnx_getcred(peer->p_cnxctx, &peer->p_hdr.info.runtime.pir_cert_list, &peer->p_hdr.info.runtime.pir_cert_list_size) );
+		tls_count(peer);
 	}
 	
 	/* Read the endpoints, maybe used to reconnect to the peer later */
@@ -801,12 +848,14 @@ int fd_p_ce_msgrcv(struct msg ** msg, int req, struct fd_peer * peer)
 			
 		} else {
 			fd_psm_change_state(peer, STATE_OPEN_HANDSHAKE);
+			CHECK_FCT_DO( fd_p_ce_tls_resume(peer, peer->p_cnxctx), /* full handshake */ );
 			CHECK_FCT_DO( fd_cnx_handshake(peer->p_cnxctx, GNUTLS_CLIENT, ALGO_HANDSHAKE_3436, peer->p_hdr.info.config.pic_priority, NULL),
 				{
 					/* Handshake failed ...  */
 					fd_hook_call(HOOK_PEER_CONNECT_FAILED, NULL, peer, "TLS handshake failed after CER/CEA exchange", NULL);
 					goto cleanup;
 				} );
+			tls_count(peer);
 
 			/* Retrieve the credentials */
 			CHECK_FCT( fd_cnx_getcred(peer->p_cnxctx, &peer->p_hdr.info.runtime.pir_cert_list, &peer->p_hdr.info.runtime.pir_cert_list_size) );
@@ -974,6 +1023,7 @@ int fd_p_ce_process_receiver(struct fd_peer * peer)
 				fd_hook_call(HOOK_PEER_CONNECT_FAILED, NULL, peer, "TLS handshake failed after CER/CEA exchange", NULL);
 				goto cleanup;
 			} );
+		tls_count(peer);
 		
 		/* Retrieve the credentials */
 		CHECK_FCT_DO( fd_cnx_getcred(peer->p_cnxctx, &peer->p_hdr.info.runtime.pir_cert_list, &peer->p_hdr.info.runtime.pir_cert_list_size),
@@ -290,6 +290,7 @@ static void * connect_thr(void * arg)
 	
 	/* Handshake if needed (secure port) */
 	if (nc->dotls) {
+		CHECK_FCT_DO( fd_p_ce_tls_resume(peer, cnx), /* full handshake */ );
 		CHECK_FCT_DO( fd_cnx_handshake(cnx, GNUTLS_CLIENT, 
 						ALGO_HANDSHAKE_3436,
 						peer->p_hdr.info.config.pic_priority, NULL),
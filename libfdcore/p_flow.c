@@ -0,0 +1,387 @@
+/*********************************************************************************************************
+* Software License Agreement (BSD License)                                                               *
+* Author: Sebastien Decugis <sdecugis@freediameter.net>							 *
+*													 *
+* Copyright (c) 2013, WIDE Project and NICT								 *
+* All rights reserved.											 *
+* 													 *
+* Redistribution and use of this software in source and binary forms, with or without modification, are  *
+* permitted provided that the following conditions are met:						 *
+* 													 *
+* * Redistributions of source code must retain the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer.										 *
+*    													 *
+* * Redistributions in binary form must reproduce the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer in the documentation and/or other						 *
+*   materials provided with the distribution.								 *
+* 													 *
+* * Neither the name of the WIDE Project or NICT nor the 						 *
+*   names of its contributors may be used to endorse or 						 *
+*   promote products derived from this software without 						 *
+*   specific prior written permission of WIDE Project and 						 *
+*   NICT.												 *
+* 													 *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED *
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A *
+* PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR *
+* ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 	 *
+* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 	 *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR *
+* TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF   *
+* ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.								 *
+*********************************************************************************************************/
+
+#include "fdcore-internal.h"
+
+/* Flow control of the messages received from the peers.
+ *
+ * The routing threads consume fd_g_incoming, and the out thread of each peer consumes its p_tosend queue. When the
+ * producers are faster, these queues fill up and the threads posting in them block: the receiver threads of all peers
+ * alike, so that one noisy peer slows down everybody. Instead, we set watermarks on these queues (fd_fifo_setthrhd):
+ *  - each time a high watermark is reached, the congestion level increases and the peers that sent the most messages
+ *    since the previous step (at least the average of the peers not throttled yet) are throttled at this level;
+ *  - each time a low watermark is reached, the peers throttled at the current level are resumed.
+ * The requests of a throttled peer go through its PSM thread, which keeps them aside (up to FLOW_HELD_MAX) until the
+ * peer is resumed; the answers are never delayed, they complete our own requests. With ThrottleTooBusy, or once
+ * FLOW_HELD_MAX requests are kept, the requests are answered with DIAMETER_TOO_BUSY so that the remote peer can route
+ * them elsewhere. This is disabled unless ThrottleThresholds is configured.
+ * The PSM thread may itself wait for room in fd_g_incoming. Meanwhile, the receiver threads of a throttled peer stop
+ * reading its connection when a request arrives and FD_FLOW_EVENTS_MAX events are already queued for the PSM (the
+ * transport then slows the peer down). The answers are still queued, and the PSM keeps processing the events, so the
+ * reading always resumes. The released requests are requeued to fd_g_incoming as room becomes available.
+ */
+
+/* The watermarks of the p_tosend queues (which hold 5 messages at most) */
+#define FLOW_TOSEND_HIGH	4
+#define FLOW_TOSEND_LOW		1
+
+/* The number of requests kept for a throttled peer */
+#define FLOW_HELD_MAX		100
+
+static pthread_mutex_t flow_mtx = PTHREAD_MUTEX_INITIALIZER; /* Serializes the steps, protects the following data and p_flow_tosend */
+static int flow_level = 0;	/* The number of high watermarks currently reached */
+static int flow_incoming = 0;	/* How many of them are for fd_g_incoming */
+
+/* The requests of the resumed peers, moved to fd_g_incoming once flow_mtx is released (see flow_release) */
+static struct fifo * flow_resumed = NULL;
+static pthread_mutex_t flow_release_mtx = PTHREAD_MUTEX_INITIALIZER; /* Keeps the order of the released requests */
+
+/* Add the time elapsed since "since" to "total" */
+static void flow_addtime(struct timespec * total, struct timespec * since, struct timespec * now)
+{
+	long long ns = (now->tv_sec - since->tv_sec) * 1000000000LL;
+	ns += now->tv_nsec - since->tv_nsec;
+	ns += total->tv_nsec;
+	total->tv_sec += ns / 1000000000;
+	total->tv_nsec = ns % 1000000000;
+}
+
+/* Report and destroy a request that could not be requeued */
+static void flow_drop(struct msg * msg)
+{
+	fd_hook_call(HOOK_MESSAGE_DROPPED, msg, NULL, "Internal error: unable to requeue this request after the peer was resumed", fd_msg_pmdl_get(msg));
+	fd_msg_free(msg);
+}
+
+/* A high watermark was reached, throttle the noisiest peers. Called with flow_mtx locked. */
+static void flow_step_up(void)
+{
+	struct fd_list * li;
+	unsigned long sum = 0, avg;
+	int nb = 0;
+	struct timespec now;
+	
+	flow_level++;
+	
+	CHECK_SYS_DO( clock_gettime(CLOCK_REALTIME, &now), return );
+	CHECK_POSIX_DO( pthread_rwlock_rdlock(&fd_g_peers_rw), return );
+	
+	/* Average number of received messages among the peers not throttled yet */
+	for (li = fd_g_peers.next; li != &fd_g_peers; li = li->next) {
+		struct fd_peer * peer = (struct fd_peer *)li->o;
+		CHECK_POSIX_DO( pthread_mutex_lock(&peer->p_state_mtx), continue );
+		if (!peer->p_flow_paused && peer->p_flow_rcvd) {
+			sum += peer->p_flow_rcvd;
+			nb++;
+		}
+		CHECK_POSIX_DO( pthread_mutex_unlock(&peer->p_state_mtx), );
+	}
+	
+	if (nb) {
+		avg = sum / nb;
+		
+		/* Throttle the peers above this average, and start a new period for everyone */
+		for (li = fd_g_peers.next; li != &fd_g_peers; li = li->next) {
+			struct fd_peer * peer = (struct fd_peer *)li->o;
+			CHECK_POSIX_DO( pthread_mutex_lock(&peer->p_state_mtx), continue );
+			if (!peer->p_flow_paused && peer->p_flow_rcvd && (peer->p_flow_rcvd >= avg)) {
+				LOG_D("Throttling peer '%s' at level %d (%lu messages received, average %lu)", peer->p_hdr.info.pi_diamid, flow_level, peer->p_flow_rcvd, avg);
+				peer->p_flow_paused = flow_level;
+				peer->p_flow_pauses++;
+				peer->p_flow_since = now;
+			}
+			peer->p_flow_rcvd = 0;
+			CHECK_POSIX_DO( pthread_mutex_unlock(&peer->p_state_mtx), );
+		}
+	}
+	
+	CHECK_POSIX_DO( pthread_rwlock_unlock(&fd_g_peers_rw), );
+}
+
+/* A low watermark was reached, resume the peers throttled at the current level. Called with flow_mtx locked. */
+static void flow_step_down(void)
+{
+	struct fd_list * li;
+	struct timespec now;
+	
+	if (!flow_level)
+		return;
+	
+	CHECK_SYS_DO( clock_gettime(CLOCK_REALTIME, &now), return );
+	CHECK_POSIX_DO( pthread_rwlock_rdlock(&fd_g_peers_rw), return );
+	
+	for (li = fd_g_peers.next; li != &fd_g_peers; li = li->next) {
+		struct fd_peer * peer = (struct fd_peer *)li->o;
+		CHECK_POSIX_DO( pthread_mutex_lock(&peer->p_state_mtx), continue );
+		if (peer->p_flow_paused >= flow_level) {
+			struct msg * msg;
+			LOG_D("Resuming peer '%s' at level %d", peer->p_hdr.info.pi_diamid, flow_level);
+			flow_addtime(&peer->p_flow_total, &peer->p_flow_since, &now);
+			peer->p_flow_paused = 0;
+			
+			/* No request can be held anymore once the peer is resumed (same lock), release the previous ones */
+			while (fd_fifo_tryget(peer->p_flow_heldq, &msg) == 0) {
+				CHECK_FCT_DO( fd_fifo_post_noblock(flow_resumed, (void *)&msg), flow_drop(msg) );
+			}
+		}
+		CHECK_POSIX_DO( pthread_mutex_unlock(&peer->p_state_mtx), );
+	}
+	
+	CHECK_POSIX_DO( pthread_rwlock_unlock(&fd_g_peers_rw), );
+	
+	flow_level--;
+}
+
+/* Requeue the requests released by flow_step_down. Called without flow_mtx, since posting in fd_g_incoming may call flow_incoming_high.
+ This is called from the watermarks callbacks, possibly by the routing thread consuming fd_g_incoming, so we must not block:
+ we move only as many requests as fd_g_incoming has room for, the next low watermark releases the following ones. */
+static void flow_release(void)
+{
+	struct msg * msg;
+	int cur, max;
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&flow_release_mtx), return );
+	CHECK_FCT_DO( fd_fifo_getstats(fd_g_incoming, &cur, &max, NULL, NULL, NULL, NULL, NULL), goto out );
+	while (flow_resumed && (!max || (cur < max)) && (fd_fifo_tryget(flow_resumed, &msg) == 0)) {
+		CHECK_FCT_DO( fd_fifo_post_noblock(fd_g_incoming, (void *)&msg), flow_drop(msg) );
+		cur++;
+	}
+out:
+	CHECK_POSIX_DO( pthread_mutex_unlock(&flow_release_mtx), );
+}
+
+/* Watermarks callbacks of fd_g_incoming */
+static void flow_incoming_high(struct fifo * queue, void ** data)
+{
+	CHECK_POSIX_DO( pthread_mutex_lock(&flow_mtx), return );
+	flow_incoming++;
+	flow_step_up();
+	CHECK_POSIX_DO( pthread_mutex_unlock(&flow_mtx), );
+}
+
+static void flow_incoming_low(struct fifo * queue, void ** data)
+{
+	CHECK_POSIX_DO( pthread_mutex_lock(&flow_mtx), return );
+	if (flow_incoming) {
+		flow_incoming--;
+		flow_step_down();
+	}
+	CHECK_POSIX_DO( pthread_mutex_unlock(&flow_mtx), );
+	flow_release();
+}
+
+/* Watermarks callbacks of the p_tosend queues, data is the peer */
+static void flow_tosend_high(struct fifo * queue, void ** data)
+{
+	struct fd_peer * peer = *data;
+	
+	if (!fd_g_config->cnf_flow_high)
+		return;
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&flow_mtx), return );
+	peer->p_flow_tosend++;
+	flow_step_up();
+	CHECK_POSIX_DO( pthread_mutex_unlock(&flow_mtx), );
+}
+
+static void flow_tosend_low(struct fifo * queue, void ** data)
+{
+	struct fd_peer * peer = *data;
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&flow_mtx), return );
+	if (peer->p_flow_tosend) {
+		peer->p_flow_tosend--;
+		flow_step_down();
+	}
+	CHECK_POSIX_DO( pthread_mutex_unlock(&flow_mtx), );
+	flow_release();
+}
+
+/* Set the watermarks of fd_g_incoming and of the p_tosend queues of the peers already created, once the configuration is parsed */
+int fd_p_flow_init(void)
+{
+	struct fd_list * li;
+	
+	TRACE_ENTRY();
+	
+	if (!fd_g_config->cnf_flow_high)
+		return 0;
+	
+	if (!flow_resumed) {
+		CHECK_FCT( fd_fifo_new(&flow_resumed, 0) );
+	}
+	CHECK_FCT( fd_fifo_setthrhd(fd_g_incoming, NULL, fd_g_config->cnf_flow_high, flow_incoming_high, fd_g_config->cnf_flow_low, flow_incoming_low) );
+	
+	CHECK_POSIX( pthread_rwlock_rdlock(&fd_g_peers_rw) );
+	for (li = fd_g_peers.next; li != &fd_g_peers; li = li->next) {
+		struct fd_peer * peer = (struct fd_peer *)li->o;
+		CHECK_FCT_DO( fd_fifo_setthrhd(peer->p_tosend, peer, FLOW_TOSEND_HIGH, flow_tosend_high, FLOW_TOSEND_LOW, flow_tosend_low), break );
+	}
+	CHECK_POSIX( pthread_rwlock_unlock(&fd_g_peers_rw) );
+	
+	return 0;
+}
+
+/* Set the watermarks of a new peer's p_tosend queue, and create the queue of its held requests */
+int fd_p_flow_peer_init(struct fd_peer * peer)
+{
+	TRACE_ENTRY("%p", peer);
+	CHECK_FCT( fd_fifo_new(&peer->p_flow_heldq, 0) );
+	if (fd_g_config->cnf_flow_high) {
+		CHECK_FCT( fd_fifo_setthrhd(peer->p_tosend, peer, FLOW_TOSEND_HIGH, flow_tosend_high, FLOW_TOSEND_LOW, flow_tosend_low) );
+	}
+	return 0;
+}
+
+/* The peer is being destroyed, release its watermarks and drop its held requests */
+void fd_p_flow_peer_fini(struct fd_peer * peer)
+{
+	struct msg * msg;
+	
+	TRACE_ENTRY("%p", peer);
+	if (peer->p_tosend) {
+		CHECK_FCT_DO( fd_fifo_setthrhd(peer->p_tosend, NULL, 0, NULL, 0, NULL), /* continue */ );
+	}
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&flow_mtx), return );
+	while (peer->p_flow_tosend) {
+		peer->p_flow_tosend--;
+		flow_step_down();
+	}
+	CHECK_POSIX_DO( pthread_mutex_unlock(&flow_mtx), );
+	flow_release();
+	
+	if (peer->p_flow_heldq) {
+		while (fd_fifo_tryget(peer->p_flow_heldq, &msg) == 0) {
+			fd_hook_call(HOOK_MESSAGE_DROPPED, msg, peer, "Request held while the peer was throttled, the peer is destroyed.", fd_msg_pmdl_get(msg));
+			fd_msg_free(msg);
+		}
+		CHECK_FCT_DO( fd_fifo_del(&peer->p_flow_heldq), /* continue */ );
+	}
+}
+
+/* Called by the receiver thread before a message of the peer is parsed. Returns EBUSY when a request of a throttled peer
+ must go through the PSM thread instead, since holding or answering it is done there (see fd_p_flow_incoming); the
+ receiver thread waits meanwhile if the PSM has FD_FLOW_EVENTS_MAX events to process already (fd_cnx_recv_setfastpath). */
+int fd_p_flow_check(struct fd_peer * peer, struct fd_cnx_rcvdata * rcv_data)
+{
+	int ret = 0;
+	
+	/* Answers are never delayed, they complete the pending requests */
+	if ((rcv_data->length < 20) || !(rcv_data->buffer[4] & CMD_FLAG_REQUEST))
+		return 0;
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&peer->p_state_mtx), return 0 );
+	if (peer->p_flow_paused)
+		ret = EBUSY;
+	CHECK_POSIX_DO( pthread_mutex_unlock(&peer->p_state_mtx), );
+	
+	return ret;
+}
+
+/* Requeue a message received from the peer to fd_g_incoming. If the peer is throttled, its requests are held until it is resumed,
+ or answered with DIAMETER_TOO_BUSY (ThrottleTooBusy, or too many requests held already).
+ With noblock (receiver thread), the message is always posted without waiting; fd_p_flow_check was called just before. */
+int fd_p_flow_incoming(struct fd_peer * peer, struct msg ** msg, int noblock)
+{
+	struct msg_hdr * hdr;
+	int busy = 0, held = 0, ret = 0;
+	
+	CHECK_FCT( fd_msg_hdr(*msg, &hdr) );
+	
+	CHECK_POSIX( pthread_mutex_lock(&peer->p_state_mtx) );
+	peer->p_flow_rcvd++;
+	if (!noblock && peer->p_flow_paused && (hdr->msg_flags & CMD_FLAG_REQUEST)) {
+		if (!fd_g_config->cnf_flags.flow_busy && (fd_fifo_length(peer->p_flow_heldq) < FLOW_HELD_MAX)) {
+			/* flow_step_down releases it, under the same lock */
+			CHECK_FCT_DO( ret = fd_fifo_post_noblock(peer->p_flow_heldq, (void **)msg), /* handled below */ );
+			if (!ret)
+				peer->p_flow_held++;
+			held = 1;
+		} else {
+			peer->p_flow_busy++;
+			busy = 1;
+		}
+	}
+	CHECK_POSIX( pthread_mutex_unlock(&peer->p_state_mtx) );
+	
+	if (held)
+		return ret;
+	
+	if (noblock) {
+		CHECK_FCT( fd_fifo_post_noblock(fd_g_incoming, (void **)msg) );
+		return 0;
+	}
+	
+	if (!busy) {
+		CHECK_FCT( fd_fifo_post(fd_g_incoming, msg) );
+		return 0;
+	}
+	
+	/* The request was counted in p_reqin_count, fd_out_send updates it */
+	CHECK_FCT( fd_msg_new_answer_from_req ( fd_g_config->cnf_dict, msg, MSGFL_ANSW_ERROR ) );
+	CHECK_FCT( fd_msg_rescode_set(*msg, "DIAMETER_TOO_BUSY", "Too many messages received from this peer", NULL, 1 ) );
+	CHECK_FCT( fd_out_send(msg, NULL, peer, 1) );
+	
+	return 0;
+}
+
+/* Dump the flow control counters of the peer */
+DECLARE_FD_DUMP_PROTOTYPE(fd_p_flow_dump, struct fd_peer * peer)
+{
+	int paused;
+	unsigned long pauses, held, busy;
+	struct timespec total;
+	
+	FD_DUMP_HANDLE_OFFSET();
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&peer->p_state_mtx), return NULL );
+	paused = peer->p_flow_paused;
+	pauses = peer->p_flow_pauses;
+	held   = peer->p_flow_held;
+	busy   = peer->p_flow_busy;
+	total  = peer->p_flow_total;
+	CHECK_POSIX_DO( pthread_mutex_unlock(&peer->p_state_mtx), );
+	
+	if (paused) {
+		CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, " flow:THROTTLED(%d)", paused), return NULL);
+	} else {
+		CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, " flow:ok"), return NULL);
+	}
+	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, ",%lupauses,%luheld,%lubusy,%ld.%06lds", 
+				pauses, held, busy, (long)total.tv_sec, (long)(total.tv_nsec/1000)), return NULL);
+	
+	return *buf;
+}
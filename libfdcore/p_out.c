@@ -35,19 +35,15 @@
 
 #include "fdcore-internal.h"
 
-/* Alloc a new hbh for requests, bufferize the message and send on the connection, save in sentreq if provided */
-static int do_send(struct msg ** msg, struct cnxctx * cnx, uint32_t * hbh, struct fd_peer * peer)
+/* Alloc a new hbh for requests, bufferize the message and save in sentreq if provided. On success, *msg is NULL if it was saved (request) */
+static int prepare_send(struct msg ** msg, uint32_t * hbh, struct fd_peer * peer, uint8_t ** buf, size_t * sz)
 {
 	struct msg_hdr * hdr;
 	int msg_is_a_req;
-	uint8_t * buf;
-	size_t sz;
-	int ret;
+	int ret = 0;
 	uint32_t bkp_hbh = 0;
 	struct msg *cpy_for_logs_only;
 	
-	TRACE_ENTRY("%p %p %p %p", msg, cnx, hbh, peer);
-	
 	/* Retrieve the message header */
 	CHECK_FCT( fd_msg_hdr(*msg, &hdr) );
 	
@@ -61,8 +57,8 @@ static int do_send(struct msg ** msg, struct cnxctx * cnx, uint32_t * hbh, struc
 	}
 	
 	/* Create the message buffer */
-	CHECK_FCT(fd_msg_bufferize( *msg, &buf, &sz ));
-	pthread_cleanup_push( free, buf );
+	CHECK_FCT(fd_msg_bufferize( *msg, buf, sz ));
+	pthread_cleanup_push( free, *buf );
 	
 	cpy_for_logs_only = *msg;
 	
@@ -74,6 +70,25 @@ static int do_send(struct msg ** msg, struct cnxctx * cnx, uint32_t * hbh, struc
 	/* Log the message */
 	fd_hook_call(HOOK_MESSAGE_SENT, cpy_for_logs_only, peer, NULL, fd_msg_pmdl_get(cpy_for_logs_only));
 	
+out:
+	;	
+	pthread_cleanup_pop(ret ? 1 : 0);
+	
+	return ret;
+}
+
+/* Prepare the message and send it on the connection, save in sentreq if provided */
+static int do_send(struct msg ** msg, struct cnxctx * cnx, uint32_t * hbh, struct fd_peer * peer)
+{
+	uint8_t * buf;
+	size_t sz;
+	int ret;
+	
+	TRACE_ENTRY("%p %p %p %p", msg, cnx, hbh, peer);
+	
+	CHECK_FCT( prepare_send(msg, hbh, peer, &buf, &sz) );
+	pthread_cleanup_push( free, buf );
+	
 	pthread_cleanup_push((void *)fd_msg_free, *msg /* might be NULL, no problem */);
 	
 	/* Send the message */
@@ -81,8 +96,6 @@ static int do_send(struct msg ** msg, struct cnxctx * cnx, uint32_t * hbh, struc
 	
 	pthread_cleanup_pop(0);
 	
-out:
-	;	
 	pthread_cleanup_pop(1);
 	
 	if (ret)
@@ -97,6 +110,37 @@ out:
 	return 0;
 }
 
+/* The messages the out thread sends together */
+struct out_batch {
+	int		 count;
+	struct msg	*msgs[FD_CNX_SEND_BATCH];	/* answers, freed after sending. NULL for requests, saved in sentreq */
+	uint8_t		*bufs[FD_CNX_SEND_BATCH];
+	size_t		 lens[FD_CNX_SEND_BATCH];
+};
+
+static void out_batch_cleanup(void * arg)
+{
+	struct out_batch * b = arg;
+	int i;
+	
+	for (i = 0; i < b->count; i++) {
+		free(b->bufs[i]);
+		if (b->msgs[i]) {
+			CHECK_FCT_DO( fd_msg_free(b->msgs[i]), /* continue */ );
+		}
+	}
+	b->count = 0;
+}
+
+/* Log and destroy a message that could not be sent */
+static void out_drop(struct msg * msg, int err)
+{
+	char buf[256];
+	snprintf(buf, sizeof(buf), "Error while sending this message: %s", strerror(err));
+	fd_hook_call(HOOK_MESSAGE_DROPPED, msg, NULL, buf, fd_msg_pmdl_get(msg));
+	fd_msg_free(msg);
+}
+
 /* The code of the "out" thread */
 static void * out_thr(void * arg)
 {
@@ -114,23 +158,45 @@ static void * out_thr(void * arg)
 	
 	/* Loop until cancelation */
 	while (!stop) {
-		int ret;
+		struct out_batch b;
+		int ret, i;
 		
 		/* Retrieve next message to send */
 		CHECK_FCT_DO( fd_fifo_get(peer->p_tosend, &msg), goto error );
 		
-		/* Send the message, log any error */
-		CHECK_FCT_DO( ret = do_send(&msg, peer->p_cnxctx, &peer->p_hbh, peer),
-			{
-				if (msg) {
-					char buf[256];
-					snprintf(buf, sizeof(buf), "Error while sending this message: %s", strerror(ret));
-					fd_hook_call(HOOK_MESSAGE_DROPPED, msg, NULL, buf, fd_msg_pmdl_get(msg));
-					fd_msg_free(msg);
-				}
-				stop = 1;
-			} );
-			
+		memset(&b, 0, sizeof(b));
+		pthread_cleanup_push(out_batch_cleanup, &b);
+		
+		/* Prepare it, and the messages already waiting behind it, to send them all at once */
+		do {
+			CHECK_FCT_DO( ret = prepare_send(&msg, &peer->p_hbh, peer, &b.bufs[b.count], &b.lens[b.count]),
+				{
+					if (msg)
+						out_drop(msg, ret);
+					stop = 1;
+					break;
+				} );
+			b.msgs[b.count++] = msg;
+			msg = NULL;
+		} while ((b.count < FD_CNX_SEND_BATCH) && (fd_fifo_tryget(peer->p_tosend, &msg) == 0));
+		
+		/* Send the messages, log any error on those that were not sent */
+		if (b.count) {
+			int sent = 0;
+			CHECK_FCT_DO( ret = fd_cnx_send_batch(peer->p_cnxctx, b.bufs, b.lens, b.count, &sent),
+				{
+					for (i = sent; i < b.count; i++) {
+						if (b.msgs[i]) {
+							out_drop(b.msgs[i], ret);
+							b.msgs[i] = NULL;
+						}
+					}
+					stop = 1;
+				} );
+		}
+		
+		/* Free the buffers and the answers that were sent */
+		pthread_cleanup_pop(1);
 	}
 	
 	/* If we're here it means there was an error on the socket. We need to continue to purge the fifo & until we are canceled */
@@ -225,12 +225,13 @@ static int leave_open_state(struct fd_peer * peer, int skip_failover)
 /* Cleanup pending events in the peer */
 void fd_psm_events_free(struct fd_peer * peer)
 {
-	struct fd_event * ev;
+	int code;
+	void * data;
 	/* Purge all events, and free the associated data if any */
-	while (fd_fifo_tryget( peer->p_events, &ev ) == 0) {
-		switch (ev->code) {
+	while (fd_fifo_tryget_tagged( peer->p_events, &code, NULL, &data ) == 0) {
+		switch (code) {
 			case FDEVP_CNX_ESTABLISHED: {
-				fd_cnx_destroy(ev->data);
+				fd_cnx_destroy(data);
 			}
 			break;
 			
@@ -239,15 +240,14 @@ void fd_psm_events_free(struct fd_peer * peer)
 			break;
 			
 			case FDEVP_CNX_INCOMING: {
-				struct cnx_incoming * evd = ev->data;
+				struct cnx_incoming * evd = data;
 				fd_hook_call(HOOK_MESSAGE_DROPPED, evd->cer, NULL, "Message discarded while cleaning peer state machine queue.", fd_msg_pmdl_get(evd->cer));
 				CHECK_FCT_DO( fd_msg_free(evd->cer), /* continue */);
 				fd_cnx_destroy(evd->cnx);
 			}
 			default:
-				free(ev->data);
+				free(data);
 		}
-		free(ev);
 	}
 }
 
@@ -291,6 +291,9 @@ int fd_psm_change_state(struct fd_peer * peer, int new_state)
 	peer->p_state = new_state;
 	CHECK_POSIX( pthread_mutex_unlock(&peer->p_state_mtx) );
 	
+	/* The saved routing decisions may not be valid anymore */
+	fd_rtdisp_cache_invalidate();
+	
 	if (old == STATE_OPEN) {
 		CHECK_FCT( leave_open_state(peer, new_state == STATE_CLOSING_GRACE) );
 	}
@@ -349,6 +352,106 @@ void fd_psm_next_timeout(struct fd_peer * peer, int add_random, int delay)
 #endif
 }
 
+/* Receive a routable message in the receiver thread when the peer is OPEN (called through fd_cnx_recv_deliver).
+ This does the same as the FDEVP_CNX_MSG_RECV processing in p_psm_th below, without the event and the PSM thread.
+ Returns EAGAIN when the message must go through the PSM instead: link-local messages, other states, parsing errors,
+ and when delivering it here would block (the receiver thread cannot be canceled during this call); EBUSY for the
+ requests of a throttled peer (see p_flow.c). */
+int fd_psm_fastpath(void * data, struct fd_cnx_rcvdata * rcv_data)
+{
+	struct fd_peer * peer = (struct fd_peer *)data;
+	struct msg * msg = NULL;
+	struct msg_hdr * hdr;
+	struct fd_msg_pmdl * pmdl;
+	uint8_t * buf = rcv_data->buffer;
+	uint32_t appl;
+	int cur, max;
+
+	CHECK_PARAMS_DO( CHECK_PEER(peer), return EAGAIN );
+
+	/* Only routable messages, see fd_msg_is_routable; the CER / DWR / DPR exchanges stay in the PSM */
+	if (rcv_data->length < 20)
+		return EAGAIN;
+	memcpy(&appl, buf + 8, sizeof(appl));
+	if ((ntohl(appl) == 0) && !(buf[4] & CMD_FLAG_PROXIABLE))
+		return EAGAIN;
+
+	if (fd_peer_getstate(peer) != STATE_OPEN)
+		return EAGAIN;
+
+	/* The PSM thread holds or answers the requests while the peer is throttled, see p_flow.c */
+	if (fd_p_flow_check(peer, rcv_data))
+		return EBUSY;
+
+	/* Keep the order of the messages already sent to the PSM thread, and let it wait when fd_g_incoming is full */
+	if (fd_fifo_length(peer->p_events) > 0)
+		return EAGAIN;
+	CHECK_FCT_DO( fd_fifo_getstats(fd_g_incoming, &cur, &max, NULL, NULL, NULL, NULL, NULL), return EAGAIN );
+	if (max && (cur >= max))
+		return EAGAIN;
+
+	/* Parse the received buffer, the PSM reports the errors */
+	pmdl = fd_msg_pmdl_get_inbuf(rcv_data->buffer, rcv_data->length);
+	if (fd_msg_parse_buffer( &buf, rcv_data->length, &msg ))
+		return EAGAIN;
+
+	/* From now on, the buffer belongs to the message */
+	fd_hook_associate(msg, pmdl);
+	CHECK_FCT_DO( fd_msg_source_set( msg, peer->p_hdr.info.pi_diamid, peer->p_hdr.info.pi_diamidlen), goto error );
+	CHECK_FCT_DO( fd_msg_hdr(msg, &hdr), goto error );
+
+	/* If it is an answer, associate with the request or drop */
+	if (!(hdr->msg_flags & CMD_FLAG_REQUEST)) {
+		struct msg * req;
+		CHECK_FCT_DO( fd_p_sr_fetch(&peer->p_sr, hdr->msg_hbhid, &req), goto error );
+		if (req == NULL) {
+			fd_hook_call(HOOK_MESSAGE_DROPPED, msg, peer, "Answer received with no corresponding sent request.", fd_msg_pmdl_get(msg));
+			fd_msg_free(msg);
+			return 0;
+		}
+		CHECK_FCT_DO( fd_msg_answ_associate( msg, req ), goto error );
+	}
+
+	fd_hook_call(HOOK_MESSAGE_RECEIVED, msg, peer, NULL, fd_msg_pmdl_get(msg));
+
+	CHECK_FCT_DO( fd_p_expi_update(peer), goto error );
+	CHECK_FCT_DO( fd_msg_source_setrr( msg, peer->p_hdr.info.pi_diamid, peer->p_hdr.info.pi_diamidlen, fd_g_config->cnf_dict ), goto error );
+
+	/* Count the message for the watchdog, and the pending requests */
+	CHECK_POSIX_DO( pthread_mutex_lock(&peer->p_state_mtx), goto error );
+	peer->p_fastrcv_count++;
+	if (hdr->msg_flags & CMD_FLAG_REQUEST)
+		peer->p_reqin_count++;
+	CHECK_POSIX_DO( pthread_mutex_unlock(&peer->p_state_mtx), goto error );
+
+	/* Requeue to the global incoming queue; it was not full above, so it only exceeds its limit by the concurrent receiver threads */
+	CHECK_FCT_DO( fd_p_flow_incoming(peer, &msg, 1), goto error );
+
+	return 0;
+
+error:
+	/* Same situations that terminate the PSM; here we drop the message and let the PSM reset the connection */
+	fd_hook_call(HOOK_MESSAGE_DROPPED, msg, peer, "Internal error while receiving the message, resetting the connection.", fd_msg_pmdl_get(msg));
+	fd_msg_free(msg);
+	CHECK_FCT_DO( fd_event_send(peer->p_events, FDEVP_CNX_ERROR, 0, NULL), );
+	return 0;
+}
+
+/* Check if the fast path received messages since the previous watchdog timeout */
+static int fastrcv_since_timeout(struct fd_peer * peer)
+{
+	unsigned long cnt;
+	int ret;
+
+	CHECK_POSIX_DO( pthread_mutex_lock(&peer->p_state_mtx), return 0 );
+	cnt = peer->p_fastrcv_count;
+	CHECK_POSIX_DO( pthread_mutex_unlock(&peer->p_state_mtx), return 0 );
+
+	ret = (cnt != peer->p_fastrcv_seen);
+	peer->p_fastrcv_seen = cnt;
+	return ret;
+}
+
 /* Cleanup the peer */
 void fd_psm_cleanup(struct fd_peer * peer, int terminate)
 {
@@ -562,7 +665,7 @@ psm_loop:
 					}
 						
 					/* Requeue to the global incoming queue */
-					CHECK_FCT_DO(fd_fifo_post(fd_g_incoming, &msg), goto psm_end );
+					CHECK_FCT_DO(fd_p_flow_incoming(peer, &msg, 0), goto psm_end );
 
 					/* Update the peer timer (only in OPEN state) */
 					if ((cur_state == STATE_OPEN) && (!peer->p_flags.pf_dw_pending)) {
@@ -831,6 +934,12 @@ psm_loop:
 	if (event == FDEVP_PSM_TIMEOUT) {
 		switch (cur_state) {
 			case STATE_OPEN:
+				/* The messages received by fd_psm_fastpath do not reset the timer, check them now */
+				if (!peer->p_flags.pf_dw_pending && fastrcv_since_timeout(peer)) {
+					fd_psm_next_timeout(peer, 1, peer->p_hdr.info.config.pic_twtimer ?: fd_g_config->cnf_timer_tw);
+					goto psm_loop;
+				}
+				/* Otherwise, same as the other states */
 			case STATE_REOPEN:
 			case STATE_OPEN_NEW:
 				CHECK_FCT_DO( fd_p_dw_timeout(peer), goto psm_end );
@@ -35,6 +35,9 @@
 
 #include "fdcore-internal.h"
 
+/* Weight of the samples in the moving average of answers delay (as for TCP's SRTT) */
+#define SR_DELAY_AVG_W	8
+
 /* Structure to store a sent request */
 struct sentreq {
 	struct fd_list	chain; 	/* the "o" field points directly to the (new) hop-by-hop of the request (uint32_t *)  */
@@ -290,6 +293,20 @@ int fd_p_sr_fetch(struct sr_list * srlist, uint32_t hbh, struct msg **req)
 		srlist->cnt--;
 		fd_list_unlink(&sr->expire);
 		*req = sr->req;
+		
+		/* Update the average answer delay (weight of the new sample: 1/SR_DELAY_AVG_W) */
+		{
+			struct timespec now;
+			long delay;
+			CHECK_SYS_DO(  clock_gettime(CLOCK_REALTIME, &now), now = sr->added_on  );
+			delay = (now.tv_sec - sr->added_on.tv_sec) * 1000000L + (now.tv_nsec - sr->added_on.tv_nsec) / 1000;
+			if (delay < 1)
+				delay = 1;
+			if (srlist->delay_avg)
+				srlist->delay_avg += (delay - srlist->delay_avg) / SR_DELAY_AVG_W;
+			else
+				srlist->delay_avg = delay;
+		}
 		free(sr);
 	}
 	CHECK_POSIX( pthread_mutex_unlock(&srlist->mtx) );
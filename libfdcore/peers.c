@@ -77,6 +77,7 @@ int fd_peer_alloc(struct fd_peer ** ptr)
 	fd_list_init(&p->p_actives, p);
 	fd_list_init(&p->p_expiry, p);
 	CHECK_FCT( fd_fifo_new(&p->p_tosend, 5) );
+	CHECK_FCT( fd_p_flow_peer_init(p) );
 	CHECK_FCT( fd_fifo_new(&p->p_tofailover, 0) );
 	p->p_hbh = lrand48();
 	
@@ -315,6 +316,20 @@ int fd_peer_get_load_pending(struct peer_hdr *peer, long * to_receive, long * to
 	return 0;
 }
 
+/* Return the average delay of the answers received from a peer */
+int fd_peer_get_answer_delay(struct peer_hdr *peer, long * delay_us)
+{
+	struct fd_peer * p = (struct fd_peer *)peer;
+	TRACE_ENTRY("%p %p", peer, delay_us);
+	CHECK_PARAMS(CHECK_PEER(peer) && delay_us);
+	
+	CHECK_POSIX( pthread_mutex_lock(&p->p_sr.mtx) );
+	*delay_us = p->p_sr.delay_avg;
+	CHECK_POSIX( pthread_mutex_unlock(&p->p_sr.mtx) );
+	
+	return 0;
+}
+
 
 /* Destroy a structure once cleanups have been performed (fd_psm_abord, ...) */
 int fd_peer_free(struct fd_peer ** ptr)
@@ -342,9 +357,12 @@ int fd_peer_free(struct fd_peer ** ptr)
 	
 	free_null(p->p_dbgorig);
 	
+	gnutls_free(p->p_tls_session.data);
+	
 	fd_list_unlink(&p->p_expiry);
 	fd_list_unlink(&p->p_actives);
 	
+	fd_p_flow_peer_fini(p);
 	CHECK_FCT_DO( fd_fifo_del(&p->p_tosend), /* continue */ );
 	CHECK_FCT_DO( fd_fifo_del(&p->p_tofailover), /* continue */ );
 	CHECK_POSIX_DO( pthread_mutex_destroy(&p->p_state_mtx), /* continue */);
@@ -466,6 +484,12 @@ DECLARE_FD_DUMP_PROTOTYPE(fd_peer_dump, struct peer_hdr * p, int details)
 			if (peer->p_hdr.info.runtime.pir_prodname) {
 				CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, " ['%s' %u]", peer->p_hdr.info.runtime.pir_prodname, peer->p_hdr.info.runtime.pir_firmrev), return NULL);
 			}
+			if (peer->p_tls_full || peer->p_tls_resumed) {
+				CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, " tls:%lufull,%luresumed", peer->p_tls_full, peer->p_tls_resumed), return NULL);
+			}
+			if (peer->p_flow_pauses) {
+				CHECK_MALLOC_DO( fd_p_flow_dump( FD_DUMP_STD_PARAMS, peer ), return NULL);
+			}
 		}
 		if (details > 1) {
 			CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, " [from:%s] flags:%s%s%s%s%s%s%s%s lft:%ds", 
@@ -481,6 +505,9 @@ DECLARE_FD_DUMP_PROTOTYPE(fd_peer_dump, struct peer_hdr * p, int details)
 				peer->p_hdr.info.config.pic_flags.exp ? "E" : "-",
 				peer->p_hdr.info.config.pic_flags.persist ? "P" : "-",
 				peer->p_hdr.info.config.pic_lft), return NULL);
+			if (peer->p_cnxctx) {
+				CHECK_MALLOC_DO( fd_cnx_dump_streams(FD_DUMP_STD_PARAMS, peer->p_cnxctx), return NULL);
+			}
 		}
 	
 	}
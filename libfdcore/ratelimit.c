@@ -0,0 +1,436 @@
+/*********************************************************************************************************
+* Software License Agreement (BSD License)                                                               *
+* Author: Sebastien Decugis <sdecugis@freediameter.net>							 *
+*													 *
+* Copyright (c) 2013, WIDE Project and NICT								 *
+* All rights reserved.											 *
+* 													 *
+* Redistribution and use of this software in source and binary forms, with or without modification, are  *
+* permitted provided that the following conditions are met:						 *
+* 													 *
+* * Redistributions of source code must retain the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer.										 *
+*    													 *
+* * Redistributions in binary form must reproduce the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer in the documentation and/or other						 *
+*   materials provided with the distribution.								 *
+* 													 *
+* * Neither the name of the WIDE Project or NICT nor the 						 *
+*   names of its contributors may be used to endorse or 						 *
+*   promote products derived from this software without 						 *
+*   specific prior written permission of WIDE Project and 						 *
+*   NICT.												 *
+* 													 *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED *
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A *
+* PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR *
+* ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 	 *
+* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 	 *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR *
+* TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF   *
+* ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.								 *
+*********************************************************************************************************/
+
+#include "fdcore-internal.h"
+
+/* Rate limiting of the routed requests.
+ *
+ * The limits are token buckets set in the configuration file (RateLimitIn / RateLimitOut), for a peer, a realm
+ * (the Destination-Realm of the request) or an application. RateLimitIn limits are checked by msg_rt_in() on the
+ * requests received from the peers, RateLimitOut limits by msg_rt_out() on the requests we send (locally issued or
+ * relayed). When no token is available, the request is answered with DIAMETER_TOO_BUSY at once: the checks run in
+ * the routing threads, which must not wait.
+ *
+ * The list of limits is only modified while the configuration is parsed, it is read without lock afterwards.
+ * Each bucket is shared by all the threads, but a thread takes its tokens by chunks and keeps them in its own
+ * cache (pthread key) for up to RTLIM_LOCAL_TTL, so most messages only touch thread local data. The shared bucket
+ * is refilled lazily with atomic operations, there is no timer.
+ */
+
+#define RTLIM_LOCAL_TTL	100000	/* us: tokens cached by a thread and not used after this delay are given back */
+#define RTLIM_CHUNK	10	/* ms: a thread takes this much worth of tokens at once from the shared bucket */
+
+enum rtlim_kind {
+	RTLIM_PEER = 0,
+	RTLIM_REALM,
+	RTLIM_APP,
+	RTLIM_KIND_MAX
+};
+static const char * rtlim_kind_str[] = { "peer", "realm", "app" };
+
+struct rtlim {
+	struct fd_list	chain;		/* link in rtlim_list */
+	int		out;		/* 0: received requests (RateLimitIn), 1: sent requests (RateLimitOut) */
+	enum rtlim_kind	kind;
+	uint8_t *	key;		/* Diameter-Id of the peer or realm name */
+	size_t		keylen;
+	application_id_t appid;		/* for RTLIM_APP */
+	uint32_t	rate;		/* tokens per second */
+	uint32_t	burst;		/* size of the bucket */
+	int64_t		chunk;		/* tokens taken at once by a thread */
+	int		idx;		/* index in the per-thread caches */
+	
+	/* The shared bucket, only accessed with atomic operations */
+	int64_t		tokens;
+	int64_t		last;		/* time of the last refill, in us */
+	
+	/* Statistics */
+	unsigned long long passed;
+	unsigned long long rejected;
+};
+
+/* Per-thread cache of the tokens of one limit */
+struct rtlim_local {
+	int64_t		tokens;
+	int64_t		since;
+};
+
+static struct fd_list	rtlim_list = FD_LIST_INITIALIZER(rtlim_list);
+static int		rtlim_nb = 0;
+static int		rtlim_has[2][RTLIM_KIND_MAX];	/* number of limits for each direction and kind */
+static pthread_key_t	rtlim_key;
+static int		rtlim_key_ok = 0;
+
+/* Add a limit, called by the configuration parser */
+int fd_rtlim_add(int out, char * kind, char * key, int rate, int burst)
+{
+	struct rtlim * new;
+	enum rtlim_kind k;
+	
+	TRACE_ENTRY("%d %p %p %d %d", out, kind, key, rate, burst);
+	CHECK_PARAMS( kind && key && (rate > 0) && (burst >= 0) );
+	
+	for (k = 0; k < RTLIM_KIND_MAX; k++) {
+		if (!strcasecmp(kind, rtlim_kind_str[k]))
+			break;
+	}
+	CHECK_PARAMS( k < RTLIM_KIND_MAX );
+	
+	CHECK_MALLOC( new = malloc(sizeof(struct rtlim)) );
+	memset(new, 0, sizeof(struct rtlim));
+	fd_list_init(&new->chain, new);
+	new->out = out ? 1 : 0;
+	new->kind = k;
+	if (k == RTLIM_APP) {
+		char * end;
+		new->appid = (application_id_t) strtoul(key, &end, 0);
+		CHECK_PARAMS_DO( *key && !*end, { free(new); return EINVAL; } );
+	} else {
+		CHECK_MALLOC_DO( new->key = (uint8_t *)os0dup(key, strlen(key)), { free(new); return ENOMEM; } );
+		new->keylen = strlen(key);
+	}
+	new->rate = rate;
+	new->burst = burst ?: rate;
+	new->idx = rtlim_nb++;
+	
+	fd_list_insert_before(&rtlim_list, &new->chain);
+	rtlim_has[new->out][k]++;
+	return 0;
+}
+
+/* Current time in us */
+static int64_t rtlim_now(void)
+{
+	struct timespec ts;
+	CHECK_SYS_DO( clock_gettime(CLOCK_MONOTONIC, &ts), return 0 );
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void rtlim_local_destroy(void * data)
+{
+	free(data);
+}
+
+int fd_rtlim_init(void)
+{
+	struct fd_list * li;
+	int64_t now;
+	
+	TRACE_ENTRY();
+	if (!rtlim_nb)
+		return 0;
+	
+	CHECK_POSIX( pthread_key_create(&rtlim_key, rtlim_local_destroy) );
+	rtlim_key_ok = 1;
+	
+	now = rtlim_now();
+	for (li = rtlim_list.next; li != &rtlim_list; li = li->next) {
+		struct rtlim * l = (struct rtlim *)li;
+		l->chunk = (int64_t)l->rate * RTLIM_CHUNK / 1000;
+		if (l->chunk > l->burst)
+			l->chunk = l->burst;
+		if (l->chunk < 1)
+			l->chunk = 1;
+		l->tokens = l->burst;
+		l->last = now;
+	}
+	return 0;
+}
+
+int fd_rtlim_fini(void)
+{
+	TRACE_ENTRY();
+	if (rtlim_key_ok) {
+		CHECK_POSIX_DO( pthread_key_delete(rtlim_key), /* continue */ );
+		rtlim_key_ok = 0;
+	}
+	while (!FD_IS_LIST_EMPTY(&rtlim_list)) {
+		struct rtlim * l = (struct rtlim *)rtlim_list.next;
+		fd_list_unlink(&l->chain);
+		free(l->key);
+		free(l);
+	}
+	memset(rtlim_has, 0, sizeof(rtlim_has));
+	rtlim_nb = 0;
+	return 0;
+}
+
+/* The token caches of the calling thread */
+static struct rtlim_local * rtlim_local(void)
+{
+	struct rtlim_local * loc = pthread_getspecific(rtlim_key);
+	if (!loc) {
+		CHECK_MALLOC_DO( loc = calloc(rtlim_nb, sizeof(struct rtlim_local)), return NULL );
+		CHECK_POSIX_DO( pthread_setspecific(rtlim_key, loc), { free(loc); return NULL; } );
+	}
+	return loc;
+}
+
+/* Add the tokens earned since the last refill to the shared bucket */
+static void rtlim_refill(struct rtlim * l, int64_t now)
+{
+	int64_t last = __atomic_load_n(&l->last, __ATOMIC_ACQUIRE);
+	int64_t add, cur, n;
+	
+	add = (now - last) * l->rate / 1000000;
+	if (add <= 0)
+		return;
+	
+	/* Only the thread which moves "last" adds the tokens; the remainder of the division is kept for the next refill */
+	if (!__atomic_compare_exchange_n(&l->last, &last, last + add * 1000000 / l->rate, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		return;
+	
+	cur = __atomic_load_n(&l->tokens, __ATOMIC_RELAXED);
+	do {
+		n = cur + add;
+		if (n > l->burst)
+			n = l->burst;
+		if (n <= cur)
+			return;
+	} while (!__atomic_compare_exchange_n(&l->tokens, &cur, n, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+}
+
+/* Take one token of the limit. Returns 1 on success, 0 if the bucket is empty */
+static int rtlim_take(struct rtlim * l, struct rtlim_local * loc, int64_t now)
+{
+	struct rtlim_local * b = &loc[l->idx];
+	int64_t cur, take;
+	
+	/* Fast path: use a token already cached by this thread */
+	if (b->tokens > 0) {
+		if (now - b->since < RTLIM_LOCAL_TTL) {
+			b->tokens--;
+			return 1;
+		}
+		/* These tokens are too old, give them back to the other threads */
+		__atomic_add_fetch(&l->tokens, b->tokens, __ATOMIC_RELAXED);
+		b->tokens = 0;
+	}
+	
+	rtlim_refill(l, now);
+	
+	/* Take a chunk from the shared bucket */
+	cur = __atomic_load_n(&l->tokens, __ATOMIC_RELAXED);
+	do {
+		if (cur <= 0)
+			return 0;
+		take = (cur < l->chunk) ? cur : l->chunk;
+	} while (!__atomic_compare_exchange_n(&l->tokens, &cur, cur - take, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+	
+	b->tokens = take - 1;
+	b->since = now;
+	return 1;
+}
+
+/* Give back a token taken by rtlim_take. If the tokens cached by this thread expired meanwhile, they all go back to the shared bucket */
+static void rtlim_giveback(struct rtlim * l, struct rtlim_local * loc, int64_t now)
+{
+	struct rtlim_local * b = &loc[l->idx];
+	
+	if (now - b->since < RTLIM_LOCAL_TTL) {
+		b->tokens++;
+		return;
+	}
+	__atomic_add_fetch(&l->tokens, b->tokens + 1, __ATOMIC_RELAXED);
+	b->tokens = 0;
+}
+
+/* Find the limit matching a key, NULL if there is none */
+static struct rtlim * rtlim_find(int out, enum rtlim_kind kind, uint8_t * key, size_t keylen, application_id_t appid)
+{
+	struct fd_list * li;
+	
+	if (!rtlim_has[out][kind])
+		return NULL;
+	
+	for (li = rtlim_list.next; li != &rtlim_list; li = li->next) {
+		struct rtlim * l = (struct rtlim *)li;
+		if ((l->out != out) || (l->kind != kind))
+			continue;
+		if (kind == RTLIM_APP) {
+			if (l->appid == appid)
+				return l;
+		} else if (key && !fd_os_almostcasesrch(key, keylen, l->key, l->keylen, NULL)) {
+			return l;
+		}
+	}
+	return NULL;
+}
+
+/* Take a token in each of the limits. Returns 0, or EBUSY as soon as one is empty */
+static int rtlim_apply(struct rtlim ** lims, int nb)
+{
+	struct rtlim_local * loc;
+	int64_t now;
+	int i, j;
+	
+	/* On internal error, let the message pass */
+	CHECK_MALLOC_DO( loc = rtlim_local(), return 0 );
+	
+	now = rtlim_now();
+	for (i = 0; i < nb; i++) {
+		if (!rtlim_take(lims[i], loc, now)) {
+			/* Reject, and give back the tokens already taken for this message */
+			for (j = 0; j < i; j++)
+				rtlim_giveback(lims[j], loc, now);
+			__atomic_add_fetch(&lims[i]->rejected, 1, __ATOMIC_RELAXED);
+			return EBUSY;
+		}
+	}
+	
+	for (i = 0; i < nb; i++)
+		__atomic_add_fetch(&lims[i]->passed, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Check a request received from a peer, in msg_rt_in. Returns 0 or EBUSY */
+int fd_rtlim_in(struct msg * msg, union avp_value * dr, application_id_t appid)
+{
+	struct rtlim * lims[RTLIM_KIND_MAX];
+	int nb = 0;
+	
+	if (!rtlim_nb)
+		return 0;
+	
+	if (rtlim_has[0][RTLIM_PEER]) {
+		DiamId_t src = NULL;
+		size_t srclen = 0;
+		CHECK_FCT_DO( fd_msg_source_get( msg, &src, &srclen ), /* continue */ );
+		if (src && ((lims[nb] = rtlim_find(0, RTLIM_PEER, (uint8_t *)src, srclen, 0)) != NULL))
+			nb++;
+	}
+	if (dr && ((lims[nb] = rtlim_find(0, RTLIM_REALM, dr->os.data, dr->os.len, 0)) != NULL))
+		nb++;
+	if ((lims[nb] = rtlim_find(0, RTLIM_APP, NULL, 0, appid)) != NULL)
+		nb++;
+	
+	return nb ? rtlim_apply(lims, nb) : 0;
+}
+
+/* Check a new request before it is sent, in msg_rt_out. The peer limits are checked later with fd_rtlim_out_peer. */
+int fd_rtlim_out(struct msg * msg, application_id_t appid)
+{
+	struct rtlim * lims[RTLIM_KIND_MAX];
+	int nb = 0;
+	
+	if (!rtlim_nb)
+		return 0;
+	
+	if (rtlim_has[1][RTLIM_REALM]) {
+		struct avp * avp;
+		CHECK_FCT_DO( fd_msg_browse(msg, MSG_BRW_FIRST_CHILD, &avp, NULL), avp = NULL );
+		while (avp) {
+			struct avp_hdr * ahdr;
+			CHECK_FCT_DO( fd_msg_avp_hdr( avp, &ahdr ), break );
+			if ((ahdr->avp_code == AC_DESTINATION_REALM) && (! (ahdr->avp_flags & AVP_FLAG_VENDOR))) {
+				if (!ahdr->avp_value) {
+					CHECK_FCT_DO( fd_msg_parse_dict( avp, fd_g_config->cnf_dict, NULL ), break );
+				}
+				if ((lims[nb] = rtlim_find(1, RTLIM_REALM, ahdr->avp_value->os.data, ahdr->avp_value->os.len, 0)) != NULL)
+					nb++;
+				break;
+			}
+			CHECK_FCT_DO( fd_msg_browse(avp, MSG_BRW_NEXT, &avp, NULL), break );
+		}
+	}
+	if ((lims[nb] = rtlim_find(1, RTLIM_APP, NULL, 0, appid)) != NULL)
+		nb++;
+	
+	return nb ? rtlim_apply(lims, nb) : 0;
+}
+
+/* Take a token for sending a request to this peer. Does not wait, the routing tries the next candidate instead. */
+int fd_rtlim_out_peer(struct fd_peer * peer)
+{
+	struct rtlim * l;
+	struct rtlim_local * loc;
+	
+	if (!rtlim_has[1][RTLIM_PEER])
+		return 0;
+	
+	l = rtlim_find(1, RTLIM_PEER, (uint8_t *)peer->p_hdr.info.pi_diamid, peer->p_hdr.info.pi_diamidlen, 0);
+	if (!l)
+		return 0;
+	CHECK_MALLOC_DO( loc = rtlim_local(), return 0 );
+	
+	if (!rtlim_take(l, loc, rtlim_now())) {
+		__atomic_add_fetch(&l->rejected, 1, __ATOMIC_RELAXED);
+		return EBUSY;
+	}
+	__atomic_add_fetch(&l->passed, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* The request could not be sent to the peer after all, give its token back */
+void fd_rtlim_out_peer_cancel(struct fd_peer * peer)
+{
+	struct rtlim * l;
+	struct rtlim_local * loc;
+	
+	if (!rtlim_has[1][RTLIM_PEER])
+		return;
+	
+	l = rtlim_find(1, RTLIM_PEER, (uint8_t *)peer->p_hdr.info.pi_diamid, peer->p_hdr.info.pi_diamidlen, 0);
+	if (!l)
+		return;
+	CHECK_MALLOC_DO( loc = rtlim_local(), return );
+	rtlim_giveback(l, loc, rtlim_now());
+	__atomic_sub_fetch(&l->passed, 1, __ATOMIC_RELAXED);
+}
+
+/* Dump the limits and their counters */
+DECLARE_FD_DUMP_PROTOTYPE(fd_rt_limits_dump)
+{
+	struct fd_list * li;
+	
+	FD_DUMP_HANDLE_OFFSET();
+	
+	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "{rate limits}(@%p): %d", &rtlim_list, rtlim_nb), return NULL);
+	for (li = rtlim_list.next; li != &rtlim_list; li = li->next) {
+		struct rtlim * l = (struct rtlim *)li;
+		CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "\n  %s %s ", l->out ? "out" : "in", rtlim_kind_str[l->kind]), return NULL);
+		if (l->kind == RTLIM_APP) {
+			CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "%u", l->appid), return NULL);
+		} else {
+			CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "'%.*s'", (int)l->keylen, l->key), return NULL);
+		}
+		CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, ": %u/s burst:%u tokens:%lld passed:%llu rejected:%llu",
+				l->rate, l->burst, (long long)__atomic_load_n(&l->tokens, __ATOMIC_RELAXED),
+				__atomic_load_n(&l->passed, __ATOMIC_RELAXED),
+				__atomic_load_n(&l->rejected, __ATOMIC_RELAXED)), return NULL);
+	}
+	
+	return *buf;
+}
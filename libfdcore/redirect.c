@@ -0,0 +1,457 @@
+/*********************************************************************************************************
+* Software License Agreement (BSD License)                                                               *
+* Author: Sebastien Decugis <sdecugis@freediameter.net>							 *
+*													 *
+* Copyright (c) 2013, WIDE Project and NICT								 *
+* All rights reserved.											 *
+* 													 *
+* Redistribution and use of this software in source and binary forms, with or without modification, are  *
+* permitted provided that the following conditions are met:						 *
+* 													 *
+* * Redistributions of source code must retain the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer.										 *
+*    													 *
+* * Redistributions in binary form must reproduce the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer in the documentation and/or other						 *
+*   materials provided with the distribution.								 *
+* 													 *
+* * Neither the name of the WIDE Project or NICT nor the 						 *
+*   names of its contributors may be used to endorse or 						 *
+*   promote products derived from this software without 						 *
+*   specific prior written permission of WIDE Project and 						 *
+*   NICT.												 *
+* 													 *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED *
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A *
+* PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR *
+* ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 	 *
+* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 	 *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR *
+* TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF   *
+* ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.								 *
+*********************************************************************************************************/
+
+
+/* Redirect answers cache.
+ *
+ * When a DIAMETER_REDIRECT_INDICATION answer passes through the routing-in process (for a request issued
+ * locally or relayed), the Redirect-Host values are saved with the scope given by the Redirect-Host-Usage AVP
+ * (RFC 6733, section 6.13) for Redirect-Max-Cache-Time seconds. The routing-out process then consults this cache
+ * before the OUT callbacks are called, so that next requests in the same scope are sent directly to the
+ * redirected hosts instead of going through the redirect agent again.
+ */
+
+#include "fdcore-internal.h"
+#include <ctype.h>
+
+/* The values of Redirect-Host-Usage AVP */
+enum redir_h_u {
+	DONT_CACHE = 0,
+	ALL_SESSION,
+	ALL_REALM,
+	REALM_AND_APPLICATION,
+	ALL_APPLICATION,
+	ALL_HOST,
+	ALL_USER
+};
+#define H_U_MAX	ALL_USER
+
+/* The scores given to the Redirect-Host targets, by usage */
+static int redir_score[H_U_MAX + 1] = {
+	/* DONT_CACHE */		FD_SCORE_REDIR_ONCE,
+	/* ALL_SESSION */		FD_SCORE_REDIR_SESSION,
+	/* ALL_REALM */			FD_SCORE_REDIR_REALM,
+	/* REALM_AND_APPLICATION */	FD_SCORE_REDIR_REALM_APP,
+	/* ALL_APPLICATION */		FD_SCORE_REDIR_APP,
+	/* ALL_HOST */			FD_SCORE_REDIR_HOST,
+	/* ALL_USER */			FD_SCORE_REDIR_USER
+};
+
+/* The order in which the usages are searched for a message, most specific first (RFC 6733, section 6.13) */
+static enum redir_h_u redir_order[] = { ALL_SESSION, ALL_USER, REALM_AND_APPLICATION, ALL_REALM, ALL_APPLICATION, ALL_HOST };
+
+/* The cache is filled from the answers of remote agents, bound its size and the lifetime of the entries */
+#define REDIR_MAX_ENTRIES	4096	/* when reached, the entry which expires first is replaced */
+#define REDIR_MAX_CACHE_TIME	86400	/* seconds, larger Redirect-Max-Cache-Time values are clamped */
+
+/* The expired entries are removed at most once per REDIR_PURGE_INTERVAL seconds; until then they are just ignored */
+#define REDIR_PURGE_INTERVAL	1
+
+/* Size of the hash table of entries (pow of 2) */
+#define REDIR_HASH_SIZE	8
+#define REDIR_H_MASK( __hash ) ((__hash) & (( 1 << REDIR_HASH_SIZE ) - 1))
+
+/* A cached entry */
+struct redir_entry {
+	struct fd_list	chain;		/* link in the hash bucket */
+	struct fd_list	exp;		/* link in the expiry list, ordered by timeout */
+	uint32_t	hash;		/* hash of (type, key, appid) */
+	enum redir_h_u	type;		/* the Redirect-Host-Usage */
+	uint8_t	*	key;		/* Session-Id, realm, host or user name, depending on type (NULL for ALL_APPLICATION) */
+	size_t		keylen;
+	application_id_t appid;		/* for ALL_APPLICATION and REALM_AND_APPLICATION */
+	struct timespec	timeout;	/* when this entry expires */
+	DiamId_t	from;		/* the redirect agent which sent the answer */
+	size_t		fromlen;
+	int		nbtargets;	/* number of Redirect-Host in the answer */
+	struct {
+		DiamId_t id;		/* DiameterIdentity part of the Redirect-Host */
+		size_t	 len;
+	} * targets;
+};
+
+static struct fd_list	redir_hash[1 << REDIR_HASH_SIZE];
+static struct fd_list	redir_exp = FD_LIST_INITIALIZER(redir_exp);
+static pthread_mutex_t	redir_lck = PTHREAD_MUTEX_INITIALIZER;
+static int		redir_count = 0;	/* written under redir_lck, loaded atomically without lock to skip the lookups when the cache is empty */
+static struct timespec	redir_next_purge;	/* protected by redir_lck */
+
+/* The keys extracted from a request */
+struct redir_keys {
+	union avp_value * sid;
+	union avp_value * dr;
+	union avp_value * dh;
+	union avp_value * un;
+	application_id_t  appid;
+};
+
+static uint32_t redir_hash_key(enum redir_h_u type, uint8_t * key, size_t keylen, application_id_t appid)
+{
+	uint32_t h = key ? fd_os_hash(key, keylen) : 0;
+	return h ^ ((uint32_t)type * 0x9E3779B1U) ^ (((type == ALL_APPLICATION) || (type == REALM_AND_APPLICATION)) ? appid : 0);
+}
+
+/* Realm and host are compared without case, we store and search them in lowercase */
+static int redir_key_is_case_insensitive(enum redir_h_u type)
+{
+	return (type == ALL_REALM) || (type == REALM_AND_APPLICATION) || (type == ALL_HOST);
+}
+
+/* Get the key of a given usage for a request; returns 0 if the request does not contain the necessary information */
+static int redir_get_key(enum redir_h_u type, struct redir_keys * k, uint8_t ** key, size_t * keylen)
+{
+	union avp_value * v = NULL;
+	switch (type) {
+		case ALL_SESSION:		v = k->sid; break;
+		case ALL_REALM:
+		case REALM_AND_APPLICATION:	v = k->dr; break;
+		case ALL_HOST:			v = k->dh; break;
+		case ALL_USER:			v = k->un; break;
+		case ALL_APPLICATION:		*key = NULL; *keylen = 0; return 1;
+		default:			return 0;
+	}
+	if (!v)
+		return 0;
+	*key = v->os.data;
+	*keylen = v->os.len;
+	return 1;
+}
+
+static void redir_entry_free(struct redir_entry * e)
+{
+	int i;
+	fd_list_unlink(&e->chain);
+	fd_list_unlink(&e->exp);
+	for (i = 0; i < e->nbtargets; i++)
+		free(e->targets[i].id);
+	free(e->targets);
+	free(e->from);
+	free(e->key);
+	free(e);
+	__atomic_sub_fetch(&redir_count, 1, __ATOMIC_RELEASE);
+}
+
+/* Remove the expired entries, redir_lck must be held */
+static void redir_purge(struct timespec * now)
+{
+	if (TS_IS_INFERIOR( now, &redir_next_purge ))
+		return;
+	redir_next_purge.tv_sec = now->tv_sec + REDIR_PURGE_INTERVAL;
+	redir_next_purge.tv_nsec = now->tv_nsec;
+	
+	while (!FD_IS_LIST_EMPTY(&redir_exp)) {
+		struct redir_entry * e = redir_exp.next->o;
+		if (TS_IS_INFERIOR( now, &e->timeout ))
+			break;
+		redir_entry_free(e);
+	}
+}
+
+/* Search an entry, redir_lck must be held. The key is already lowercase if needed. */
+static struct redir_entry * redir_find(enum redir_h_u type, uint8_t * key, size_t keylen, application_id_t appid, uint32_t hash)
+{
+	struct fd_list * li, * sentinel = &redir_hash[REDIR_H_MASK(hash)];
+	for (li = sentinel->next; li != sentinel; li = li->next) {
+		struct redir_entry * e = li->o;
+		if ((e->hash != hash) || (e->type != type))
+			continue;
+		if (((type == ALL_APPLICATION) || (type == REALM_AND_APPLICATION)) && (e->appid != appid))
+			continue;
+		if (key && fd_os_cmp(key, keylen, e->key, e->keylen))
+			continue;
+		return e;
+	}
+	return NULL;
+}
+
+/* Parse the top-level AVP with given code (no vendor), if found. Errors are ignored, the cache is just not used in that case. */
+static union avp_value * redir_avp_val(struct avp * avp, struct avp_hdr * ahdr)
+{
+	if (fd_msg_parse_dict( avp, fd_g_config->cnf_dict, NULL ))
+		return NULL;
+	return ahdr->avp_value;
+}
+
+/* Extract the keys from a request */
+static int redir_req_keys(struct msg * req, struct redir_keys * k)
+{
+	struct msg_hdr * hdr;
+	struct avp * avp;
+	
+	memset(k, 0, sizeof(struct redir_keys));
+	CHECK_FCT( fd_msg_hdr(req, &hdr) );
+	k->appid = hdr->msg_appl;
+	
+	CHECK_FCT( fd_msg_browse(req, MSG_BRW_FIRST_CHILD, &avp, NULL) );
+	while (avp) {
+		struct avp_hdr * ahdr;
+		CHECK_FCT( fd_msg_avp_hdr( avp, &ahdr ) );
+		if (! (ahdr->avp_flags & AVP_FLAG_VENDOR)) {
+			switch (ahdr->avp_code) {
+				case AC_SESSION_ID:		k->sid = redir_avp_val(avp, ahdr); break;
+				case AC_DESTINATION_REALM:	k->dr  = redir_avp_val(avp, ahdr); break;
+				case AC_DESTINATION_HOST:	k->dh  = redir_avp_val(avp, ahdr); break;
+				case AC_USER_NAME:		k->un  = redir_avp_val(avp, ahdr); break;
+			}
+		}
+		CHECK_FCT( fd_msg_browse(avp, MSG_BRW_NEXT, &avp, NULL) );
+	}
+	return 0;
+}
+
+/* Save the information from a redirect answer, if it is one. Called from the routing-in thread for all error answers. */
+int fd_rtredir_learn(struct msg * answer)
+{
+	struct msg * qry = NULL;
+	struct avp * avp;
+	union avp_value *rc = NULL, *usage = NULL, *maxtime = NULL, *oh = NULL;
+	int nbrh = 0, i;
+	struct redir_entry * new = NULL, * old;
+	struct fd_list * li;
+	struct redir_keys k;
+	uint8_t * key;
+	size_t keylen;
+	struct timespec now;
+	
+	TRACE_ENTRY("%p", answer);
+	CHECK_PARAMS( answer );
+	
+	/* Check first that this is a redirect indication that can be cached */
+	CHECK_FCT( fd_msg_browse(answer, MSG_BRW_FIRST_CHILD, &avp, NULL) );
+	while (avp) {
+		struct avp_hdr * ahdr;
+		CHECK_FCT( fd_msg_avp_hdr( avp, &ahdr ) );
+		if (! (ahdr->avp_flags & AVP_FLAG_VENDOR)) {
+			switch (ahdr->avp_code) {
+				case AC_RESULT_CODE:		rc = redir_avp_val(avp, ahdr); break;
+				case AC_REDIRECT_HOST_USAGE:	usage = redir_avp_val(avp, ahdr); break;
+				case AC_REDIRECT_MAX_CACHE_TIME: maxtime = redir_avp_val(avp, ahdr); break;
+				case AC_ORIGIN_HOST:		oh = redir_avp_val(avp, ahdr); break;
+				case AC_REDIRECT_HOST:		nbrh++; break;
+			}
+		}
+		CHECK_FCT( fd_msg_browse(avp, MSG_BRW_NEXT, &avp, NULL) );
+	}
+	
+	if (!rc || (rc->u32 != ER_DIAMETER_REDIRECT_INDICATION) || !nbrh)
+		return 0;
+	
+	/* The answer is used only for the request it was received for */
+	if (!usage || (usage->u32 == DONT_CACHE) || (usage->u32 > H_U_MAX) || !maxtime || !maxtime->u32)
+		return 0;
+	
+	/* Find the key from the original request */
+	CHECK_FCT( fd_msg_answ_getq( answer, &qry ) );
+	if (!qry)
+		return 0;
+	CHECK_FCT( redir_req_keys(qry, &k) );
+	if (!redir_get_key(usage->u32, &k, &key, &keylen)) {
+		TRACE_DEBUG(FULL, "Redirect answer with usage %u cannot be cached, the request does not contain the key", usage->u32);
+		return 0;
+	}
+	
+	/* Create the new entry */
+	CHECK_MALLOC( new = malloc(sizeof(struct redir_entry)) );
+	memset(new, 0, sizeof(struct redir_entry));
+	fd_list_init(&new->chain, new);
+	fd_list_init(&new->exp, new);
+	new->type = usage->u32;
+	new->appid = k.appid;
+	if (key) {
+		CHECK_MALLOC_DO( new->key = os0dup(key, keylen), goto error );
+		new->keylen = keylen;
+		if (redir_key_is_case_insensitive(new->type)) {
+			for (i = 0; i < keylen; i++)
+				new->key[i] = tolower(new->key[i]);
+		}
+	}
+	new->hash = redir_hash_key(new->type, new->key, new->keylen, new->appid);
+	if (oh) {
+		CHECK_MALLOC_DO( new->from = (DiamId_t)os0dup(oh->os.data, oh->os.len), goto error );
+		new->fromlen = oh->os.len;
+	}
+	CHECK_MALLOC_DO( new->targets = calloc(nbrh, sizeof(new->targets[0])), goto error );
+	
+	/* Save the Redirect-Host values */
+	CHECK_FCT_DO( fd_msg_browse(answer, MSG_BRW_FIRST_CHILD, &avp, NULL), goto error );
+	while (avp) {
+		struct avp_hdr * ahdr;
+		CHECK_FCT_DO( fd_msg_avp_hdr( avp, &ahdr ), goto error );
+		if ((ahdr->avp_code == AC_REDIRECT_HOST) && !(ahdr->avp_flags & AVP_FLAG_VENDOR)) {
+			union avp_value * rh = redir_avp_val(avp, ahdr);
+			DiamId_t id = NULL;
+			size_t idlen = 0;
+			if (rh && !fd_os_parse_DiameterURI(rh->os.data, rh->os.len, &id, &idlen, NULL, NULL, NULL, NULL)) {
+				new->targets[new->nbtargets].id = id;
+				new->targets[new->nbtargets].len = idlen;
+				new->nbtargets++;
+			}
+		}
+		CHECK_FCT_DO( fd_msg_browse(avp, MSG_BRW_NEXT, &avp, NULL), goto error );
+	}
+	if (!new->nbtargets)
+		goto error;
+	
+	CHECK_SYS_DO( clock_gettime(CLOCK_REALTIME, &now), goto error );
+	new->timeout.tv_sec = now.tv_sec + ((maxtime->u32 > REDIR_MAX_CACHE_TIME) ? REDIR_MAX_CACHE_TIME : maxtime->u32);
+	new->timeout.tv_nsec = now.tv_nsec;
+	
+	/* Now save the entry, replacing any previous one with the same key */
+	CHECK_POSIX_DO( pthread_mutex_lock(&redir_lck), goto error );
+	redir_purge(&now);
+	old = redir_find(new->type, new->key, new->keylen, new->appid, new->hash);
+	if (old)
+		redir_entry_free(old);
+	else if (redir_count >= REDIR_MAX_ENTRIES)
+		redir_entry_free(redir_exp.next->o);
+	fd_list_insert_before(&redir_hash[REDIR_H_MASK(new->hash)], &new->chain);
+	/* Insert in the expiry list, ordered by timeout (usually at the end) */
+	for (li = redir_exp.prev; li != &redir_exp; li = li->prev) {
+		struct redir_entry * e = li->o;
+		if (!TS_IS_INFERIOR( &new->timeout, &e->timeout ))
+			break;
+	}
+	fd_list_insert_after(li, &new->exp);
+	__atomic_add_fetch(&redir_count, 1, __ATOMIC_RELEASE);
+	CHECK_POSIX( pthread_mutex_unlock(&redir_lck) );
+	
+	TRACE_DEBUG(FULL, "Cached redirect from '%s' (usage %d, %d targets) for %us", new->from ?: "(unknown)", new->type, new->nbtargets, maxtime->u32);
+	return 0;
+	
+error:
+	if (new) {
+		for (i = 0; i < new->nbtargets; i++)
+			free(new->targets[i].id);
+		free(new->targets);
+		free(new->from);
+		free(new->key);
+		free(new);
+	}
+	return 0;
+}
+
+/* Give a better score to the redirect targets that apply to this request, if any. Called before the OUT callbacks. */
+int fd_rtredir_apply(struct msg * req, struct fd_list * candidates)
+{
+	struct redir_keys k;
+	struct timespec now;
+	int i;
+	
+	TRACE_ENTRY("%p %p", req, candidates);
+	CHECK_PARAMS( req && candidates );
+	
+	/* Fast path: nothing in the cache */
+	if (!__atomic_load_n(&redir_count, __ATOMIC_ACQUIRE) || FD_IS_LIST_EMPTY(candidates))
+		return 0;
+	
+	CHECK_FCT( redir_req_keys(req, &k) );
+	CHECK_SYS( clock_gettime(CLOCK_REALTIME, &now) );
+	
+	CHECK_POSIX( pthread_mutex_lock(&redir_lck) );
+	pthread_cleanup_push( fd_cleanup_mutex, &redir_lck );
+	
+	redir_purge(&now);
+	
+	for (i = 0; i < sizeof(redir_order) / sizeof(redir_order[0]); i++) {
+		enum redir_h_u type = redir_order[i];
+		struct redir_entry * e;
+		struct fd_list * li;
+		uint8_t * key, lkey[256];
+		size_t keylen;
+		int t, matched = 0;
+		
+		if (!redir_get_key(type, &k, &key, &keylen))
+			continue;
+		
+		if (key && redir_key_is_case_insensitive(type)) {
+			if (keylen > sizeof(lkey))
+				continue;
+			for (t = 0; t < keylen; t++)
+				lkey[t] = tolower(key[t]);
+			key = lkey;
+		}
+		
+		e = redir_find(type, key, keylen, k.appid, redir_hash_key(type, key, keylen, k.appid));
+		if (!e || !TS_IS_INFERIOR( &now, &e->timeout )) /* expired entries may remain until the next purge */
+			continue;
+		
+		/* Found the most specific entry for this request, update the scores */
+		for (li = candidates->next; li != candidates; li = li->next) {
+			struct rtd_candidate * c = (struct rtd_candidate *) li;
+			for (t = 0; t < e->nbtargets; t++) {
+				if (!fd_os_almostcasesrch(e->targets[t].id, e->targets[t].len, c->diamid, c->diamidlen, NULL)) {
+					c->score += redir_score[type];
+					matched = 1;
+					break;
+				}
+			}
+		}
+		
+		/* If we could use one of the targets, avoid the redirect agent itself */
+		if (matched && e->from) {
+			for (li = candidates->next; li != candidates; li = li->next) {
+				struct rtd_candidate * c = (struct rtd_candidate *) li;
+				if (!fd_os_almostcasesrch(e->from, e->fromlen, c->diamid, c->diamidlen, NULL))
+					c->score += FD_SCORE_SENT_REDIRECT;
+			}
+		}
+		
+		break;
+	}
+	
+	pthread_cleanup_pop(0);
+	CHECK_POSIX( pthread_mutex_unlock(&redir_lck) );
+	
+	return 0;
+}
+
+/* Initialize the cache */
+int fd_rtredir_init(void)
+{
+	int i;
+	for (i = 0; i < sizeof(redir_hash) / sizeof(redir_hash[0]); i++)
+		fd_list_init(&redir_hash[i], NULL);
+	return 0;
+}
+
+/* Destroy all the entries */
+int fd_rtredir_fini(void)
+{
+	CHECK_POSIX( pthread_mutex_lock(&redir_lck) );
+	while (!FD_IS_LIST_EMPTY(&redir_exp))
+		redir_entry_free(redir_exp.next->o);
+	CHECK_POSIX( pthread_mutex_unlock(&redir_lck) );
+	return 0;
+}
@@ -0,0 +1,216 @@
+/*********************************************************************************************************
+* Software License Agreement (BSD License)                                                               *
+* Author: Sebastien Decugis <sdecugis@freediameter.net>							 *
+*													 *
+* Copyright (c) 2013, WIDE Project and NICT								 *
+* All rights reserved.											 *
+* 													 *
+* Redistribution and use of this software in source and binary forms, with or without modification, are  *
+* permitted provided that the following conditions are met:						 *
+* 													 *
+* * Redistributions of source code must retain the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer.										 *
+*    													 *
+* * Redistributions in binary form must reproduce the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer in the documentation and/or other						 *
+*   materials provided with the distribution.								 *
+* 													 *
+* * Neither the name of the WIDE Project or NICT nor the 						 *
+*   names of its contributors may be used to endorse or 						 *
+*   promote products derived from this software without 						 *
+*   specific prior written permission of WIDE Project and 						 *
+*   NICT.												 *
+* 													 *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED *
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A *
+* PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR *
+* ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 	 *
+* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 	 *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR *
+* TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF   *
+* ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.								 *
+*********************************************************************************************************/
+
+#include "fdcore-internal.h"
+
+/* Cache of the OUT routing decisions.
+ *
+ * When all the OUT callbacks are cacheable (see fd_rt_out_set_cacheable), the scores they give to the candidates
+ * depend only on the (Application-Id, Destination-Realm, Destination-Host) of the message. We save these scores
+ * for each tuple, and reuse them for the next messages instead of calling the callbacks again. The whole cache
+ * is invalidated by incrementing rtc_gen, when a peer changes state or the callbacks change.
+ *
+ * The table is only read and written by the routing-out thread (there is a single one), so it is not locked.
+ * Other threads only increment rtc_gen, atomically; a decision computed while the generation changed is not saved.
+ */
+
+/* Number of slots in the table (pow of 2). A new decision replaces the previous one in the same slot. */
+#define RTC_SIZE_BITS	8
+#define RTC_SLOT( __hash ) ((__hash) & (( 1 << RTC_SIZE_BITS ) - 1))
+
+/* A saved decision */
+struct rtc_entry {
+	uint32_t	gen;	/* value of rtc_gen when the decision was saved, 0 if the slot is unused */
+	struct rtc_key	key;	/* dr and dh are allocated here */
+	int		nb;	/* number of candidates */
+	struct {
+		DiamId_t diamid;
+		size_t	 diamidlen;
+		int	 delta;	/* the score added by the callbacks */
+	} * 		scores;	/* ordered as in the rt_data (by fd_os_cmp of diamid) */
+};
+
+static struct rtc_entry	rtc_table[1 << RTC_SIZE_BITS];
+static uint32_t		rtc_gen = 1;
+
+/* Invalidate all the saved decisions, may be called from any thread */
+void fd_rtdisp_cache_invalidate(void)
+{
+	/* 0 is never a valid generation */
+	if (!__atomic_add_fetch(&rtc_gen, 1, __ATOMIC_ACQ_REL))
+		__atomic_add_fetch(&rtc_gen, 1, __ATOMIC_ACQ_REL);
+}
+
+/* The current generation, to pass to fd_rtc_save */
+uint32_t fd_rtc_gen(void)
+{
+	return __atomic_load_n(&rtc_gen, __ATOMIC_ACQUIRE);
+}
+
+static void rtc_entry_clear(struct rtc_entry * e)
+{
+	int i;
+	for (i = 0; i < e->nb; i++)
+		free(e->scores[i].diamid);
+	free(e->scores);
+	free(e->key.dr);
+	free(e->key.dh);
+	memset(e, 0, sizeof(struct rtc_entry));
+}
+
+/* Extract the key from a message. Returns 0 if the key is usable. Malformed AVPs just make the message not cacheable. */
+int fd_rtc_get_key(struct msg * msg, struct rtc_key * key)
+{
+	struct msg_hdr * hdr;
+	struct avp * avp;
+	
+	memset(key, 0, sizeof(struct rtc_key));
+	CHECK_FCT( fd_msg_hdr(msg, &hdr) );
+	key->appid = hdr->msg_appl;
+	
+	CHECK_FCT( fd_msg_browse(msg, MSG_BRW_FIRST_CHILD, &avp, NULL) );
+	while (avp) {
+		struct avp_hdr * ahdr;
+		CHECK_FCT( fd_msg_avp_hdr( avp, &ahdr ) );
+		if (!(ahdr->avp_flags & AVP_FLAG_VENDOR) 
+				&& (((ahdr->avp_code == AC_DESTINATION_REALM) && !key->dr) || ((ahdr->avp_code == AC_DESTINATION_HOST) && !key->dh))) {
+			if (fd_msg_parse_dict( avp, fd_g_config->cnf_dict, NULL ) || !ahdr->avp_value)
+				return EINVAL;
+			if (ahdr->avp_code == AC_DESTINATION_REALM) {
+				key->dr = ahdr->avp_value->os.data;
+				key->drlen = ahdr->avp_value->os.len;
+			} else {
+				key->dh = ahdr->avp_value->os.data;
+				key->dhlen = ahdr->avp_value->os.len;
+			}
+		}
+		CHECK_FCT( fd_msg_browse(avp, MSG_BRW_NEXT, &avp, NULL) );
+	}
+	
+	key->hash = key->appid * 0x9E3779B1U;
+	if (key->dr)
+		key->hash ^= fd_os_hash(key->dr, key->drlen);
+	if (key->dh)
+		key->hash ^= fd_os_hash(key->dh, key->dhlen) * 31;
+	return 0;
+}
+
+static int rtc_key_match(struct rtc_key * k1, struct rtc_key * k2)
+{
+	if ((k1->hash != k2->hash) || (k1->appid != k2->appid))
+		return 0;
+	if ((!k1->dr != !k2->dr) || (k1->dr && fd_os_cmp(k1->dr, k1->drlen, k2->dr, k2->drlen)))
+		return 0;
+	if ((!k1->dh != !k2->dh) || (k1->dh && fd_os_cmp(k1->dh, k1->dhlen, k2->dh, k2->dhlen)))
+		return 0;
+	return 1;
+}
+
+/* Apply a saved decision to the candidates (ordered by diamid). Returns 1 if a decision was found and applied. */
+int fd_rtc_apply(struct rtc_key * key, struct fd_list * candidates)
+{
+	struct rtc_entry * e = &rtc_table[RTC_SLOT(key->hash)];
+	struct fd_list * li;
+	int i;
+	
+	if ((e->gen != fd_rtc_gen()) || !rtc_key_match(key, &e->key))
+		return 0;
+	
+	/* All the candidates must be in the saved decision (there may be less, e.g. because of Route-Record) */
+	for (i = 0, li = candidates->next; li != candidates; li = li->next, i++) {
+		struct rtd_candidate * c = (struct rtd_candidate *) li;
+		while ((i < e->nb) && (fd_os_cmp(e->scores[i].diamid, e->scores[i].diamidlen, c->diamid, c->diamidlen) < 0))
+			i++;
+		if ((i == e->nb) || fd_os_cmp(e->scores[i].diamid, e->scores[i].diamidlen, c->diamid, c->diamidlen))
+			return 0;
+	}
+	
+	/* Ok, now apply the scores */
+	for (i = 0, li = candidates->next; li != candidates; li = li->next, i++) {
+		struct rtd_candidate * c = (struct rtd_candidate *) li;
+		while (fd_os_cmp(e->scores[i].diamid, e->scores[i].diamidlen, c->diamid, c->diamidlen) < 0)
+			i++;
+		c->score += e->scores[i].delta;
+	}
+	return 1;
+}
+
+/* Save the decision computed by the callbacks, from ini_score. gen is the value of fd_rtc_gen() before the callbacks were called. */
+void fd_rtc_save(struct rtc_key * key, uint32_t gen, struct fd_list * candidates, int ini_score)
+{
+	struct rtc_entry new, * e = &rtc_table[RTC_SLOT(key->hash)];
+	struct fd_list * li;
+	
+	/* The peers or the callbacks changed in the meantime, this decision may already be wrong */
+	if (gen != fd_rtc_gen())
+		return;
+	
+	memset(&new, 0, sizeof(new));
+	new.key = *key;
+	new.key.dr = new.key.dh = NULL;
+	if (key->dr) {
+		CHECK_MALLOC_DO( new.key.dr = os0dup(key->dr, key->drlen), goto error );
+	}
+	if (key->dh) {
+		CHECK_MALLOC_DO( new.key.dh = os0dup(key->dh, key->dhlen), goto error );
+	}
+	for (li = candidates->next; li != candidates; li = li->next)
+		new.nb++;
+	CHECK_MALLOC_DO( new.scores = calloc(new.nb ?: 1, sizeof(new.scores[0])), goto error );
+	new.nb = 0;
+	for (li = candidates->next; li != candidates; li = li->next) {
+		struct rtd_candidate * c = (struct rtd_candidate *) li;
+		CHECK_MALLOC_DO( new.scores[new.nb].diamid = os0dup(c->diamid, c->diamidlen), goto error );
+		new.scores[new.nb].diamidlen = c->diamidlen;
+		new.scores[new.nb].delta = c->score - ini_score;
+		new.nb++;
+	}
+	new.gen = gen;
+	
+	/* Replace the previous content of the slot */
+	rtc_entry_clear(e);
+	*e = new;
+	return;
+error:
+	rtc_entry_clear(&new);
+}
+
+/* Destroy all saved decisions, once the routing-out thread is stopped */
+void fd_rtc_fini(void)
+{
+	int i;
+	for (i = 0; i < sizeof(rtc_table) / sizeof(rtc_table[0]); i++)
+		rtc_entry_clear(&rtc_table[i]);
+}
@@ -39,11 +39,12 @@
 /*              First part : handling the extensions callbacks                  */
 /********************************************************************************/
 
-/* Lists of the callbacks, and locks to protect them */
-static pthread_rwlock_t rt_fwd_lock = PTHREAD_RWLOCK_INITIALIZER;
+/* Lists of the callbacks, and locks to protect them. The locks are only taken by the writers (registration), the
+ routing threads use the snapshots below. */
+static pthread_mutex_t	rt_fwd_lock = PTHREAD_MUTEX_INITIALIZER;
 static struct fd_list 	rt_fwd_list = FD_LIST_INITIALIZER_O(rt_fwd_list, &rt_fwd_lock);
 
-static pthread_rwlock_t rt_out_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t	rt_out_lock = PTHREAD_MUTEX_INITIALIZER;
 static struct fd_list 	rt_out_list = FD_LIST_INITIALIZER_O(rt_out_list, &rt_out_lock);
 
 /* Items in the lists are the same */
@@ -59,15 +60,145 @@ struct rt_hdl {
 		int (*rt_fwd_cb)(void * cbdata, struct msg ** msg);
 		int (*rt_out_cb)(void * cbdata, struct msg ** msg, struct fd_list * candidates);
 	};
+	int		cacheable; /* for OUT handlers, see fd_rt_out_set_cacheable */
 };	
 
-/* Add a new entry in the list */
-static int add_ordered(struct rt_hdl * new, struct fd_list * list)
+/* An immutable copy of a list, that the routing threads browse without lock. A new snapshot is published each
+ time the list changes; the previous one (and the removed handler) is freed once no routing thread uses it anymore. */
+struct rt_snap {
+	int		nb;	  /* number of handlers */
+	int		nocache;  /* number of OUT handlers that are not cacheable */
+	struct rt_hdl *	hdl[];	  /* the handlers, in the list order */
+};
+static struct rt_snap *	rt_fwd_snap = NULL;
+static struct rt_snap *	rt_out_snap = NULL;
+
+/* Each routing thread has a reader record. Its seq value is odd while the thread is using a snapshot. */
+struct rt_reader {
+	struct fd_list	chain;	/* link in rt_readers */
+	unsigned long	seq;
+};
+static struct fd_list	rt_readers = FD_LIST_INITIALIZER(rt_readers);
+static pthread_mutex_t	rt_readers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t	rt_reader_key;
+static int		rt_reader_key_ok = 0;
+
+/* A writer waiting for the readers to leave their section sleeps on rt_gp_cond */
+static int		rt_gp_waiting = 0;
+static pthread_mutex_t	rt_gp_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	rt_gp_cond = PTHREAD_COND_INITIALIZER;
+
+/* Wake up the waiting writers, if any. Called after the seq value of a reader changed to even. */
+static void rt_gp_wakeup(void)
+{
+	if (!__atomic_load_n(&rt_gp_waiting, __ATOMIC_SEQ_CST))
+		return;
+	CHECK_POSIX_DO( pthread_mutex_lock(&rt_gp_mtx), return );
+	CHECK_POSIX_DO( pthread_cond_broadcast(&rt_gp_cond), );
+	CHECK_POSIX_DO( pthread_mutex_unlock(&rt_gp_mtx), );
+}
+
+/* Called when a routing thread terminates (also when it is canceled in a callback) */
+static void rt_reader_destroy(void * arg)
+{
+	struct rt_reader * r = arg;
+	
+	/* Release a writer that may be waiting for this thread before we take the lock */
+	__atomic_store_n(&r->seq, (r->seq + 1) & ~1UL, __ATOMIC_SEQ_CST);
+	rt_gp_wakeup();
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&rt_readers_lock), );
+	fd_list_unlink(&r->chain);
+	CHECK_POSIX_DO( pthread_mutex_unlock(&rt_readers_lock), );
+	free(r);
+}
+
+/* Enter a read-side section, return the reader record to pass to rt_read_end, or NULL on error */
+static struct rt_reader * rt_read_begin(void)
+{
+	struct rt_reader * r = pthread_getspecific(rt_reader_key);
+	
+	if (!r) {
+		/* First use in this thread */
+		CHECK_MALLOC_DO( r = malloc(sizeof(struct rt_reader)), return NULL );
+		fd_list_init(&r->chain, r);
+		r->seq = 0;
+		CHECK_POSIX_DO( pthread_mutex_lock(&rt_readers_lock), { free(r); return NULL; } );
+		fd_list_insert_before(&rt_readers, &r->chain);
+		CHECK_POSIX_DO( pthread_mutex_unlock(&rt_readers_lock), /* continue */ );
+		CHECK_POSIX_DO( pthread_setspecific(rt_reader_key, r), { rt_reader_destroy(r); return NULL; } );
+	}
+	
+	/* The snapshot pointer must be loaded after this store is visible (the load is SEQ_CST as well) */
+	__atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_SEQ_CST);
+	return r;
+}
+
+static void rt_read_end(struct rt_reader * r)
+{
+	__atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_SEQ_CST);
+	rt_gp_wakeup();
+}
+
+/* Wait until no routing thread may still be using a snapshot published before the call */
+static void rt_wait_readers(void)
+{
+	struct fd_list * li;
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&rt_readers_lock), return );
+	__atomic_add_fetch(&rt_gp_waiting, 1, __ATOMIC_SEQ_CST);
+	CHECK_POSIX_DO( pthread_mutex_lock(&rt_gp_mtx), goto out );
+	for (li = rt_readers.next; li != &rt_readers; li = li->next) {
+		struct rt_reader * r = li->o;
+		unsigned long seq = __atomic_load_n(&r->seq, __ATOMIC_SEQ_CST);
+		if (seq & 1) {
+			/* The reader calls rt_gp_wakeup after changing seq, since it sees rt_gp_waiting set */
+			while (__atomic_load_n(&r->seq, __ATOMIC_SEQ_CST) == seq) {
+				CHECK_POSIX_DO( pthread_cond_wait(&rt_gp_cond, &rt_gp_mtx), break );
+			}
+		}
+	}
+	CHECK_POSIX_DO( pthread_mutex_unlock(&rt_gp_mtx), );
+out:
+	__atomic_sub_fetch(&rt_gp_waiting, 1, __ATOMIC_SEQ_CST);
+	CHECK_POSIX_DO( pthread_mutex_unlock(&rt_readers_lock), );
+}
+
+/* Publish a new snapshot of the list, the list lock must be held. The old snapshot is freed when it is safe. */
+static int rt_publish(struct fd_list * list, struct rt_snap ** psnap)
 {
-	/* The list is ordered by prio parameter */
 	struct fd_list * li;
+	struct rt_snap * new, * old;
+	int nb = 0;
 	
-	CHECK_POSIX( pthread_rwlock_wrlock(list->o) );
+	for (li = list->next; li != list; li = li->next)
+		nb++;
+	
+	CHECK_MALLOC( new = malloc(sizeof(struct rt_snap) + nb * sizeof(struct rt_hdl *)) );
+	new->nb = 0;
+	new->nocache = 0;
+	for (li = list->next; li != list; li = li->next) {
+		struct rt_hdl * h = (struct rt_hdl *) li;
+		new->hdl[new->nb++] = h;
+		if (!h->cacheable)
+			new->nocache++;
+	}
+	
+	old = __atomic_exchange_n(psnap, new, __ATOMIC_SEQ_CST);
+	rt_wait_readers();
+	free(old);
+	
+	/* The routing decisions saved with the previous callbacks are not valid anymore */
+	if (list == &rt_out_list)
+		fd_rtdisp_cache_invalidate();
+	
+	return 0;
+}
+
+/* Insert an entry in the list, ordered by prio parameter. The list lock must be held. */
+static void insert_ordered(struct rt_hdl * new, struct fd_list * list)
+{
+	struct fd_list * li;
 	
 	for (li = list->next; li != list; li = li->next) {
 		struct rt_hdl * h = (struct rt_hdl *) li;
@@ -76,10 +207,32 @@ static int add_ordered(struct rt_hdl * new, struct fd_list * list)
 	}
 	
 	fd_list_insert_before(li, &new->chain);
+}
+
+/* Add a new entry in the list */
+static int add_ordered(struct rt_hdl * new, struct fd_list * list, struct rt_snap ** psnap)
+{
+	int ret;
 	
-	CHECK_POSIX( pthread_rwlock_unlock(list->o) );
+	CHECK_POSIX( pthread_mutex_lock(list->o) );
+	insert_ordered(new, list);
+	CHECK_FCT_DO( ret = rt_publish(list, psnap), fd_list_unlink(&new->chain) );
+	CHECK_POSIX( pthread_mutex_unlock(list->o) );
 	
-	return 0;
+	return ret;
+}
+
+/* Remove an entry from the list. When this returns, no routing thread is using the entry anymore. */
+static int del_entry(struct rt_hdl * del, struct fd_list * list, struct rt_snap ** psnap)
+{
+	int ret;
+	
+	CHECK_POSIX( pthread_mutex_lock(list->o) );
+	fd_list_unlink(&del->chain);
+	CHECK_FCT_DO( ret = rt_publish(list, psnap), insert_ordered(del, list) );
+	CHECK_POSIX( pthread_mutex_unlock(list->o) );
+	
+	return ret;
 }
 
 /* Register a new FWD callback */
@@ -102,7 +255,7 @@ int fd_rt_fwd_register ( int (*rt_fwd_cb)(void * cbdata, struct msg ** msg), voi
 	new->rt_fwd_cb 	= rt_fwd_cb;
 	
 	/* Save this in the list */
-	CHECK_FCT( add_ordered(new, &rt_fwd_list) );
+	CHECK_FCT_DO( add_ordered(new, &rt_fwd_list, &rt_fwd_snap), { free(new); return ENOMEM; } );
 	
 	/* Give it back to the extension if needed */
 	if (handler)
@@ -122,9 +275,7 @@ int fd_rt_fwd_unregister ( struct fd_rt_fwd_hdl * handler, void ** cbdata )
 	CHECK_PARAMS( del->chain.head == &rt_fwd_list );
 	
 	/* Unlink */
-	CHECK_POSIX( pthread_rwlock_wrlock(&rt_fwd_lock) );
-	fd_list_unlink(&del->chain);
-	CHECK_POSIX( pthread_rwlock_unlock(&rt_fwd_lock) );
+	CHECK_FCT( del_entry(del, &rt_fwd_list, &rt_fwd_snap) );
 	
 	if (cbdata)
 		*cbdata = del->cbdata;
@@ -152,7 +303,7 @@ int fd_rt_out_register ( int (*rt_out_cb)(void * cbdata, struct msg ** pmsg, str
 	new->rt_out_cb 	= rt_out_cb;
 	
 	/* Save this in the list */
-	CHECK_FCT( add_ordered(new, &rt_out_list) );
+	CHECK_FCT_DO( add_ordered(new, &rt_out_list, &rt_out_snap), { free(new); return ENOMEM; } );
 	
 	/* Give it back to the extension if needed */
 	if (handler)
@@ -172,9 +323,7 @@ int fd_rt_out_unregister ( struct fd_rt_out_hdl * handler, void ** cbdata )
 	CHECK_PARAMS( del->chain.head == &rt_out_list );
 	
 	/* Unlink */
-	CHECK_POSIX( pthread_rwlock_wrlock(&rt_out_lock) );
-	fd_list_unlink(&del->chain);
-	CHECK_POSIX( pthread_rwlock_unlock(&rt_out_lock) );
+	CHECK_FCT( del_entry(del, &rt_out_list, &rt_out_snap) );
 	
 	if (cbdata)
 		*cbdata = del->cbdata;
@@ -183,6 +332,25 @@ int fd_rt_out_unregister ( struct fd_rt_out_hdl * handler, void ** cbdata )
 	return 0;
 }
 
+/* Change the cacheable flag of an OUT callback */
+int fd_rt_out_set_cacheable ( struct fd_rt_out_hdl * handler, int cacheable )
+{
+	struct rt_hdl * h;
+	int ret;
+	TRACE_ENTRY( "%p %d", handler, cacheable);
+	CHECK_PARAMS( handler );
+	
+	h = (struct rt_hdl *)handler;
+	CHECK_PARAMS( h->chain.head == &rt_out_list );
+	
+	CHECK_POSIX( pthread_mutex_lock(&rt_out_lock) );
+	h->cacheable = cacheable ? 1 : 0;
+	CHECK_FCT_DO( ret = rt_publish(&rt_out_list, &rt_out_snap), );
+	CHECK_POSIX( pthread_mutex_unlock(&rt_out_lock) );
+	
+	return ret;
+}
+
 /********************************************************************************/
 /*                      Some default OUT routing callbacks                      */
 /********************************************************************************/
@@ -716,6 +884,13 @@ static int msg_rt_in(struct msg * msg)
 			return 0;
 		}
 
+		/* Enforce the rate limits of the received requests (RateLimitIn) */
+		if (fd_rtlim_in(msgptr, dr_val, hdr->msg_appl)) {
+			fd_hook_call(HOOK_MESSAGE_ROUTING_ERROR, msgptr, NULL, "Rate limit exceeded", fd_msg_pmdl_get(msgptr));
+			CHECK_FCT( return_error( &msgptr, "DIAMETER_TOO_BUSY", "Rate limit exceeded", NULL) );
+			return 0;
+		}
+
 		/* If we are listed as Destination-Host */
 		if (is_dest_host == YES) {
 			if (is_local_app == YES) {
@@ -784,6 +959,11 @@ static int msg_rt_in(struct msg * msg)
 		CHECK_FCT( fd_msg_answ_getq( msgptr, &qry ) );
 		CHECK_FCT( fd_msg_source_get( qry, &qry_src, NULL ) );
 
+		/* Save the Redirect-Host information, if any, for the next requests */
+		if (is_err) {
+			CHECK_FCT_DO( fd_rtredir_learn( msgptr ), /* continue */ );
+		}
+
 		if ((!qry_src) && (!is_err)) {
 			/* The message is a normal answer to a request issued localy, we do not call the callbacks chain on it. */
 			fd_hook_call(HOOK_MESSAGE_ROUTING_LOCAL, msgptr, NULL, NULL, fd_msg_pmdl_get(msgptr));
@@ -796,14 +976,16 @@ static int msg_rt_in(struct msg * msg)
 
 	/* Call all registered callbacks for this message */
 	{
-		struct fd_list * li;
+		struct rt_reader * rdr;
+		struct rt_snap * snap;
+		int i;
 
-		CHECK_FCT( pthread_rwlock_rdlock( &rt_fwd_lock ) );
-		pthread_cleanup_push( fd_cleanup_rwlock, &rt_fwd_lock );
+		CHECK_MALLOC( rdr = rt_read_begin() );
+		snap = __atomic_load_n(&rt_fwd_snap, __ATOMIC_SEQ_CST);
 
 		/* requests: dir = 1 & 2 => in order; answers = 3 & 2 => in reverse order */
-		for (	li = (is_req ? rt_fwd_list.next : rt_fwd_list.prev) ; msgptr && (li != &rt_fwd_list) ; li = (is_req ? li->next : li->prev) ) {
-			struct rt_hdl * rh = (struct rt_hdl *)li;
+		for (	i = (is_req ? 0 : (snap ? snap->nb - 1 : -1)) ; snap && msgptr && (i >= 0) && (i < snap->nb) ; i += (is_req ? 1 : -1) ) {
+			struct rt_hdl * rh = snap->hdl[i];
 			int ret;
 
 			if (is_req && (rh->dir > RT_FWD_ALL))
@@ -825,8 +1007,7 @@ static int msg_rt_in(struct msg * msg)
 				} );
 		}
 
-		pthread_cleanup_pop(0);
-		CHECK_FCT( pthread_rwlock_unlock( &rt_fwd_lock ) );
+		rt_read_end(rdr);
 
 		/* If a callback has handled the message, we stop now */
 		if (!msgptr)
@@ -847,6 +1028,9 @@ static int msg_rt_in(struct msg * msg)
 }
 		
 
+/* Number of Route-Record values that are handled without allocation in msg_rt_out */
+#define RR_PREALLOC	16
+
 /* The ROUTING-OUT message processing */
 static int msg_rt_out(struct msg * msg)
 {
@@ -860,6 +1044,8 @@ static int msg_rt_out(struct msg * msg)
 	struct msg *msgptr = msg;
 	DiamId_t qry_src = NULL;
 	size_t qry_src_len = 0;
+	int rtd_is_new = 0;
+	int limited = 0;
 	
 	/* Read the message header */
 	CHECK_FCT( fd_msg_hdr(msgptr, &hdr) );
@@ -908,6 +1094,14 @@ static int msg_rt_out(struct msg * msg)
 
 	/* If there is no routing data already, let's create it */
 	if (rtd == NULL) {
+		/* Enforce the rate limits of the new requests (RateLimitOut), retransmissions were already counted */
+		if (fd_rtlim_out(msgptr, hdr->msg_appl)) {
+			fd_hook_call(HOOK_MESSAGE_ROUTING_ERROR, msgptr, NULL, "Rate limit exceeded", fd_msg_pmdl_get(msgptr));
+			CHECK_FCT( return_error( &msgptr, "DIAMETER_TOO_BUSY", "Rate limit exceeded", NULL) );
+			return 0;
+		}
+		
+		rtd_is_new = 1;
 		CHECK_FCT( fd_rtd_init(&rtd) );
 
 		/* Add all peers currently in OPEN state */
@@ -918,37 +1112,77 @@ static int msg_rt_out(struct msg * msg)
 							p->p_hdr.info.pi_diamid, 
 							p->p_hdr.info.pi_diamidlen, 
 							p->p_hdr.info.runtime.pir_realm,
-							p->p_hdr.info.runtime.pir_realmlen), 
+							p->p_hdr.info.runtime.pir_realmlen,
+							&p->p_hdr), 
 				{ CHECK_FCT_DO( pthread_rwlock_unlock(&fd_g_activ_peers_rw), ); return ret; } );
 		}
 		CHECK_FCT( pthread_rwlock_unlock(&fd_g_activ_peers_rw) );
 
-		/* Now let's remove all peers from the Route-Records */
-		CHECK_FCT(  fd_msg_browse(msgptr, MSG_BRW_FIRST_CHILD, &avp, NULL)  );
-		while (avp) {
-			struct avp_hdr * ahdr;
-			struct fd_pei error_info;
-			CHECK_FCT(  fd_msg_avp_hdr( avp, &ahdr )  );
-
-			if ((ahdr->avp_code == AC_ROUTE_RECORD) && (! (ahdr->avp_flags & AVP_FLAG_VENDOR)) ) {
-				/* Parse this AVP */
-				CHECK_FCT_DO( ret = fd_msg_parse_dict ( avp, fd_g_config->cnf_dict, &error_info ),
-					{
-						if (error_info.pei_errcode) {
-							CHECK_FCT( return_error( &msgptr, error_info.pei_errcode, error_info.pei_message, error_info.pei_avp) );
-							if (error_info.pei_avp_free) { fd_msg_free(error_info.pei_avp); }
-							return 0;
-						} else {
-							return ret;
+		/* Now let's remove all peers from the Route-Records. We first collect the values, then remove them in one pass. */
+		{
+			uint8_t * rr_st[RR_PREALLOC], ** rr = rr_st;
+			size_t rr_sz_st[RR_PREALLOC], * rr_sz = rr_sz_st;
+			int rr_nb = 0, rr_max = RR_PREALLOC;
+			
+			ret = 0;
+			CHECK_FCT_DO( ret = fd_msg_browse(msgptr, MSG_BRW_FIRST_CHILD, &avp, NULL), goto rr_out );
+			while (avp) {
+				struct avp_hdr * ahdr;
+				struct fd_pei error_info;
+				CHECK_FCT_DO( ret = fd_msg_avp_hdr( avp, &ahdr ), goto rr_out );
+
+				if ((ahdr->avp_code == AC_ROUTE_RECORD) && (! (ahdr->avp_flags & AVP_FLAG_VENDOR)) ) {
+					/* Parse this AVP */
+					CHECK_FCT_DO( ret = fd_msg_parse_dict ( avp, fd_g_config->cnf_dict, &error_info ),
+						{
+							if (error_info.pei_errcode) {
+								CHECK_FCT_DO( ret = return_error( &msgptr, error_info.pei_errcode, error_info.pei_message, error_info.pei_avp), goto rr_out );
+								if (error_info.pei_avp_free) { fd_msg_free(error_info.pei_avp); }
+								ret = 0;
+								msgptr = NULL;
+							}
+							goto rr_out;
+						} );
+					ASSERT( ahdr->avp_value );
+					
+					/* Grow the arrays if needed (more than RR_PREALLOC hops) */
+					if (rr_nb == rr_max) {
+						uint8_t ** nrr;
+						size_t * nrr_sz;
+						CHECK_MALLOC_DO( nrr = malloc(2 * rr_max * sizeof(uint8_t *)), { ret = ENOMEM; goto rr_out; } );
+						CHECK_MALLOC_DO( nrr_sz = malloc(2 * rr_max * sizeof(size_t)), { free(nrr); ret = ENOMEM; goto rr_out; } );
+						memcpy(nrr, rr, rr_nb * sizeof(uint8_t *));
+						memcpy(nrr_sz, rr_sz, rr_nb * sizeof(size_t));
+						if (rr != rr_st) {
+							free(rr);
+							free(rr_sz);
 						}
-					} );
-				ASSERT( ahdr->avp_value );
-				/* Remove this value from the list. We don't need to pay special attention to the contents here. */
-				fd_rtd_candidate_del(rtd, ahdr->avp_value->os.data, ahdr->avp_value->os.len);
-			}
+						rr = nrr;
+						rr_sz = nrr_sz;
+						rr_max *= 2;
+					}
+					
+					/* We don't need to pay special attention to the contents here. */
+					rr[rr_nb] = ahdr->avp_value->os.data;
+					rr_sz[rr_nb] = ahdr->avp_value->os.len;
+					rr_nb++;
+				}
 
-			/* Go to next AVP */
-			CHECK_FCT(  fd_msg_browse(avp, MSG_BRW_NEXT, &avp, NULL)  );
+				/* Go to next AVP */
+				CHECK_FCT_DO( ret = fd_msg_browse(avp, MSG_BRW_NEXT, &avp, NULL), goto rr_out );
+			}
+			
+			/* Remove these values from the list */
+			CHECK_FCT_DO( ret = fd_rtd_candidate_del_set(rtd, rr, rr_sz, rr_nb), goto rr_out );
+rr_out:
+			if (rr != rr_st) {
+				free(rr);
+				free(rr_sz);
+			}
+			if (ret || !msgptr) {
+				fd_rtd_free(&rtd);
+				return ret;
+			}
 		}
 		
 		/* Save the routing information in the message */
@@ -959,15 +1193,35 @@ static int msg_rt_out(struct msg * msg)
 
 	/* Ok, we have our list in rtd now, let's (re)initialize the scores */
 	fd_rtd_candidate_extract(rtd, &candidates, FD_SCORE_INI);
+	
+	/* The peer objects saved from fd_g_activ_peers are used without lock while the message is routed, like the result of 
+	   fd_peer_getbyid below. They are not kept when the message is routed again after a failover: the peer may be freed since. */
+	if (!rtd_is_new) {
+		for (li = candidates->next; li != candidates; li = li->next)
+			((struct rtd_candidate *)li)->peer = NULL;
+	}
 
 	/* Pass the list to registered callbacks (even if it is empty list) */
 	{
-		CHECK_FCT( pthread_rwlock_rdlock( &rt_out_lock ) );
-		pthread_cleanup_push( fd_cleanup_rwlock, &rt_out_lock );
+		struct rtc_key key;
+		uint32_t gen = 0;
+		int use_cache = 0, cached = 0, i;
+		struct rt_reader * rdr;
+		struct rt_snap * snap;
+		
+		CHECK_MALLOC( rdr = rt_read_begin() );
+		snap = __atomic_load_n(&rt_out_snap, __ATOMIC_SEQ_CST);
+		
+		/* If all the callbacks are cacheable, try to reuse a previous decision. The candidates are ordered only on first attempt. */
+		if (rtd_is_new && snap && snap->nb && !snap->nocache && !fd_rtc_get_key(msgptr, &key)) {
+			use_cache = 1;
+			gen = fd_rtc_gen();
+			cached = fd_rtc_apply(&key, candidates);
+		}
 
 		/* We call the cb by reverse priority order */
-		for (	li = rt_out_list.prev ; (msgptr != NULL) && (li != &rt_out_list) ; li = li->prev ) {
-			struct rt_hdl * rh = (struct rt_hdl *)li;
+		for (	i = (snap ? snap->nb - 1 : -1) ; (msgptr != NULL) && (!cached) && (i >= 0) ; i-- ) {
+			struct rt_hdl * rh = snap->hdl[i];
 
 			TRACE_DEBUG(ANNOYING, "Calling next OUT callback on %p : %p (prio %d)", msgptr, rh->rt_out_cb, rh->prio);
 			CHECK_FCT_DO( ret = (*rh->rt_out_cb)(rh->cbdata, &msgptr, candidates),
@@ -980,14 +1234,19 @@ static int msg_rt_out(struct msg * msg)
 					msgptr = NULL;
 				} );
 		}
+		
+		if (use_cache && !cached && msgptr)
+			fd_rtc_save(&key, gen, candidates, FD_SCORE_INI);
 
-		pthread_cleanup_pop(0);
-		CHECK_FCT( pthread_rwlock_unlock( &rt_out_lock ) );
+		rt_read_end(rdr);
 
 		/* If an error occurred or the callback disposed of the message, go to next message */
 		if (! msgptr) {
 			return 0;
 		}
+		
+		/* Apply the cached Redirect-Host information, if any, after the callbacks or the replay of their decision */
+		CHECK_FCT_DO( fd_rtredir_apply( msgptr, candidates ), /* continue */ );
 	}
 	
 	/* Order the candidate peers by score attributed by the callbacks */
@@ -1007,8 +1266,14 @@ static int msg_rt_out(struct msg * msg)
 		CHECK_FCT( fd_peer_getbyid( c->diamid, c->diamidlen, 0, (void *)&peer ) );
 
 		if (fd_peer_getstate(peer) == STATE_OPEN) {
+			/* Skip the peer if it is over its rate limit */
+			if (fd_rtlim_out_peer(peer)) {
+				limited = 1;
+				continue;
+			}
+			
 			/* Send to this one */
-			CHECK_FCT_DO( fd_out_send(&msgptr, NULL, peer, 1), continue );
+			CHECK_FCT_DO( fd_out_send(&msgptr, NULL, peer, 1), { fd_rtlim_out_peer_cancel(peer); continue; } );
 			
 			/* If the sending was successful */
 			break;
@@ -1017,8 +1282,13 @@ static int msg_rt_out(struct msg * msg)
 
 	/* If the message has not been sent, return an error */
 	if (msgptr) {
-		fd_hook_call(HOOK_MESSAGE_ROUTING_ERROR, msgptr, NULL, "No remaining suitable candidate to route the message to", fd_msg_pmdl_get(msgptr));
-		return_error( &msgptr, "DIAMETER_UNABLE_TO_DELIVER", "No suitable candidate to route the message to", NULL);
+		if (limited) {
+			fd_hook_call(HOOK_MESSAGE_ROUTING_ERROR, msgptr, NULL, "The remaining candidates are over their rate limit", fd_msg_pmdl_get(msgptr));
+			return_error( &msgptr, "DIAMETER_TOO_BUSY", "Rate limit exceeded", NULL);
+		} else {
+			fd_hook_call(HOOK_MESSAGE_ROUTING_ERROR, msgptr, NULL, "No remaining suitable candidate to route the message to", fd_msg_pmdl_get(msgptr));
+			return_error( &msgptr, "DIAMETER_UNABLE_TO_DELIVER", "No suitable candidate to route the message to", NULL);
+		}
 	}
 
 	/* We're done with this message */
@@ -1165,11 +1435,20 @@ static enum thread_state in_state = NOTRUNNING;
 int fd_rtdisp_init(void)
 {
 	int i;
+	struct fd_rt_out_hdl * hdl;
 	
 	/* Prepare the array for dispatch */
 	CHECK_MALLOC( disp_state = calloc(fd_g_config->cnf_dispthr, sizeof(enum thread_state)) );
 	CHECK_MALLOC( dispatch = calloc(fd_g_config->cnf_dispthr, sizeof(pthread_t)) );
 	
+	/* The routing threads register themselves as readers of the callbacks lists */
+	CHECK_POSIX( pthread_key_create(&rt_reader_key, rt_reader_destroy) );
+	rt_reader_key_ok = 1;
+	
+	/* Prepare the cache of redirect answers */
+	CHECK_FCT( fd_rtredir_init() );
+	CHECK_FCT( fd_rtlim_init() );
+	
 	/* Create the threads */
 	for (i=0; i < fd_g_config->cnf_dispthr; i++) {
 		CHECK_POSIX( pthread_create( &dispatch[i], NULL, dispatch_thr, &disp_state[i] ) );
@@ -1179,9 +1458,11 @@ int fd_rtdisp_init(void)
 	
 	/* Later: TODO("Set the thresholds for the queues to create more threads as needed"); */
 	
-	/* Register the built-in callbacks */
-	CHECK_FCT( fd_rt_out_register( dont_send_if_no_common_app, NULL, 10, NULL ) );
-	CHECK_FCT( fd_rt_out_register( score_destination_avp, NULL, 10, NULL ) );
+	/* Register the built-in callbacks, their scores depend only on the cached criteria */
+	CHECK_FCT( fd_rt_out_register( dont_send_if_no_common_app, NULL, 10, &hdl ) );
+	CHECK_FCT( fd_rt_out_set_cacheable( hdl, 1 ) );
+	CHECK_FCT( fd_rt_out_register( score_destination_avp, NULL, 10, &hdl ) );
+	CHECK_FCT( fd_rt_out_set_cacheable( hdl, 1 ) );
 	
 	return 0;
 }
@@ -1285,6 +1566,20 @@ int fd_rtdisp_cleanup(void)
 	}
 	
 	fd_disp_unregister_all(); /* destroy remaining handlers */
+	
+	/* The routing threads are stopped, we can free the last snapshots */
+	free(rt_fwd_snap);
+	rt_fwd_snap = NULL;
+	free(rt_out_snap);
+	rt_out_snap = NULL;
+	if (rt_reader_key_ok) {
+		CHECK_POSIX_DO( pthread_key_delete(rt_reader_key), /* continue */ );
+		rt_reader_key_ok = 0;
+	}
+	
+	CHECK_FCT_DO( fd_rtredir_fini(), /* continue */ );
+	CHECK_FCT_DO( fd_rtlim_fini(), /* continue */ );
+	fd_rtc_fini();
 
 	return 0;
 }
@@ -44,6 +44,31 @@
 #define CMSG_BUF_LEN	1024
 #endif /* CMSG_BUF_LEN */
 
+/* Number of messages received or sent with a single system call, when several are available */
+#define SCTP_RCVBATCH_SIZE	16
+#define SCTP_SNDBATCH_SIZE	16
+
+#ifdef HAVE_MMSG
+typedef struct mmsghdr sctp_mmsg_t;
+#else /* HAVE_MMSG */
+/* Without recvmmsg / sendmmsg, the batches contain only one message */
+typedef struct {
+	struct msghdr	msg_hdr;
+	unsigned int	msg_len;
+} sctp_mmsg_t;
+#endif /* HAVE_MMSG */
+
+/* The messages read from the socket by the last call, consumed one by one by fd_sctp_recvmeta.
+ The buffer of a slot is given to the caller with the message it contains, a new one is allocated before the next read. */
+struct sctp_rcvbatch {
+	sctp_mmsg_t	 msgs[SCTP_RCVBATCH_SIZE];
+	struct iovec	 iov[SCTP_RCVBATCH_SIZE];	/* iov_base is NULL once the buffer was given away */
+	char		 anci[SCTP_RCVBATCH_SIZE][CMSG_BUF_LEN];
+	size_t		 slotsz;
+	int		 count;		/* number of messages read by the last call */
+	int		 next;		/* the next message to consume */
+};
+
 /* Use old draft-ietf-tsvwg-sctpsocket-17 API ? If not defined, RFC6458 API will be used */
 /* #define OLD_SCTP_SOCKET_API */
 
@@ -1139,15 +1164,175 @@ again:
 	return ret;
 }
 
-/* Receive the next data from the socket, or next notification */
+/* Send several messages at once, each one in a single iovec and over its own stream. Returns the number of messages sent,
+ less than count if an error occurred after the first ones were sent, or -1 and errno is set. */
+ssize_t fd_sctp_sendstrmv(struct cnxctx * conn, const uint16_t * strids, const struct iovec *iov, int count)
+{
+	sctp_mmsg_t		 msgs[SCTP_SNDBATCH_SIZE];
+	union {
+		struct cmsghdr	 hdr;
+#ifdef OLD_SCTP_SOCKET_API
+		uint8_t		 buf[CMSG_SPACE(sizeof(struct sctp_sndrcvinfo))];
+#else /* OLD_SCTP_SOCKET_API */
+		uint8_t		 buf[CMSG_SPACE(sizeof(struct sctp_sndinfo))];
+#endif /* OLD_SCTP_SOCKET_API */
+	}			 anci[SCTP_SNDBATCH_SIZE];
+	ssize_t ret;
+	int sent = 0, nb, i;
+	struct timespec ts, now;
+	
+	TRACE_ENTRY("%p %p %p %d", conn, strids, iov, count);
+	CHECK_PARAMS_DO(conn && strids && iov && count, { errno = EINVAL; return -1; } );
+	CHECK_SYS_DO(  clock_gettime(CLOCK_REALTIME, &ts), return -1 );
+	
+	while (sent < count) {
+		nb = count - sent;
+		if (nb > SCTP_SNDBATCH_SIZE)
+			nb = SCTP_SNDBATCH_SIZE;
+		
+		memset(msgs, 0, nb * sizeof(msgs[0]));
+		memset(anci, 0, nb * sizeof(anci[0]));
+		
+		/* One anciliary block per message, to specify its SCTP stream */
+		for (i = 0; i < nb; i++) {
+			struct cmsghdr * hdr = &anci[i].hdr;
+			hdr->cmsg_len   = sizeof(anci[i]);
+			hdr->cmsg_level = IPPROTO_SCTP;
+#ifdef OLD_SCTP_SOCKET_API
+			hdr->cmsg_type  = SCTP_SNDRCV;
+			((struct sctp_sndrcvinfo *)CMSG_DATA(hdr))->sinfo_stream = strids[sent + i];
+#else /* OLD_SCTP_SOCKET_API */
+			hdr->cmsg_type  = SCTP_SNDINFO;
+			((struct sctp_sndinfo *)CMSG_DATA(hdr))->snd_sid = strids[sent + i];
+#endif /* OLD_SCTP_SOCKET_API */
+			
+			msgs[i].msg_hdr.msg_iov        = (struct iovec *)&iov[sent + i];
+			msgs[i].msg_hdr.msg_iovlen     = 1;
+			msgs[i].msg_hdr.msg_control    = &anci[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(anci[i]);
+		}
+		
+		TRACE_DEBUG(FULL, "Sending %d messages (first:%zdb on stream %hu) on socket %d", nb, iov[sent].iov_len, strids[sent], conn->cc_socket);
+again:
+#ifdef HAVE_MMSG
+		ret = sendmmsg(conn->cc_socket, msgs, nb, 0);
+#else /* HAVE_MMSG */
+		ret = sendmsg(conn->cc_socket, &msgs[0].msg_hdr, 0);
+		if (ret >= 0)
+			ret = 1;
+#endif /* HAVE_MMSG */
+		/* Handle special case of timeout */
+		if ((ret < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+			int err = errno;
+			pthread_testcancel();
+			/* Check how much time we were blocked since the last message was sent. */
+			CHECK_SYS_DO(  clock_gettime(CLOCK_REALTIME, &now), return -1 );
+			if ( ((now.tv_sec - ts.tv_sec) * 1000 + ((now.tv_nsec - ts.tv_nsec) / 1000000L)) > MAX_HOTL_BLOCKING_TIME) {
+				LOG_D("Unable to send any data for %dms, closing the connection", MAX_HOTL_BLOCKING_TIME);
+			} else if (! fd_cnx_teststate(conn, CC_STATUS_CLOSING )) {
+				goto again; /* don't care, just ignore */
+			}
+			
+			/* propagate the error */
+			errno = err;
+		}
+		
+		if (ret < 0) {
+			CHECK_SYS_DO( ret, ); /* for tracing error only */
+			return sent ? sent : -1;
+		}
+		
+		/* Messages are sent entirely or not at all; continue after the last one that was sent */
+		sent += ret;
+		CHECK_SYS_DO(  clock_gettime(CLOCK_REALTIME, &ts), return -1 );
+	}
+	
+	return sent;
+}
+
+/* Read from the socket the messages already available, at least one (blocking), up to SCTP_RCVBATCH_SIZE. Returns the number of messages read or -1. */
+static ssize_t sctp_rcvbatch_fill(struct cnxctx * conn, struct sctp_rcvbatch * b)
+{
+	ssize_t ret;
+	int i;
+	
+	/* The kernel updated these fields in the previous call */
+	for (i = 0; i < b->count; i++) {
+		b->msgs[i].msg_hdr.msg_controllen = CMSG_BUF_LEN;
+		b->msgs[i].msg_hdr.msg_flags = 0;
+	}
+	b->count = 0;
+	b->next = 0;
+	
+	/* Replace the buffers given away with the messages */
+	for (i = 0; i < SCTP_RCVBATCH_SIZE; i++) {
+		if (!b->iov[i].iov_base) {
+			CHECK_MALLOC_DO( b->iov[i].iov_base = malloc(b->slotsz), { errno = ENOMEM; return -1; } );
+		}
+	}
+	
+#ifdef HAVE_MMSG
+	/* Block for the first message only, then take those that are already queued. When the receiver stops after
+	 the first message (cc_loop not set), the following data may be for another reader (TLS handshake), leave it in the socket. */
+	ret = recvmmsg(conn->cc_socket, b->msgs, conn->cc_loop ? SCTP_RCVBATCH_SIZE : 1, MSG_WAITFORONE, NULL);
+#else /* HAVE_MMSG */
+	ret = recvmsg(conn->cc_socket, &b->msgs[0].msg_hdr, 0);
+	if (ret >= 0) {
+		b->msgs[0].msg_len = ret;
+		ret = 1;
+	}
+#endif /* HAVE_MMSG */
+	
+	if (ret > 0)
+		b->count = ret;
+	
+	return ret;
+}
+
+/* Allocate the receive batch of a connection */
+static int sctp_rcvbatch_new(struct cnxctx * conn, size_t slotsz)
+{
+	struct sctp_rcvbatch * b;
+	int i;
+	
+	CHECK_MALLOC( b = calloc(1, sizeof(struct sctp_rcvbatch)) );
+	b->slotsz = slotsz;
+	
+	/* The buffers are allocated by sctp_rcvbatch_fill */
+	for (i = 0; i < SCTP_RCVBATCH_SIZE; i++) {
+		b->iov[i].iov_len  = slotsz;
+		b->msgs[i].msg_hdr.msg_iov        = &b->iov[i];
+		b->msgs[i].msg_hdr.msg_iovlen     = 1;
+		b->msgs[i].msg_hdr.msg_control    = b->anci[i];
+		b->msgs[i].msg_hdr.msg_controllen = CMSG_BUF_LEN;
+	}
+	
+	conn->cc_sctp_para.rcvbatch = b;
+	return 0;
+}
+
+/* Free the receive batch, the messages not consumed yet are lost */
+void fd_sctp_rcvbatch_free(struct cnxctx * conn)
+{
+	CHECK_PARAMS_DO( conn, return );
+	
+	if (conn->cc_sctp_para.rcvbatch) {
+		int i;
+		for (i = 0; i < SCTP_RCVBATCH_SIZE; i++)
+			free(conn->cc_sctp_para.rcvbatch->iov[i].iov_base);
+		free(conn->cc_sctp_para.rcvbatch);
+		conn->cc_sctp_para.rcvbatch = NULL;
+	}
+}
+
+/* Receive the next data from the socket, or next notification. The messages are read from the socket by batches, kept in conn */
 int fd_sctp_recvmeta(struct cnxctx * conn, uint16_t * strid, uint8_t ** buf, size_t * len, int *event)
 {
 	ssize_t 		 ret = 0;
-	struct msghdr 		 mhdr;
-	char   			 ancidata[ CMSG_BUF_LEN ];
-	struct iovec 		 iov;
+	struct sctp_rcvbatch	*b;
+	struct msghdr 		*mhdr;
 	uint8_t			*data = NULL;
-	size_t 			 bufsz = 0, datasize = 0;
+	size_t 			 bufsz = 0, datasize = 0, rcvd;
 	size_t			 mempagesz = sysconf(_SC_PAGESIZE); /* We alloc buffer by memory pages for efficiency */
 	int 			 timedout = 0;
 	
@@ -1158,65 +1343,79 @@ int fd_sctp_recvmeta(struct cnxctx * conn, uint16_t * strid, uint8_t ** buf, siz
 	*buf = NULL;
 	*len = 0;
 	*event = 0;
+	if (strid)
+		*strid = 0;
 	
-	/* Prepare header for receiving message */
-	memset(&mhdr, 0, sizeof(mhdr));
-	mhdr.msg_iov    = &iov;
-	mhdr.msg_iovlen = 1;
-	mhdr.msg_control    = &ancidata;
-	mhdr.msg_controllen = sizeof(ancidata);
+	/* Prepare the batch on first call */
+	if (!conn->cc_sctp_para.rcvbatch) {
+		CHECK_FCT( sctp_rcvbatch_new(conn, mempagesz) );
+	}
+	b = conn->cc_sctp_para.rcvbatch;
 	
 next_message:
 	datasize = 0;
 	
 	/* We will loop while all data is not received. */
 incomplete:
-	while (datasize >= bufsz ) {
-		/* The buffer is full, enlarge it */
-		bufsz += mempagesz;
-		CHECK_MALLOC( data = realloc(data, bufsz ) );
-	}
-	/* the new data will be received following the preceding */
-	memset(&iov,  0, sizeof(iov));
-	iov.iov_base = data + datasize ;
-	iov.iov_len  = bufsz - datasize;
-
-	/* Receive data from the socket */
+	if (b->next >= b->count) {
+		/* All the messages of the previous batch were consumed, read the next ones */
 again:
-	pthread_cleanup_push(free, data);
-	ret = recvmsg(conn->cc_socket, &mhdr, 0);
-	pthread_testcancel();
-	pthread_cleanup_pop(0);
-	
-	/* First, handle timeouts (same as fd_cnx_s_recv) */
-	if ((ret < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
-		if (! fd_cnx_teststate(conn, CC_STATUS_CLOSING ))
-			goto again; /* don't care, just ignore */
-		if (!timedout) {
-			timedout ++; /* allow for one timeout while closing */
-			goto again;
+		pthread_cleanup_push(free, data);
+		ret = sctp_rcvbatch_fill(conn, b);
+		pthread_testcancel();
+		pthread_cleanup_pop(0);
+		
+		/* First, handle timeouts (same as fd_cnx_s_recv) */
+		if ((ret < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+			if (! fd_cnx_teststate(conn, CC_STATUS_CLOSING ))
+				goto again; /* don't care, just ignore */
+			if (!timedout) {
+				timedout ++; /* allow for one timeout while closing */
+				goto again;
+			}
+			/* fallback to normal handling */
+		}
+		
+		/* Handle errors */
+		if (ret < 0) {
+			CHECK_SYS_DO(ret, /* to log in case of error */);
+			goto closed;
 		}
-		/* fallback to normal handling */
 	}
 	
-	/* Handle errors */
-	if (ret <= 0) { /* Socket timedout, closed, or an error occurred */
-		CHECK_SYS_DO(ret, /* to log in case of error */);
-		free(data);
-		*event = FDEVP_CNX_ERROR;
-		return 0;
+	/* Consume the next message of the batch */
+	mhdr = &b->msgs[b->next].msg_hdr;
+	rcvd = b->msgs[b->next].msg_len;
+	
+	/* The socket was closed */
+	if (rcvd == 0)
+		goto closed;
+	
+	if (!data) {
+		/* Take the buffer of the slot, the message is not copied */
+		data = b->iov[b->next].iov_base;
+		bufsz = b->slotsz;
+		b->iov[b->next].iov_base = NULL;
+	} else {
+		/* The new data follows the preceding, enlarge the buffer if needed */
+		if (datasize + rcvd > bufsz) {
+			bufsz = ((datasize + rcvd) / mempagesz + 1) * mempagesz;
+			CHECK_MALLOC( data = realloc(data, bufsz ) );
+		}
+		memcpy(data + datasize, b->iov[b->next].iov_base, rcvd);
 	}
+	b->next++;
 	
 	/* Update the size of data we received */
-	datasize += ret;
+	datasize += rcvd;
 
 	/* SCTP provides an indication when we received a full record; loop if it is not the case */
-	if ( ! (mhdr.msg_flags & MSG_EOR) ) {
+	if ( ! (mhdr->msg_flags & MSG_EOR) ) {
 		goto incomplete;
 	}
 	
 	/* Handle the case where the data received is a notification */
-	if (mhdr.msg_flags & MSG_NOTIFICATION) {
+	if (mhdr->msg_flags & MSG_NOTIFICATION) {
 		union sctp_notification * notif = (union sctp_notification *) data;
 		
 		TRACE_DEBUG(FULL, "Received %zdb data of notification on socket %d", datasize, conn->cc_socket);
@@ -1300,7 +1499,7 @@ again:
 #endif /*  OLD_SCTP_SOCKET_API */
 		
 		/* Handle the anciliary data */
-		for (hdr = CMSG_FIRSTHDR(&mhdr); hdr; hdr = CMSG_NXTHDR(&mhdr, hdr)) {
+		for (hdr = CMSG_FIRSTHDR(mhdr); hdr; hdr = CMSG_NXTHDR(mhdr, hdr)) {
 
 			/* We deal only with anciliary data at SCTP level */
 			if (hdr->cmsg_level != IPPROTO_SCTP) {
@@ -1350,4 +1549,9 @@ again:
 	}
 	
 	return 0;
+	
+closed:
+	free(data);
+	*event = FDEVP_CNX_ERROR;
+	return 0;
 }
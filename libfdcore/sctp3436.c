@@ -45,13 +45,19 @@
 /*
 
 Architecture of this wrapper:
- - we have several fifo queues (1 per stream pairs).
+ - we have one gnutls_session per stream pair.
  GnuTLS is configured to use custom push / pull functions:
- - the pull function retrieves the data from the fifo queue corresponding to a stream #.
+ - the pull function retrieves the data received on the stream #.
  - the push function sends the data on a certain stream.
- We also have a demux thread that reads the socket and store received data in the appropriate fifo
+ We have a demux thread that reads the socket and finds the stream of received data.
  
- We have one gnutls_session per stream pair, and as many threads that read the gnutls records and save incoming data to the target queue.
+ During the handshake of a session, the demux thread stores the data in a fifo queue (1 per stream pair), and the thread
+ performing the handshake pulls from this queue (blocking).
+ Once the handshake is complete, the session is "direct": the demux thread passes the data to the session and decrypts it
+ itself (the pull function does not block anymore), then saves incoming messages to the target queue. 
+ So an established association uses only one thread, whatever the number of stream pairs.
+ When the target queue is full, the demux thread waits for room outside of the session lock before reading the socket again,
+ so the remote peer is slowed down by the SCTP flow control as with the other receiver threads.
  
 This complexity is required because we cannot read a socket for a given stream only; we can only get the next message and find its stream.
 */
@@ -62,7 +68,57 @@ This complexity is required because we cannot read a socket for a given stream o
 /*                      threads                              */
 /*************************************************************/
 
-/* Demux received data and store in the appropriate fifo */
+/* The TLS session of a stream pair */
+static gnutls_session_t ctx_session(struct sctp3436_ctx * ctx)
+{
+	return ctx->strid ? ctx->session : ctx->parent->cc_tls_para.session;
+}
+
+/* Decrypt the data available for a direct session. Called with ctx->lock held.
+ Returns EWOULDBLOCK when the target queue is full, with the complete message saved in full (see fd_tls_rcv_inline) */
+static int direct_recv(struct sctp3436_ctx * ctx, struct fd_tls_rcvstate * full)
+{
+	struct cnxctx * conn = ctx->parent;
+	struct fd_sctp_strstats * stats = NULL;
+	int ret;
+	
+	if (ctx->closed)
+		return 0;
+	
+	if (conn->cc_sctp_para.stats_in && (ctx->strid < conn->cc_sctp_para.str_in))
+		stats = &conn->cc_sctp_para.stats_in[ctx->strid];
+	
+	ret = fd_tls_rcv_inline(conn, ctx_session(ctx), &ctx->rcv, stats, full);
+	if (ret == EWOULDBLOCK)
+		return ret;
+	
+	if (ret) {
+		ctx->closed = 1;
+		/* The data we may not have read yet is discarded */
+		free(ctx->partial.buf);
+		memset(&ctx->partial, 0, sizeof(ctx->partial));
+	}
+	return 0;
+}
+
+/* Cleanup handler for the message waiting for room in the target queue */
+static void free_full(void * arg)
+{
+	fd_tls_rcvstate_clear(arg);
+}
+
+/* Are all the sessions closed? */
+static int all_closed(struct cnxctx * conn)
+{
+	uint16_t i;
+	for (i = 0; i < conn->cc_sctp_para.pairs; i++) {
+		if (!conn->cc_sctp3436_data.array[i].closed)
+			return 0;
+	}
+	return 1;
+}
+
+/* Demux received data and decrypt it, or store it in the appropriate fifo during the handshake */
 static void * demuxer(void * arg)
 {
 	struct cnxctx * conn = arg;
@@ -70,6 +126,8 @@ static void * demuxer(void * arg)
 	size_t    bufsz;
 	int	  event;
 	uint16_t  strid;
+	int	  closed = 0;
+	struct fd_tls_rcvstate full;
 	
 	TRACE_ENTRY("%p", arg);
 	CHECK_PARAMS_DO(conn && (conn->cc_socket > 0), goto out);
@@ -85,13 +143,59 @@ static void * demuxer(void * arg)
 	ASSERT( fd_cnx_target_queue(conn) );
 	ASSERT( conn->cc_sctp3436_data.array );
 	
+	memset(&full, 0, sizeof(full));
+	
 	do {
 		CHECK_FCT_DO( fd_sctp_recvmeta(conn, &strid, &buf, &bufsz, &event), goto fatal );
 		switch (event) {
 			case FDEVP_CNX_MSG_RECV:
-				/* Demux this message to the appropriate fifo, another thread will pull, gnutls process, and send to target queue */
 				if (strid < conn->cc_sctp_para.pairs) {
-					CHECK_FCT_DO(fd_event_send(conn->cc_sctp3436_data.array[strid].raw_recv, event, bufsz, buf), goto fatal );
+					struct sctp3436_ctx * ctx = &conn->cc_sctp3436_data.array[strid];
+					int ret = 0, state;
+					
+					/* We must not be canceled while processing the session */
+					CHECK_POSIX_DO( pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state), goto fatal );
+					CHECK_POSIX_DO( pthread_mutex_lock(&ctx->lock), goto fatal );
+					if (ctx->direct) {
+						if (ctx->closed) {
+							free(buf);
+						} else {
+							/* The previous data was consumed entirely, otherwise the session would have been closed */
+							ASSERT(ctx->partial.buf == NULL);
+							ctx->partial.buf = buf;
+							ctx->partial.bufsz = bufsz;
+							ctx->partial.offset = 0;
+							ret = direct_recv(ctx, &full);
+							closed = ctx->closed;
+						}
+					} else {
+						/* A thread is performing the handshake on this stream, it will pull the data from this fifo.
+						 We must not block while holding the lock, the handshake is short anyway */
+						CHECK_FCT_DO( ret = fd_fifo_post_tagged_noblock(ctx->raw_recv, event, bufsz, buf), /* continue */ );
+					}
+					CHECK_POSIX_DO( pthread_mutex_unlock(&ctx->lock), goto fatal );
+					CHECK_POSIX_DO( pthread_setcancelstate(state, NULL), goto fatal );
+					
+					/* The target queue is full: wait for room, then decrypt the rest of the data. We do not read the socket meanwhile. */
+					while (ret == EWOULDBLOCK) {
+						pthread_cleanup_push( free_full, &full );
+						CHECK_FCT_DO( ret = fd_cnx_recv_post( conn, &full.rcv_data, full.limit ), );
+						pthread_cleanup_pop( ret ? 1 : 0 );
+						CHECK_FCT_DO( ret, goto fatal );
+						memset(&full, 0, sizeof(full));
+						
+						CHECK_POSIX_DO( pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state), goto fatal );
+						CHECK_POSIX_DO( pthread_mutex_lock(&ctx->lock), goto fatal );
+						ret = direct_recv(ctx, &full);
+						closed = ctx->closed;
+						CHECK_POSIX_DO( pthread_mutex_unlock(&ctx->lock), goto fatal );
+						CHECK_POSIX_DO( pthread_setcancelstate(state, NULL), goto fatal );
+					}
+					CHECK_FCT_DO( ret, goto fatal );
+					
+					/* After the remote peer closed all the sessions, we are done */
+					if (closed && all_closed(conn))
+						goto out;
 				} else {
 					TRACE_DEBUG(INFO, "Received packet (%zd bytes) on out-of-range stream #%d from %s, discarded.", bufsz, strid, conn->cc_remid);
 					free(buf);
@@ -117,7 +221,7 @@ static void * demuxer(void * arg)
 	} while (conn->cc_loop);
 	
 out:
-	/* Signal termination of the connection to all decipher threads */
+	/* Signal termination of the connection to the threads still handshaking */
 	for (strid = 0; strid < conn->cc_sctp_para.pairs; strid++) {
 		if (conn->cc_sctp3436_data.array[strid].raw_recv) {
 			CHECK_FCT_DO(fd_event_send(conn->cc_sctp3436_data.array[strid].raw_recv, FDEVP_CNX_ERROR, 0, NULL), goto fatal );
@@ -133,31 +237,6 @@ fatal:
 	goto out;
 }
 
-/* Decrypt the data received in this stream pair and store it in the target queue */
-static void * decipher(void * arg)
-{
-	struct sctp3436_ctx * ctx = arg;
-	struct cnxctx 	 *cnx;
-	
-	TRACE_ENTRY("%p", arg);
-	CHECK_PARAMS_DO(ctx && ctx->raw_recv && ctx->parent, goto error);
-	cnx = ctx->parent;
-	ASSERT( fd_cnx_target_queue(cnx) );
-	
-	/* Set the thread name */
-	{
-		char buf[48];
-		snprintf(buf, sizeof(buf), "Decipher (%hu@%d:%s)", ctx->strid, cnx->cc_socket, cnx->cc_remid);
-		fd_log_threadname ( buf );
-	}
-	
-	/* The next function loops while there is no error */
-	CHECK_FCT_DO(fd_tls_rcvthr_core(cnx, ctx->strid ? ctx->session : cnx->cc_tls_para.session), /* continue */);
-error:
-	fd_cnx_markerror(cnx);
-	TRACE_DEBUG(FULL, "Thread terminated");	
-	return NULL;
-}
 
 /*************************************************************/
 /*                     push / pull                           */
@@ -231,10 +310,21 @@ static ssize_t sctp3436_pull(gnutls_transport_ptr_t tr, void * buf, size_t len)
 	TRACE_ENTRY("%p %p %zd", tr, buf, len);
 	CHECK_PARAMS_DO( tr && buf, { errno = EINVAL; goto error; } );
 	
-	/* If we don't have data available now, pull new message from the fifo -- this is blocking (until the queue is destroyed) */
+	/* If we don't have data available now, pull new message from the fifo */
 	if (!ctx->partial.buf) {
 		int ev;
-		CHECK_FCT_DO( errno = fd_event_get(ctx->raw_recv, &ev, &ctx->partial.bufsz, (void *)&ctx->partial.buf), goto error );
+		if (ctx->direct) {
+			/* Called by the demuxer: only the data queued during the handshake may be waiting, the demuxer calls again when more data is received */
+			errno = fd_fifo_tryget_tagged(ctx->raw_recv, &ev, &ctx->partial.bufsz, (void *)&ctx->partial.buf);
+			if (errno == EWOULDBLOCK) {
+				errno = EAGAIN;
+				goto error;
+			}
+			CHECK_FCT_DO( errno, goto error );
+		} else {
+			/* During the handshake -- this is blocking (until the queue is destroyed) */
+			CHECK_FCT_DO( errno = fd_event_get(ctx->raw_recv, &ev, &ctx->partial.bufsz, (void *)&ctx->partial.buf), goto error );
+		}
 		if (ev == FDEVP_CNX_ERROR) {
 			/* Documentations says to return 0 on connection closed, but it does hang within gnutls_handshake */
 			return -1;
@@ -265,7 +355,7 @@ static ssize_t sctp3436_pull(gnutls_transport_ptr_t tr, void * buf, size_t len)
 	return pulled;
 	
 error:
-	gnutls_transport_set_errno (ctx->session, errno);
+	gnutls_transport_set_errno (ctx_session(ctx), errno);
 	return -1;
 }
 
@@ -567,6 +657,7 @@ int fd_sctp3436_init(struct cnxctx * conn)
 	for (i = 0; i < conn->cc_sctp_para.pairs; i++) {
 		conn->cc_sctp3436_data.array[i].parent = conn;
 		conn->cc_sctp3436_data.array[i].strid  = i;
+		CHECK_POSIX( pthread_mutex_init(&conn->cc_sctp3436_data.array[i].lock, NULL) );
 		CHECK_FCT( fd_fifo_new(&conn->cc_sctp3436_data.array[i].raw_recv, 10) );
 	}
 	
@@ -675,7 +766,20 @@ int fd_sctp3436_handshake_others(struct cnxctx * conn, char * priority, void * a
 	return 0;
 }
 
-/* Receive messages from others ? all other stream pairs : the master pair */
+/* Let the demuxer decrypt the data of a session from now on */
+static int set_direct(struct sctp3436_ctx * ctx)
+{
+	CHECK_POSIX( pthread_mutex_lock(&ctx->lock) );
+	pthread_cleanup_push( fd_cleanup_mutex, &ctx->lock );
+	ctx->direct = 1;
+	/* Process the data that was received after the handshake, if any. It is posted even if the target queue is full, this is bounded by the handshake. */
+	direct_recv(ctx, NULL);
+	pthread_cleanup_pop( 0 );
+	CHECK_POSIX( pthread_mutex_unlock(&ctx->lock) );
+	return 0;
+}
+
+/* Receive messages from others ? all other stream pairs : the master pair. The demuxer thread decrypts the data of all sessions */
 int fd_sctp3436_startthreads(struct cnxctx * conn, int others)
 {
 	uint16_t i;
@@ -685,12 +789,10 @@ int fd_sctp3436_startthreads(struct cnxctx * conn, int others)
 	
 	if (others) {
 		for (i = 1; i < conn->cc_sctp_para.pairs; i++) {
-
-			/* Start the decipher thread */
-			CHECK_POSIX( pthread_create( &conn->cc_sctp3436_data.array[i].thr, NULL, decipher, &conn->cc_sctp3436_data.array[i] ) );
+			CHECK_FCT( set_direct(&conn->cc_sctp3436_data.array[i]) );
 		}
 	} else {
-		CHECK_POSIX( pthread_create( &conn->cc_sctp3436_data.array[0].thr, NULL, decipher, &conn->cc_sctp3436_data.array[0] ) );
+		CHECK_FCT( set_direct(&conn->cc_sctp3436_data.array[0]) );
 	}
 	return 0;
 }
@@ -724,6 +826,12 @@ void fd_sctp3436_waitthreadsterm(struct cnxctx * conn)
 			conn->cc_sctp3436_data.array[i].thr = (pthread_t)NULL;
 		}
 	}
+	
+	/* The demuxer terminates once all sessions are closed by the remote peer, or on socket error */
+	if (conn->cc_rcvthr != (pthread_t)NULL) {
+		CHECK_POSIX_DO( pthread_join(conn->cc_rcvthr, NULL), /* continue */ );
+		conn->cc_rcvthr = (pthread_t)NULL;
+	}
 	return;
 }
 
@@ -755,6 +863,9 @@ void fd_sctp3436_stopthreads(struct cnxctx * conn)
 	for (i = 0; i < conn->cc_sctp_para.pairs; i++) {
 		CHECK_FCT_DO( fd_thr_term(&conn->cc_sctp3436_data.array[i].thr), /* continue */ );
 	}
+	
+	/* The demuxer uses the sessions, so stop it as well */
+	CHECK_FCT_DO( fd_thr_term(&conn->cc_rcvthr), /* continue */ );
 	return;
 }
 
@@ -765,17 +876,16 @@ void fd_sctp3436_destroy(struct cnxctx * conn)
 	
 	CHECK_PARAMS_DO( conn && conn->cc_sctp3436_data.array, return );
 	
-	/* Terminate all receiving threads in case we did not do it yet */
+	/* Terminate all receiving threads (including the demux thread) in case we did not do it yet */
 	fd_sctp3436_stopthreads(conn);
 	
-	/* Now, stop the demux thread */
-	CHECK_FCT_DO( fd_thr_term(&conn->cc_rcvthr), /* continue */ );
-	
 	/* Free remaining data in the array */
 	for (i = 0; i < conn->cc_sctp_para.pairs; i++) {
 		if (conn->cc_sctp3436_data.array[i].raw_recv)
 			fd_event_destroy( &conn->cc_sctp3436_data.array[i].raw_recv, free );
 		free(conn->cc_sctp3436_data.array[i].partial.buf);
+		fd_tls_rcvstate_clear(&conn->cc_sctp3436_data.array[i].rcv);
+		CHECK_POSIX_DO( pthread_mutex_destroy(&conn->cc_sctp3436_data.array[i].lock), /* continue */ );
 		if (conn->cc_sctp3436_data.array[i].session) {
 			GNUTLS_TRACE( gnutls_deinit(conn->cc_sctp3436_data.array[i].session) );
 			conn->cc_sctp3436_data.array[i].session = NULL;
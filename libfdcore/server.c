@@ -92,6 +92,286 @@ static DECLARE_FD_DUMP_PROTOTYPE(dump_cnx, void * item) {
 	return *buf;
 }
 
+
+/* The TLS handshakes of incoming connections are performed by a pool of threads shared by all the secure servers, sized on the number
+ of CPUs since the handshake is mostly cryptography. The server workers then only wait for the CER on established connections. */
+
+/* Admission control: new connections are refused when that many handshakes per thread are already waiting */
+#ifndef HS_QUEUE_PER_WORKER
+#define HS_QUEUE_PER_WORKER	8
+#endif /* HS_QUEUE_PER_WORKER */
+
+/* Connections from an address whose last handshake failed are refused for a delay doubling with each failure, in seconds */
+#ifndef HS_BACKOFF_MIN
+#define HS_BACKOFF_MIN		1
+#endif /* HS_BACKOFF_MIN */
+#ifndef HS_BACKOFF_MAX
+#define HS_BACKOFF_MAX		64
+#endif /* HS_BACKOFF_MAX */
+
+/* At most that many addresses are remembered, the one that failed least recently is forgotten first */
+#ifndef HS_BACKOFF_ENTRIES
+#define HS_BACKOFF_ENTRIES	1024
+#endif /* HS_BACKOFF_ENTRIES */
+
+/* Size of the hash table of the addresses (pow of 2) */
+#define HS_BACKOFF_HASH_SIZE	8
+#define HS_BACKOFF_H_MASK( __hash ) ((__hash) & (( 1 << HS_BACKOFF_HASH_SIZE ) - 1))
+
+struct hs_job {
+	struct cnxctx *	conn;		/* the connection to handshake */
+	struct server *	s;		/* the server that accepted it */
+};
+
+struct hs_backoff {
+	struct fd_list	chain;		/* link in the hs_backoff_hash bucket */
+	struct fd_list	lru;		/* link in hs_backoff_lru, ordered by last failure */
+	uint32_t	hash;
+	char		remid[60];	/* remote address (fd_cnx_getremoteid) */
+	int		failures;	/* consecutive failed handshakes */
+	struct timespec	until;		/* connections are refused until this time */
+};
+
+static struct fifo *	hs_queue = NULL;	/* struct hs_job waiting for a thread */
+static pthread_t *	hs_workers = NULL;
+static int		hs_nb = 0;		/* number of threads */
+
+static pthread_mutex_t	hs_lock = PTHREAD_MUTEX_INITIALIZER;	/* protects the following data */
+static struct fd_list	hs_backoff_hash[1 << HS_BACKOFF_HASH_SIZE];
+static struct fd_list	hs_backoff_lru = FD_LIST_INITIALIZER(hs_backoff_lru);
+static int		hs_backoff_nb = 0;
+static long long	hs_ok = 0, hs_failed = 0, hs_refused_full = 0, hs_refused_backoff = 0;
+static long long	hs_time_us = 0, hs_time_max_us = 0;	/* cumulated and max duration of the handshakes */
+
+/* dump one item of the hs_queue fifo */
+static DECLARE_FD_DUMP_PROTOTYPE(dump_hs_job, void * item) {
+	struct hs_job * j = item;
+	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, " '%s'", fd_cnx_getid(j->conn)), return NULL);
+	return *buf;
+}
+
+/* Forget an address. Called with hs_lock held */
+static void hs_backoff_free(struct hs_backoff * b)
+{
+	fd_list_unlink(&b->chain);
+	fd_list_unlink(&b->lru);
+	free(b);
+	hs_backoff_nb--;
+}
+
+/* Find the backoff entry of an address. Called with hs_lock held */
+static struct hs_backoff * hs_backoff_find(char * remid, uint32_t hash, struct timespec * now)
+{
+	struct fd_list * li;
+	
+	/* We forget about an address once it had no failure for the max backoff time. The oldest failures come first. */
+	while (!FD_IS_LIST_EMPTY(&hs_backoff_lru)) {
+		struct hs_backoff * b = hs_backoff_lru.next->o;
+		if (now->tv_sec <= b->until.tv_sec + HS_BACKOFF_MAX)
+			break;
+		hs_backoff_free(b);
+	}
+	
+	for (li = hs_backoff_hash[HS_BACKOFF_H_MASK(hash)].next; li != &hs_backoff_hash[HS_BACKOFF_H_MASK(hash)]; li = li->next) {
+		struct hs_backoff * b = (struct hs_backoff *)li;
+		if ((b->hash == hash) && !strcmp(b->remid, remid))
+			return b;
+	}
+	return NULL;
+}
+
+/* Record the result of a handshake for the backoff and statistics */
+static void hs_account(struct cnxctx * conn, int success, struct timespec * start)
+{
+	struct timespec now, d;
+	struct hs_backoff * b;
+	char * remid = fd_cnx_getremoteid(conn);
+	uint32_t hash = fd_os_hash((uint8_t *)remid, strlen(remid));
+	long long us;
+	
+	CHECK_SYS_DO( clock_gettime(CLOCK_REALTIME, &now), return );
+	TS_DIFFERENCE( &d, start, &now );
+	us = (long long)d.tv_sec * 1000000 + d.tv_nsec / 1000;
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&hs_lock), return );
+	hs_time_us += us;
+	if (us > hs_time_max_us)
+		hs_time_max_us = us;
+	
+	b = hs_backoff_find(remid, hash, &now);
+	if (success) {
+		hs_ok++;
+		if (b)
+			hs_backoff_free(b);
+	} else {
+		int delay;
+		hs_failed++;
+		if (!b) {
+			if (hs_backoff_nb >= HS_BACKOFF_ENTRIES)
+				hs_backoff_free(hs_backoff_lru.next->o);
+			CHECK_MALLOC_DO( b = calloc(1, sizeof(struct hs_backoff)), goto out );
+			fd_list_init(&b->chain, b);
+			fd_list_init(&b->lru, b);
+			b->hash = hash;
+			snprintf(b->remid, sizeof(b->remid), "%s", remid);
+			fd_list_insert_before(&hs_backoff_hash[HS_BACKOFF_H_MASK(hash)], &b->chain);
+			hs_backoff_nb++;
+		}
+		/* The most recent failure goes last */
+		fd_list_unlink(&b->lru);
+		fd_list_insert_before(&hs_backoff_lru, &b->lru);
+		delay = HS_BACKOFF_MIN << b->failures;
+		if (delay >= HS_BACKOFF_MAX)
+			delay = HS_BACKOFF_MAX;
+		else
+			b->failures++;
+		b->until = now;
+		b->until.tv_sec += delay;
+	}
+out:
+	CHECK_POSIX_DO( pthread_mutex_unlock(&hs_lock), /* continue */ );
+}
+
+/* Queue a new connection for handshake, or refuse it */
+static int hs_submit(struct server * s, struct cnxctx * conn)
+{
+	struct hs_job * j;
+	struct hs_backoff * b;
+	struct timespec now;
+	char * refused = NULL;
+	char * remid = fd_cnx_getremoteid(conn);
+	uint32_t hash = fd_os_hash((uint8_t *)remid, strlen(remid));
+	
+	CHECK_SYS( clock_gettime(CLOCK_REALTIME, &now) );
+	
+	CHECK_POSIX( pthread_mutex_lock(&hs_lock) );
+	b = hs_backoff_find(remid, hash, &now);
+	if (b && TS_IS_INFERIOR(&now, &b->until)) {
+		hs_refused_backoff++;
+		refused = "the previous TLS handshake from this address failed recently";
+	} else if (fd_fifo_length(hs_queue) >= hs_nb * HS_QUEUE_PER_WORKER) {
+		hs_refused_full++;
+		refused = "too many TLS handshakes are already waiting";
+	}
+	CHECK_POSIX( pthread_mutex_unlock(&hs_lock) );
+	
+	if (refused) {
+		char buf[1024];
+		snprintf(buf, sizeof(buf), "Connection '%s' refused: %s.", fd_cnx_getid(conn), refused);
+		fd_hook_call(HOOK_PEER_CONNECT_FAILED, NULL, NULL, buf, NULL);
+		fd_cnx_destroy(conn);
+		return 0;
+	}
+	
+	CHECK_MALLOC( j = malloc(sizeof(struct hs_job)) );
+	j->conn = conn;
+	j->s = s;
+	/* Only the server threads post here, so the queue does not grow much past the admission limit */
+	CHECK_FCT_DO( fd_fifo_post_noblock(hs_queue, (void *)&j), { free(j); return __ret__; } );
+	return 0;
+}
+
+static void hs_job_cleanup(void * arg)
+{
+	struct hs_job * j = arg;
+	if (j->conn)
+		fd_cnx_destroy(j->conn);
+	free(j);
+}
+
+/* The threads of the handshake pool */
+static void * hs_worker(void * arg)
+{
+	TRACE_ENTRY("%p", arg);
+	
+	/* Set the thread name */
+	{
+		char buf[48];
+		snprintf(buf, sizeof(buf), "TLS handshake#%d", (int)(long)arg);
+		fd_log_threadname ( buf );
+	}
+	
+	do {
+		struct hs_job * j = NULL;
+		struct timespec start;
+		int ret;
+	
+		CHECK_FCT_DO( fd_fifo_get( hs_queue, &j ), break );
+	
+		pthread_cleanup_push(hs_job_cleanup, j);
+	
+		LOG_D("Starting handshake with %s", fd_cnx_getid(j->conn));
+		CHECK_SYS_DO( clock_gettime(CLOCK_REALTIME, &start), /* continue */ );
+	
+		ret = fd_cnx_handshake(j->conn, GNUTLS_SERVER, (j->s->secur == 1) ? ALGO_HANDSHAKE_DEFAULT : ALGO_HANDSHAKE_3436, NULL, NULL);
+		hs_account(j->conn, ret == 0, &start);
+	
+		if (ret != 0) {
+			char buf[1024];
+			snprintf(buf, sizeof(buf), "TLS handshake failed for connection '%s', connection closed.", fd_cnx_getid(j->conn));
+	
+			fd_hook_call(HOOK_PEER_CONNECT_FAILED, NULL, NULL, buf, NULL);
+		} else {
+			/* Hand the connection to the server workers, which wait for the CER. Blocks when they are all busy */
+			CHECK_FCT_DO( fd_fifo_post( j->s->pending, &j->conn ), /* destroyed in cleanup */ );
+		}
+	
+		pthread_cleanup_pop(1);
+	} while (1);
+	
+	LOG_E("TLS handshake thread exiting.");
+	return NULL;
+}
+
+/* Create the handshake pool, the first time a secure server is created */
+static int hs_start(void)
+{
+	long i;
+	
+	if (hs_workers)
+		return 0;
+	
+	for (i = 0; i < (1 << HS_BACKOFF_HASH_SIZE); i++)
+		fd_list_init(&hs_backoff_hash[i], NULL);
+	
+	hs_nb = sysconf(_SC_NPROCESSORS_ONLN);
+	if (hs_nb < 1)
+		hs_nb = 1;
+	
+	CHECK_FCT( fd_fifo_new(&hs_queue, 0) );
+	CHECK_MALLOC( hs_workers = calloc( hs_nb, sizeof(pthread_t) ) );
+	for (i = 0; i < hs_nb; i++) {
+		CHECK_POSIX( pthread_create( &hs_workers[i], NULL, hs_worker, (void *)i ) );
+	}
+	
+	return 0;
+}
+
+/* Terminate the handshake pool */
+static void hs_stop(void)
+{
+	int i;
+	struct hs_job * j;
+	
+	if (!hs_workers)
+		return;
+	
+	for (i = 0; i < hs_nb; i++) {
+		CHECK_FCT_DO( fd_thr_term(&hs_workers[i]), /* continue */);
+	}
+	free(hs_workers);
+	hs_workers = NULL;
+	
+	/* Close any pending connection */
+	while ( fd_fifo_tryget( hs_queue, &j ) == 0 ) {
+		hs_job_cleanup(j);
+	}
+	CHECK_FCT_DO( fd_fifo_del(&hs_queue), );
+	
+	while (!FD_IS_LIST_EMPTY(&hs_backoff_lru))
+		hs_backoff_free(hs_backoff_lru.next->o);
+}
+
 /* Dump all servers information */
 DECLARE_FD_DUMP_PROTOTYPE(fd_servers_dump, int details)
 {
@@ -123,6 +403,18 @@ DECLARE_FD_DUMP_PROTOTYPE(fd_servers_dump, int details)
 		}
 	}
 	
+	if (details && hs_workers) {
+		long long ok, failed, full, backoff, time_us, max_us;
+		CHECK_POSIX_DO( pthread_mutex_lock(&hs_lock), return NULL );
+		ok = hs_ok; failed = hs_failed; full = hs_refused_full; backoff = hs_refused_backoff;
+		time_us = hs_time_us; max_us = hs_time_max_us;
+		CHECK_POSIX_DO( pthread_mutex_unlock(&hs_lock), return NULL );
+	
+		CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "\n{TLS handshakes} %d threads, %lld ok, %lld failed, refused: %lld (queue full) %lld (backoff), duration avg:%lldus max:%lldus\n",
+				hs_nb, ok, failed, full, backoff, (ok + failed) ? time_us / (ok + failed) : 0, max_us), return NULL);
+		CHECK_MALLOC_DO( fd_fifo_dump(FD_DUMP_STD_PARAMS, "pending handshakes", hs_queue, dump_hs_job), return NULL );
+	}
+	
 	return *buf;
 }
 
@@ -159,20 +451,8 @@ next_client:
 	/* Get the next connection */
 	CHECK_FCT_DO( fd_fifo_get( s->pending, &c ), { fatal = 1; goto cleanup; } );
 
-	/* Handshake if we are a secure server port, or start clear otherwise */
-	if (s->secur) {
-		LOG_D("Starting handshake with %s", fd_cnx_getid(c));
-
-		int ret = fd_cnx_handshake(c, GNUTLS_SERVER, (s->secur == 1) ? ALGO_HANDSHAKE_DEFAULT : ALGO_HANDSHAKE_3436, NULL, NULL);
-		if (ret != 0) {
-			char buf[1024];
-			snprintf(buf, sizeof(buf), "TLS handshake failed for connection '%s', connection closed.", fd_cnx_getid(c));
-
-			fd_hook_call(HOOK_PEER_CONNECT_FAILED, NULL, NULL, buf, NULL);
-
-			goto cleanup;
-		}
-	} else {
+	/* On a secure server port, the handshake pool already completed the TLS handshake. Start clear otherwise */
+	if (!s->secur) {
 		CHECK_FCT_DO( fd_cnx_start_clear(c, 0), goto cleanup );
 	}
 	
@@ -293,7 +573,12 @@ static void * serv_th(void * arg)
 		
 		/* Store this connection in the fifo for processing by the worker pool. Will block when the fifo is full */
 		pthread_cleanup_push((void *)fd_cnx_destroy, conn);
-		CHECK_FCT_DO( fd_fifo_post( s->pending, &conn ), break );
+		if (s->secur) {
+			/* The TLS handshake is performed first by the handshake pool */
+			CHECK_FCT_DO( hs_submit( s, conn ), break );
+		} else {
+			CHECK_FCT_DO( fd_fifo_post( s->pending, &conn ), break );
+		}
 		pthread_cleanup_pop(0);
 		
 	} while (1);
@@ -323,6 +608,10 @@ static struct server * new_serv( int proto, int secur )
 	new->proto = proto;
 	new->secur = secur;
 	
+	if (secur) {
+		CHECK_FCT_DO( hs_start(), return NULL );
+	}
+	
 	CHECK_FCT_DO( fd_fifo_new(&new->pending, 5), return NULL);
 	CHECK_MALLOC_DO( new->workers = calloc( fd_g_config->cnf_thr_srv, sizeof(struct pool_workers) ), return NULL );
 	
@@ -470,10 +759,19 @@ int fd_servers_start()
 /* Terminate all the servers */
 int fd_servers_stop()
 {
+	struct fd_list * li;
+	
 	TRACE_ENTRY("");
 	
 	TRACE_DEBUG(INFO, "Shutting down server sockets...");
 	
+	/* Stop accepting connections first, then the handshake pool which feeds the servers workers */
+	for (li = FD_SERVERS.next; li != &FD_SERVERS; li = li->next) {
+		struct server * s = (struct server *)li;
+		CHECK_FCT_DO( fd_thr_term(&s->thr), /* continue */);
+	}
+	hs_stop();
+	
 	/* Loop on all servers */
 	while (!FD_IS_LIST_EMPTY(&FD_SERVERS)) {
 		struct server * s = (struct server *)(FD_SERVERS.next);
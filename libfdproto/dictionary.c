@@ -35,6 +35,9 @@
 
 #include "fdproto-internal.h"
 #include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #define ENABLE_LOCK_BYPASS 1
 #define USE_HASHLIST 1
@@ -81,6 +84,12 @@
    void deleteEntryStringHashList(const char *k, void *hl);
    int insertStringHashList(const char *k, void *v, void *hl, void **duplicate);
    int findStringHashList(const char *k, void *hl, void **result);
+
+   int initOctetStringHashList(void **hl);
+   void deleteOctetStringHashList(void *hl);
+   void deleteEntryOctetStringHashList(const uint8_t *k, size_t len, void *hl);
+   int insertOctetStringHashList(const uint8_t *k, size_t len, void *v, void *hl, void **duplicate);
+   int findOctetStringHashList(const uint8_t *k, size_t len, void *hl, void **result);
 #endif
 
 /* Names of the base types */
@@ -124,6 +133,7 @@ struct dict_object {
 	struct dict_object *	parent; /* The parent of this object, if any */
 	
 	struct fd_list		list[NB_LISTS_PER_OBJ];/* used to chain objects.*/
+	struct dict_rules_idx *	rules_idx; /* compiled rules of a command or grouped AVP, built on first use and reset when the rules change */
 #ifdef USE_HASHLIST
 	void *            hashlist[NB_LISTS_PER_OBJ];
 #endif
@@ -188,6 +198,7 @@ struct dictionary {
 	int			dict_bypass_lock;	/* When true, don't use the dict_lock */
 #endif
 	pthread_rwlock_t 	dict_lock;		/* The global rwlock for the dictionary */
+	int			dict_bulk;		/* Nesting level of fd_dict_bulk_begin: while > 0, AVPs and enumvals are not kept ordered */
 	
 	struct dict_object	dict_vendors;		/* Sentinel for the list of vendors, corresponding to vendor 0 */
 	struct dict_object	dict_applications;	/* Sentinel for the list of applications, corresponding to app 0 */
@@ -344,6 +355,7 @@ static int init_object_data(struct dict_object * dest, void * source, enum dict_
 			switch (dest->data.type.type_base)
 			{
 			   case AVP_TYPE_OCTETSTRING:
+			      initOctetStringHashList(&dest->hashlist[0]);
 			      break;
             case AVP_TYPE_INTEGER32:
                initInt32HashList(&dest->hashlist[0]);
@@ -425,6 +437,15 @@ static int verify_object( struct dict_object * obj )
 	return 1;
 }
 
+/* Discard the compiled rules of an object - the lock must be held for writing */
+static void rules_idx_reset(struct dict_object * parent)
+{
+	if (parent && parent->rules_idx) {
+		free(parent->rules_idx);
+		parent->rules_idx = NULL;
+	}
+}
+
 /* Free the data associated to an object */
 static void destroy_object_data(struct dict_object * obj)
 {
@@ -436,6 +457,8 @@ static void destroy_object_data(struct dict_object * obj)
 #if USE_HASHLIST
 			deleteUInt32HashList(obj->hashlist[0]);
          deleteStringHashList(obj->hashlist[1]);
+         /* The AVPs of the vendor, destroyed next, must not use them */
+         obj->hashlist[0] = obj->hashlist[1] = NULL;
 #endif
 			break;
 		
@@ -449,6 +472,7 @@ static void destroy_object_data(struct dict_object * obj)
          switch (obj->data.type.type_base)
          {
             case AVP_TYPE_OCTETSTRING:
+               deleteOctetStringHashList(obj->hashlist[0]);
                break;
             case AVP_TYPE_INTEGER32:
                deleteInt32HashList(obj->hashlist[0]);
@@ -466,15 +490,14 @@ static void destroy_object_data(struct dict_object * obj)
                deleteFloat32HashList(obj->hashlist[0]);
                break;
             case AVP_TYPE_FLOAT64:
-               deleteFloat64HashList(obj
-
-
-                     ->hashlist[0]);
+               deleteFloat64HashList(obj->hashlist[0]);
                break;
             default:
                break;
          }
          deleteStringHashList(obj->hashlist[1]);
+         /* Same as vendors, for the enumerated values */
+         obj->hashlist[0] = obj->hashlist[1] = NULL;
 #endif
 			break;
 			
@@ -496,8 +519,12 @@ static void destroy_object_data(struct dict_object * obj)
 	}
 }
 
-/* Forward declaration */
+/* Forward declarations */
 static void destroy_object(struct dict_object * obj);
+#if USE_HASHLIST
+static void hash_unlink_enumval(struct dict_object * parent, struct dict_object * obj);
+static void hash_unlink_avp(struct dict_object * vendor, struct dict_object * obj);
+#endif
 
 /* Destroy all objects in a list - the lock must be held */
 static void destroy_list(struct fd_list * head) 
@@ -526,7 +553,20 @@ static void destroy_object(struct dict_object * obj)
 	/* Mark the object as invalid */
 	obj->objeyec = 0xdead;
 	
-	/* First, destroy the data associated to the object */
+	/* The compiled rules of the object, or of its parent, are not valid anymore */
+	rules_idx_reset(obj);
+	if (obj->type == DICT_RULE)
+		rules_idx_reset(obj->parent);
+	
+#if USE_HASHLIST
+	/* Remove the object from the hash lists of its type or vendor (the list[0] of an AVP is in list[1] of its vendor) */
+	if (obj->type == DICT_ENUMVAL)
+		hash_unlink_enumval(obj->parent, obj);
+	if ((obj->type == DICT_AVP) && (obj->list[0].head != &obj->list[0]))
+		hash_unlink_avp((struct dict_object *)((char *)(obj->list[0].head) - (size_t)&(((struct dict_object *)0)->list[1])), obj);
+#endif
+	
+	/* Destroy the data associated to the object */
 	destroy_object_data(obj);
 	
 	for (i=0; i<NB_LISTS_PER_OBJ; i++) {
@@ -818,6 +858,21 @@ in the local context where they are called. They are meant to be called only fro
 		ret = ENOENT;							\
 }
 
+/* For search in the hash lists: findfct is one of the find*HashList functions, followed by its key and hash list parameters */
+#define SEARCH_hash( findfct, ... ) {						\
+	struct dict_object * __obj = NULL;					\
+	ret = 0;								\
+	if (findfct( __VA_ARGS__, (void **)&__obj ) == 0) {			\
+		if (result)							\
+			*result = __obj;					\
+		goto end;							\
+	}									\
+	if (result)								\
+		*result = NULL;							\
+	else									\
+		ret = ENOENT;							\
+}
+
 /* For search of commands in lists by code and flag. R_flag_val = 0 or CMD_FLAG_REQUEST */
 #define SEARCH_codefl( value, R_flag_val, sentinel) {					\
 	int __cmp;								\
@@ -993,7 +1048,7 @@ static int search_enumval ( struct dictionary * dict, int criteria, const void *
 				
 				if ( _what->search.enum_name != NULL ) {
 #if USE_HASHLIST
-               ret = findStringHashList(_what->search.enum_name, parent->hashlist[1], (void**)result);
+					SEARCH_hash( findStringHashList, _what->search.enum_name, parent->hashlist[1] );
 #else
 					/* We are looking for this string */
 					SEARCH_os0(  _what->search.enum_name, &parent->list[1], enumval.enum_name, 1 );
@@ -1002,16 +1057,20 @@ static int search_enumval ( struct dictionary * dict, int criteria, const void *
 					/* We are looking for the value in enum_value */
 					switch (parent->data.type.type_base) {
 						case AVP_TYPE_OCTETSTRING:
+#if USE_HASHLIST
+							SEARCH_hash( findOctetStringHashList, _what->search.enum_value.os.data, _what->search.enum_value.os.len, parent->hashlist[0] );
+#else
 							SEARCH_os(	 _what->search.enum_value.os.data, 
 									 _what->search.enum_value.os.len, 
 									 &parent->list[2], 
 									 enumval.enum_value.os , 
 									 1 );
+#endif
 							break;
 
 						case AVP_TYPE_INTEGER32:
 #if USE_HASHLIST
-		               ret = findInt32HashList(_what->search.enum_value.i32, parent->hashlist[0], (void**)result);
+							SEARCH_hash( findInt32HashList, _what->search.enum_value.i32, parent->hashlist[0] );
 #else
 							SEARCH_scalar(	_what->search.enum_value.i32,
 									&parent->list[2],
@@ -1023,7 +1082,7 @@ static int search_enumval ( struct dictionary * dict, int criteria, const void *
 							
 						case AVP_TYPE_INTEGER64:
 #if USE_HASHLIST
-                     ret = findInt64HashList(_what->search.enum_value.i64, parent->hashlist[0], (void**)result);
+							SEARCH_hash( findInt64HashList, _what->search.enum_value.i64, parent->hashlist[0] );
 #else
 							SEARCH_scalar(	_what->search.enum_value.i64,
 									&parent->list[2],
@@ -1035,7 +1094,7 @@ static int search_enumval ( struct dictionary * dict, int criteria, const void *
 							
 						case AVP_TYPE_UNSIGNED32:
 #if USE_HASHLIST
-                     ret = findUInt32HashList(_what->search.enum_value.u32, parent->hashlist[0], (void**)result);
+							SEARCH_hash( findUInt32HashList, _what->search.enum_value.u32, parent->hashlist[0] );
 #else
 							SEARCH_scalar(	_what->search.enum_value.u32,
 									&parent->list[2],
@@ -1047,7 +1106,7 @@ static int search_enumval ( struct dictionary * dict, int criteria, const void *
 							
 						case AVP_TYPE_UNSIGNED64:
 #if USE_HASHLIST
-                     ret = findUInt64HashList(_what->search.enum_value.u64, parent->hashlist[0], (void**)result);
+							SEARCH_hash( findUInt64HashList, _what->search.enum_value.u64, parent->hashlist[0] );
 #else
 							SEARCH_scalar(	_what->search.enum_value.u64,
 									&parent->list[2],
@@ -1059,7 +1118,7 @@ static int search_enumval ( struct dictionary * dict, int criteria, const void *
 							
 						case AVP_TYPE_FLOAT32:
 #if USE_HASHLIST
-                     ret = findFloat32HashList(_what->search.enum_value.f32, parent->hashlist[0], (void**)result);
+							SEARCH_hash( findFloat32HashList, _what->search.enum_value.f32, parent->hashlist[0] );
 #else
 							SEARCH_scalar(	_what->search.enum_value.f32,
 									&parent->list[2],
@@ -1071,7 +1130,7 @@ static int search_enumval ( struct dictionary * dict, int criteria, const void *
 							
 						case AVP_TYPE_FLOAT64:
 #if USE_HASHLIST
-                     ret = findFloat64HashList(_what->search.enum_value.f64, parent->hashlist[0], (void**)result);
+							SEARCH_hash( findFloat64HashList, _what->search.enum_value.f64, parent->hashlist[0] );
 #else
 							SEARCH_scalar(	_what->search.enum_value.f64,
 									&parent->list[2],
@@ -1112,7 +1171,7 @@ static int search_avp ( struct dictionary * dict, int criteria, const void * wha
 				code = *(avp_code_t *) what;
 
 #if USE_HASHLIST
-				ret = findUInt32HashList(code, dict->dict_vendors.hashlist[0], (void**)result);
+				SEARCH_hash( findUInt32HashList, code, dict->dict_vendors.hashlist[0] );
 #else
 				SEARCH_scalar( code, &dict->dict_vendors.list[1],  avp.avp_code, 1, (struct dict_object *)NULL );
 #endif
@@ -1122,7 +1181,7 @@ static int search_avp ( struct dictionary * dict, int criteria, const void * wha
 		case AVP_BY_NAME:
 			/* "what" is the AVP name, vendor 0 */
 #if USE_HASHLIST
-		   ret = findStringHashList((const char *)what, dict->dict_vendors.hashlist[1], (void**)result);
+			SEARCH_hash( findStringHashList, (const char *)what, dict->dict_vendors.hashlist[1] );
 #else
 			SEARCH_os0( what, &dict->dict_vendors.list[2], avp.avp_name, 1);
 #endif
@@ -1149,14 +1208,14 @@ static int search_avp ( struct dictionary * dict, int criteria, const void * wha
 				/* We now have our vendor = head of the appropriate avp list */
 				if (criteria == AVP_BY_NAME_AND_VENDOR) {
 #if USE_HASHLIST
-				   ret = findStringHashList(_what->avp_name, vendor->hashlist[1], (void**)result);
+					SEARCH_hash( findStringHashList, _what->avp_name, vendor->hashlist[1] );
 #else
 					SEARCH_os0( _what->avp_name, &vendor->list[2], avp.avp_name, 1);
 #endif
 				} else {
 					/* AVP_BY_CODE_AND_VENDOR */
 #if USE_HASHLIST
-				   ret = findUInt32HashList(_what->avp_code, vendor->hashlist[0], (void**)result);
+					SEARCH_hash( findUInt32HashList, _what->avp_code, vendor->hashlist[0] );
 #else
 					SEARCH_scalar( _what->avp_code, &vendor->list[1], avp.avp_code, 1, (struct dict_object *)NULL );
 #endif
@@ -1195,13 +1254,13 @@ static int search_avp ( struct dictionary * dict, int criteria, const void * wha
 				if (_what->avp_data.avp_code) {
 					CHECK_PARAMS( ! _what->avp_data.avp_name );
 #if USE_HASHLIST
-					ret = findUInt32HashList(_what->avp_data.avp_code, vendor->hashlist[0], (void**)result);
+					SEARCH_hash( findUInt32HashList, _what->avp_data.avp_code, vendor->hashlist[0] );
 #else
 					SEARCH_scalar( _what->avp_data.avp_code, &vendor->list[1], avp.avp_code, 1, (struct dict_object *)NULL );
 #endif
 				} else {
 #if USE_HASHLIST
-				   ret = findStringHashList(_what->avp_data.avp_name, vendor->hashlist[1], (void**)result);
+					SEARCH_hash( findStringHashList, _what->avp_data.avp_name, vendor->hashlist[1] );
 #else
 					SEARCH_os0( _what->avp_data.avp_name, &vendor->list[2], avp.avp_name, 1);
 #endif
@@ -1212,6 +1271,15 @@ static int search_avp ( struct dictionary * dict, int criteria, const void * wha
 		case AVP_BY_NAME_ALL_VENDORS:
 			{
 				struct fd_list * li;
+#if USE_HASHLIST
+				/* First, search for vendor 0 */
+				SEARCH_hash( findStringHashList, (const char *)what, dict->dict_vendors.hashlist[1] );
+				
+				/* If not found, loop for all vendors, until found */
+				for (li = dict->dict_vendors.list[0].next; li != &dict->dict_vendors.list[0]; li = li->next) {
+					SEARCH_hash( findStringHashList, (const char *)what, _O(li->o)->hashlist[1] );
+				}
+#else
 				size_t wl = strlen((char *)what);
 				
 				/* First, search for vendor 0 */
@@ -1219,14 +1287,9 @@ static int search_avp ( struct dictionary * dict, int criteria, const void * wha
 				
 				/* If not found, loop for all vendors, until found */
 				for (li = dict->dict_vendors.list[0].next; li != &dict->dict_vendors.list[0]; li = li->next) {
-#if USE_HASHLIST
-               ret = findStringHashList(what, _O(li->o)->hashlist[1], (void**)result);
-               if (ret == 0 && *result)
-                  goto end;
-#else
 					SEARCH_os0_l( what, wl, &_O(li->o)->list[2], avp.avp_name, 1);
-#endif
 				}
+#endif
 			}
 			break;
 		
@@ -1796,6 +1859,286 @@ int fd_dict_getval ( struct dict_object * object, void * val)
 	return 0;
 }
 
+#if USE_HASHLIST
+/* Link or unlink the value of an enumerated value in the hash list of its type. When unlinking, the entry is only
+ removed if it refers to this object. The type's hash lists are NULL while the type is being destroyed. */
+static int hash_enumval_value(struct dict_object * parent, struct dict_object * obj, int link, struct dict_object ** locref)
+{
+	union avp_value * v = &obj->data.enumval.enum_value;
+	void * hl = parent->hashlist[0];
+	struct dict_object * cur = NULL;
+	
+	if (!hl)
+		return link ? EINVAL : 0;
+	
+	switch (parent->data.type.type_base) {
+		case AVP_TYPE_OCTETSTRING:
+			if (link)
+				return insertOctetStringHashList(v->os.data, v->os.len, obj, hl, (void **)locref);
+			if (!findOctetStringHashList(v->os.data, v->os.len, hl, (void **)&cur) && (cur == obj))
+				deleteEntryOctetStringHashList(v->os.data, v->os.len, hl);
+			break;
+
+		case AVP_TYPE_INTEGER32:
+			if (link)
+				return insertInt32HashList(v->i32, obj, hl, (void **)locref);
+			if (!findInt32HashList(v->i32, hl, (void **)&cur) && (cur == obj))
+				deleteEntryInt32HashList(v->i32, hl);
+			break;
+
+		case AVP_TYPE_INTEGER64:
+			if (link)
+				return insertInt64HashList(v->i64, obj, hl, (void **)locref);
+			if (!findInt64HashList(v->i64, hl, (void **)&cur) && (cur == obj))
+				deleteEntryInt64HashList(v->i64, hl);
+			break;
+
+		case AVP_TYPE_UNSIGNED32:
+			if (link)
+				return insertUInt32HashList(v->u32, obj, hl, (void **)locref);
+			if (!findUInt32HashList(v->u32, hl, (void **)&cur) && (cur == obj))
+				deleteEntryUInt32HashList(v->u32, hl);
+			break;
+
+		case AVP_TYPE_UNSIGNED64:
+			if (link)
+				return insertUInt64HashList(v->u64, obj, hl, (void **)locref);
+			if (!findUInt64HashList(v->u64, hl, (void **)&cur) && (cur == obj))
+				deleteEntryUInt64HashList(v->u64, hl);
+			break;
+
+		case AVP_TYPE_FLOAT32:
+			if (link)
+				return insertFloat32HashList(v->f32, obj, hl, (void **)locref);
+			if (!findFloat32HashList(v->f32, hl, (void **)&cur) && (cur == obj))
+				deleteEntryFloat32HashList(v->f32, hl);
+			break;
+
+		case AVP_TYPE_FLOAT64:
+			if (link)
+				return insertFloat64HashList(v->f64, obj, hl, (void **)locref);
+			if (!findFloat64HashList(v->f64, hl, (void **)&cur) && (cur == obj))
+				deleteEntryFloat64HashList(v->f64, hl);
+			break;
+
+		default:
+			/* Invalid parent type basetype */
+			CHECK_PARAMS( parent = NULL );
+	}
+	return 0;
+}
+
+/* Link an enumerated value in the hash lists of its type - the lock must be held for writing */
+static int hash_link_enumval(struct dict_object * parent, struct dict_object * new, struct dict_object ** locref)
+{
+	int ret;
+	
+	ret = hash_enumval_value(parent, new, 1, locref);
+	if (ret)
+		return ret;
+
+	ret = insertStringHashList(new->data.enumval.enum_name, new, parent->hashlist[1], (void **)locref);
+	if (ret)
+		hash_enumval_value(parent, new, 0, NULL);
+	return ret;
+}
+
+/* Link an AVP in the hash lists of its vendor - the lock must be held for writing */
+static int hash_link_avp(struct dict_object * vendor, struct dict_object * new, struct dict_object ** locref)
+{
+	int ret;
+	
+	ret = insertUInt32HashList(new->data.avp.avp_code, new, vendor->hashlist[0], (void **)locref);
+	if (ret)
+		return ret;
+
+	ret = insertStringHashList(new->data.avp.avp_name, new, vendor->hashlist[1], (void **)locref);
+	if (ret)
+		deleteEntryUInt32HashList(new->data.avp.avp_code, vendor->hashlist[0]);
+	return ret;
+}
+
+/* Remove an enumerated value from the hash lists of its type - the lock must be held for writing */
+static void hash_unlink_enumval(struct dict_object * parent, struct dict_object * obj)
+{
+	struct dict_object * cur = NULL;
+	
+	if (!parent->hashlist[1])
+		return;
+	
+	hash_enumval_value(parent, obj, 0, NULL);
+	if (!findStringHashList(obj->data.enumval.enum_name, parent->hashlist[1], (void **)&cur) && (cur == obj))
+		deleteEntryStringHashList(obj->data.enumval.enum_name, parent->hashlist[1]);
+}
+
+/* Remove an AVP from the hash lists of its vendor - the lock must be held for writing */
+static void hash_unlink_avp(struct dict_object * vendor, struct dict_object * obj)
+{
+	struct dict_object * cur = NULL;
+	
+	if (!vendor->hashlist[0])
+		return;
+	
+	if (!findUInt32HashList(obj->data.avp.avp_code, vendor->hashlist[0], (void **)&cur) && (cur == obj))
+		deleteEntryUInt32HashList(obj->data.avp.avp_code, vendor->hashlist[0]);
+	cur = NULL;
+	if (!findStringHashList(obj->data.avp.avp_name, vendor->hashlist[1], (void **)&cur) && (cur == obj))
+		deleteEntryStringHashList(obj->data.avp.avp_name, vendor->hashlist[1]);
+}
+#endif /* USE_HASHLIST */
+
+/* Check if an object with the same key as a new one (locref) actually has the same data. Returns 0 in this case, EEXIST otherwise */
+static int check_duplicate(enum dict_object_type type, struct dict_object * locref, struct dict_object * new)
+{
+	int ret = EEXIST;
+	
+	switch (type) {
+		case DICT_VENDOR:
+			TRACE_DEBUG(FULL, "Vendor %s already in dictionary", new->data.vendor.vendor_name);
+			/* if we are here, it means the two vendors id are identical */
+			if (fd_os_cmp(locref->data.vendor.vendor_name, locref->datastr_len, 
+					new->data.vendor.vendor_name, new->datastr_len)) {
+				TRACE_DEBUG(INFO, "Conflicting vendor name: %s", new->data.vendor.vendor_name);
+				break;
+			}
+			/* Otherwise (same name), we consider the function succeeded, since the (same) object is in the dictionary */
+			ret = 0; 
+			break;
+
+		case DICT_APPLICATION:
+			TRACE_DEBUG(FULL, "Application %s already in dictionary", new->data.application.application_name);
+			/* got same id */
+			if (fd_os_cmp(locref->data.application.application_name, locref->datastr_len, 
+					new->data.application.application_name, new->datastr_len)) {
+				TRACE_DEBUG(FULL, "Conflicting application name");
+				break;
+			}
+			ret = 0;
+			break;
+
+		case DICT_TYPE:
+			TRACE_DEBUG(FULL, "Type %s already in dictionary", new->data.type.type_name);
+			/* got same name */
+			if (locref->data.type.type_base != new->data.type.type_base) {
+				TRACE_DEBUG(FULL, "Conflicting base type");
+				break;
+			}
+			/* discard new definition only it a callback is provided and different from the previous one */
+			if ((new->data.type.type_interpret) && (locref->data.type.type_interpret != new->data.type.type_interpret)) {
+				TRACE_DEBUG(FULL, "Conflicting interpret cb");
+				break;
+			}
+			if ((new->data.type.type_encode) && (locref->data.type.type_encode != new->data.type.type_encode)) {
+				TRACE_DEBUG(FULL, "Conflicting encode cb");
+				break;
+			}
+			if ((new->data.type.type_dump) && (locref->data.type.type_dump != new->data.type.type_dump)) {
+				TRACE_DEBUG(FULL, "Conflicting dump cb");
+				break;
+			}
+			ret = 0;
+			break;
+
+		case DICT_ENUMVAL:
+			TRACE_DEBUG(FULL, "Enum %s already in dictionary", new->data.enumval.enum_name);
+			/* got either same name or same value. We check that both are true */
+			if (order_enum_by_name(locref, new)) {
+				TRACE_DEBUG(FULL, "Conflicting enum name");
+				break;
+			}
+			if (order_enum_by_val(locref, new)) {
+				TRACE_DEBUG(FULL, "Conflicting enum value");
+				break;
+			}
+			ret = 0;
+			break;
+
+		case DICT_AVP:
+			TRACE_DEBUG(FULL, "AVP %s already in dictionary", new->data.avp.avp_name);
+			/* got either same name or code */
+			if (order_avp_by_code(locref, new)) {
+				TRACE_DEBUG(FULL, "Conflicting AVP code");
+				break;
+			}
+			if (order_avp_by_name(locref, new)) {
+				TRACE_DEBUG(FULL, "Conflicting AVP name");
+				break;
+			}
+			if  (locref->data.avp.avp_vendor != new->data.avp.avp_vendor) {
+				TRACE_DEBUG(FULL, "Conflicting AVP vendor");
+				break;
+			}
+			if  (locref->data.avp.avp_flag_mask != new->data.avp.avp_flag_mask) {
+				TRACE_DEBUG(FULL, "Conflicting AVP flags mask");
+				break;
+			}
+			if  ((locref->data.avp.avp_flag_val & locref->data.avp.avp_flag_mask) != (new->data.avp.avp_flag_val & new->data.avp.avp_flag_mask)) {
+				TRACE_DEBUG(FULL, "Conflicting AVP flags value");
+				break;
+			}
+			if  (locref->data.avp.avp_basetype != new->data.avp.avp_basetype) {
+				TRACE_DEBUG(FULL, "Conflicting AVP base type");
+				break;
+			}
+			ret = 0;
+			break;
+
+		case DICT_COMMAND:
+			TRACE_DEBUG(FULL, "Command %s already in dictionary", new->data.cmd.cmd_name);
+			/* We got either same name, or same code + R flag */
+			if (order_cmd_by_name(locref, new)) {
+				TRACE_DEBUG(FULL, "Conflicting command name");
+				break;
+			}
+			if (locref->data.cmd.cmd_code != new->data.cmd.cmd_code) {
+				TRACE_DEBUG(FULL, "Conflicting command code");
+				break;
+			}
+			if (locref->data.cmd.cmd_flag_mask != new->data.cmd.cmd_flag_mask) {
+				TRACE_DEBUG(FULL, "Conflicting command flags mask %hhx:%hhx", locref->data.cmd.cmd_flag_mask, new->data.cmd.cmd_flag_mask);
+				break;
+			}
+			if ((locref->data.cmd.cmd_flag_val & locref->data.cmd.cmd_flag_mask) != (new->data.cmd.cmd_flag_val & new->data.cmd.cmd_flag_mask)) {
+				TRACE_DEBUG(FULL, "Conflicting command flags value");
+				break;
+			}
+			ret = 0;
+			break;
+
+		case DICT_RULE:
+			/* Both rules point to the same AVPs (code & vendor) */
+			if (locref->data.rule.rule_position != new->data.rule.rule_position) {
+				TRACE_DEBUG(FULL, "Conflicting rule position");
+				break;
+			}
+			if ( ((locref->data.rule.rule_position == RULE_FIXED_HEAD) ||
+				(locref->data.rule.rule_position == RULE_FIXED_TAIL))
+			    && (locref->data.rule.rule_order != new->data.rule.rule_order)) {
+				TRACE_DEBUG(FULL, "Conflicting rule order");
+				break;
+			}
+			if (locref->data.rule.rule_min != new->data.rule.rule_min) {
+				int r1 = locref->data.rule.rule_min;
+				int r2 = new->data.rule.rule_min;
+				int p  = locref->data.rule.rule_position;
+				if (  ((r1 != -1) && (r2 != -1)) /* none of the definitions contains the "default" value */
+				   || ((p == RULE_OPTIONAL) && (r1 != 0) && (r2 != 0)) /* the other value is not 0 for an optional rule */
+				   || ((r1 != 1) && (r2 != 1)) /* the other value is not 1 for another rule */
+				) {
+					TRACE_DEBUG(FULL, "Conflicting rule min");
+					break;
+				}
+			}
+			if (locref->data.rule.rule_max != new->data.rule.rule_max) {
+				TRACE_DEBUG(FULL, "Conflicting rule max");
+				break;
+			}
+			ret = 0;
+			break;
+	}
+	return ret;
+}
+
 /* Add a new object in the dictionary */
 int fd_dict_new ( struct dictionary * dict, enum dict_object_type type, void * data, struct dict_object * parent, struct dict_object **ref )
 {
@@ -1906,73 +2249,15 @@ int fd_dict_new ( struct dictionary * dict, enum dict_object_type type, void * d
 		
 		case DICT_ENUMVAL:
 #if USE_HASHLIST
-		   switch (parent->data.type.type_base)
-		   {
-            case AVP_TYPE_INTEGER32:
-               ret = insertInt32HashList(new->data.enumval.enum_value.i32, new, parent->hashlist[0], (void**)&locref);
-               break;
-
-            case AVP_TYPE_INTEGER64:
-               ret = insertInt64HashList(new->data.enumval.enum_value.i64, new, parent->hashlist[0], (void**)&locref);
-               break;
-
-            case AVP_TYPE_UNSIGNED32:
-               ret = insertUInt32HashList(new->data.enumval.enum_value.u32, new, parent->hashlist[0], (void**)&locref);
-               break;
-
-            case AVP_TYPE_UNSIGNED64:
-               ret = insertUInt64HashList(new->data.enumval.enum_value.u64, new, parent->hashlist[0], (void**)&locref);
-               break;
-
-            case AVP_TYPE_FLOAT32:
-               ret = insertFloat32HashList(new->data.enumval.enum_value.f32, new, parent->hashlist[0], (void**)&locref);
-               break;
-
-            case AVP_TYPE_FLOAT64:
-               ret = insertFloat64HashList(new->data.enumval.enum_value.f64, new, parent->hashlist[0], (void**)&locref);
-               break;
-
-            default:
-               /* Invalid parent type basetype */
-               CHECK_PARAMS( parent = NULL );
-		   }
-		   if (ret)
-		      goto error_unlock;
-
-         ret = insertStringHashList(new->data.enumval.enum_name, new, parent->hashlist[1], (void **)&locref);
-         if (ret) {
-            switch (parent->data.type.type_base)
-            {
-               case AVP_TYPE_INTEGER32:
-                  deleteEntryInt32HashList(new->data.enumval.enum_value.i32, parent->hashlist[0]);
-                  break;
-
-               case AVP_TYPE_INTEGER64:
-                  deleteEntryInt64HashList(new->data.enumval.enum_value.i64, parent->hashlist[0]);
-                  break;
-
-               case AVP_TYPE_UNSIGNED32:
-                  deleteEntryUInt32HashList(new->data.enumval.enum_value.u32, parent->hashlist[0]);
-                  break;
-
-               case AVP_TYPE_UNSIGNED64:
-                  deleteEntryUInt64HashList(new->data.enumval.enum_value.u64, parent->hashlist[0]);
-                  break;
-
-               case AVP_TYPE_FLOAT32:
-                  deleteEntryFloat32HashList(new->data.enumval.enum_value.f32, parent->hashlist[0]);
-                  break;
-
-               case AVP_TYPE_FLOAT64:
-                  deleteEntryFloat64HashList(new->data.enumval.enum_value.f64, parent->hashlist[0]);
-                  break;
-
-               default:
-                  /* Invalid parent type basetype */
-                  CHECK_PARAMS( parent = NULL );
-            }
-            goto error_unlock;
-         }
+			ret = hash_link_enumval(parent, new, &locref);
+			if (ret)
+				goto error_unlock;
+			if (dict->dict_bulk) {
+				/* The duplicates were detected by the hash lists, the lists are ordered in fd_dict_bulk_commit */
+				fd_list_insert_before( &parent->list[1], &new->list[0] );
+				fd_list_insert_before( &parent->list[2], &new->list[1] );
+				break;
+			}
 #endif
 			/* A type_enum object is linked in it's parent 'type' object lists 1 and 2 by its name and values */
 			ret = fd_list_insert_ordered ( &parent->list[1], &new->list[0], (int (*)(void*, void *))order_enum_by_name, (void **)&locref );
@@ -1988,15 +2273,15 @@ int fd_dict_new ( struct dictionary * dict, enum dict_object_type type, void * d
 		
 		case DICT_AVP:
 #if USE_HASHLIST
-		   ret = insertUInt32HashList(new->data.avp.avp_code, new, vendor->hashlist[0], (void **)&locref);
-		   if (ret)
-		      goto error_unlock;
-
-		   ret = insertStringHashList(new->data.avp.avp_name, new, vendor->hashlist[1], (void **)&locref);
-		   if (ret) {
-		      deleteEntryUInt32HashList(new->data.avp.avp_code, vendor->hashlist[0]);
-		      goto error_unlock;
-		   }
+			ret = hash_link_avp(vendor, new, &locref);
+			if (ret)
+				goto error_unlock;
+			if (dict->dict_bulk) {
+				/* Same as enumvals */
+				fd_list_insert_before( &vendor->list[1], &new->list[0] );
+				fd_list_insert_before( &vendor->list[2], &new->list[1] );
+				break;
+			}
 #endif
 			/* An avp object is linked in lists 1 and 2 of its vendor, by code and name */
 			ret = fd_list_insert_ordered ( &vendor->list[1], &new->list[0], (int (*)(void*, void *))order_avp_by_code, (void **)&locref );
@@ -2031,9 +2316,11 @@ int fd_dict_new ( struct dictionary * dict, enum dict_object_type type, void * d
 			   if(locref->data.rule.rule_position == RULE_REQUIRED && new->data.rule.rule_position == RULE_OPTIONAL){
 			      TRACE_DEBUG(INFO, "Overriding rule to optional for AVP: %s", locref->data.rule.rule_avp->data.avp.avp_name);
 			      locref->data.rule.rule_position = RULE_OPTIONAL;
+			      rules_idx_reset(parent);
 			   }
 				goto error_unlock;
 			}
+			rules_idx_reset(parent);
 			break;
 			
 		default:
@@ -2066,150 +2353,7 @@ error_unlock:
 	CHECK_POSIX_DO(  pthread_rwlock_unlock(&dict->dict_lock),  /* continue */  );
 	if (ret == EEXIST) {
 		/* We have a duplicate key in locref. Check if the pointed object is the same or not */
-		switch (type) {
-			case DICT_VENDOR:
-				TRACE_DEBUG(FULL, "Vendor %s already in dictionary", new->data.vendor.vendor_name);
-				/* if we are here, it means the two vendors id are identical */
-				if (fd_os_cmp(locref->data.vendor.vendor_name, locref->datastr_len, 
-						new->data.vendor.vendor_name, new->datastr_len)) {
-					TRACE_DEBUG(INFO, "Conflicting vendor name: %s", new->data.vendor.vendor_name);
-					break;
-				}
-				/* Otherwise (same name), we consider the function succeeded, since the (same) object is in the dictionary */
-				ret = 0; 
-				break;
-
-			case DICT_APPLICATION:
-				TRACE_DEBUG(FULL, "Application %s already in dictionary", new->data.application.application_name);
-				/* got same id */
-				if (fd_os_cmp(locref->data.application.application_name, locref->datastr_len, 
-						new->data.application.application_name, new->datastr_len)) {
-					TRACE_DEBUG(FULL, "Conflicting application name");
-					break;
-				}
-				ret = 0;
-				break;
-
-			case DICT_TYPE:
-				TRACE_DEBUG(FULL, "Type %s already in dictionary", new->data.type.type_name);
-				/* got same name */
-				if (locref->data.type.type_base != new->data.type.type_base) {
-					TRACE_DEBUG(FULL, "Conflicting base type");
-					break;
-				}
-				/* discard new definition only it a callback is provided and different from the previous one */
-				if ((new->data.type.type_interpret) && (locref->data.type.type_interpret != new->data.type.type_interpret)) {
-					TRACE_DEBUG(FULL, "Conflicting interpret cb");
-					break;
-				}
-				if ((new->data.type.type_encode) && (locref->data.type.type_encode != new->data.type.type_encode)) {
-					TRACE_DEBUG(FULL, "Conflicting encode cb");
-					break;
-				}
-				if ((new->data.type.type_dump) && (locref->data.type.type_dump != new->data.type.type_dump)) {
-					TRACE_DEBUG(FULL, "Conflicting dump cb");
-					break;
-				}
-				ret = 0;
-				break;
-
-			case DICT_ENUMVAL:
-				TRACE_DEBUG(FULL, "Enum %s already in dictionary", new->data.enumval.enum_name);
-				/* got either same name or same value. We check that both are true */
-				if (order_enum_by_name(locref, new)) {
-					TRACE_DEBUG(FULL, "Conflicting enum name");
-					break;
-				}
-				if (order_enum_by_val(locref, new)) {
-					TRACE_DEBUG(FULL, "Conflicting enum value");
-					break;
-				}
-				ret = 0;
-				break;
-
-			case DICT_AVP:
-				TRACE_DEBUG(FULL, "AVP %s already in dictionary", new->data.avp.avp_name);
-				/* got either same name or code */
-				if (order_avp_by_code(locref, new)) {
-					TRACE_DEBUG(FULL, "Conflicting AVP code");
-					break;
-				}
-				if (order_avp_by_name(locref, new)) {
-					TRACE_DEBUG(FULL, "Conflicting AVP name");
-					break;
-				}
-				if  (locref->data.avp.avp_vendor != new->data.avp.avp_vendor) {
-					TRACE_DEBUG(FULL, "Conflicting AVP vendor");
-					break;
-				}
-				if  (locref->data.avp.avp_flag_mask != new->data.avp.avp_flag_mask) {
-					TRACE_DEBUG(FULL, "Conflicting AVP flags mask");
-					break;
-				}
-				if  ((locref->data.avp.avp_flag_val & locref->data.avp.avp_flag_mask) != (new->data.avp.avp_flag_val & new->data.avp.avp_flag_mask)) {
-					TRACE_DEBUG(FULL, "Conflicting AVP flags value");
-					break;
-				}
-				if  (locref->data.avp.avp_basetype != new->data.avp.avp_basetype) {
-					TRACE_DEBUG(FULL, "Conflicting AVP base type");
-					break;
-				}
-				ret = 0;
-				break;
-
-			case DICT_COMMAND:
-				TRACE_DEBUG(FULL, "Command %s already in dictionary", new->data.cmd.cmd_name);
-				/* We got either same name, or same code + R flag */
-				if (order_cmd_by_name(locref, new)) {
-					TRACE_DEBUG(FULL, "Conflicting command name");
-					break;
-				}
-				if (locref->data.cmd.cmd_code != new->data.cmd.cmd_code) {
-					TRACE_DEBUG(FULL, "Conflicting command code");
-					break;
-				}
-				if (locref->data.cmd.cmd_flag_mask != new->data.cmd.cmd_flag_mask) {
-					TRACE_DEBUG(FULL, "Conflicting command flags mask %hhx:%hhx", locref->data.cmd.cmd_flag_mask, new->data.cmd.cmd_flag_mask);
-					break;
-				}
-				if ((locref->data.cmd.cmd_flag_val & locref->data.cmd.cmd_flag_mask) != (new->data.cmd.cmd_flag_val & new->data.cmd.cmd_flag_mask)) {
-					TRACE_DEBUG(FULL, "Conflicting command flags value");
-					break;
-				}
-				ret = 0;
-				break;
-
-			case DICT_RULE:
-				/* Both rules point to the same AVPs (code & vendor) */
-				if (locref->data.rule.rule_position != new->data.rule.rule_position) {
-					TRACE_DEBUG(FULL, "Conflicting rule position");
-					break;
-				}
-				if ( ((locref->data.rule.rule_position == RULE_FIXED_HEAD) ||
-					(locref->data.rule.rule_position == RULE_FIXED_TAIL))
-				    && (locref->data.rule.rule_order != new->data.rule.rule_order)) {
-					TRACE_DEBUG(FULL, "Conflicting rule order");
-					break;
-				}
-				if (locref->data.rule.rule_min != new->data.rule.rule_min) {
-					int r1 = locref->data.rule.rule_min;
-					int r2 = new->data.rule.rule_min;
-					int p  = locref->data.rule.rule_position;
-					if (  ((r1 != -1) && (r2 != -1)) /* none of the definitions contains the "default" value */
-					   || ((p == RULE_OPTIONAL) && (r1 != 0) && (r2 != 0)) /* the other value is not 0 for an optional rule */
-					   || ((r1 != 1) && (r2 != 1)) /* the other value is not 1 for another rule */
-					) {
-						TRACE_DEBUG(FULL, "Conflicting rule min");
-						break;
-					}
-				}
-				if (locref->data.rule.rule_max != new->data.rule.rule_max) {
-					TRACE_DEBUG(FULL, "Conflicting rule max");
-					break;
-				}
-				ret = 0;
-				break;
-		}
+		ret = check_duplicate(type, locref, new);
 		if (!ret) {
 			TRACE_DEBUG(FULL, "An existing object with the same data was found, ignoring the error...");
 		}
@@ -2521,6 +2665,10 @@ int fd_dict_fini ( struct dictionary ** dict)
 		destroy_list ( &(*dict)->dict_applications.list[i] );
 		destroy_list ( &(*dict)->dict_vendors.list[i] );
 	}
+#if USE_HASHLIST
+	deleteUInt32HashList((*dict)->dict_vendors.hashlist[0]);
+	deleteStringHashList((*dict)->dict_vendors.hashlist[1]);
+#endif
 	
 	/* Dictionary is empty, now destroy the lock */
 #if ENABLE_LOCK_BYPASS
@@ -2583,7 +2731,82 @@ int fd_dict_iterate_rules ( struct dict_object *parent, void * data, int (*cb)(v
 	return ret;
 }
 
-/* Create the list of vendors. Returns a 0-terminated array, that must be freed after use. Returns NULL on error. */
+/* Build the compiled form of the rules of an object - the lock must be held */
+static struct dict_rules_idx * rules_idx_build(struct dict_object * parent)
+{
+	struct dict_rules_idx * idx;
+	struct fd_list * li;
+	uint32_t size = 4;
+	int nb = 0, i;
+	
+	for (li = parent->list[2].next; li != &parent->list[2]; li = li->next)
+		nb++;
+	while (size < 2 * nb)
+		size <<= 1;
+	
+	/* The structure, the rules and the table are allocated in one block */
+	CHECK_MALLOC_DO( idx = calloc(1, sizeof(struct dict_rules_idx) + nb * sizeof(struct dict_rule_data) + size * sizeof(idx->table[0])), return NULL );
+	idx->rules = (struct dict_rule_data *)(idx + 1);
+	idx->table = (void *)(idx->rules + nb);
+	idx->mask = size - 1;
+	
+	for (i = 0, li = parent->list[2].next; li != &parent->list[2]; li = li->next, i++) {
+		struct dict_rule_data * rule = &(_O(li->o)->data.rule);
+		uint32_t h = (uint32_t)(((unsigned long)rule->rule_avp >> 4) * 0x9E3779B1U) & idx->mask;
+		
+		memcpy(&idx->rules[i], rule, sizeof(struct dict_rule_data));
+		while (idx->table[h].avp)
+			h = (h + 1) & idx->mask;
+		idx->table[h].avp = rule->rule_avp;
+		idx->table[h].rule = i;
+	}
+	idx->nb = nb;
+	
+	return idx;
+}
+
+int fd_dict_rules_idx_do ( struct dict_object *parent, void * data, int (*cb)(void *, struct dict_rules_idx *) )
+{
+	int ret = 0;
+	struct dict_rules_idx * idx;
+	
+	TRACE_ENTRY("%p %p %p", parent, data, cb);
+	
+	/* Check parameters */
+	CHECK_PARAMS(  verify_object(parent)  );
+	CHECK_PARAMS(  (parent->type == DICT_COMMAND) 
+			|| ((parent->type == DICT_AVP) && (parent->data.avp.avp_basetype == AVP_TYPE_GROUPED)) );
+	
+	/* Acquire the read lock  */
+#if ENABLE_LOCK_BYPASS
+	if (!parent->dico->dict_bypass_lock)
+#endif
+	CHECK_POSIX(  pthread_rwlock_rdlock(&parent->dico->dict_lock)  );
+	
+	/* Build the index on first use. Several threads may do it at the same time, only one is kept. */
+	idx = __atomic_load_n(&parent->rules_idx, __ATOMIC_ACQUIRE);
+	if (!idx) {
+		struct dict_rules_idx * expected = NULL;
+		CHECK_MALLOC_DO( idx = rules_idx_build(parent), { ret = ENOMEM; goto out; } );
+		if (!__atomic_compare_exchange_n(&parent->rules_idx, &expected, idx, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			free(idx);
+			idx = expected;
+		}
+	}
+	
+	ret = (*cb)(data, idx);
+	
+out:
+	/* Release the lock */
+#if ENABLE_LOCK_BYPASS
+	if (!parent->dico->dict_bypass_lock)
+#endif
+	CHECK_POSIX(  pthread_rwlock_unlock(&parent->dico->dict_lock)  );
+	
+	return ret;
+}
+
+/* Create the list of vendors. Returns a 0-terminated array, that must be freed after use. Returns NULL on error. */
 uint32_t * fd_dict_get_vendorid_list(struct dictionary * dict)
 {
 	uint32_t * ret = NULL;
@@ -2635,3 +2858,952 @@ int fd_dict_get_error_cmd(struct dictionary * dict, struct dict_object **obj)
 	*obj = &dict->dict_cmd_error;
 	return 0;
 }
+
+/*******************************************************************************************************/
+/*******************************************************************************************************/
+/*                                                                                                     */
+/*                                  Bulk load                                                          */
+/*                                                                                                     */
+/*******************************************************************************************************/
+/*******************************************************************************************************/
+
+/* Between fd_dict_bulk_begin and fd_dict_bulk_commit, the AVPs and enumerated values are 
+ appended at the end of their lists instead of being inserted in order, which costs a walk of the list for each object.
+ The duplicates are still detected immediately by the hash lists, and the searches use these hash lists as well.
+ The lists are sorted once when the outermost fd_dict_bulk_commit is called. Without USE_HASHLIST, nothing is deferred. */
+
+/* Stable merge sort of a list of objects, in place. The lock must be held for writing */
+static void bulk_sort_list(struct fd_list * sentinel, int (*cmp)(struct dict_object *, struct dict_object *))
+{
+	struct fd_list *chain, *p, *q, *e, **tail;
+	int insize, nmerges, psize, qsize;
+	
+	if (FD_IS_LIST_EMPTY(sentinel))
+		return;
+	
+	/* Detach the items as a NULL-terminated chain, the prev pointers are restored at the end */
+	chain = sentinel->next;
+	sentinel->prev->next = NULL;
+	
+	for (insize = 1; ; insize *= 2) {
+		p = chain;
+		chain = NULL;
+		tail = &chain;
+		nmerges = 0;
+		
+		while (p) {
+			/* Merge the runs starting at p and q, of (up to) insize items each */
+			nmerges++;
+			for (q = p, psize = 0; q && (psize < insize); psize++)
+				q = q->next;
+			qsize = insize;
+			
+			while (psize || (qsize && q)) {
+				if (psize && (!qsize || !q || (cmp(_O(p->o), _O(q->o)) <= 0))) {
+					e = p; p = p->next; psize--;
+				} else {
+					e = q; q = q->next; qsize--;
+				}
+				*tail = e;
+				tail = &e->next;
+			}
+			p = q;
+		}
+		*tail = NULL;
+		
+		if (nmerges <= 1)
+			break;
+	}
+	
+	/* Restore the doubly-linked list */
+	for (p = sentinel, e = chain; e; p = e, e = e->next) {
+		e->prev = p;
+		p->next = e;
+	}
+	p->next = sentinel;
+	sentinel->prev = p;
+}
+
+/* Order all the lists that were appended during the bulk load. The lock must be held for writing */
+static void bulk_sort(struct dictionary * dict)
+{
+#if USE_HASHLIST
+	struct fd_list * li;
+	
+	/* AVPs of vendor 0, then of the other vendors */
+	bulk_sort_list(&dict->dict_vendors.list[1], order_avp_by_code);
+	bulk_sort_list(&dict->dict_vendors.list[2], order_avp_by_name);
+	for (li = dict->dict_vendors.list[0].next; li != &dict->dict_vendors.list[0]; li = li->next) {
+		bulk_sort_list(&_O(li->o)->list[1], order_avp_by_code);
+		bulk_sort_list(&_O(li->o)->list[2], order_avp_by_name);
+	}
+	
+	/* Enumerated values of each type */
+	for (li = dict->dict_types.next; li != &dict->dict_types; li = li->next) {
+		bulk_sort_list(&_O(li->o)->list[1], order_enum_by_name);
+		bulk_sort_list(&_O(li->o)->list[2], order_enum_by_val);
+	}
+#endif /* USE_HASHLIST */
+}
+
+/* Start (or nest) a bulk load */
+int fd_dict_bulk_begin(struct dictionary * dict)
+{
+	TRACE_ENTRY("%p", dict);
+	CHECK_PARAMS( dict && (dict->dict_eyec == DICT_EYECATCHER) );
+	
+#if ENABLE_LOCK_BYPASS
+	if (!dict->dict_bypass_lock)
+#endif
+	CHECK_POSIX(  pthread_rwlock_wrlock(&dict->dict_lock)  );
+	
+	dict->dict_bulk++;
+	
+#if ENABLE_LOCK_BYPASS
+	if (!dict->dict_bypass_lock)
+#endif
+	CHECK_POSIX(  pthread_rwlock_unlock(&dict->dict_lock)  );
+	
+	return 0;
+}
+
+/* Terminate a bulk load, and order the lists when it is the outermost one */
+int fd_dict_bulk_commit(struct dictionary * dict)
+{
+	int ret = 0;
+	
+	TRACE_ENTRY("%p", dict);
+	CHECK_PARAMS( dict && (dict->dict_eyec == DICT_EYECATCHER) );
+	
+#if ENABLE_LOCK_BYPASS
+	if (!dict->dict_bypass_lock)
+#endif
+	CHECK_POSIX(  pthread_rwlock_wrlock(&dict->dict_lock)  );
+	
+	CHECK_PARAMS_DO( dict->dict_bulk > 0, { ret = EINVAL; goto out; } );
+	
+	if (--dict->dict_bulk == 0)
+		bulk_sort(dict);
+out:	
+#if ENABLE_LOCK_BYPASS
+	if (!dict->dict_bypass_lock)
+#endif
+	CHECK_POSIX(  pthread_rwlock_unlock(&dict->dict_lock)  );
+	
+	return ret;
+}
+
+/*******************************************************************************************************/
+/*******************************************************************************************************/
+/*                                                                                                     */
+/*                                  Snapshots                                                          */
+/*                                                                                                     */
+/*******************************************************************************************************/
+/*******************************************************************************************************/
+
+/* A snapshot is a binary image of the contents of a dictionary, that can be loaded much faster than the 
+ dict_* extensions that created it: the objects are created in bulk, and linked in their (sorted) lists by 
+ merging, instead of one fd_dict_new call at a time.
+
+ The image is made of a header, followed by an array of fixed-size records (struct dict_snap_obj), followed by
+ an area containing the 0-terminated strings. It does not contain any pointer: the records refer to each other
+ by their index in the array (parents always come first) and to the strings by their offset, so the file can
+ be mapped anywhere. The records are grouped by object type, in the order of enum dict_object_type. 
+ 
+ The callbacks of the types (encode, interpret, dump) and the dispatch callbacks are not saved. The types 
+ that have callbacks must be already defined when the snapshot is loaded (this is the case of the base
+ protocol types). */
+
+#define DICT_SNAP_MAGIC		"fdDICTsn"
+#define DICT_SNAP_VERSION	1
+#define DICT_SNAP_BYTEORDER	0x01020304	/* the images are not portable between hosts with different endianness */
+
+/* Special values of the references to the objects that exist in all dictionaries */
+#define DICT_SNAP_REF_NONE	(-1)	/* NULL */
+#define DICT_SNAP_REF_VENDOR0	(-2)	/* vendor 0 */
+#define DICT_SNAP_REF_APPLI0	(-3)	/* application 0 */
+#define DICT_SNAP_REF_CMDERR	(-4)	/* the generic error command */
+
+struct dict_snap_hdr {
+	char		magic[8];	/* DICT_SNAP_MAGIC */
+	uint32_t	version;	/* DICT_SNAP_VERSION */
+	uint32_t	byteorder;	/* DICT_SNAP_BYTEORDER */
+	uint32_t	nb_objs;	/* number of records following the header */
+	uint32_t	str_size;	/* size of the strings area following the records */
+};
+
+struct dict_snap_obj {
+	uint32_t	type;		/* enum dict_object_type */
+	int32_t		parent;		/* index of the parent record, or DICT_SNAP_REF_* */
+	uint32_t	name;		/* offset of the name of the object in the strings area (not used for rules) */
+	uint32_t	name_len;
+	union {
+		struct {
+			uint32_t	id;
+		} vendor, application;
+		struct {
+			uint32_t	base;
+			uint32_t	has_cb;		/* the type has callbacks in the saved dictionary */
+		} type;
+		struct {
+			uint32_t	os;		/* offset of the value in the strings area, for OctetString types */
+			uint32_t	os_len;
+			uint64_t	val;		/* the first 8 bytes of union avp_value, for the other types */
+		} enumval;
+		struct {
+			uint32_t	code;
+			uint32_t	vendor;
+			uint32_t	basetype;
+			uint8_t		flag_mask;
+			uint8_t		flag_val;
+		} avp;
+		struct {
+			uint32_t	code;
+			uint8_t		flag_mask;
+			uint8_t		flag_val;
+		} cmd;
+		struct {
+			int32_t		avp;		/* index of the AVP record */
+			uint32_t	position;
+			uint32_t	order;
+			int32_t		min;
+			int32_t		max;
+		} rule;
+	} d;
+};
+
+/* Hash of an object pointer, for the table used while saving */
+#define SNAP_PTR_HASH( _p ) ((uint32_t)(((unsigned long)(_p) >> 4) * 0x9E3779B1U))
+
+/* The state while building an image */
+struct snap_save {
+	struct dictionary *	dict;
+	struct dict_snap_obj *	objs;
+	uint32_t		nb;
+	uint32_t		max;
+	char *			str;
+	size_t			str_size;
+	size_t			str_alloc;
+	struct {
+		struct dict_object *	obj;
+		int32_t			idx;
+	} *			refs;	/* object -> index of its record */
+	uint32_t		mask;
+};
+
+/* Append a string in the strings area */
+static int snap_str(struct snap_save * s, void * data, size_t len, uint32_t * off)
+{
+	if (s->str_size + len + 1 > s->str_alloc) {
+		size_t n = s->str_alloc ?: 4096;
+		while (s->str_size + len + 1 > n)
+			n *= 2;
+		CHECK_PARAMS( n <= UINT32_MAX );
+		CHECK_MALLOC( s->str = realloc(s->str, n) );
+		s->str_alloc = n;
+	}
+	memcpy(s->str + s->str_size, data, len);
+	s->str[s->str_size + len] = '\0';
+	*off = s->str_size;
+	s->str_size += len + 1;
+	return 0;
+}
+
+/* Get the reference of an object that was already saved */
+static int snap_ref(struct snap_save * s, struct dict_object * obj, int32_t * ref)
+{
+	uint32_t h;
+	
+	if (obj == NULL) {
+		*ref = DICT_SNAP_REF_NONE;
+		return 0;
+	}
+	if (obj == &s->dict->dict_vendors) {
+		*ref = DICT_SNAP_REF_VENDOR0;
+		return 0;
+	}
+	if (obj == &s->dict->dict_applications) {
+		*ref = DICT_SNAP_REF_APPLI0;
+		return 0;
+	}
+	if (obj == &s->dict->dict_cmd_error) {
+		*ref = DICT_SNAP_REF_CMDERR;
+		return 0;
+	}
+	for (h = SNAP_PTR_HASH(obj) & s->mask; s->refs[h].obj; h = (h + 1) & s->mask) {
+		if (s->refs[h].obj == obj) {
+			*ref = s->refs[h].idx;
+			return 0;
+		}
+	}
+	TRACE_DEBUG(INFO, "Object %p referenced before it was saved", obj);
+	return EINVAL;
+}
+
+/* Save one object */
+static int snap_add(struct snap_save * s, struct dict_object * obj)
+{
+	struct dict_snap_obj * rec;
+	uint32_t h;
+	
+	CHECK_PARAMS( s->nb < s->max );
+	rec = &s->objs[s->nb];
+	memset(rec, 0, sizeof(struct dict_snap_obj));
+	rec->type = obj->type;
+	CHECK_FCT( snap_ref(s, obj->parent, &rec->parent) );
+	
+	switch (obj->type) {
+		case DICT_VENDOR:
+			rec->d.vendor.id = obj->data.vendor.vendor_id;
+			CHECK_FCT( snap_str(s, obj->data.vendor.vendor_name, obj->datastr_len, &rec->name) );
+			break;
+		
+		case DICT_APPLICATION:
+			rec->d.application.id = obj->data.application.application_id;
+			CHECK_FCT( snap_str(s, obj->data.application.application_name, obj->datastr_len, &rec->name) );
+			break;
+		
+		case DICT_TYPE:
+			rec->d.type.base = obj->data.type.type_base;
+			rec->d.type.has_cb = (obj->data.type.type_encode || obj->data.type.type_interpret || obj->data.type.type_dump) ? 1 : 0;
+			CHECK_FCT( snap_str(s, obj->data.type.type_name, obj->datastr_len, &rec->name) );
+			break;
+		
+		case DICT_ENUMVAL:
+			if (obj->parent->data.type.type_base == AVP_TYPE_OCTETSTRING) {
+				CHECK_FCT( snap_str(s, obj->data.enumval.enum_value.os.data, obj->data.enumval.enum_value.os.len, &rec->d.enumval.os) );
+				rec->d.enumval.os_len = obj->data.enumval.enum_value.os.len;
+			} else {
+				memcpy(&rec->d.enumval.val, &obj->data.enumval.enum_value, sizeof(rec->d.enumval.val));
+			}
+			CHECK_FCT( snap_str(s, obj->data.enumval.enum_name, obj->datastr_len, &rec->name) );
+			break;
+		
+		case DICT_AVP:
+			rec->d.avp.code = obj->data.avp.avp_code;
+			rec->d.avp.vendor = obj->data.avp.avp_vendor;
+			rec->d.avp.basetype = obj->data.avp.avp_basetype;
+			rec->d.avp.flag_mask = obj->data.avp.avp_flag_mask;
+			rec->d.avp.flag_val = obj->data.avp.avp_flag_val;
+			CHECK_FCT( snap_str(s, obj->data.avp.avp_name, obj->datastr_len, &rec->name) );
+			break;
+		
+		case DICT_COMMAND:
+			rec->d.cmd.code = obj->data.cmd.cmd_code;
+			rec->d.cmd.flag_mask = obj->data.cmd.cmd_flag_mask;
+			rec->d.cmd.flag_val = obj->data.cmd.cmd_flag_val;
+			CHECK_FCT( snap_str(s, obj->data.cmd.cmd_name, obj->datastr_len, &rec->name) );
+			break;
+		
+		case DICT_RULE:
+			CHECK_FCT( snap_ref(s, obj->data.rule.rule_avp, &rec->d.rule.avp) );
+			rec->d.rule.position = obj->data.rule.rule_position;
+			rec->d.rule.order = obj->data.rule.rule_order;
+			rec->d.rule.min = obj->data.rule.rule_min;
+			rec->d.rule.max = obj->data.rule.rule_max;
+			break;
+		
+		default:
+			ASSERT(0);
+	}
+	rec->name_len = obj->datastr_len;
+	
+	/* Save the index of the object for the records that will refer to it */
+	for (h = SNAP_PTR_HASH(obj) & s->mask; s->refs[h].obj; h = (h + 1) & s->mask)
+		;
+	s->refs[h].obj = obj;
+	s->refs[h].idx = s->nb;
+	
+	s->nb++;
+	return 0;
+}
+
+/* Save all the objects of a list */
+static int snap_add_list(struct snap_save * s, struct fd_list * sentinel)
+{
+	struct fd_list * li;
+	for (li = sentinel->next; li != sentinel; li = li->next) {
+		CHECK_FCT( snap_add(s, _O(li->o)) );
+	}
+	return 0;
+}
+
+/* Save all the objects in the order expected by the loader - the lock must be held */
+static int snap_add_all(struct snap_save * s)
+{
+	struct dictionary * dict = s->dict;
+	struct fd_list * li, * av;
+	
+	CHECK_FCT( snap_add_list(s, &dict->dict_vendors.list[0]) );
+	CHECK_FCT( snap_add_list(s, &dict->dict_applications.list[0]) );
+	CHECK_FCT( snap_add_list(s, &dict->dict_types) );
+	for (li = dict->dict_types.next; li != &dict->dict_types; li = li->next) {
+		CHECK_FCT( snap_add_list(s, &_O(li->o)->list[1]) );
+	}
+	/* The AVPs of vendor 0, then of the other vendors */
+	li = &dict->dict_vendors.list[0];
+	do {
+		CHECK_FCT( snap_add_list(s, &_O(li->o)->list[1]) );
+		li = li->next;
+	} while (li != &dict->dict_vendors.list[0]);
+	CHECK_FCT( snap_add_list(s, &dict->dict_cmd_name) );
+	
+	/* The rules of the commands, then of the grouped AVPs */
+	for (li = dict->dict_cmd_name.next; li != &dict->dict_cmd_name; li = li->next) {
+		CHECK_FCT( snap_add_list(s, &_O(li->o)->list[2]) );
+	}
+	CHECK_FCT( snap_add_list(s, &dict->dict_cmd_error.list[2]) );
+	li = &dict->dict_vendors.list[0];
+	do {
+		struct fd_list * avps = &_O(li->o)->list[1];
+		for (av = avps->next; av != avps; av = av->next) {
+			CHECK_FCT( snap_add_list(s, &_O(av->o)->list[2]) );
+		}
+		li = li->next;
+	} while (li != &dict->dict_vendors.list[0]);
+	
+	return 0;
+}
+
+int fd_dict_snapshot_save(struct dictionary * dict, const char * path)
+{
+	struct snap_save s;
+	struct dict_snap_hdr hdr;
+	FILE * f = NULL;
+	int ret = 0, i;
+	uint32_t size = 4;
+	
+	TRACE_ENTRY("%p %p", dict, path);
+	CHECK_PARAMS( dict && (dict->dict_eyec == DICT_EYECATCHER) && path );
+	
+	memset(&s, 0, sizeof(s));
+	s.dict = dict;
+	
+	/* Lock the dictionary for reading */
+#if ENABLE_LOCK_BYPASS
+	if (!dict->dict_bypass_lock)
+#endif
+	CHECK_POSIX(  pthread_rwlock_rdlock(&dict->dict_lock)  );
+	
+	for (i = 1; i <= DICT_TYPE_MAX; i++)
+		s.max += dict->dict_count[i];
+	while (size < 2 * s.max)
+		size <<= 1;
+	s.mask = size - 1;
+	CHECK_MALLOC_DO( s.objs = calloc(s.max ?: 1, sizeof(struct dict_snap_obj)), { ret = ENOMEM; goto out; } );
+	CHECK_MALLOC_DO( s.refs = calloc(size, sizeof(s.refs[0])), { ret = ENOMEM; goto out; } );
+	
+	CHECK_FCT_DO( ret = snap_add_all(&s), goto out );
+	
+	/* Now write the image */
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, DICT_SNAP_MAGIC, sizeof(hdr.magic));
+	hdr.version = DICT_SNAP_VERSION;
+	hdr.byteorder = DICT_SNAP_BYTEORDER;
+	hdr.nb_objs = s.nb;
+	hdr.str_size = s.str_size;
+	
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		ret = errno;
+		TRACE_ERROR("Unable to create the dictionary snapshot '%s': %s", path, strerror(ret));
+		goto out;
+	}
+	if ((fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+	 || (s.nb && (fwrite(s.objs, sizeof(struct dict_snap_obj), s.nb, f) != s.nb))
+	 || (s.str_size && (fwrite(s.str, s.str_size, 1, f) != 1))) {
+		ret = errno ?: EIO;
+		TRACE_ERROR("Unable to write the dictionary snapshot '%s': %s", path, strerror(ret));
+	}
+	if ((fclose(f) != 0) && !ret) {
+		ret = errno;
+		TRACE_ERROR("Unable to write the dictionary snapshot '%s': %s", path, strerror(ret));
+	}
+	if (!ret) {
+		LOG_N("Saved %u dictionary objects in '%s'", s.nb, path);
+	}
+	
+out:
+	/* Unlock */
+#if ENABLE_LOCK_BYPASS
+	if (!dict->dict_bypass_lock)
+#endif
+	CHECK_POSIX_DO(  pthread_rwlock_unlock(&dict->dict_lock), /* continue */  );
+	
+	free(s.objs);
+	free(s.refs);
+	free(s.str);
+	return ret;
+}
+
+/* How the objects of each type are linked in the dictionary: the object's lists, and their order functions */
+static struct {
+	int	li[2];
+	int	(*cmp[2])(struct dict_object *, struct dict_object *);
+} snap_links[] = {
+	  { { -1, -1 }, { NULL,			NULL } }
+	, { {  0, -1 }, { order_vendor_by_id,	NULL } }		/* DICT_VENDOR */
+	, { {  0, -1 }, { order_appli_by_id,	NULL } }		/* DICT_APPLICATION */
+	, { {  0, -1 }, { order_type_by_name,	NULL } }		/* DICT_TYPE */
+	, { {  0,  1 }, { order_enum_by_name,	order_enum_by_val } }	/* DICT_ENUMVAL */
+	, { {  0,  1 }, { order_avp_by_code,	order_avp_by_name } }	/* DICT_AVP */
+	, { {  1,  0 }, { order_cmd_by_codefl,	order_cmd_by_name } }	/* DICT_COMMAND */
+	, { {  0, -1 }, { order_rule_by_avpvc,	NULL } }		/* DICT_RULE */
+};
+
+/* The state while loading a group of records of the same type */
+struct snap_ent {
+	struct dict_object *	obj;		/* the new object */
+	uint32_t		rec;		/* its record */
+	struct dict_object *	vendor;		/* for AVPs */
+	struct fd_list *	sentinel[2];	/* the lists in which the object goes */
+	struct fd_list *	pos[2];		/* the object will be inserted before these elements */
+	struct dict_object *	dup;		/* an existing object with the same key */
+};
+
+/* The mapped image */
+struct snap_img {
+	struct dict_snap_hdr *	hdr;
+	struct dict_snap_obj *	objs;
+	char *			str;
+	struct dict_object **	map;	/* the dictionary object of each record */
+};
+
+/* Order two entries by the sentinel of their list k, then by the key of this list */
+static int snap_cmp(struct snap_ent * e1, struct snap_ent * e2, int k)
+{
+	if (e1->sentinel[k] != e2->sentinel[k])
+		return (e1->sentinel[k] < e2->sentinel[k]) ? -1 : 1;
+	return (*snap_links[e1->obj->type].cmp[k])(e1->obj, e2->obj);
+}
+
+/* Stable merge sort of the entries */
+static void snap_sort(struct snap_ent * ents, struct snap_ent * tmp, size_t n, int k)
+{
+	size_t h = n / 2, i = 0, j = h, o = 0;
+	
+	if (n < 2)
+		return;
+	
+	snap_sort(ents, tmp, h, k);
+	snap_sort(ents + h, tmp, n - h, k);
+	while ((i < h) && (j < n))
+		tmp[o++] = (snap_cmp(&ents[j], &ents[i], k) < 0) ? ents[j++] : ents[i++];
+	while (i < h)
+		tmp[o++] = ents[i++];
+	memcpy(ents, tmp, o * sizeof(struct snap_ent));
+}
+
+/* Find where the sorted entries go in their list k. Since both are sorted, this is a single walk of each list. */
+static int snap_place(struct snap_ent * ents, size_t n, int k)
+{
+	struct fd_list * cur = NULL;
+	size_t i;
+	
+	for (i = 0; i < n; i++) {
+		struct snap_ent * e = &ents[i];
+		int cmp = 1;
+		
+		if (!i || (e->sentinel[k] != ents[i - 1].sentinel[k])) {
+			cur = e->sentinel[k]->next;
+		} else {
+			/* Two records with the same key: the image is corrupted */
+			CHECK_PARAMS( snap_cmp(&ents[i - 1], e, k) );
+		}
+		
+		while ((cur != e->sentinel[k]) && ((cmp = (*snap_links[e->obj->type].cmp[k])(_O(cur->o), e->obj)) < 0))
+			cur = cur->next;
+		
+		if ((cur != e->sentinel[k]) && (cmp == 0))
+			e->dup = _O(cur->o);
+		else
+			e->pos[k] = cur;
+	}
+	return 0;
+}
+
+/* Resolve a reference in the image */
+static int snap_get_ref(struct dictionary * dict, struct snap_img * img, uint32_t rec, int32_t ref, struct dict_object ** obj)
+{
+	switch (ref) {
+		case DICT_SNAP_REF_NONE:
+			*obj = NULL;
+			return 0;
+		case DICT_SNAP_REF_VENDOR0:
+			*obj = &dict->dict_vendors;
+			return 0;
+		case DICT_SNAP_REF_APPLI0:
+			*obj = &dict->dict_applications;
+			return 0;
+		case DICT_SNAP_REF_CMDERR:
+			*obj = &dict->dict_cmd_error;
+			return 0;
+	}
+	/* Only records from the previous groups can be referenced */
+	CHECK_PARAMS( (ref >= 0) && ((uint32_t)ref < rec) && img->map[ref] );
+	*obj = img->map[ref];
+	return 0;
+}
+
+/* Get a string from the image */
+static int snap_get_str(struct snap_img * img, uint32_t off, uint32_t len, char ** str)
+{
+	CHECK_PARAMS( ((uint64_t)off + len < img->hdr->str_size) && (img->str[off + len] == '\0') );
+	*str = img->str + off;
+	return 0;
+}
+
+/* Create the object of a record, without linking it - the lock must be held */
+static int snap_new_object(struct dictionary * dict, struct snap_img * img, uint32_t i, struct snap_ent * e)
+{
+	struct dict_snap_obj * rec = &img->objs[i];
+	struct dict_object * parent = NULL;
+	union {
+		struct dict_vendor_data		vendor;
+		struct dict_application_data	application;
+		struct dict_type_data		type;
+		struct dict_enumval_data	enumval;
+		struct dict_avp_data		avp;
+		struct dict_cmd_data		cmd;
+		struct dict_rule_data		rule;
+	} data;
+	int dupos = 0;
+	
+	memset(&data, 0, sizeof(data));
+	memset(e, 0, sizeof(struct snap_ent));
+	e->rec = i;
+	
+	/* Check the parent as fd_dict_new does */
+	CHECK_FCT( snap_get_ref(dict, img, i, rec->parent, &parent) );
+	switch (dict_obj_info[rec->type].parent) {
+		case 0:
+			CHECK_PARAMS( parent == NULL );
+			break;
+		case 2:
+			CHECK_PARAMS( parent != NULL );
+			/* fallthrough */
+		case 1:
+			if (!parent)
+				break;
+			if (rec->type == DICT_RULE) {
+				CHECK_PARAMS( (parent->type == DICT_COMMAND) 
+						|| ( (parent->type == DICT_AVP) && (parent->data.avp.avp_basetype == AVP_TYPE_GROUPED ) ) );
+			} else {
+				CHECK_PARAMS( parent->type == dict_obj_info[rec->type].parenttype );
+			}
+	}
+	
+	switch (rec->type) {
+		case DICT_VENDOR:
+			data.vendor.vendor_id = rec->d.vendor.id;
+			CHECK_PARAMS( data.vendor.vendor_id != 0 );
+			CHECK_FCT( snap_get_str(img, rec->name, rec->name_len, &data.vendor.vendor_name) );
+			e->sentinel[0] = &dict->dict_vendors.list[0];
+			break;
+		
+		case DICT_APPLICATION:
+			data.application.application_id = rec->d.application.id;
+			CHECK_PARAMS( data.application.application_id != 0 );
+			CHECK_FCT( snap_get_str(img, rec->name, rec->name_len, &data.application.application_name) );
+			e->sentinel[0] = &dict->dict_applications.list[0];
+			break;
+		
+		case DICT_TYPE:
+			data.type.type_base = rec->d.type.base;
+			CHECK_PARAMS( data.type.type_base <= AVP_TYPE_MAX );
+			CHECK_FCT( snap_get_str(img, rec->name, rec->name_len, &data.type.type_name) );
+			e->sentinel[0] = &dict->dict_types;
+			break;
+		
+		case DICT_ENUMVAL:
+			CHECK_PARAMS( parent->data.type.type_base != AVP_TYPE_GROUPED );
+			if (parent->data.type.type_base == AVP_TYPE_OCTETSTRING) {
+				char * os;
+				CHECK_FCT( snap_get_str(img, rec->d.enumval.os, rec->d.enumval.os_len, &os) );
+				data.enumval.enum_value.os.data = (uint8_t *)os;
+				data.enumval.enum_value.os.len = rec->d.enumval.os_len;
+				dupos = 1;
+			} else {
+				memcpy(&data.enumval.enum_value, &rec->d.enumval.val, sizeof(rec->d.enumval.val));
+			}
+			CHECK_FCT( snap_get_str(img, rec->name, rec->name_len, &data.enumval.enum_name) );
+			e->sentinel[0] = &parent->list[1];
+			e->sentinel[1] = &parent->list[2];
+			break;
+		
+		case DICT_AVP:
+			data.avp.avp_code = rec->d.avp.code;
+			data.avp.avp_vendor = rec->d.avp.vendor;
+			data.avp.avp_basetype = rec->d.avp.basetype;
+			data.avp.avp_flag_mask = rec->d.avp.flag_mask;
+			data.avp.avp_flag_val = rec->d.avp.flag_val;
+			CHECK_PARAMS( data.avp.avp_basetype <= AVP_TYPE_MAX );
+			CHECK_PARAMS( !parent || (parent->data.type.type_base == data.avp.avp_basetype) );
+			CHECK_FCT( snap_get_str(img, rec->name, rec->name_len, &data.avp.avp_name) );
+			CHECK_FCT( search_vendor(dict, VENDOR_BY_ID, &data.avp.avp_vendor, &e->vendor) );
+			CHECK_PARAMS( e->vendor );
+			e->sentinel[0] = &e->vendor->list[1];
+			e->sentinel[1] = &e->vendor->list[2];
+			break;
+		
+		case DICT_COMMAND:
+			data.cmd.cmd_code = rec->d.cmd.code;
+			data.cmd.cmd_flag_mask = rec->d.cmd.flag_mask;
+			data.cmd.cmd_flag_val = rec->d.cmd.flag_val;
+			CHECK_PARAMS( data.cmd.cmd_flag_mask & CMD_FLAG_REQUEST );
+			CHECK_FCT( snap_get_str(img, rec->name, rec->name_len, &data.cmd.cmd_name) );
+			e->sentinel[0] = &dict->dict_cmd_code;
+			e->sentinel[1] = &dict->dict_cmd_name;
+			break;
+		
+		case DICT_RULE:
+			CHECK_FCT( snap_get_ref(dict, img, i, rec->d.rule.avp, &data.rule.rule_avp) );
+			CHECK_PARAMS( data.rule.rule_avp && (data.rule.rule_avp->type == DICT_AVP) );
+			data.rule.rule_position = rec->d.rule.position;
+			data.rule.rule_order = rec->d.rule.order;
+			data.rule.rule_min = rec->d.rule.min;
+			data.rule.rule_max = rec->d.rule.max;
+			e->sentinel[0] = &parent->list[2];
+			break;
+		
+		default:
+			CHECK_PARAMS( 0 );
+	}
+	
+	/* Now create the object */
+	CHECK_MALLOC( e->obj = malloc(sizeof(struct dict_object)) );
+	init_object(e->obj, rec->type);
+	e->obj->dico = dict;
+	e->obj->parent = parent;
+	CHECK_FCT_DO( init_object_data(e->obj, &data, rec->type, dupos), { free(e->obj); e->obj = NULL; return EINVAL; } );
+	
+	return 0;
+}
+
+/* Free an object that was not linked in the dictionary */
+static void snap_free_object(struct dict_object * obj)
+{
+	if ((obj->type == DICT_ENUMVAL) && (obj->parent->data.type.type_base == AVP_TYPE_OCTETSTRING))
+		free(obj->data.enumval.enum_value.os.data);
+	destroy_object_data(obj);
+	free(obj);
+}
+
+/* Remove the entries that were mapped to an existing object */
+static size_t snap_compact(struct snap_ent * ents, size_t n)
+{
+	size_t i, o = 0;
+	for (i = 0; i < n; i++) {
+		if (ents[i].obj)
+			ents[o++] = ents[i];
+	}
+	return o;
+}
+
+/* Load the records [b, e) which all have the same type - the lock must be held for writing */
+static int snap_load_group(struct dictionary * dict, struct snap_img * img, uint32_t b, uint32_t e)
+{
+	struct snap_ent * ents = NULL, * tmp = NULL;
+	enum dict_object_type type = img->objs[b].type;
+	size_t n = e - b, i, hashed = 0;
+	int ret = 0, k;
+	
+	CHECK_MALLOC_DO( ents = calloc(n, sizeof(struct snap_ent)), { ret = ENOMEM; goto out; } );
+	CHECK_MALLOC_DO( tmp = calloc(n, sizeof(struct snap_ent)), { ret = ENOMEM; goto out; } );
+	
+	/* Create the objects */
+	for (i = 0; i < n; i++) {
+		CHECK_FCT_DO( ret = snap_new_object(dict, img, b + i, &ents[i]), 
+			{ TRACE_ERROR("Invalid record %zd in the dictionary snapshot", b + i); goto out; } );
+	}
+	
+	/* Find their place in the lists. Objects that already exist in the dictionary are reused, if they have the same data. */
+	for (k = 0; k < 2; k++) {
+		if (snap_links[type].li[k] < 0)
+			break;
+		snap_sort(ents, tmp, n, k);
+		CHECK_FCT_DO( ret = snap_place(ents, n, k), goto out );
+		for (i = 0; i < n; i++) {
+			struct snap_ent * en = &ents[i];
+			if (!en->dup)
+				continue;
+			
+			if ((type == DICT_RULE) && (en->dup->data.rule.rule_position == RULE_REQUIRED) && (en->obj->data.rule.rule_position == RULE_OPTIONAL)) {
+				/* As in fd_dict_new, override the existing rule */
+				TRACE_DEBUG(INFO, "Overriding rule to optional for AVP: %s", en->dup->data.rule.rule_avp->data.avp.avp_name);
+				en->dup->data.rule.rule_position = RULE_OPTIONAL;
+				rules_idx_reset(en->dup->parent);
+			} else if ((k > 0) || check_duplicate(type, en->dup, en->obj)) {
+				char * buf = NULL;
+				size_t len = 0, offset = 0;
+				ret = EEXIST;
+				CHECK_MALLOC_DO( dump_object(&buf, &len, &offset, en->dup, 0, 0, 0), );
+				TRACE_ERROR("Conflicting entry in the dictionary for record %d of the snapshot: %s", en->rec, buf ?: "");
+				free(buf);
+				goto out;
+			}
+			img->map[en->rec] = en->dup;
+			snap_free_object(en->obj);
+			en->obj = NULL;
+		}
+		n = snap_compact(ents, n);
+	}
+	
+	/* The callbacks of the types are not saved in the image */
+	if (type == DICT_TYPE) {
+		for (i = 0; i < n; i++) {
+			if (img->objs[ents[i].rec].d.type.has_cb) {
+				TRACE_ERROR("Type '%s' has callbacks that cannot be restored from the snapshot, it must be defined before the snapshot is loaded", ents[i].obj->data.type.type_name);
+				ret = ENOTSUP;
+				goto out;
+			}
+		}
+	}
+	
+#if USE_HASHLIST
+	/* Link the new objects in the hash lists */
+	for (hashed = 0; hashed < n; hashed++) {
+		struct dict_object * locref = NULL;
+		if (type == DICT_ENUMVAL)
+			ret = hash_link_enumval(ents[hashed].obj->parent, ents[hashed].obj, &locref);
+		else if (type == DICT_AVP)
+			ret = hash_link_avp(ents[hashed].vendor, ents[hashed].obj, &locref);
+		if (ret) {
+			TRACE_ERROR("Unable to index record %d of the dictionary snapshot: %s", ents[hashed].rec, strerror(ret));
+			goto out;
+		}
+	}
+#endif
+	
+	/* Nothing can fail anymore, link the objects in their lists, in order */
+	for (k = 1; k >= 0; k--) {
+		if (snap_links[type].li[k] < 0)
+			continue;
+		if (k == 0)
+			snap_sort(ents, tmp, n, 0);
+		for (i = 0; i < n; i++)
+			fd_list_insert_before(ents[i].pos[k], &ents[i].obj->list[snap_links[type].li[k]]);
+	}
+	for (i = 0; i < n; i++) {
+		img->map[ents[i].rec] = ents[i].obj;
+		if (type == DICT_RULE)
+			rules_idx_reset(ents[i].obj->parent);
+		ents[i].obj = NULL;
+	}
+	dict->dict_count[type] += n;
+	hashed = 0;
+	
+out:
+	if (ents) {
+#if USE_HASHLIST
+		while (hashed > 0) {
+			hashed--;
+			if (type == DICT_ENUMVAL)
+				hash_unlink_enumval(ents[hashed].obj->parent, ents[hashed].obj);
+			else if (type == DICT_AVP)
+				hash_unlink_avp(ents[hashed].vendor, ents[hashed].obj);
+		}
+#endif
+		for (i = 0; i < n; i++) {
+			if (ents[i].obj)
+				snap_free_object(ents[i].obj);
+		}
+	}
+	free(ents);
+	free(tmp);
+	return ret;
+}
+
+int fd_dict_snapshot_load(struct dictionary * dict, const char * path)
+{
+	struct snap_img img;
+	struct stat st;
+	void * addr = MAP_FAILED;
+	int fd = -1, ret = 0;
+	uint32_t b, e, created = 0;
+	enum dict_object_type last = 0;
+	
+	TRACE_ENTRY("%p %p", dict, path);
+	CHECK_PARAMS( dict && (dict->dict_eyec == DICT_EYECATCHER) && path );
+	
+	memset(&img, 0, sizeof(img));
+	
+	/* Map the image */
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		ret = errno;
+		TRACE_ERROR("Unable to open the dictionary snapshot '%s': %s", path, strerror(ret));
+		return ret;
+	}
+	CHECK_SYS_DO( fstat(fd, &st), { ret = __ret__; goto out; } );
+	if ((uint64_t)st.st_size < sizeof(struct dict_snap_hdr)) {
+		TRACE_ERROR("The file '%s' is not a dictionary snapshot", path);
+		ret = EINVAL;
+		goto out;
+	}
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (addr == MAP_FAILED) {
+		ret = errno;
+		TRACE_ERROR("Unable to map the dictionary snapshot '%s': %s", path, strerror(ret));
+		goto out;
+	}
+	
+	/* Check the header */
+	img.hdr = addr;
+	if (memcmp(img.hdr->magic, DICT_SNAP_MAGIC, sizeof(img.hdr->magic)) 
+	 || (img.hdr->byteorder != DICT_SNAP_BYTEORDER)
+	 || (img.hdr->version != DICT_SNAP_VERSION)) {
+		TRACE_ERROR("The file '%s' is not a dictionary snapshot, or was created by a different version or on a different host", path);
+		ret = EINVAL;
+		goto out;
+	}
+	if ((uint64_t)st.st_size != sizeof(struct dict_snap_hdr) + (uint64_t)img.hdr->nb_objs * sizeof(struct dict_snap_obj) + img.hdr->str_size) {
+		TRACE_ERROR("The dictionary snapshot '%s' is truncated or corrupted", path);
+		ret = EINVAL;
+		goto out;
+	}
+	img.objs = (struct dict_snap_obj *)(img.hdr + 1);
+	img.str = (char *)(img.objs + img.hdr->nb_objs);
+	CHECK_MALLOC_DO( img.map = calloc(img.hdr->nb_objs ?: 1, sizeof(struct dict_object *)), { ret = ENOMEM; goto out; } );
+	
+	/* Lock the dictionary for change */
+#if ENABLE_LOCK_BYPASS
+	if (!dict->dict_bypass_lock)
+#endif
+	CHECK_POSIX_DO(  ret = pthread_rwlock_wrlock(&dict->dict_lock),  goto out  );
+	
+	/* The groups are merged in the ordered lists, so order the objects of a pending bulk load first */
+	if (dict->dict_bulk)
+		bulk_sort(dict);
+	
+	/* Load the groups of records */
+	for (b = 0; b < img.hdr->nb_objs; b = e) {
+		enum dict_object_type type = img.objs[b].type;
+		CHECK_PARAMS_DO( CHECK_TYPE(type) && (type > last), { ret = EINVAL; break; } );
+		for (e = b + 1; (e < img.hdr->nb_objs) && (img.objs[e].type == type); e++)
+			;
+		CHECK_FCT_DO( ret = snap_load_group(dict, &img, b, e), break );
+		last = type;
+	}
+	if (!ret) {
+		for (b = 1; b <= DICT_TYPE_MAX; b++)
+			created += dict->dict_count[b];
+	}
+	
+#if ENABLE_LOCK_BYPASS
+	if (!dict->dict_bypass_lock)
+#endif
+	CHECK_POSIX_DO(  pthread_rwlock_unlock(&dict->dict_lock), /* continue */  );
+	
+	if (!ret) {
+		LOG_N("Loaded %u objects from the dictionary snapshot '%s', the dictionary now contains %u objects", img.hdr->nb_objs, path, created);
+	} else {
+		TRACE_ERROR("Error while loading the dictionary snapshot '%s', it was partially loaded", path);
+	}
+out:
+	free(img.map);
+	if (addr != MAP_FAILED)
+		munmap(addr, st.st_size);
+	close(fd);
+	return ret;
+}
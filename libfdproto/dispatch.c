@@ -63,6 +63,19 @@ struct disp_hdl {
 #define VALIDATE_HDL( _hdl ) \
 	( ( ( _hdl ) != NULL ) && ( ((struct disp_hdl *)( _hdl ))->eyec == DISP_EYEC ) )
 
+/* Summary of the registered handlers, that fd_msg_dispatch uses to skip the work no handler needs. It is rebuilt
+ each time a handler is registered or unregistered, and read with fd_disp_lock held. NULL when there is no handler. */
+struct disp_table {
+	int		nb_avp;	/* number of DISP_HOW_AVP and DISP_HOW_AVP_ENUMVAL handlers */
+	int		nb_app;	/* number of items in app */
+	struct {
+		application_id_t	id;
+		struct dictionary *	dict;
+		struct dict_object *	obj;
+	}		app[];	/* the applications referenced by the handlers, ordered by id */
+};
+static struct disp_table * disp_table = NULL;
+
 /**************************************************************************************/
 
 /* Call CBs from a given list (any_handlers if cb_list is NULL) -- must have locked fd_disp_lock before */
@@ -114,6 +127,97 @@ int fd_disp_call_cb_int( struct fd_list * cb_list, struct msg ** msg, struct avp
 	return 0;
 }
 
+/* Rebuild disp_table from the list of handlers -- must have write-locked fd_disp_lock before */
+static int disp_table_build(void)
+{
+	struct fd_list * li;
+	struct disp_table * new;
+	int nb = 0;
+	
+	if (FD_IS_LIST_EMPTY(&all_handlers)) {
+		free(disp_table);
+		disp_table = NULL;
+		return 0;
+	}
+	
+	for (li = all_handlers.next; li != &all_handlers; li = li->next)
+		nb++;
+	CHECK_MALLOC( new = malloc(sizeof(struct disp_table) + nb * sizeof(new->app[0])) );
+	new->nb_avp = 0;
+	new->nb_app = 0;
+	
+	for (li = all_handlers.next; li != &all_handlers; li = li->next) {
+		struct disp_hdl * hdl = (struct disp_hdl *)(li->o);
+		struct dict_application_data data;
+		struct dictionary * dict;
+		int i;
+		
+		if (hdl->how >= DISP_HOW_AVP)
+			new->nb_avp++;
+		
+		/* The application may be specified for other handlers than DISP_HOW_APPID, and is not checked in that case.
+		 An application missing from the table is only searched in the dictionary. */
+		if (!hdl->when.app 
+				|| fd_dict_getval(hdl->when.app, &data) 
+				|| fd_dict_getdict(hdl->when.app, &dict))
+			continue;
+		
+		/* Insert in order of id, once */
+		for (i = new->nb_app; (i > 0) && (new->app[i - 1].id > data.application_id); i--)
+			;
+		if ((i > 0) && (new->app[i - 1].id == data.application_id))
+			continue;
+		memmove(&new->app[i + 1], &new->app[i], (new->nb_app - i) * sizeof(new->app[0]));
+		new->app[i].id   = data.application_id;
+		new->app[i].dict = dict;
+		new->app[i].obj  = hdl->when.app;
+		new->nb_app++;
+	}
+	
+	free(disp_table);
+	disp_table = new;
+	return 0;
+}
+
+/* Return the application object with this id if a handler refers to it, NULL otherwise -- must have locked fd_disp_lock before */
+struct dict_object * fd_disp_app_int( struct dictionary * dict, application_id_t id )
+{
+	int lo = 0, hi;
+	
+	if (!disp_table)
+		return NULL;
+	
+	hi = disp_table->nb_app - 1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (disp_table->app[mid].id == id)
+			return (disp_table->app[mid].dict == dict) ? disp_table->app[mid].obj : NULL;
+		if (disp_table->app[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return NULL;
+}
+
+/* Return the number of handlers registered for AVPs -- must have locked fd_disp_lock before */
+int fd_disp_nb_avp_int( void )
+{
+	return disp_table ? disp_table->nb_avp : 0;
+}
+
+/* Check if some handler in the list (of an AVP) is registered for an enumerated value -- must have locked fd_disp_lock before */
+int fd_disp_has_enumval_int( struct fd_list * cb_list )
+{
+	struct fd_list * li;
+	
+	for (li = cb_list->next; li != cb_list; li = li->next) {
+		if (((struct disp_hdl *)(li->o))->when.value)
+			return 1;
+	}
+	return 0;
+}
+
 /**************************************************************************************/
 
 /* Create a new handler and link it */
@@ -124,6 +228,7 @@ int fd_disp_register ( int (*cb)( struct msg **, struct avp *, struct session *,
 	struct disp_hdl * new;
 	struct dict_object * type_enum = NULL, * type_avp;
 	struct dictionary  * dict = NULL;
+	int ret;
 	
 	TRACE_ENTRY("%p %d %p %p", cb, how, when, handle);
 	CHECK_PARAMS( cb && ( (how == DISP_HOW_ANY) || when ));
@@ -187,8 +292,18 @@ int fd_disp_register ( int (*cb)( struct msg **, struct avp *, struct session *,
 	CHECK_POSIX( pthread_rwlock_wrlock(&fd_disp_lock) );
 	fd_list_insert_before(&all_handlers, &new->all);
 	fd_list_insert_before(cb_list, &new->parent);
+	CHECK_FCT_DO( ret = disp_table_build(),
+		{
+			fd_list_unlink(&new->all);
+			fd_list_unlink(&new->parent);
+		} );
 	CHECK_POSIX( pthread_rwlock_unlock(&fd_disp_lock) );
 	
+	if (ret) {
+		free(new);
+		return ret;
+	}
+	
 	/* We're done */
 	if (handle)
 		*handle = new;
@@ -208,6 +323,8 @@ int fd_disp_unregister ( struct disp_hdl ** handle, void ** opaque )
 	CHECK_POSIX( pthread_rwlock_wrlock(&fd_disp_lock) );
 	fd_list_unlink(&del->all);
 	fd_list_unlink(&del->parent);
+	/* On failure the previous table is kept, it only makes fd_msg_dispatch do more work than needed */
+	CHECK_FCT_DO( disp_table_build(), /* continue */ );
 	CHECK_POSIX( pthread_rwlock_unlock(&fd_disp_lock) );
 	
 	if (opaque)
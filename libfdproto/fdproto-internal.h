@@ -50,16 +50,60 @@ void fd_sess_fini(void);
 /* Iterator on the rules of a parent object */
 int fd_dict_iterate_rules ( struct dict_object *parent, void * data, int (*cb)(void *, struct dict_rule_data *) );
 
+/* Compiled form of the rules of a command or grouped AVP, to check all the rules in a single pass on the children */
+struct dict_rules_idx {
+	int			 nb;	/* number of rules */
+	struct dict_rule_data  * rules;	/* copy of the rules, in the order of fd_dict_iterate_rules */
+	uint32_t		 mask;	/* size of the table - 1 (the size is a power of 2, at least twice nb) */
+	struct {
+		struct dict_object * avp;  /* the AVP model of the rule, NULL for an empty slot */
+		int		     rule; /* index of the rule in the rules array */
+	}		       * table;	/* open addressing table */
+};
+/* Call cb with the compiled rules of parent (built on first use), while the dictionary is read-locked */
+int fd_dict_rules_idx_do ( struct dict_object *parent, void * data, int (*cb)(void *, struct dict_rules_idx *) );
+/* Find the index of the rule of an AVP model in the compiled rules, or -1 */
+static __inline__ int fd_dict_rules_idx_find ( struct dict_rules_idx * idx, struct dict_object * avp )
+{
+	uint32_t h = (uint32_t)(((unsigned long)avp >> 4) * 0x9E3779B1U);
+	for (h &= idx->mask; idx->table[h].avp; h = (h + 1) & idx->mask) {
+		if (idx->table[h].avp == avp)
+			return idx->table[h].rule;
+	}
+	return -1;
+}
+
 /* Dispatch / messages / dictionary API */
 int fd_dict_disp_cb(enum dict_object_type type, struct dict_object *obj, struct fd_list ** cb_list);
 DECLARE_FD_DUMP_PROTOTYPE(fd_dict_dump_avp_value, union avp_value *avp_value, struct dict_object * model, int indent, int header);
 int fd_disp_call_cb_int( struct fd_list * cb_list, struct msg ** msg, struct avp *avp, struct session *sess, enum disp_action *action, 
 			struct dict_object * obj_app, struct dict_object * obj_cmd, struct dict_object * obj_avp, struct dict_object * obj_enu,
 			char ** drop_reason, struct msg ** drop_msg);
+struct dict_object * fd_disp_app_int( struct dictionary * dict, application_id_t id );
+int fd_disp_nb_avp_int( void );
+int fd_disp_has_enumval_int( struct fd_list * cb_list );
 extern pthread_rwlock_t fd_disp_lock;
 
 /* Messages / sessions API */
 int fd_sess_reclaim_msg ( struct session ** session );
+int fd_msg_pools_init(void);
+
+/* Pools of fixed-size objects with per-thread caches, for the messages (pools.c) */
+enum fd_pool_id {
+	FD_POOL_MSG = 0,	/* struct msg */
+	FD_POOL_AVP,		/* struct avp */
+	FD_POOL_OS_S,		/* OctetString values, up to FD_POOL_OS_S_SIZE bytes including the final '\0' */
+	FD_POOL_OS_M,
+	FD_POOL_OS_L,
+	FD_POOL_MAX
+};
+#define FD_POOL_OS_S_SIZE	32
+#define FD_POOL_OS_M_SIZE	64
+#define FD_POOL_OS_L_SIZE	128
+int fd_pools_init(size_t msg_size, size_t avp_size);
+void fd_pools_fini(void);
+void * fd_pool_alloc(enum fd_pool_id id);
+void fd_pool_free(enum fd_pool_id id, void * obj);
 
 
 #endif /* _LIBFDPROTO_INTERNAL_H */
@@ -75,13 +75,20 @@ struct fifo {
 	struct timespec blocking_time; /* Cumulated time threads trying to post new items were blocked (queue full). */
 	struct timespec last_time;     /* For the last element retrieved from the queue, how long it take between posting (including blocking) and poping */
 	
+	struct fd_list	spare;	/* List items already popped, kept for reuse so that posting does not always call malloc */
+	int		nspare;	/* number of items in spare */
 };
 
 struct fifo_item {
-	struct fd_list   item;
+	struct fd_list   item;	/* item.o is the posted pointer (may be NULL for tagged items) */
 	struct timespec  posted_on;
+	int		 tag;	/* Inline data of the items posted with fd_fifo_post_tagged */
+	size_t		 size;
 };
 
+/* The maximum number of popped list items each queue keeps for reuse */
+#define FIFO_SPARE_MAX	32
+
 /* The eye catcher value */
 #define FIFO_EYEC	0xe7ec1130
 
@@ -111,6 +118,7 @@ int fd_fifo_new ( struct fifo ** queue, int max )
 	new->max = max;
 	
 	fd_list_init(&new->list, NULL);
+	fd_list_init(&new->spare, NULL);
 	
 	/* We're done */
 	*queue = new;
@@ -148,6 +156,9 @@ DECLARE_FD_DUMP_PROTOTYPE(fd_fifo_dump, char * name, struct fifo * queue, fd_fif
 			CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "\n [#%i](@%p)@%ld.%06ld: ", 
 						i++, fi->item.o, (long)fi->posted_on.tv_sec,(long)(fi->posted_on.tv_nsec/1000)), 
 					 goto error);
+			if (fi->tag || fi->size) {
+				CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "tag:%d size:%zd ", fi->tag, fi->size), goto error);
+			}
 			CHECK_MALLOC_DO( (*dump_item)(FD_DUMP_STD_PARAMS, fi->item.o), goto error);
 		}
 	}
@@ -204,6 +215,12 @@ int fd_fifo_del ( struct fifo  ** queue )
 	
 	CHECK_POSIX_DO(  pthread_mutex_destroy( &q->mtx ),  );
 	
+	while (!FD_IS_LIST_EMPTY(&q->spare)) {
+		struct fd_list * li = q->spare.next;
+		fd_list_unlink(li);
+		free(li);
+	}
+	
 	free(q);
 	*queue = NULL;
 	
@@ -338,12 +355,14 @@ int fd_fifo_setthrhd ( struct fifo * queue, void * data, uint16_t high, void (*h
 	TRACE_ENTRY( "%p %p %hu %p %hu %p", queue, data, high, h_cb, low, l_cb );
 	
 	/* Check the parameters */
-	CHECK_PARAMS( CHECK_FIFO( queue ) && (high > low) && (queue->data == NULL) );
+	CHECK_PARAMS( CHECK_FIFO( queue ) && (((high > low) && (queue->data == NULL)) || ((high == 0) && (data == NULL))) );
 	
 	/* lock the queue */
 	CHECK_POSIX(  pthread_mutex_lock( &queue->mtx )  );
 	
 	/* Save the values */
+	if (high == 0)
+		queue->highest = 0;
 	queue->high = high;
 	queue->low  = low;
 	queue->data = data;
@@ -375,8 +394,13 @@ static void fifo_cleanup_push(void * queue)
 }
 
 
-/* Post a new item in the queue */
-int fd_fifo_post_internal ( struct fifo * queue, void ** item, int skip_max )
+/* How fd_fifo_post_internal behaves when the queue is full */
+#define POST_WAIT	0	/* wait until an item is pulled */
+#define POST_SKIP_MAX	1	/* post anyway */
+#define POST_TRY	2	/* return EWOULDBLOCK */
+
+/* Post a new item in the queue. limit replaces the maximum of the queue if not 0 */
+static int fd_fifo_post_internal ( struct fifo * queue, void * data, int tag, size_t size, int mode, int limit )
 {
 	struct fifo_item * new;
 	int call_cb = 0;
@@ -388,8 +412,15 @@ int fd_fifo_post_internal ( struct fifo * queue, void ** item, int skip_max )
 	/* lock the queue */
 	CHECK_POSIX(  pthread_mutex_lock( &queue->mtx )  );
 	
-	if ((!skip_max) && (queue->max)) {
-		while (queue->count >= queue->max) {
+	if (!limit)
+		limit = queue->max;
+	
+	if ((mode != POST_SKIP_MAX) && limit) {
+		if ((mode == POST_TRY) && (queue->count >= limit)) {
+			CHECK_POSIX(  pthread_mutex_unlock( &queue->mtx )  );
+			return EWOULDBLOCK;
+		}
+		while (queue->count >= limit) {
 			int ret = 0;
 			
 			/* We have to wait for an item to be pulled */
@@ -403,14 +434,21 @@ int fd_fifo_post_internal ( struct fifo * queue, void ** item, int skip_max )
 		}
 	}
 	
-	/* Create a new list item */
-	CHECK_MALLOC_DO(  new = malloc (sizeof (struct fifo_item)) , {
-			pthread_mutex_unlock( &queue->mtx );
-			return ENOMEM;
-		} );
+	/* Reuse a list item if we have one, otherwise create a new one */
+	if (queue->nspare) {
+		new = (struct fifo_item *)(queue->spare.next);
+		fd_list_unlink(&new->item);
+		queue->nspare--;
+	} else {
+		CHECK_MALLOC_DO(  new = malloc (sizeof (struct fifo_item)) , {
+				pthread_mutex_unlock( &queue->mtx );
+				return ENOMEM;
+			} );
+	}
 	
-	fd_list_init(&new->item, *item);
-	*item = NULL;
+	fd_list_init(&new->item, data);
+	new->tag = tag;
+	new->size = size;
 	
 	/* Add the new item at the end */
 	fd_list_insert_before( &queue->list, &new->item);
@@ -464,8 +502,9 @@ int fd_fifo_post_int ( struct fifo * queue, void ** item )
 	/* Check the parameters */
 	CHECK_PARAMS( CHECK_FIFO( queue ) && item && *item );
 	
-	return fd_fifo_post_internal ( queue,item, 0 );
-	
+	CHECK_FCT( fd_fifo_post_internal ( queue, *item, 0, 0, POST_WAIT, 0 ) );
+	*item = NULL;
+	return 0;
 }
 
 /* Post a new item in the queue, not blocking */
@@ -476,12 +515,68 @@ int fd_fifo_post_noblock ( struct fifo * queue, void ** item )
 	/* Check the parameters */
 	CHECK_PARAMS( CHECK_FIFO( queue ) && item && *item );
 	
-	return fd_fifo_post_internal ( queue,item, 1 );
+	CHECK_FCT( fd_fifo_post_internal ( queue, *item, 0, 0, POST_SKIP_MAX, 0 ) );
+	*item = NULL;
+	return 0;
+}
+
+/* Post a tag, size and pointer stored inline in the queue */
+int fd_fifo_post_tagged ( struct fifo * queue, int tag, size_t size, void * data )
+{
+	TRACE_ENTRY( "%p %d %zd %p", queue, tag, size, data );
+	
+	/* Check the parameters */
+	CHECK_PARAMS( CHECK_FIFO( queue ) );
+	
+	return fd_fifo_post_internal ( queue, data, tag, size, POST_WAIT, 0 );
+}
+
+/* Same, not blocking */
+int fd_fifo_post_tagged_noblock ( struct fifo * queue, int tag, size_t size, void * data )
+{
+	TRACE_ENTRY( "%p %d %zd %p", queue, tag, size, data );
+	
+	/* Check the parameters */
+	CHECK_PARAMS( CHECK_FIFO( queue ) );
+	
+	return fd_fifo_post_internal ( queue, data, tag, size, POST_SKIP_MAX, 0 );
+}
+
+/* Same, failing when the queue is full */
+int fd_fifo_trypost_tagged ( struct fifo * queue, int tag, size_t size, void * data )
+{
+	TRACE_ENTRY( "%p %d %zd %p", queue, tag, size, data );
+	
+	/* Check the parameters */
+	CHECK_PARAMS( CHECK_FIFO( queue ) );
+	
+	return fd_fifo_post_internal ( queue, data, tag, size, POST_TRY, 0 );
+}
+
+/* Post a tag, size and pointer, waiting while the queue holds limit items or more */
+int fd_fifo_post_tagged_lim ( struct fifo * queue, int limit, int tag, size_t size, void * data )
+{
+	TRACE_ENTRY( "%p %d %d %zd %p", queue, limit, tag, size, data );
+	
+	/* Check the parameters */
+	CHECK_PARAMS( CHECK_FIFO( queue ) && (limit >= 0) );
+	
+	return fd_fifo_post_internal ( queue, data, tag, size, POST_WAIT, limit );
+}
+
+/* Same, failing when the queue holds limit items or more */
+int fd_fifo_trypost_tagged_lim ( struct fifo * queue, int limit, int tag, size_t size, void * data )
+{
+	TRACE_ENTRY( "%p %d %d %zd %p", queue, limit, tag, size, data );
+	
+	/* Check the parameters */
+	CHECK_PARAMS( CHECK_FIFO( queue ) && (limit >= 0) );
 	
+	return fd_fifo_post_internal ( queue, data, tag, size, POST_TRY, limit );
 }
 
 /* Pop the first item from the queue */
-static void * mq_pop(struct fifo * queue)
+static void * mq_pop(struct fifo * queue, int * tag, size_t * size)
 {
 	void * ret = NULL;
 	struct fifo_item * fi;
@@ -491,6 +586,10 @@ static void * mq_pop(struct fifo * queue)
 	
 	fi = (struct fifo_item *)(queue->list.next);
 	ret = fi->item.o;
+	if (tag)
+		*tag = fi->tag;
+	if (size)
+		*size = fi->size;
 	fd_list_unlink(&fi->item);
 	queue->count--;
 	queue->total_items++;
@@ -509,7 +608,12 @@ static void * mq_pop(struct fifo * queue)
 		queue->total_time.tv_nsec = elapsed % 1000000000;
 	}
 skip_timing:	
-	free(fi);
+	if (queue->nspare < FIFO_SPARE_MAX) {
+		fd_list_insert_before( &queue->spare, &fi->item);
+		queue->nspare++;
+	} else {
+		free(fi);
+	}
 	
 	if (queue->thrs_push) {
 		CHECK_POSIX_DO( pthread_cond_signal( &queue->cond_push ), );
@@ -532,14 +636,12 @@ static __inline__ int test_l_cb(struct fifo * queue)
 	return 0;
 }
 
-/* Try poping an item */
-int fd_fifo_tryget_int ( struct fifo * queue, void ** item )
+/* The internal function for fd_fifo_tryget and fd_fifo_tryget_tagged */
+static int fifo_tryget ( struct fifo * queue, void ** item, int * tag, size_t * size )
 {
 	int wouldblock = 0;
 	int call_cb = 0;
 	
-	TRACE_ENTRY( "%p %p", queue, item );
-	
 	/* Check the parameters */
 	CHECK_PARAMS( CHECK_FIFO( queue ) && item );
 	
@@ -550,7 +652,7 @@ int fd_fifo_tryget_int ( struct fifo * queue, void ** item )
 	if (queue->count > 0) {
 got_item:
 		/* There are elements in the queue, so pick the first one */
-		*item = mq_pop(queue);
+		*item = mq_pop(queue, tag, size);
 		call_cb = test_l_cb(queue);
 	} else {
 		if (queue->thrs_push > 0) {
@@ -578,6 +680,20 @@ got_item:
 	return wouldblock ? EWOULDBLOCK : 0;
 }
 
+/* Try poping an item */
+int fd_fifo_tryget_int ( struct fifo * queue, void ** item )
+{
+	TRACE_ENTRY( "%p %p", queue, item );
+	return fifo_tryget(queue, item, NULL, NULL);
+}
+
+/* Try poping a tagged item */
+int fd_fifo_tryget_tagged ( struct fifo * queue, int * tag, size_t * size, void ** data )
+{
+	TRACE_ENTRY( "%p %p %p %p", queue, tag, size, data );
+	return fifo_tryget(queue, data, tag, size);
+}
+
 /* This handler is called when a thread is blocked on a queue, and cancelled */
 static void fifo_cleanup(void * queue)
 {
@@ -595,7 +711,7 @@ static void fifo_cleanup(void * queue)
 }
 
 /* The internal function for fd_fifo_timedget and fd_fifo_get */
-static int fifo_tget ( struct fifo * queue, void ** item, int istimed, const struct timespec *abstime)
+static int fifo_tget ( struct fifo * queue, void ** item, int * tag, size_t * size, int istimed, const struct timespec *abstime)
 {
 	int call_cb = 0;
 	int ret = 0;
@@ -620,7 +736,7 @@ awaken:
 	
 	if (queue->count > 0) {
 		/* There are items in the queue, so pick the first one */
-		*item = mq_pop(queue);
+		*item = mq_pop(queue, tag, size);
 		call_cb = test_l_cb(queue);
 	} else {
 		/* We have to wait for a new item */
@@ -654,14 +770,28 @@ awaken:
 int fd_fifo_get_int ( struct fifo * queue, void ** item )
 {
 	TRACE_ENTRY( "%p %p", queue, item );
-	return fifo_tget(queue, item, 0, NULL);
+	return fifo_tget(queue, item, NULL, NULL, 0, NULL);
+}
+
+/* Get the next available tagged item, block until there is one */
+int fd_fifo_get_tagged ( struct fifo * queue, int * tag, size_t * size, void ** data )
+{
+	TRACE_ENTRY( "%p %p %p %p", queue, tag, size, data );
+	return fifo_tget(queue, data, tag, size, 0, NULL);
 }
 
 /* Get the next available item, block until there is one, or the timeout expires */
 int fd_fifo_timedget_int ( struct fifo * queue, void ** item, const struct timespec *abstime )
 {
 	TRACE_ENTRY( "%p %p %p", queue, item, abstime );
-	return fifo_tget(queue, item, 1, abstime);
+	return fifo_tget(queue, item, NULL, NULL, 1, abstime);
+}
+
+/* Get the next available tagged item, block until there is one, or the timeout expires */
+int fd_fifo_timedget_tagged ( struct fifo * queue, int * tag, size_t * size, void ** data, const struct timespec *abstime )
+{
+	TRACE_ENTRY( "%p %p %p %p %p", queue, tag, size, data, abstime );
+	return fifo_tget(queue, data, tag, size, 1, abstime);
 }
 
 /* Test if data is available in the queue, without pulling it */
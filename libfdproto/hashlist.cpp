@@ -44,6 +44,12 @@ extern "C" {
    void deleteEntryStringHashList(const char *k, void *hl);
    int insertStringHashList(const char *k, void *v, void *hl, void **duplicate);
    int findStringHashList(const char *k, void *hl, void **result);
+
+   int initOctetStringHashList(void **hl);
+   void deleteOctetStringHashList(void *hl);
+   void deleteEntryOctetStringHashList(const uint8_t *k, size_t len, void *hl);
+   int insertOctetStringHashList(const uint8_t *k, size_t len, void *v, void *hl, void **duplicate);
+   int findOctetStringHashList(const uint8_t *k, size_t len, void *hl, void **result);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -402,3 +408,54 @@ int findStringHashList(const char *k, void *hl, void **result)
 
    return ret;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+int initOctetStringHashList(void **hl)
+{
+   *hl = (void*)(new std::unordered_map<std::string,void*>());
+   return 0;
+}
+
+void deleteOctetStringHashList(void *hl)
+{
+   delete (std::unordered_map<std::string,void*>*)hl;
+}
+
+void deleteEntryOctetStringHashList(const uint8_t *k, size_t len, void *hl)
+{
+   std::unordered_map<std::string,void*> &l( *(std::unordered_map<std::string,void*>*)hl );
+
+   l.erase(std::string((const char *)k, len));
+}
+
+int insertOctetStringHashList(const uint8_t *k, size_t len, void *v, void *hl, void **duplicate)
+{
+   std::unordered_map<std::string,void*> &l( *(std::unordered_map<std::string,void*>*)hl );
+
+   auto result = l.insert({std::string((const char *)k, len),v});
+
+   if (!result.second && duplicate)
+      *duplicate = result.first->second;
+
+   return result.second ? 0 : EEXIST;
+}
+
+int findOctetStringHashList(const uint8_t *k, size_t len, void *hl, void **result)
+{
+   if (hl == NULL || result == NULL)
+      return EINVAL;
+
+   int ret = 0;
+   std::unordered_map<std::string,void*> &l( *(std::unordered_map<std::string,void*>*)hl );
+
+   auto search = l.find(std::string((const char *)k, len));
+
+   if (search != l.end())
+      *result = search->second;
+   else
+      ret = ENOENT;
+
+   return ret;
+}
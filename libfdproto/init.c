@@ -59,6 +59,7 @@ int fd_libproto_init()
 	
 	/* Initialize the modules that need it */
 	fd_msg_eteid_init();
+	CHECK_FCT( fd_msg_pools_init() );
 	CHECK_FCT( fd_sess_init() );
 	
 	return 0;
@@ -68,4 +69,5 @@ int fd_libproto_init()
 void fd_libproto_fini(void)
 {
 	fd_sess_fini();
+	fd_pools_fini();
 }
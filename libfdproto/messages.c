@@ -45,7 +45,8 @@
 /* Type of object */
 enum msg_objtype {
 	MSG_MSG = 1, 
-	MSG_AVP
+	MSG_AVP,
+	MSG_SHARED	/* AVPs shared by a message and its clones, see fd_msg_clone */
 };
 
 /* Chaining of elements as a free hierarchy */
@@ -53,6 +54,7 @@ struct msg_avp_chain {
 	struct fd_list		chaining;	/* Chaining information at this level. */
 	struct fd_list		children;	/* sentinel for the children of this object */
 	enum msg_objtype 	type;		/* Type of this object, _MSG_MSG or _MSG_AVP */
+	int			dirty;		/* The length of this object (and so its ancestors) must be computed again */
 };
 
 /* Return the chain information from an AVP or MSG. Since it's the first field, we just cast */
@@ -77,6 +79,11 @@ struct msg_avp_chain {
  *
  * All elements at the same level are linked by their "chaining" list.
  * The "children" list is the sentinel for the lists of children of this element.
+ *
+ * The "dirty" flag caches the result of fd_msg_update_length: it is cleared once the length of
+ * the object has been computed (or read from a consistent buffer), and set again by any operation
+ * that may change this length. When an object is dirty, all its ancestors are dirty as well,
+ * so that fd_msg_update_length can skip the unchanged subtrees entirely.
  */
 
 /* The following definitions are used to recognize objects in memory. */
@@ -98,9 +105,13 @@ struct avp {
 	uint8_t			*avp_rawdata;		/* when the data can not be interpreted, the raw data is copied here. The header is not part of it. */
 	size_t			 avp_rawlen;		/* The length of the raw buffer. */
 	union avp_value		 avp_storage;		/* To avoid many alloc/free, store the integer values here and set avp_public.avp_data to &storage */
-	int			 avp_mustfreeos;	/* 1 if an octetstring is malloc'd in avp_storage and must be freed. */
+	int			 avp_mustfreeos;	/* 1 if an octetstring is malloc'd in avp_storage and must be freed, AVP_OS_POOL(id) if it comes from a pool. */
+	int			 avp_tmplos;		/* 1 if the octetstring in avp_storage points in the msg_tmpldata of the message (see fd_msg_tmpl_add). */
 };
 
+/* Value of avp_mustfreeos for an octetstring allocated in the pool id */
+#define AVP_OS_POOL(_id)	(2 + (_id))
+
 /* Macro to compute the AVP header size */
 #define AVPHDRSZ_NOVEND	8
 #define AVPHDRSZ_VENDOR	12
@@ -137,6 +148,8 @@ struct msg {
 	DiamId_t		 msg_src_id;		/* Diameter Id of the peer this message was received from. This string is malloc'd and must be freed */
 	size_t			 msg_src_id_len;	/* cached length of this string */
 	struct fd_msg_pmdl	 msg_pmdl;		/* list of permessagedata structures. */
+	struct tmpl_data	*msg_tmpldata;		/* data referenced by the AVPs (see fd_msg_tmpl_add and fd_msg_clone), freed with the message */
+	struct msg_shared	*msg_shared;		/* If not NULL, the AVPs of the message are shared with its clones and msg_chain.children is empty */
 };
 
 /* Macro to compute the message header size */
@@ -171,6 +184,8 @@ static int avp_value_sizes[] = {
 
 /* Forward declaration */
 static int parsedict_do_msg(struct dictionary * dict, struct msg * msg, int only_hdr, struct fd_pei *error_info);
+static int obj_unshare(msg_or_avp * obj);
+static void msg_shared_release(struct msg * msg);
 
 /***************************************************************************************************************/
 /* Creating objects */
@@ -181,6 +196,17 @@ static void init_chain(struct msg_avp_chain * chain, int type)
 	fd_list_init( &chain->chaining, (void *)chain);
 	fd_list_init( &chain->children, (void *)chain);
 	chain->type = type;
+	chain->dirty = 1;
+}
+
+/* Mark an object and its ancestors as needing a new length computation */
+static void chain_dirty(struct msg_avp_chain * chain)
+{
+	chain->dirty = 1;
+	
+	/* The ancestors of a dirty object are already dirty, so we can stop at the first one */
+	while ((chain->chaining.head != &chain->chaining) && ((chain = chain->chaining.head->o) != NULL) && (!chain->dirty))
+		chain->dirty = 1;
 }
 
 /* Initialize a new AVP object */
@@ -206,6 +232,50 @@ static void init_msg ( struct msg * msg )
 	CHECK_POSIX_DO( pthread_mutex_init(&msg->msg_pmdl.lock, NULL), );
 }
 
+/* Initialize the pools of messages and AVPs */
+int fd_msg_pools_init(void)
+{
+	return fd_pools_init(sizeof(struct msg), sizeof(struct avp));
+}
+
+/* Copy an octetstring value in the storage area of an AVP. Small values are allocated from the pools. */
+static int avp_os_set ( struct avp * avp, uint8_t * data, size_t len )
+{
+	enum fd_pool_id id;
+	uint8_t * os;
+	
+	if (len < FD_POOL_OS_S_SIZE)
+		id = FD_POOL_OS_S;
+	else if (len < FD_POOL_OS_M_SIZE)
+		id = FD_POOL_OS_M;
+	else if (len < FD_POOL_OS_L_SIZE)
+		id = FD_POOL_OS_L;
+	else {
+		CHECK_MALLOC(  avp->avp_storage.os.data = os0dup(data, len)  );
+		avp->avp_mustfreeos = 1;
+		return 0;
+	}
+	
+	CHECK_MALLOC(  os = fd_pool_alloc(id)  );
+	if (len)
+		memcpy(os, data, len);
+	os[len] = '\0';
+	avp->avp_storage.os.data = os;
+	avp->avp_mustfreeos = AVP_OS_POOL(id);
+	return 0;
+}
+
+/* Free the octetstring value of an AVP if needed */
+static void avp_os_free ( struct avp * avp )
+{
+	if (avp->avp_mustfreeos == 1)
+		free(avp->avp_storage.os.data);
+	else if (avp->avp_mustfreeos != 0)
+		fd_pool_free(avp->avp_mustfreeos - AVP_OS_POOL(0), avp->avp_storage.os.data);
+	avp->avp_mustfreeos = 0;
+	avp->avp_tmplos = 0;
+}
+
 
 /* Create a new AVP instance */
 int fd_msg_avp_new ( struct dict_object * model, int flags, struct avp ** avp )
@@ -223,7 +293,7 @@ int fd_msg_avp_new ( struct dict_object * model, int flags, struct avp ** avp )
 	}
 	
 	/* Create a new object */
-	CHECK_MALLOC(  new = malloc (sizeof(struct avp))  );
+	CHECK_MALLOC(  new = fd_pool_alloc(FD_POOL_AVP)  );
 	
 	/* Initialize the fields */
 	init_avp(new);
@@ -231,7 +301,7 @@ int fd_msg_avp_new ( struct dict_object * model, int flags, struct avp ** avp )
 	if (model) {
 		struct dict_avp_data dictdata;
 		
-		CHECK_FCT_DO(  fd_dict_getval(model, &dictdata), { free(new); return __ret__; }  );
+		CHECK_FCT_DO(  fd_dict_getval(model, &dictdata), { fd_pool_free(FD_POOL_AVP, new); return __ret__; }  );
 	
 		new->avp_model = model;
 		new->avp_public.avp_code    = dictdata.avp_code;
@@ -247,7 +317,7 @@ int fd_msg_avp_new ( struct dict_object * model, int flags, struct avp ** avp )
 	if (flags & AVPFL_SET_RAWDATA_FROM_AVP) {
 		new->avp_rawlen = (*avp)->avp_public.avp_len - GETAVPHDRSZ( (*avp)->avp_public.avp_flags );
 		if (new->avp_rawlen) {
-			CHECK_MALLOC_DO(  new->avp_rawdata = malloc(new->avp_rawlen), { free(new); return __ret__; }  );
+			CHECK_MALLOC_DO(  new->avp_rawdata = malloc(new->avp_rawlen), { fd_pool_free(FD_POOL_AVP, new); return __ret__; }  );
 			memset(new->avp_rawdata, 0x00, new->avp_rawlen);
 		}
 	}
@@ -278,7 +348,7 @@ int fd_msg_new_appl ( struct dict_object * model, struct dict_object * appl, int
 	}
 	
 	/* Create a new object */
-	CHECK_MALLOC(  new = malloc (sizeof(struct msg))  );
+	CHECK_MALLOC(  new = fd_pool_alloc(FD_POOL_MSG)  );
 	
 	/* Initialize the fields */
 	init_msg(new);
@@ -290,8 +360,8 @@ int fd_msg_new_appl ( struct dict_object * model, struct dict_object * appl, int
 		struct dict_cmd_data     dictdata;
 		struct dict_object     	*dictappl;
 		
-		CHECK_FCT_DO( fd_dict_getdict(model, &dict), { free(new); return __ret__; } );
-		CHECK_FCT_DO( fd_dict_getval(model, &dictdata), { free(new); return __ret__; }  );
+		CHECK_FCT_DO( fd_dict_getdict(model, &dict), { fd_pool_free(FD_POOL_MSG, new); return __ret__; } );
+		CHECK_FCT_DO( fd_dict_getval(model, &dictdata), { fd_pool_free(FD_POOL_MSG, new); return __ret__; }  );
 		
 		new->msg_model = model;
 		new->msg_public.msg_flags	= dictdata.cmd_flag_val;
@@ -301,10 +371,10 @@ int fd_msg_new_appl ( struct dict_object * model, struct dict_object * appl, int
 		if (appl)
 			dictappl = appl;
 		else
-			CHECK_FCT_DO(  fd_dict_search( dict, DICT_APPLICATION, APPLICATION_OF_COMMAND, model, &dictappl, 0), { free(new); return __ret__; }  );
+			CHECK_FCT_DO(  fd_dict_search( dict, DICT_APPLICATION, APPLICATION_OF_COMMAND, model, &dictappl, 0), { fd_pool_free(FD_POOL_MSG, new); return __ret__; }  );
 		if (dictappl != NULL) {
 			struct dict_application_data appdata;
-			CHECK_FCT_DO(  fd_dict_getval(dictappl, &appdata), { free(new); return __ret__; }  );
+			CHECK_FCT_DO(  fd_dict_getval(dictappl, &appdata), { fd_pool_free(FD_POOL_MSG, new); return __ret__; }  );
 			new->msg_public.msg_appl = appdata.application_id;
 		}
 	}
@@ -319,6 +389,8 @@ int fd_msg_new_appl ( struct dict_object * model, struct dict_object * appl, int
 }	
 
 static int bufferize_avp(unsigned char * buffer, size_t buflen, size_t * offset,  struct avp * avp);
+static int bufferize_chain(unsigned char * buffer, size_t buflen, size_t * offset, struct fd_list * list);
+static void destroy_tree(struct msg_avp_chain * obj);
 static int parsebuf_list(unsigned char * buf, size_t buflen, struct fd_list * head);
 static int parsedict_do_chain(struct dictionary * dict, struct fd_list * head, int mandatory, struct fd_pei *error_info);
 
@@ -416,6 +488,7 @@ int fd_msg_new_answer_from_req ( struct dictionary * dict, struct msg ** msg, in
 
 				/* We move this AVP now so that we do not parse again in next loop */
 				fd_list_move_end(&ans->msg_chain.children, &avpcpylist);
+				chain_dirty(_C(ans));
 			}
 			/* move to next AVP in the message, we can have several Proxy-Info instances */
 			CHECK_FCT_DO( fd_msg_browse(avp, MSG_BRW_NEXT, &avp, NULL), { free(ans); return __ret__; } );
@@ -431,6 +504,492 @@ int fd_msg_new_answer_from_req ( struct dictionary * dict, struct msg ** msg, in
 	return 0;
 }
 
+/***************************************************************************************************************/
+/* Message templates */
+
+#define MSG_TMPL_EYEC	(0x11355469)
+
+/* A copy of the data of a template, owned by the message it was applied to */
+struct tmpl_data {
+	struct tmpl_data	*next;		/* other copies in the same message */
+	unsigned char		 data[];	/* the AVPs in wire format */
+};
+
+/* The description of one AVP in a template */
+struct tmpl_avp {
+	struct dict_object	*model;		/* The dictionary model of the AVP */
+	enum dict_avp_basetype	 basetype;	/* Its base type */
+	struct avp_hdr		 hdr;		/* The header of the AVP (avp_value is not used) */
+	union avp_value		 value;		/* The value of the AVP, except os.data which is computed from data_off */
+	size_t			 data_off;	/* For OctetString AVPs, offset of the value in the buffer */
+	int			 nb_children;	/* For grouped AVPs, number of AVPs that follow and are direct children */
+};
+
+struct msg_tmpl {
+	int			 eyec;		/* Must be equal to MSG_TMPL_EYEC */
+	unsigned char		*buf;		/* The AVPs encoded in wire format */
+	size_t			 buflen;	/* The size of this buffer */
+	int			 has_os;	/* If 0, the AVPs do not reference the buffer and it is not copied */
+	int			 nb_top;	/* Number of top-level AVPs */
+	int			 nb;		/* Total number of AVPs in the avps array, in depth-first order */
+	struct tmpl_avp		 avps[];
+};
+
+#define CHECK_TMPL(_x) ((_x) && ((_x)->eyec == MSG_TMPL_EYEC))
+
+/* Count the AVPs in a list, recursively */
+static int tmpl_count(struct fd_list * list)
+{
+	struct fd_list * li;
+	int nb = 0;
+	
+	for (li = list->next; li != list; li = li->next)
+		nb += 1 + tmpl_count(&_C(li->o)->children);
+	
+	return nb;
+}
+
+/* Describe the AVPs of a list in the template, following the layout written by bufferize_chain */
+static int tmpl_index_chain(struct msg_tmpl * tmpl, int * idx, size_t * offset, struct fd_list * list, int * count)
+{
+	struct fd_list * li;
+	
+	for (li = list->next; li != list; li = li->next) {
+		struct avp * avp = _A(li->o);
+		struct tmpl_avp * ta = &tmpl->avps[(*idx)++];
+		struct dict_avp_data dictdata;
+		
+		CHECK_PARAMS(  CHECK_AVP(avp) && avp->avp_model  );
+		CHECK_FCT(  fd_dict_getval(avp->avp_model, &dictdata)  );
+		
+		ta->model = avp->avp_model;
+		ta->basetype = dictdata.avp_basetype;
+		ta->hdr = avp->avp_public;
+		ta->hdr.avp_value = NULL;
+		
+		*offset += GETAVPHDRSZ(avp->avp_public.avp_flags);
+		
+		if (ta->basetype == AVP_TYPE_GROUPED) {
+			CHECK_FCT(  tmpl_index_chain(tmpl, idx, offset, &avp->avp_chain.children, &ta->nb_children)  );
+		} else {
+			ta->value = *avp->avp_public.avp_value;
+			if (ta->basetype == AVP_TYPE_OCTETSTRING) {
+				ta->value.os.data = NULL;
+				ta->data_off = *offset;
+				tmpl->has_os = 1;
+			}
+			*offset += PAD4(avp->avp_public.avp_len - GETAVPHDRSZ(avp->avp_public.avp_flags));
+		}
+		
+		(*count)++;
+	}
+	
+	return 0;
+}
+
+/* Create a template from the AVPs of a message */
+int fd_msg_tmpl_new ( struct msg * skel, struct msg_tmpl ** tmpl )
+{
+	struct msg_tmpl * new;
+	size_t offset = 0;
+	int idx = 0, nb, ret;
+	
+	TRACE_ENTRY("%p %p", skel, tmpl);
+	
+	CHECK_PARAMS(  CHECK_MSG(skel) && tmpl  );
+	CHECK_FCT(  obj_unshare(skel)  );
+	
+	/* This also checks that all the values are set */
+	CHECK_FCT(  fd_msg_update_length(skel)  );
+	
+	nb = tmpl_count(&skel->msg_chain.children);
+	CHECK_MALLOC(  new = malloc(sizeof(struct msg_tmpl) + nb * sizeof(struct tmpl_avp))  );
+	memset(new, 0, sizeof(struct msg_tmpl) + nb * sizeof(struct tmpl_avp));
+	new->eyec = MSG_TMPL_EYEC;
+	new->nb = nb;
+	new->buflen = skel->msg_public.msg_length - GETMSGHDRSZ();
+	
+	/* Encode the AVPs */
+	CHECK_MALLOC_DO(  new->buf = malloc(new->buflen ?: 1), { free(new); return ENOMEM; }  );
+	memset(new->buf, 0, new->buflen);
+	CHECK_FCT_DO(  ret = bufferize_chain(new->buf, new->buflen, &offset, &skel->msg_chain.children), goto error  );
+	ASSERT(offset == new->buflen);
+	
+	/* And describe them */
+	offset = 0;
+	CHECK_FCT_DO(  ret = tmpl_index_chain(new, &idx, &offset, &skel->msg_chain.children, &new->nb_top), goto error  );
+	
+	*tmpl = new;
+	return 0;
+error:
+	free(new->buf);
+	free(new);
+	return ret;
+}
+
+/* Create the AVPs described in the template, starting at index *idx */
+static int tmpl_build_chain(struct msg_tmpl * tmpl, int * idx, int nb, unsigned char * data, struct fd_list * head)
+{
+	int i;
+	
+	for (i = 0; i < nb; i++) {
+		struct tmpl_avp * ta = &tmpl->avps[(*idx)++];
+		struct avp * avp;
+		
+		CHECK_MALLOC(  avp = fd_pool_alloc(FD_POOL_AVP)  );
+		init_avp(avp);
+		avp->avp_model = ta->model;
+		avp->avp_public = ta->hdr;
+		
+		/* Link it now, so that it is freed with the list on error */
+		fd_list_insert_before( head, &avp->avp_chain.chaining );
+		
+		if (ta->basetype == AVP_TYPE_GROUPED) {
+			CHECK_FCT(  tmpl_build_chain(tmpl, idx, ta->nb_children, data, &avp->avp_chain.children)  );
+		} else {
+			avp->avp_storage = ta->value;
+			if (ta->basetype == AVP_TYPE_OCTETSTRING) {
+				avp->avp_storage.os.data = data + ta->data_off;
+				avp->avp_tmplos = 1;
+			}
+			avp->avp_public.avp_value = &avp->avp_storage;
+		}
+		
+		/* The length saved in the template is already correct */
+		avp->avp_chain.dirty = 0;
+	}
+	
+	return 0;
+}
+
+/* Add the AVPs of a template at the end of a message */
+int fd_msg_tmpl_add ( struct msg_tmpl * tmpl, struct msg * msg )
+{
+	struct fd_list avps = FD_LIST_INITIALIZER(avps);
+	struct tmpl_data * td = NULL;
+	int idx = 0, ret;
+	
+	TRACE_ENTRY("%p %p", tmpl, msg);
+	
+	CHECK_PARAMS(  CHECK_TMPL(tmpl) && CHECK_MSG(msg)  );
+	CHECK_FCT(  obj_unshare(msg)  );
+	
+	/* The values of the OctetString AVPs point in this copy */
+	if (tmpl->has_os) {
+		CHECK_MALLOC(  td = malloc(sizeof(struct tmpl_data) + tmpl->buflen)  );
+		memcpy(td->data, tmpl->buf, tmpl->buflen);
+	}
+	
+	CHECK_FCT_DO(  ret = tmpl_build_chain(tmpl, &idx, tmpl->nb_top, td ? td->data : NULL, &avps),
+		{
+			while (!FD_IS_LIST_EMPTY(&avps))
+				destroy_tree(_C(avps.next->o));
+			free(td);
+			return ret;
+		}  );
+	
+	if (td) {
+		td->next = msg->msg_tmpldata;
+		msg->msg_tmpldata = td;
+	}
+	fd_list_move_end(&msg->msg_chain.children, &avps);
+	chain_dirty(_C(msg));
+	
+	return 0;
+}
+
+/* Destroy a template */
+int fd_msg_tmpl_free ( struct msg_tmpl * tmpl )
+{
+	TRACE_ENTRY("%p", tmpl);
+	
+	CHECK_PARAMS(  CHECK_TMPL(tmpl)  );
+	
+	tmpl->eyec = 0xdead;
+	free(tmpl->buf);
+	free(tmpl);
+	return 0;
+}
+
+/***************************************************************************************************************/
+/* Cloning messages */
+
+/* Size of the data of the AVPs that were not interpreted yet, which is referenced in the buffer of the original message */
+static size_t clone_srclen(struct fd_list * head)
+{
+	struct fd_list * ch;
+	size_t len = 0;
+	
+	for (ch = head->next; ch != head; ch = ch->next) {
+		struct avp * avp = _A(ch->o);
+		
+		if ((avp->avp_model == NULL) && (avp->avp_source != NULL) && (avp->avp_rawdata == NULL)
+		  && (avp->avp_public.avp_len > GETAVPHDRSZ( avp->avp_public.avp_flags )))
+			len += avp->avp_public.avp_len - GETAVPHDRSZ( avp->avp_public.avp_flags );
+		
+		len += clone_srclen(&avp->avp_chain.children);
+	}
+	
+	return len;
+}
+
+/* Copy the AVPs of a chain at the end of another list. *data is where the not interpreted data is copied. */
+static int clone_chain(struct fd_list * from, struct fd_list * to, unsigned char ** data)
+{
+	struct fd_list * ch;
+	
+	for (ch = from->next; ch != from; ch = ch->next) {
+		struct avp * src = _A(ch->o);
+		struct avp * avp;
+		
+		CHECK_MALLOC(  avp = fd_pool_alloc(FD_POOL_AVP)  );
+		init_avp(avp);
+		avp->avp_model = src->avp_model;
+		avp->avp_model_not_found = src->avp_model_not_found;
+		avp->avp_public = src->avp_public;
+		avp->avp_chain.dirty = src->avp_chain.dirty;
+		
+		/* Link it now, so that it is freed with the list on error */
+		fd_list_insert_before( to, &avp->avp_chain.chaining );
+		
+		if (src->avp_public.avp_value) {
+			avp->avp_storage = *src->avp_public.avp_value;
+			avp->avp_public.avp_value = &avp->avp_storage;
+			
+			if (src->avp_model) {
+				struct dict_avp_data dictdata;
+				CHECK_FCT(  fd_dict_getval(src->avp_model, &dictdata)  );
+				if (dictdata.avp_basetype == AVP_TYPE_OCTETSTRING) {
+					CHECK_FCT(  avp_os_set(avp, src->avp_public.avp_value->os.data, src->avp_public.avp_value->os.len)  );
+				}
+			}
+		}
+		
+		if (src->avp_rawdata) {
+			CHECK_MALLOC(  avp->avp_rawdata = malloc(src->avp_rawlen)  );
+			memcpy(avp->avp_rawdata, src->avp_rawdata, src->avp_rawlen);
+			avp->avp_rawlen = src->avp_rawlen;
+		} else if ((src->avp_model == NULL) && (src->avp_source != NULL)
+		  && (src->avp_public.avp_len > GETAVPHDRSZ( src->avp_public.avp_flags ))) {
+			size_t len = src->avp_public.avp_len - GETAVPHDRSZ( src->avp_public.avp_flags );
+			memcpy(*data, src->avp_source, len);
+			avp->avp_source = *data;
+			*data += len;
+		}
+		
+		CHECK_FCT(  clone_chain(&src->avp_chain.children, &avp->avp_chain.children, data)  );
+	}
+	
+	return 0;
+}
+
+/* The AVPs of a message and of its clones, until one of them is modified (copy-on-write). They are browsed without lock 
+ by all the messages, so they are never modified, except the cached data (dictionary models, lengths) under the lock. */
+struct msg_shared {
+	struct msg_avp_chain	 chain;		/* The AVPs are the children of this object, of type MSG_SHARED */
+	pthread_mutex_t		 lock;		/* Serializes the parsing, the length computation and the copies */
+	int			 refs;		/* Number of messages sharing the AVPs */
+	struct tmpl_data	*tmpldata;	/* The data referenced by the AVPs, moved from the cloned message */
+	uint8_t			*rawbuffer;	/* idem */
+};
+
+/* Number of msg_shared objects in use, to skip the search of obj_shared when there is none */
+static int msg_shared_nb = 0;
+
+/* Copy the shared AVPs in a list. The data not interpreted yet is copied in a single buffer stored in *td. The lock is held. */
+static int shared_copy(struct msg_shared * sh, struct fd_list * list, struct tmpl_data ** td)
+{
+	unsigned char * data = NULL;
+	size_t srclen;
+	int ret;
+	
+	*td = NULL;
+	srclen = clone_srclen(&sh->chain.children);
+	if (srclen) {
+		CHECK_MALLOC(  *td = malloc(sizeof(struct tmpl_data) + srclen)  );
+		(*td)->next = NULL;
+		data = (*td)->data;
+	}
+	
+	CHECK_FCT_DO(  ret = clone_chain(&sh->chain.children, list, &data),
+		{
+			while (!FD_IS_LIST_EMPTY(list))
+				destroy_tree(_C(list->next->o));
+			free(*td);
+			*td = NULL;
+			return ret;
+		}  );
+	
+	return 0;
+}
+
+/* Give the shared AVP objects and their data to a message. The lock is held. */
+static void shared_move(struct msg_shared * sh, struct msg * msg)
+{
+	fd_list_move_end(&msg->msg_chain.children, &sh->chain.children);
+	msg->msg_tmpldata = sh->tmpldata;
+	sh->tmpldata = NULL;
+	msg->msg_rawbuffer = sh->rawbuffer;
+	sh->rawbuffer = NULL;
+}
+
+/* Destroy the shared AVPs, when no message references them anymore */
+static void shared_free(struct msg_shared * sh)
+{
+	while (!FD_IS_LIST_EMPTY(&sh->chain.children))
+		destroy_tree(_C(sh->chain.children.next->o));
+	while (sh->tmpldata) {
+		struct tmpl_data * td = sh->tmpldata;
+		sh->tmpldata = td->next;
+		free(td);
+	}
+	free(sh->rawbuffer);
+	CHECK_POSIX_DO( pthread_mutex_destroy(&sh->lock), );
+	free(sh);
+	__atomic_sub_fetch(&msg_shared_nb, 1, __ATOMIC_RELAXED);
+}
+
+/* A message stops sharing its AVPs (it is being freed) */
+static void msg_shared_release(struct msg * msg)
+{
+	struct msg_shared * sh = msg->msg_shared;
+	int last;
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&sh->lock), );
+	last = (--sh->refs == 0);
+	CHECK_POSIX_DO( pthread_mutex_unlock(&sh->lock), );
+	
+	msg->msg_shared = NULL;
+	if (last)
+		shared_free(sh);
+}
+
+/* Give its own AVPs to a message before they are modified. This is where the copy of fd_msg_clone actually happens, if needed. */
+static int msg_unshare(struct msg * msg)
+{
+	struct msg_shared * sh = msg->msg_shared;
+	int last = 0, ret = 0;
+	
+	CHECK_POSIX( pthread_mutex_lock(&sh->lock) );
+	
+	if (sh->refs > 1) {
+		/* Other messages may be browsing the shared AVPs, so this one gets a copy */
+		struct fd_list copy = FD_LIST_INITIALIZER(copy);
+		struct tmpl_data * td;
+		
+		CHECK_FCT_DO(  ret = shared_copy(sh, &copy, &td), goto out  );
+		fd_list_move_end(&msg->msg_chain.children, &copy);
+		msg->msg_tmpldata = td;
+	} else {
+		/* This was the last message sharing the AVPs, just take them */
+		shared_move(sh, msg);
+	}
+	
+	msg->msg_shared = NULL;
+	last = (--sh->refs == 0);
+out:
+	CHECK_POSIX( pthread_mutex_unlock(&sh->lock) );
+	if ((ret == 0) && last)
+		shared_free(sh);
+	return ret;
+}
+
+/* The shared AVPs an object belongs to, if any: a message that shares its AVPs, or one of these AVPs */
+static struct msg_shared * obj_shared(msg_or_avp * obj)
+{
+	struct msg_avp_chain * root = _C(obj);
+	
+	if (!__atomic_load_n(&msg_shared_nb, __ATOMIC_RELAXED))
+		return NULL;
+	
+	if (root->type == MSG_MSG)
+		return _M(root)->msg_shared;
+	
+	/* Find the top of the hierarchy */
+	while (root->chaining.head != &root->chaining)
+		root = root->chaining.head->o;
+	
+	return (root->type == MSG_SHARED) ? (struct msg_shared *)root : NULL;
+}
+
+/* The list of the children of an object, which are the shared AVPs for a message that shares them */
+static struct fd_list * obj_children(msg_or_avp * obj)
+{
+	if ((_C(obj)->type == MSG_MSG) && _M(obj)->msg_shared)
+		return &_M(obj)->msg_shared->chain.children;
+	return &_C(obj)->children;
+}
+
+/* Called before an object is modified: a message that shares its AVPs gets its own copy first. The shared AVPs 
+ themselves cannot be modified, since the message they were retrieved from is not known (see fd_msg_unshare). */
+static int obj_unshare(msg_or_avp * obj)
+{
+	struct msg_shared * sh = obj_shared(obj);
+	
+	if (!sh)
+		return 0;
+	
+	if (_C(obj)->type == MSG_MSG)
+		return msg_unshare(_M(obj));
+	
+	TRACE_DEBUG(INFO, "The AVP %p is shared by cloned messages and cannot be modified, call fd_msg_unshare on its message first", obj);
+	return EBUSY;
+}
+
+/* Create a copy of a message. The AVPs are shared until one of the messages is modified. */
+int fd_msg_clone ( struct msg * msg, struct msg ** clone )
+{
+	struct msg * new = NULL;
+	struct msg_shared * sh;
+	
+	TRACE_ENTRY("%p %p", msg, clone);
+	
+	CHECK_PARAMS(  CHECK_MSG(msg) && clone  );
+	
+	CHECK_MALLOC(  new = fd_pool_alloc(FD_POOL_MSG)  );
+	init_msg(new);
+	new->msg_model = msg->msg_model;
+	new->msg_model_not_found = msg->msg_model_not_found;
+	new->msg_public = msg->msg_public;
+	new->msg_routable = msg->msg_routable;
+	new->msg_chain.dirty = msg->msg_chain.dirty;
+	
+	if (!msg->msg_shared) {
+		/* Move the AVPs of the message and the data they reference to a new shared object */
+		CHECK_MALLOC_DO(  sh = malloc(sizeof(struct msg_shared)), { destroy_tree(_C(new)); return __ret__; }  );
+		memset(sh, 0, sizeof(struct msg_shared));
+		init_chain(&sh->chain, MSG_SHARED);
+		CHECK_POSIX_DO(  pthread_mutex_init(&sh->lock, NULL), { free(sh); destroy_tree(_C(new)); return __ret__; }  );
+		sh->refs = 1;
+		fd_list_move_end(&sh->chain.children, &msg->msg_chain.children);
+		sh->tmpldata = msg->msg_tmpldata;
+		msg->msg_tmpldata = NULL;
+		sh->rawbuffer = msg->msg_rawbuffer;
+		msg->msg_rawbuffer = NULL;
+		msg->msg_shared = sh;
+		__atomic_add_fetch(&msg_shared_nb, 1, __ATOMIC_RELAXED);
+	}
+	
+	sh = msg->msg_shared;
+	CHECK_POSIX_DO(  pthread_mutex_lock(&sh->lock), { destroy_tree(_C(new)); return __ret__; }  );
+	sh->refs++;
+	CHECK_POSIX_DO(  pthread_mutex_unlock(&sh->lock), /* continue */  );
+	new->msg_shared = sh;
+	
+	*clone = new;
+	return 0;
+}
+
+/* Give its own AVPs to a message, so that they can be modified */
+int fd_msg_unshare ( struct msg * msg )
+{
+	TRACE_ENTRY("%p", msg);
+	
+	CHECK_PARAMS(  CHECK_MSG(msg)  );
+	
+	return obj_unshare(msg);
+}
+
 /***************************************************************************************************************/
 
 /* Explore a message */
@@ -487,7 +1046,7 @@ int fd_msg_browse_internal ( msg_or_avp * reference, enum msg_brw_dir dir, msg_o
 			break;
 
 		case MSG_BRW_FIRST_CHILD:
-			li = &_C(reference)->children;
+			li = obj_children(reference);
 			if (! FD_IS_LIST_EMPTY(li)) {
 				result = _C(li->next->o);
 				diff = 1;
@@ -495,7 +1054,7 @@ int fd_msg_browse_internal ( msg_or_avp * reference, enum msg_brw_dir dir, msg_o
 			break;
 
 		case MSG_BRW_LAST_CHILD:
-			li = &_C(reference)->children;
+			li = obj_children(reference);
 			if (! FD_IS_LIST_EMPTY(li)) {
 				result = _C(li->prev->o);
 				diff = 1;
@@ -509,12 +1068,17 @@ int fd_msg_browse_internal ( msg_or_avp * reference, enum msg_brw_dir dir, msg_o
 				/* The sentinel is the parent's children list */
 				result = _C(li->head->o);
 				diff = -1;
+				/* The message of an AVP shared by several messages is not known */
+				if (result->type == MSG_SHARED) {
+					result = NULL;
+					diff = 0;
+				}
 			}
 			break;
 
 		case MSG_BRW_WALK:
 			/* First, try to find a child */
-			li = &_C(reference)->children;
+			li = obj_children(reference);
 			if ( ! FD_IS_LIST_EMPTY(li) ) {
 				result = _C(li->next->o);
 				diff = 1;
@@ -567,6 +1131,7 @@ int fd_msg_avp_add ( msg_or_avp * reference, enum msg_brw_dir dir, struct avp *a
 	
 	/* Check the parameters */
 	CHECK_PARAMS(  VALIDATE_OBJ(reference)  &&  CHECK_AVP(avp)  &&  FD_IS_LIST_EMPTY(&avp->avp_chain.chaining)  );
+	CHECK_FCT(  obj_unshare(reference)  );
 	
 	/* Now insert */
 	switch (dir) {
@@ -600,10 +1165,65 @@ int fd_msg_avp_add ( msg_or_avp * reference, enum msg_brw_dir dir, struct avp *a
 			/* Other directions are invalid */
 			CHECK_PARAMS( dir = 0 );
 	}
+	
+	/* The new parent must compute its length again */
+	chain_dirty(_C(avp));
 			
 	return 0;
 }
 
+/* Copy in an AVP and its children the data that is owned by the message, so that they can be moved to another one */
+static int avp_own_data ( struct avp * avp )
+{
+	struct fd_list * ch;
+	
+	/* The value of an AVP created by fd_msg_tmpl_add */
+	if (avp->avp_tmplos) {
+		CHECK_FCT(  avp_os_set(avp, avp->avp_storage.os.data, avp->avp_storage.os.len)  );
+		avp->avp_tmplos = 0;
+	}
+	
+	/* The data that was not interpreted yet, in the received buffer or in the buffer of fd_msg_clone */
+	if (avp->avp_source && !avp->avp_rawdata) {
+		avp->avp_rawlen = avp->avp_public.avp_len - GETAVPHDRSZ( avp->avp_public.avp_flags );
+		if (avp->avp_rawlen) {
+			CHECK_MALLOC(  avp->avp_rawdata = malloc(avp->avp_rawlen)  );
+			memcpy(avp->avp_rawdata, avp->avp_source, avp->avp_rawlen);
+		}
+		avp->avp_source = NULL;
+	}
+	
+	for (ch = avp->avp_chain.children.next; ch != &avp->avp_chain.children; ch = ch->next) {
+		CHECK_FCT(  avp_own_data(_A(ch->o))  );
+	}
+	
+	return 0;
+}
+
+/* Remove an AVP from its parent */
+int fd_msg_avp_unlink ( struct avp * avp )
+{
+	TRACE_ENTRY("%p", avp);
+	
+	/* Check the parameters */
+	CHECK_PARAMS(  CHECK_AVP(avp)  );
+	
+	/* Nothing to do if the AVP is not linked */
+	if (FD_IS_LIST_EMPTY(&avp->avp_chain.chaining))
+		return 0;
+	
+	CHECK_FCT(  obj_unshare(avp)  );
+	
+	/* Its data must not reference the buffers of the message anymore */
+	CHECK_FCT(  avp_own_data(avp)  );
+	
+	/* The former parent must compute its length again */
+	chain_dirty(_C(avp));
+	fd_list_unlink( &avp->avp_chain.chaining );
+	
+	return 0;
+}
+
 /* Search a given AVP model in a message */
 int fd_msg_search_avp ( struct msg * msg, struct dict_object * what, struct avp ** avp )
 {
@@ -646,6 +1266,76 @@ int fd_msg_search_avp ( struct msg * msg, struct dict_object * what, struct avp
 }
 
 
+/* Search several AVPs in one pass over each level of the message */
+#define SEARCH_AVPS_STACK	16	/* number of items for which the keys are stored on the stack */
+struct search_key {
+	avp_code_t	code;
+	vendor_id_t	vendor;
+};
+
+int fd_msg_search_avps ( struct msg * msg, struct msg_avp_search * items, int nb )
+{
+	struct search_key keys_stack[SEARCH_AVPS_STACK], * keys = keys_stack;
+	struct dictionary * dict;
+	int i, p, ret = 0;
+	
+	TRACE_ENTRY("%p %p %d", msg, items, nb);
+	
+	CHECK_PARAMS( CHECK_MSG(msg) && items && (nb > 0) );
+	for (i = 0; i < nb; i++) {
+		enum dict_object_type dicttype;
+		CHECK_PARAMS( items[i].model && (fd_dict_gettype(items[i].model, &dicttype) == 0) && (dicttype == DICT_AVP) );
+		CHECK_PARAMS( (items[i].parent >= -1) && (items[i].parent < i) );
+	}
+	CHECK_FCT( fd_dict_getdict( items[0].model, &dict) );
+	
+	if (nb > SEARCH_AVPS_STACK) {
+		CHECK_MALLOC( keys = malloc(nb * sizeof(struct search_key)) );
+	}
+	for (i = 0; i < nb; i++) {
+		struct dict_avp_data dictdata;
+		CHECK_FCT_DO( ret = fd_dict_getval(items[i].model, &dictdata), goto out );
+		keys[i].code   = dictdata.avp_code;
+		keys[i].vendor = dictdata.avp_vendor;
+		items[i].avp   = NULL;
+	}
+	
+	/* The top level (p == -1), then the children of each grouped AVP that was found, in order. An item is searched
+	 only once its parent is found, since the parent comes first in the array */
+	for (p = -1; p < nb; p++) {
+		struct avp * nextavp;
+		int left = 0;
+		
+		for (i = p + 1; i < nb; i++) {
+			if (items[i].parent == p)
+				left++;
+		}
+		if (!left || ((p >= 0) && !items[p].avp))
+			continue;
+		
+		CHECK_FCT_DO( ret = fd_msg_browse((p < 0) ? (msg_or_avp *)msg : (msg_or_avp *)items[p].avp, MSG_BRW_FIRST_CHILD, (void *)&nextavp, NULL), goto out );
+		while (nextavp && left) {
+			for (i = p + 1; i < nb; i++) {
+				if ((items[i].parent != p) || items[i].avp)
+					continue;
+				if ( (nextavp->avp_public.avp_code   == keys[i].code)
+				  && (nextavp->avp_public.avp_vendor == keys[i].vendor) ) { /* always 0 if no V flag */
+					items[i].avp = nextavp;
+					left--;
+					/* Parse the AVP (and its children), as fd_msg_search_avp does */
+					CHECK_FCT_DO( fd_msg_parse_dict( nextavp, dict, NULL ), /* nothing */ );
+				}
+			}
+			CHECK_FCT_DO( ret = fd_msg_browse(nextavp, MSG_BRW_NEXT, (void *)&nextavp, NULL), goto out );
+		}
+	}
+out:
+	if (keys != keys_stack)
+		free(keys);
+	return ret;
+}
+
+
 /***************************************************************************************************************/
 /* Deleting objects */
 
@@ -657,12 +1347,18 @@ static int destroy_obj (struct msg_avp_chain * obj )
 	/* Check the parameter is a valid object */
 	CHECK_PARAMS(  VALIDATE_OBJ(obj) && FD_IS_LIST_EMPTY( &obj->children ) );
 
-	/* Unlink this object if needed */
+	/* Unlink this object if needed, the former parent must compute its length again */
+	chain_dirty(obj);
 	fd_list_unlink( &obj->chaining );
 	
+	/* Release the AVPs shared with clones of the message */
+	if ((obj->type == MSG_MSG) && (_M(obj)->msg_shared != NULL)) {
+		msg_shared_release(_M(obj));
+	}
+	
 	/* Free the octetstring if needed */
-	if ((obj->type == MSG_AVP) && (_A(obj)->avp_mustfreeos == 1)) {
-		free(_A(obj)->avp_storage.os.data);
+	if (obj->type == MSG_AVP) {
+		avp_os_free(_A(obj));
 	}
 	/* Free the rawdata if needed */
 	if ((obj->type == MSG_AVP) && (_A(obj)->avp_rawdata != NULL)) {
@@ -672,6 +1368,12 @@ static int destroy_obj (struct msg_avp_chain * obj )
 		free(_M(obj)->msg_rawbuffer);
 	}
 	
+	while ((obj->type == MSG_MSG) && (_M(obj)->msg_tmpldata != NULL)) {
+		struct tmpl_data * td = _M(obj)->msg_tmpldata;
+		_M(obj)->msg_tmpldata = td->next;
+		free(td);
+	}
+	
 	if ((obj->type == MSG_MSG) && (_M(obj)->msg_src_id != NULL)) {
 		free(_M(obj)->msg_src_id);
 	}
@@ -689,7 +1391,7 @@ static int destroy_obj (struct msg_avp_chain * obj )
 	}
 	
 	/* free the object */
-	free(obj);
+	fd_pool_free((obj->type == MSG_MSG) ? FD_POOL_MSG : FD_POOL_AVP, obj);
 	
 	return 0;
 }
@@ -728,6 +1430,9 @@ int fd_msg_free ( msg_or_avp * object )
 				return 0;
 			}
 		}
+	} else {
+		/* An AVP that is still shared must be removed from the message only */
+		CHECK_FCT(  obj_unshare(object)  );
 	}
 	
 	destroy_tree(_C(object));
@@ -1197,6 +1902,8 @@ int fd_msg_hdr ( struct msg *msg, struct msg_hdr **pdata )
 	TRACE_ENTRY("%p %p", msg, pdata);
 	CHECK_PARAMS(  CHECK_MSG(msg) && pdata  );
 	
+	/* The caller may change the header, do not trust the cached length anymore */
+	msg->msg_chain.dirty = 1;
 	*pdata = &msg->msg_public;
 	return 0;
 }
@@ -1207,6 +1914,9 @@ int fd_msg_avp_hdr ( struct avp *avp, struct avp_hdr **pdata )
 	TRACE_ENTRY("%p %p", avp, pdata);
 	CHECK_PARAMS(  CHECK_AVP(avp) && pdata  );
 	
+	/* The caller may change the header or the value, do not trust the cached length anymore. The shared AVPs are read-only. */
+	if (!obj_shared(avp))
+		chain_dirty(_C(avp));
 	*pdata = &avp->avp_public;
 	return 0;
 }
@@ -1580,6 +2290,7 @@ int fd_msg_avp_setvalue ( struct avp *avp, union avp_value *value )
 	
 	/* Check parameter */
 	CHECK_PARAMS(  CHECK_AVP(avp) && avp->avp_model  );
+	CHECK_FCT(  obj_unshare(avp)  );
 	
 	/* Retrieve information from the AVP model */
 	{
@@ -1593,10 +2304,8 @@ int fd_msg_avp_setvalue ( struct avp *avp, union avp_value *value )
 	}
 	
 	/* First, clean any previous value */
-	if (avp->avp_mustfreeos != 0) {
-		free(avp->avp_storage.os.data);
-		avp->avp_mustfreeos = 0;
-	}
+	avp_os_free(avp);
+	chain_dirty(_C(avp));
 	
 	memset(&avp->avp_storage, 0, sizeof(union avp_value));
 	
@@ -1611,8 +2320,7 @@ int fd_msg_avp_setvalue ( struct avp *avp, union avp_value *value )
 	
 	/* Duplicate an octetstring if needed. */
 	if (type == AVP_TYPE_OCTETSTRING) {
-		CHECK_MALLOC(  avp->avp_storage.os.data = os0dup(value->os.data, value->os.len)  );
-		avp->avp_mustfreeos = 1;
+		CHECK_FCT(  avp_os_set(avp, value->os.data, value->os.len)  );
 	}
 	
 	/* Set the data pointer of the public part */
@@ -1658,10 +2366,8 @@ int fd_msg_avp_value_encode ( void *data, struct avp *avp )
 	/* Ok, now we can encode the value */
 	
 	/* First, clean any previous value */
-	if (avp->avp_mustfreeos != 0) {
-		free(avp->avp_storage.os.data);
-		avp->avp_mustfreeos = 0;
-	}
+	avp_os_free(avp);
+	chain_dirty(_C(avp));
 	avp->avp_public.avp_value = NULL;
 	memset(&avp->avp_storage, 0, sizeof(union avp_value));
 	
@@ -1712,9 +2418,11 @@ int fd_msg_avp_value_interpret ( struct avp *avp, void *data )
 /***************************************************************************************************************/
 /* Creating a buffer from memory objects (bufferize a struct msg) */
 
-/* Following macros are used to store 32 and 64 bit fields into a buffer in network byte order */
+/* Following macros are used to store 32 and 64 bit fields into a buffer in network byte order.
+ The memcpy lets the compiler emit a single (unaligned if needed) store without breaking the aliasing rules. */
 #define PUT_in_buf_32( _u32data, _bufptr ) {							\
-	*(uint32_t *)(_bufptr) = htonl((uint32_t)(_u32data));					\
+	uint32_t __v = htonl((uint32_t)(_u32data));						\
+	memcpy(_bufptr, &__v, sizeof(__v));							\
 }
 
 /* The location is not on 64b boundary, so we split the writing in two operations to avoid sigbus */
@@ -1723,6 +2431,14 @@ int fd_msg_avp_value_interpret ( struct avp *avp, void *data )
 	memcpy(_bufptr, &__v, sizeof(__v));							\
 }
 
+/* Copy some data in the buffer and clear the padding after it, since the buffer is not initialized */
+#define PUT_in_buf_padded( _data, _len, _bufptr ) {						\
+	size_t __l = (_len);									\
+	if (__l)										\
+		memcpy(_bufptr, _data, __l);							\
+	memset((_bufptr) + __l, 0, PAD4(__l) - __l);						\
+}
+
 /* Write a message header in the buffer */
 static int bufferize_msg(unsigned char * buffer, size_t buflen, size_t * offset, struct msg * msg)
 {
@@ -1787,12 +2503,12 @@ static int bufferize_avp(unsigned char * buffer, size_t buflen, size_t * offset,
 		
 		if ( avp->avp_rawdata != NULL ) {
 			/* the content was stored in rawdata */
-			memcpy(&buffer[*offset], avp->avp_rawdata, avp->avp_rawlen);
+			PUT_in_buf_padded(avp->avp_rawdata, avp->avp_rawlen, &buffer[*offset]);
 			*offset += PAD4(avp->avp_rawlen);
 		} else {
 			/* the message was not parsed completely */
 			size_t datalen = avp->avp_public.avp_len - GETAVPHDRSZ(avp->avp_public.avp_flags);
-			memcpy(&buffer[*offset], avp->avp_source, datalen);
+			PUT_in_buf_padded(avp->avp_source, datalen, &buffer[*offset]);
 			*offset += PAD4(datalen);
 		}
 		
@@ -1807,8 +2523,7 @@ static int bufferize_avp(unsigned char * buffer, size_t buflen, size_t * offset,
 				return bufferize_chain(buffer, buflen, offset, &avp->avp_chain.children);
 
 			case AVP_TYPE_OCTETSTRING:
-				if (avp->avp_public.avp_value->os.len)
-					memcpy(&buffer[*offset], avp->avp_public.avp_value->os.data, avp->avp_public.avp_value->os.len);
+				PUT_in_buf_padded(avp->avp_public.avp_value->os.data, avp->avp_public.avp_value->os.len, &buffer[*offset]);
 				*offset += PAD4(avp->avp_public.avp_value->os.len);
 				break;
 
@@ -1867,7 +2582,7 @@ static int bufferize_chain(unsigned char * buffer, size_t buflen, size_t * offse
 	return 0;
 }
 
-/* Create the message buffer, in network-byte order. We browse the tree twice, this could be probably improved if needed */
+/* Create the message buffer, in network-byte order. The length computation only visits the parts of the tree modified since the last time. */
 int fd_msg_bufferize ( struct msg * msg, unsigned char ** buffer, size_t * len )
 {
 	int ret = 0;
@@ -1882,12 +2597,9 @@ int fd_msg_bufferize ( struct msg * msg, unsigned char ** buffer, size_t * len )
 	/* Update the length. This also checks that all AVP have their values set */
 	CHECK_FCT(  fd_msg_update_length(msg)  );
 	
-	/* Now allocate a buffer to store the message */
+	/* Now allocate a buffer to store the message. All bytes are written below, including the padding. */
 	CHECK_MALLOC(  buf = malloc(msg->msg_public.msg_length)  );
 	
-	/* Clear the memory, so that the padding is always 0 (should not matter) */
-	memset(buf, 0, msg->msg_public.msg_length);
-	
 	/* Write the message header in the buffer */
 	CHECK_FCT_DO( ret = bufferize_msg(buf, msg->msg_public.msg_length, &offset, msg), 
 		{
@@ -1895,12 +2607,19 @@ int fd_msg_bufferize ( struct msg * msg, unsigned char ** buffer, size_t * len )
 			return ret;
 		}  );
 	
-	/* Write the list of AVPs */
-	CHECK_FCT_DO( ret = bufferize_chain(buf, msg->msg_public.msg_length, &offset, &msg->msg_chain.children),
-		{
-			free(buf);
-			return ret;
-		}  );
+	/* Write the list of AVPs. When they are shared with clones of the message, they are read in place. */
+	if (msg->msg_shared) {
+		struct msg_shared * sh = msg->msg_shared;
+		CHECK_POSIX_DO( ret = pthread_mutex_lock(&sh->lock), { free(buf); return ret; } );
+		CHECK_FCT_DO( ret = bufferize_chain(buf, msg->msg_public.msg_length, &offset, &sh->chain.children), /* unlock below */ );
+		CHECK_POSIX_DO( pthread_mutex_unlock(&sh->lock), /* continue */ );
+	} else {
+		CHECK_FCT_DO( ret = bufferize_chain(buf, msg->msg_public.msg_length, &offset, &msg->msg_chain.children), /* handled below */ );
+	}
+	if (ret) {
+		free(buf);
+		return ret;
+	}
 	
 	ASSERT(offset == msg->msg_public.msg_length); /* or the msg_update_length is buggy */
 		
@@ -1932,7 +2651,7 @@ static int parsebuf_list(unsigned char * buf, size_t buflen, struct fd_list * he
 		}
 		
 		/* Create a new AVP object */
-		CHECK_MALLOC(  avp = malloc (sizeof(struct avp))  );
+		CHECK_MALLOC(  avp = fd_pool_alloc(FD_POOL_AVP)  );
 		
 		init_avp(avp);
 		
@@ -1946,7 +2665,7 @@ static int parsebuf_list(unsigned char * buf, size_t buflen, struct fd_list * he
 		if (avp->avp_public.avp_flags & AVP_FLAG_VENDOR) {
 			if (buflen - offset < 4) {
 				TRACE_DEBUG(INFO, "truncated buffer: remaining only %zd bytes for vendor and data", buflen - offset);
-				free(avp);
+				fd_pool_free(FD_POOL_AVP, avp);
 				return EBADMSG;
 			}
 			avp->avp_public.avp_vendor  = ntohl(*(uint32_t *)(buf + offset));
@@ -1959,7 +2678,7 @@ static int parsebuf_list(unsigned char * buf, size_t buflen, struct fd_list * he
 			TRACE_DEBUG(INFO, "truncated buffer: remaining only %zd bytes for data, and avp data size is %d", 
 					buflen - offset, 
 					avp->avp_public.avp_len - GETAVPHDRSZ(avp->avp_public.avp_flags));
-			free(avp);
+			fd_pool_free(FD_POOL_AVP, avp);
 			return EBADMSG;
 		}
 		
@@ -1969,10 +2688,17 @@ static int parsebuf_list(unsigned char * buf, size_t buflen, struct fd_list * he
 		/* Now eat the data and eventual padding */
 		offset += PAD4(avp->avp_public.avp_len - GETAVPHDRSZ(avp->avp_public.avp_flags));
 		
+		/* The length read from the buffer is the one we would compute */
+		avp->avp_chain.dirty = 0;
+		
 		/* And insert this avp in the list, at the end */
 		fd_list_insert_before( head, &avp->avp_chain.chaining );
 	}
 	
+	/* If the last padding was not included in the buffer, the length of the parent will change */
+	if ((offset != buflen) && (head->o != NULL))
+		chain_dirty(head->o);
+	
 	return 0;
 }
 
@@ -2001,11 +2727,15 @@ int fd_msg_parse_buffer ( unsigned char ** buffer, size_t buflen, struct msg **
 	}
 	
 	/* Create a new object */
-	CHECK_MALLOC( new = malloc (sizeof(struct msg)) );
+	CHECK_MALLOC( new = fd_pool_alloc(FD_POOL_MSG) );
 	
 	/* Initialize the fields */
 	init_msg(new);
 	
+	/* The length is up to date, unless parsebuf_list finds otherwise */
+	if (buflen == msglen)
+		new->msg_chain.dirty = 0;
+	
 	/* Now read from the buffer */
 	new->msg_public.msg_version = buf[0];
 	new->msg_public.msg_length = msglen;
@@ -2195,8 +2925,7 @@ static int parsedict_do_avp(struct dictionary * dict, struct avp * avp, int mand
 					return EBADMSG;
 				} );
 			avp->avp_storage.os.len = avp->avp_public.avp_len - GETAVPHDRSZ( avp->avp_public.avp_flags );
-			CHECK_MALLOC(  avp->avp_storage.os.data = os0dup(source, avp->avp_storage.os.len)  );
-			avp->avp_mustfreeos = 1;
+			CHECK_FCT(  avp_os_set(avp, source, avp->avp_storage.os.len)  );
 			break;
 		
 		case AVP_TYPE_INTEGER32:
@@ -2348,6 +3077,8 @@ no_model:
 
 int fd_msg_parse_dict ( msg_or_avp * object, struct dictionary * dict, struct fd_pei *error_info )
 {
+	struct msg_shared * sh;
+	
 	TRACE_ENTRY("%p %p %p", dict, object, error_info);
 	
 	CHECK_PARAMS(  VALIDATE_OBJ(object)  );
@@ -2355,6 +3086,23 @@ int fd_msg_parse_dict ( msg_or_avp * object, struct dictionary * dict, struct fd
 	if (error_info)
 		memset(error_info, 0, sizeof(struct fd_pei));
 	
+	/* The shared AVPs are parsed in place, the result is the same for all the messages */
+	sh = obj_shared(object);
+	if (sh) {
+		int ret;
+		
+		CHECK_POSIX( pthread_mutex_lock(&sh->lock) );
+		if (_C(object)->type == MSG_MSG) {
+			ret = parsedict_do_msg(dict, _M(object), 1, error_info);
+			if (ret == 0)
+				ret = parsedict_do_chain(dict, &sh->chain.children, 1, error_info);
+		} else {
+			ret = parsedict_do_avp(dict, _A(object), 0, error_info);
+		}
+		CHECK_POSIX( pthread_mutex_unlock(&sh->lock) );
+		return ret;
+	}
+	
 	switch (_C(object)->type) {
 		case MSG_MSG:
 			return parsedict_do_msg(dict, _M(object), 0, error_info);
@@ -2371,43 +3119,6 @@ int fd_msg_parse_dict ( msg_or_avp * object, struct dictionary * dict, struct fd
 /***************************************************************************************************************/
 /* Parsing messages and AVP for rules (ABNF) compliance */
 
-/* This function is used to get stats (first occurence position, last occurence position, number of occurences) 
-   of AVP instances of a given model in a chain of AVP */
-static void parserules_stat_avps( struct dict_object * model_avp, struct fd_list *list, int * count, int * firstpos, int * lastpos) 
-{
-	struct fd_list * li;
-	int curpos = 0; /* The current position in the list */
-	
-	TRACE_ENTRY("%p %p %p %p %p", model_avp, list, count, firstpos, lastpos);
-	
-	*count = 0;	/* number of instances found */
-	*firstpos = 0;	/* position of the first instance */
-	*lastpos = 0;	/* position of the last instance, starting from the end */
-	
-	for (li = list->next; li != list; li = li->next) {
-		/* Increment the current position counter */
-		curpos++;
-		
-		/* If we previously saved a "lastpos" information, increment it */
-		if (*lastpos != 0)
-			(*lastpos)++;
-		
-		/* Check the type of the next AVP. We can compare the references directly, it is safe. */
-		if (_A(li->o)->avp_model == model_avp) {
-			
-			/* This AVP is of the type we are searching */
-			(*count)++;
-			
-			/* If we don't have yet a "firstpos", save it */
-			if (*firstpos == 0)
-				*firstpos = curpos;
-			
-			/* Reset the lastpos */
-			(*lastpos) = 1;
-		}
-	}
-}
-
 /* We use this structure as parameter for the next function */
 struct parserules_data {
 	struct fd_list  * sentinel;  	/* Sentinel of the list of children AVP */
@@ -2455,26 +3166,27 @@ static struct avp * empty_avp(struct dict_object * model_avp)
 	return avp;
 }
 
-/* Check that a list of AVPs is compliant with a given rule -- will be iterated on the list of rules */
-static int parserules_check_one_rule(void * data, struct dict_rule_data *rule)
+/* Get the name of the AVP of a rule, for logging only */
+static char * parserules_avp_name(struct dict_rule_data *rule, struct dict_avp_data * avpdata)
 {
-	int count, first, last, min;
-	struct parserules_data * pr_data = data;
+	if (fd_dict_getval(rule->rule_avp, avpdata) == 0)
+		return avpdata->avp_name;
+	return "<unresolved name>";
+}
+
+/* Check that the statistics of the AVPs of a given rule in a list (number of occurences, position of the first
+   occurence, position of the last occurence starting from the end) are compliant with the rule */
+static int parserules_check_one_rule(struct parserules_data * pr_data, struct dict_rule_data *rule, int count, int first, int last)
+{
+	int min;
 	char * avp_name = "<unresolved name>";
+	struct dict_avp_data avpdata;
 	
-	TRACE_ENTRY("%p %p", data, rule);
+	TRACE_ENTRY("%p %p %d %d %d", pr_data, rule, count, first, last);
 	
-	/* Get statistics of the AVP concerned by this rule in the parent instance */
-	parserules_stat_avps( rule->rule_avp, pr_data->sentinel, &count, &first, &last);
-	
-	if (TRACE_BOOL(INFO))
+	if (TRACE_BOOL(ANNOYING))
 	{
-		struct dict_avp_data avpdata;
-		int ret;
-		ret = fd_dict_getval(rule->rule_avp, &avpdata);
-		if (ret == 0)
-			avp_name = avpdata.avp_name;
-		
+		avp_name = parserules_avp_name(rule, &avpdata);
 		TRACE_DEBUG(ANNOYING, "Checking rule: p:%d(%d) m/M:%2d/%2d. Counted %d (first: %d, last:%d) of AVP '%s'", 
 					rule->rule_position,
 					rule->rule_order,
@@ -2497,6 +3209,7 @@ static int parserules_check_one_rule(void * data, struct dict_rule_data *rule)
 			min = 1;
 	}
 	if (count < min) {
+		avp_name = parserules_avp_name(rule, &avpdata);
 		fd_log_error("Conflicting rule: the number of occurences (%d) is < the rule min (%d) for '%s'.", count, min, avp_name);
 		if (pr_data->pei) {
 			pr_data->pei->pei_errcode = "DIAMETER_MISSING_AVP";
@@ -2508,6 +3221,7 @@ static int parserules_check_one_rule(void * data, struct dict_rule_data *rule)
 	
 	/* Check the "max" value */
 	if ((rule->rule_max != -1) && (count > rule->rule_max)) {
+		avp_name = parserules_avp_name(rule, &avpdata);
 		fd_log_error("Conflicting rule: the number of occurences (%d) is > the rule max (%d) for '%s'.", count, rule->rule_max, avp_name);
 		if (pr_data->pei) {
 			if (rule->rule_max == 0)
@@ -2530,6 +3244,7 @@ static int parserules_check_one_rule(void * data, struct dict_rule_data *rule)
 		case RULE_FIXED_HEAD:
 			/* Since "0*1<fixed>" is a valid rule specifier, we only reject cases where the AVP appears *after* its fixed position */
 			if (first > rule->rule_order) {
+				avp_name = parserules_avp_name(rule, &avpdata);
 				fd_log_error("Conflicting rule: the FIXED_HEAD AVP appears first in (%d) position, the rule requires (%d) for '%s'.", first, rule->rule_order, avp_name);
 				if (pr_data->pei) {
 					pr_data->pei->pei_errcode = "DIAMETER_MISSING_AVP";
@@ -2544,6 +3259,7 @@ static int parserules_check_one_rule(void * data, struct dict_rule_data *rule)
 		case RULE_FIXED_TAIL:
 			/* Since "0*1<fixed>" is a valid rule specifier, we only reject cases where the AVP appears *before* its fixed position */
 			if (last > rule->rule_order) {	/* We have a ">" here because we count in reverse order (i.e. from the end) */
+				avp_name = parserules_avp_name(rule, &avpdata);
 				fd_log_error("Conflicting rule: the FIXED_TAIL AVP appears last in (%d) position, the rule requires (%d) for '%s'.", last, rule->rule_order, avp_name);
 				if (pr_data->pei) {
 					pr_data->pei->pei_errcode = "DIAMETER_MISSING_AVP";
@@ -2565,6 +3281,54 @@ static int parserules_check_one_rule(void * data, struct dict_rule_data *rule)
 	return 0;
 }
 
+/* Number of rules for which the statistics are kept on the stack */
+#define PARSERULES_STACK_RULES	64
+
+/* Check that a list of AVPs is compliant with all the rules of its parent, in a single pass on the list */
+static int parserules_check_rules(void * data, struct dict_rules_idx * idx)
+{
+	struct parserules_data * pr_data = data;
+	struct {
+		int count;	/* number of occurences */
+		int first;	/* position of the first occurence */
+		int last;	/* position of the last occurence */
+	} st_stack[PARSERULES_STACK_RULES], * st = st_stack;
+	struct fd_list * li;
+	int curpos = 0, i, ret = 0;
+	
+	TRACE_ENTRY("%p %p", data, idx);
+	
+	if (idx->nb > PARSERULES_STACK_RULES) {
+		CHECK_MALLOC( st = malloc(idx->nb * sizeof(st[0])) );
+	}
+	memset(st, 0, idx->nb * sizeof(st[0]));
+	
+	/* Get statistics of all the AVPs concerned by the rules */
+	for (li = pr_data->sentinel->next; li != pr_data->sentinel; li = li->next) {
+		curpos++;
+		/* Compare the references of the models directly, it is safe */
+		i = fd_dict_rules_idx_find(idx, _A(li->o)->avp_model);
+		if (i < 0)
+			continue;
+		st[i].count++;
+		if (!st[i].first)
+			st[i].first = curpos;
+		st[i].last = curpos;
+	}
+	
+	/* Now check each rule, in the dictionary order */
+	for (i = 0; i < idx->nb; i++) {
+		/* The position of the last occurence is counted from the end of the list */
+		ret = parserules_check_one_rule(pr_data, &idx->rules[i], st[i].count, st[i].first, st[i].count ? (curpos - st[i].last + 1) : 0);
+		if (ret)
+			break;
+	}
+	
+	if (st != st_stack)
+		free(st);
+	return ret;
+}
+
 /* Check the rules recursively */
 static int parserules_do ( struct dictionary * dict, msg_or_avp * object, struct fd_pei *error_info, int mandatory)
 {
@@ -2632,15 +3396,16 @@ static int parserules_do ( struct dictionary * dict, msg_or_avp * object, struct
 		if (  CHECK_MSG(object) 
 		   || (mandatory && (_A(object)->avp_public.avp_flags & AVP_FLAG_MANDATORY)) )
 			is_child_mand = 1;
-		for (ch = _C(object)->children.next; ch != &_C(object)->children; ch = ch->next) {
+		struct fd_list * children = obj_children(object);
+		for (ch = children->next; ch != children; ch = ch->next) {
 			CHECK_FCT(  parserules_do ( dict, _C(ch->o), error_info, is_child_mand )  );
 		}
 	}
 
 	/* Now check all rules of this object */
-	data.sentinel = &_C(object)->children;
+	data.sentinel = obj_children(object);
 	data.pei  = error_info;
-	CHECK_FCT( fd_dict_iterate_rules ( model, &data, parserules_check_one_rule ) );
+	CHECK_FCT( fd_dict_rules_idx_do ( model, &data, parserules_check_rules ) );
 	
 	return 0;
 }
@@ -2661,8 +3426,8 @@ int fd_msg_parse_rules ( msg_or_avp * object, struct dictionary * dict, struct f
 
 /***************************************************************************************************************/
 
-/* Compute the lengh of an object and its subtree. */
-int fd_msg_update_length ( msg_or_avp * object )
+/* Compute the lengh of an object and its subtree. The subtrees that did not change since the previous call are skipped. */
+static int update_length_do ( msg_or_avp * object )
 {
 	size_t sz = 0;
 	struct dict_object * model;
@@ -2673,7 +3438,13 @@ int fd_msg_update_length ( msg_or_avp * object )
 	
 	TRACE_ENTRY("%p", object);
 	
-	/* Get the model of the object. This also validates the object */
+	CHECK_PARAMS(  VALIDATE_OBJ(object)  );
+	
+	/* Nothing changed in this subtree since the length was computed */
+	if (!_C(object)->dirty)
+		return 0;
+	
+	/* Get the model of the object */
 	CHECK_FCT( fd_msg_model ( object, &model ) );
 	
 	/* Get the information of the model */
@@ -2681,8 +3452,10 @@ int fd_msg_update_length ( msg_or_avp * object )
 		CHECK_FCT(  fd_dict_getval(model, &dictdata)  );
 	} else {
 		/* For unknown AVP, just don't change the size */
-		if (_C(object)->type == MSG_AVP)
+		if (_C(object)->type == MSG_AVP) {
+			_C(object)->dirty = 0;
 			return 0;
+		}
 	}
 	
 	/* Deal with easy cases: AVPs without children */
@@ -2727,7 +3500,9 @@ int fd_msg_update_length ( msg_or_avp * object )
 		
 		/* Recurse in all children and update the sz information */
 		for (ch = _C(object)->children.next; ch != &_C(object)->children; ch = ch->next) {
-			CHECK_FCT(  fd_msg_update_length ( ch->o )  );
+			if (_C(ch->o)->dirty) {
+				CHECK_FCT(  update_length_do ( ch->o )  );
+			}
 			
 			/* Add the padded size to the parent */
 			sz += PAD4( _A(ch->o)->avp_public.avp_len );
@@ -2740,9 +3515,62 @@ int fd_msg_update_length ( msg_or_avp * object )
 	else
 		_M(object)->msg_public.msg_length = sz;
 	
+	_C(object)->dirty = 0;
 	return 0;
 }
 
+/* Compute the length of the AVPs shared by a message with its clones, without copying them */
+static int update_length_shared ( struct msg * msg )
+{
+	struct msg_shared * sh = msg->msg_shared;
+	struct fd_list * ch;
+	size_t sz = GETMSGHDRSZ( );
+	int ret = 0;
+	
+	if (!msg->msg_chain.dirty)
+		return 0;
+	
+	CHECK_POSIX( pthread_mutex_lock(&sh->lock) );
+	for (ch = sh->chain.children.next; ch != &sh->chain.children; ch = ch->next) {
+		if (_C(ch->o)->dirty) {
+			CHECK_FCT_DO(  ret = update_length_do ( ch->o ), break  );
+		}
+		sz += PAD4( _A(ch->o)->avp_public.avp_len );
+	}
+	CHECK_POSIX( pthread_mutex_unlock(&sh->lock) );
+	
+	if (ret == 0) {
+		msg->msg_public.msg_length = sz;
+		msg->msg_chain.dirty = 0;
+	}
+	return ret;
+}
+
+int fd_msg_update_length ( msg_or_avp * object )
+{
+	struct msg_shared * sh;
+	
+	TRACE_ENTRY("%p", object);
+	
+	CHECK_PARAMS(  VALIDATE_OBJ(object)  );
+	
+	/* Computing the length does not require a private copy of the AVPs, the cached lengths are updated in place */
+	sh = obj_shared(object);
+	if (sh) {
+		int ret;
+		
+		if (_C(object)->type == MSG_MSG)
+			return update_length_shared(_M(object));
+		
+		CHECK_POSIX( pthread_mutex_lock(&sh->lock) );
+		ret = update_length_do(object);
+		CHECK_POSIX( pthread_mutex_unlock(&sh->lock) );
+		return ret;
+	}
+	
+	return update_length_do(object);
+}
+
 /***************************************************************************************************************/
 /* Macro to check if further callbacks must be called */
 #define TEST_ACTION_STOP()					\
@@ -2780,9 +3608,12 @@ int fd_msg_dispatch ( struct msg ** msg, struct session * session, enum disp_act
 	/* If we don't know the model at this point, we stop cause we cannot get the dictionary. It's invalid: an error should already have been trigged by ANY callbacks */
 	CHECK_PARAMS_DO(cmd = (*msg)->msg_model, { ret = EINVAL; goto out; } );
 	
-	/* Now resolve message application */
+	/* Now resolve message application, the applications of the registered handlers are found in the dispatch table */
 	CHECK_FCT_DO( ret = fd_dict_getdict( cmd, &dict ), goto out );
-	CHECK_FCT_DO( ret = fd_dict_search( dict, DICT_APPLICATION, APPLICATION_BY_ID, &(*msg)->msg_public.msg_appl, &app, 0 ), goto out );
+	app = fd_disp_app_int( dict, (*msg)->msg_public.msg_appl );
+	if (app == NULL) {
+		CHECK_FCT_DO( ret = fd_dict_search( dict, DICT_APPLICATION, APPLICATION_BY_ID, &(*msg)->msg_public.msg_appl, &app, 0 ), goto out );
+	}
 	
 	if (app == NULL) {
 		if ((*msg)->msg_public.msg_flags & CMD_FLAG_REQUEST) {
@@ -2797,8 +3628,11 @@ int fd_msg_dispatch ( struct msg ** msg, struct session * session, enum disp_act
 		goto out;
 	}
 	
-	/* So start browsing the message */
-	CHECK_FCT_DO( ret = fd_msg_browse( *msg, MSG_BRW_FIRST_CHILD, &avp, NULL ), goto out );
+	/* So start browsing the message, unless no handler is registered for AVPs */
+	avp = NULL;
+	if (fd_disp_nb_avp_int()) {
+		CHECK_FCT_DO( ret = fd_msg_browse( *msg, MSG_BRW_FIRST_CHILD, &avp, NULL ), goto out );
+	}
 	while (avp != NULL) {
 		/* For unknown AVP, we don't have a callback registered, so just skip */
 		if (avp->avp_model) {
@@ -2806,9 +3640,11 @@ int fd_msg_dispatch ( struct msg ** msg, struct session * session, enum disp_act
 			
 			/* Get the list of callback for this AVP */
 			CHECK_FCT_DO( ret = fd_dict_disp_cb(DICT_AVP, avp->avp_model, &cb_list), goto out );
+			if (FD_IS_LIST_EMPTY(cb_list))
+				goto next;
 			
-			/* We search enumerated values only in case of non-grouped AVP */
-			if ( avp->avp_public.avp_value ) {
+			/* We search enumerated values only in case of non-grouped AVP, and if a handler needs it */
+			if ( avp->avp_public.avp_value && fd_disp_has_enumval_int(cb_list) ) {
 				struct dict_object * type;
 				/* Check if the AVP has a constant value */
 				CHECK_FCT_DO( ret = fd_dict_search(dict, DICT_TYPE, TYPE_OF_AVP, avp->avp_model, &type, 0), goto out );
@@ -2825,6 +3661,7 @@ int fd_msg_dispatch ( struct msg ** msg, struct session * session, enum disp_act
 			CHECK_FCT_DO( ret = fd_disp_call_cb_int( cb_list, msg, avp, session, action, app, cmd, avp->avp_model, enumval, drop_reason, drop_msg ), goto out );
 			TEST_ACTION_STOP();
 		}
+next:
 		/* Go to next AVP */
 		CHECK_FCT_DO(  ret = fd_msg_browse( avp, MSG_BRW_WALK, &avp, NULL ), goto out );
 	}
@@ -0,0 +1,367 @@
+/*********************************************************************************************************
+* Software License Agreement (BSD License)                                                               *
+* Author: Sebastien Decugis <sdecugis@freediameter.net>							 *
+*													 *
+* Copyright (c) 2013, WIDE Project and NICT								 *
+* All rights reserved.											 *
+* 													 *
+* Redistribution and use of this software in source and binary forms, with or without modification, are  *
+* permitted provided that the following conditions are met:						 *
+* 													 *
+* * Redistributions of source code must retain the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer.										 *
+*    													 *
+* * Redistributions in binary form must reproduce the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer in the documentation and/or other						 *
+*   materials provided with the distribution.								 *
+* 													 *
+* * Neither the name of the WIDE Project or NICT nor the 						 *
+*   names of its contributors may be used to endorse or 						 *
+*   promote products derived from this software without 						 *
+*   specific prior written permission of WIDE Project and 						 *
+*   NICT.												 *
+* 													 *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED *
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A *
+* PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR *
+* ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 	 *
+* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 	 *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR *
+* TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF   *
+* ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.								 *
+*********************************************************************************************************/
+
+
+/* Pools of fixed-size objects for the messages, AVPs and small AVP values.
+ *
+ * Each thread keeps a cache of two magazines (arrays of free objects) per pool, so that most allocations and
+ * releases do not take any lock nor call malloc. When both magazines of a thread are empty (resp. full), a full
+ * (resp. empty) magazine is exchanged with the depot of the pool, which is shared by all threads and protected
+ * by a mutex. The depot keeps at most POOL_DEPOT_MAX magazines, the objects in excess are freed.
+ *
+ * Objects are always allocated with malloc, so an object from a pool can also be released with free().
+ * When the library is built with DISABLE_MSG_POOLS (e.g. for valgrind runs), these functions only call malloc and free.
+ */
+
+#include "fdproto-internal.h"
+
+/* Number of objects in a magazine */
+#define POOL_MAG_SIZE	32
+/* Maximum number of magazines with objects in a depot */
+#define POOL_DEPOT_MAX	64
+
+struct pool_mag {
+	struct pool_mag	*next;		/* chaining in the depot */
+	int		 rounds;	/* number of objects in objs */
+	void		*objs[POOL_MAG_SIZE];
+};
+
+static struct pool {
+	const char	*name;
+	size_t		 size;		/* size of the objects, 0 if the pool is not initialized */
+	
+	pthread_mutex_t	 lock;		/* protects the depot */
+	struct pool_mag	*full;		/* magazines with objects */
+	int		 nb_full;
+	struct pool_mag	*empty;		/* empty magazines */
+	
+	/* Statistics */
+	long long	 created;	/* objects allocated with malloc */
+	long long	 released;	/* objects released with free */
+	long long	 depot_get;	/* magazines taken from the depot */
+	long long	 depot_put;	/* magazines given to the depot */
+} pools[FD_POOL_MAX] = {
+	[FD_POOL_MSG]   = { "msg",   0, PTHREAD_MUTEX_INITIALIZER },
+	[FD_POOL_AVP]   = { "avp",   0, PTHREAD_MUTEX_INITIALIZER },
+	[FD_POOL_OS_S]  = { "os_s",  FD_POOL_OS_S_SIZE, PTHREAD_MUTEX_INITIALIZER },
+	[FD_POOL_OS_M]  = { "os_m",  FD_POOL_OS_M_SIZE, PTHREAD_MUTEX_INITIALIZER },
+	[FD_POOL_OS_L]  = { "os_l",  FD_POOL_OS_L_SIZE, PTHREAD_MUTEX_INITIALIZER }
+};
+
+#ifndef DISABLE_MSG_POOLS
+
+/* The cache of a thread */
+struct pool_cache {
+	struct {
+		struct pool_mag	*loaded;
+		struct pool_mag	*previous;
+	} p[FD_POOL_MAX];
+};
+
+static pthread_key_t pool_key;		/* to destroy the cache when the thread terminates */
+static __thread struct pool_cache * pool_tls;	/* same value, faster to read than pthread_getspecific */
+static int pool_active = 0;	/* the key is created and the pools can be used (atomic access) */
+static int pool_caches = 0;	/* number of threads that have a cache */
+
+/* Give a magazine back to the depot, or free it */
+static void pool_mag_release(struct pool * pool, struct pool_mag * m)
+{
+	int i, active;
+	
+	if (!m)
+		return;
+	
+	CHECK_POSIX_DO( pthread_mutex_lock(&pool->lock), );
+	active = __atomic_load_n(&pool_active, __ATOMIC_ACQUIRE);
+	if ((m->rounds == 0) && active) {
+		m->next = pool->empty;
+		pool->empty = m;
+		m = NULL;
+	} else if (active && (pool->nb_full < POOL_DEPOT_MAX)) {
+		m->next = pool->full;
+		pool->full = m;
+		pool->nb_full++;
+		pool->depot_put++;
+		m = NULL;
+	}
+	CHECK_POSIX_DO( pthread_mutex_unlock(&pool->lock), );
+	
+	if (m) {
+		for (i = 0; i < m->rounds; i++)
+			free(m->objs[i]);
+		__atomic_add_fetch(&pool->released, m->rounds, __ATOMIC_RELAXED);
+		free(m);
+	}
+}
+
+/* Destroy the cache of a thread */
+static void pool_cache_destroy(void * arg)
+{
+	struct pool_cache * c = arg;
+	int i;
+	
+	for (i = 0; i < FD_POOL_MAX; i++) {
+		pool_mag_release(&pools[i], c->p[i].loaded);
+		pool_mag_release(&pools[i], c->p[i].previous);
+	}
+	__atomic_sub_fetch(&pool_caches, 1, __ATOMIC_RELAXED);
+	if (pool_tls == c)
+		pool_tls = NULL;
+	free(c);
+}
+
+/* Get the cache of the current thread */
+static struct pool_cache * pool_cache_get(void)
+{
+	struct pool_cache * c = pool_tls;
+	
+	if (!c) {
+		c = calloc(1, sizeof(struct pool_cache));
+		if (!c)
+			return NULL;
+		if (pthread_setspecific(pool_key, c)) {
+			free(c);
+			return NULL;
+		}
+		__atomic_add_fetch(&pool_caches, 1, __ATOMIC_RELAXED);
+		pool_tls = c;
+	}
+	return c;
+}
+
+#endif /* DISABLE_MSG_POOLS */
+
+/* Initialize the pools */
+int fd_pools_init(size_t msg_size, size_t avp_size)
+{
+	TRACE_ENTRY("%zd %zd", msg_size, avp_size);
+	
+	pools[FD_POOL_MSG].size = msg_size;
+	pools[FD_POOL_AVP].size = avp_size;
+	
+#ifndef DISABLE_MSG_POOLS
+	if (!__atomic_load_n(&pool_active, __ATOMIC_ACQUIRE)) {
+		CHECK_POSIX( pthread_key_create(&pool_key, pool_cache_destroy) );
+		__atomic_store_n(&pool_active, 1, __ATOMIC_RELEASE);
+	}
+#endif /* DISABLE_MSG_POOLS */
+	return 0;
+}
+
+/* Release the cached objects. The objects released after this call are freed directly. */
+void fd_pools_fini(void)
+{
+#ifndef DISABLE_MSG_POOLS
+	struct pool_cache * c;
+	int i;
+	
+	if (!__atomic_exchange_n(&pool_active, 0, __ATOMIC_ACQ_REL))
+		return;
+	
+	/* The cache of the calling thread. The framework threads have terminated, their caches were destroyed with them.
+	  Once the key is deleted, the cache of a thread that would still run is not used anymore, and not freed. */
+	c = pthread_getspecific(pool_key);
+	if (c) {
+		CHECK_POSIX_DO( pthread_setspecific(pool_key, NULL), );
+		pool_cache_destroy(c);
+	}
+	CHECK_POSIX_DO( pthread_key_delete(pool_key), );
+	
+	/* The depots */
+	for (i = 0; i < FD_POOL_MAX; i++) {
+		struct pool * pool = &pools[i];
+		struct pool_mag * full, * empty;
+		
+		CHECK_POSIX_DO( pthread_mutex_lock(&pool->lock), );
+		full = pool->full;
+		empty = pool->empty;
+		pool->full = pool->empty = NULL;
+		pool->nb_full = 0;
+		CHECK_POSIX_DO( pthread_mutex_unlock(&pool->lock), );
+		
+		while (full) {
+			struct pool_mag * m = full;
+			full = m->next;
+			pool_mag_release(pool, m);
+		}
+		while (empty) {
+			struct pool_mag * m = empty;
+			empty = m->next;
+			free(m);
+		}
+	}
+#endif /* DISABLE_MSG_POOLS */
+}
+
+/* Allocate an object */
+void * fd_pool_alloc(enum fd_pool_id id)
+{
+	struct pool * pool = &pools[id];
+#ifndef DISABLE_MSG_POOLS
+	struct pool_cache * c;
+	
+	if (__atomic_load_n(&pool_active, __ATOMIC_ACQUIRE) && pool->size && ((c = pool_cache_get()) != NULL)) {
+		struct pool_mag * m = c->p[id].loaded;
+		
+		if (!m || !m->rounds) {
+			if (c->p[id].previous && c->p[id].previous->rounds) {
+				/* Use the other magazine */
+				c->p[id].loaded = c->p[id].previous;
+				c->p[id].previous = m;
+			} else if (__atomic_load_n(&pool->nb_full, __ATOMIC_RELAXED)) {
+				/* Exchange the empty magazine with a full one from the depot */
+				struct pool_mag * old = c->p[id].previous;
+				struct pool_mag * full = NULL;
+				
+				CHECK_POSIX_DO( pthread_mutex_lock(&pool->lock), );
+				if (pool->full) {
+					full = pool->full;
+					pool->full = full->next;
+					pool->nb_full--;
+					pool->depot_get++;
+					if (old) {
+						old->next = pool->empty;
+						pool->empty = old;
+					}
+				}
+				CHECK_POSIX_DO( pthread_mutex_unlock(&pool->lock), );
+				
+				if (full) {
+					c->p[id].previous = m;
+					c->p[id].loaded = full;
+				}
+			}
+			m = c->p[id].loaded;
+		}
+		
+		if (m && m->rounds)
+			return m->objs[--m->rounds];
+		
+		__atomic_add_fetch(&pool->created, 1, __ATOMIC_RELAXED);
+	}
+#endif /* DISABLE_MSG_POOLS */
+	return malloc(pool->size);
+}
+
+/* Release an object */
+void fd_pool_free(enum fd_pool_id id, void * obj)
+{
+#ifndef DISABLE_MSG_POOLS
+	struct pool * pool = &pools[id];
+	struct pool_cache * c;
+	
+	if (!obj)
+		return;
+	
+	if (__atomic_load_n(&pool_active, __ATOMIC_ACQUIRE) && pool->size && ((c = pool_cache_get()) != NULL)) {
+		struct pool_mag * m = c->p[id].loaded;
+		
+		if (!m || (m->rounds == POOL_MAG_SIZE)) {
+			if (c->p[id].previous && (c->p[id].previous->rounds == 0)) {
+				/* Use the other magazine */
+				c->p[id].loaded = c->p[id].previous;
+				c->p[id].previous = m;
+			} else if (!m || (__atomic_load_n(&pool->nb_full, __ATOMIC_RELAXED) < POOL_DEPOT_MAX)) {
+				/* Give the full magazine to the depot, and get an empty one */
+				struct pool_mag * empty = NULL;
+				
+				CHECK_POSIX_DO( pthread_mutex_lock(&pool->lock), );
+				if (m && (pool->nb_full < POOL_DEPOT_MAX)) {
+					m->next = pool->full;
+					pool->full = m;
+					pool->nb_full++;
+					pool->depot_put++;
+					m = NULL;
+				}
+				if (!m && pool->empty) {
+					empty = pool->empty;
+					pool->empty = empty->next;
+				}
+				CHECK_POSIX_DO( pthread_mutex_unlock(&pool->lock), );
+				
+				if (!m) {
+					if (!empty) {
+						empty = malloc(sizeof(struct pool_mag));
+						if (empty)
+							empty->rounds = 0;
+					}
+					c->p[id].loaded = empty;
+				}
+			}
+			m = c->p[id].loaded;
+		}
+		
+		if (m && (m->rounds < POOL_MAG_SIZE)) {
+			m->objs[m->rounds++] = obj;
+			return;
+		}
+		
+		__atomic_add_fetch(&pool->released, 1, __ATOMIC_RELAXED);
+	}
+#endif /* DISABLE_MSG_POOLS */
+	free(obj);
+}
+
+/* Dump the statistics of the pools */
+DECLARE_FD_DUMP_PROTOTYPE(fd_msg_pools_dump)
+{
+	FD_DUMP_HANDLE_OFFSET();
+	
+#ifdef DISABLE_MSG_POOLS
+	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "{pools} disabled (DISABLE_MSG_POOLS)"), return NULL);
+#else /* DISABLE_MSG_POOLS */
+	int i;
+	
+	CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "{pools} %s, threads:%d", __atomic_load_n(&pool_active, __ATOMIC_RELAXED) ? "active" : "inactive", __atomic_load_n(&pool_caches, __ATOMIC_RELAXED)), return NULL);
+	for (i = 0; i < FD_POOL_MAX; i++) {
+		struct pool * pool = &pools[i];
+		int nb_full;
+		long long depot_get, depot_put;
+		
+		CHECK_POSIX_DO( pthread_mutex_lock(&pool->lock), );
+		nb_full = pool->nb_full;
+		depot_get = pool->depot_get;
+		depot_put = pool->depot_put;
+		CHECK_POSIX_DO( pthread_mutex_unlock(&pool->lock), );
+		
+		CHECK_MALLOC_DO( fd_dump_extend( FD_DUMP_STD_PARAMS, "\n  '%s' size:%zd created:%lld released:%lld depot:%d/%d magazines, get:%lld put:%lld", 
+					pool->name, pool->size, 
+					__atomic_load_n(&pool->created, __ATOMIC_RELAXED), __atomic_load_n(&pool->released, __ATOMIC_RELAXED),
+					nb_full, POOL_DEPOT_MAX, depot_get, depot_put), return NULL);
+	}
+#endif /* DISABLE_MSG_POOLS */
+	
+	return *buf;
+}
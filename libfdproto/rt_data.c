@@ -109,12 +109,12 @@ void fd_rtd_free(struct rt_data ** rtd)
 }
 
 /* Add a peer to the candidates list. The source is our local peer list, so no need to care for the case here. */
-int  fd_rtd_candidate_add(struct rt_data * rtd, DiamId_t peerid, size_t peeridlen, DiamId_t realm, size_t realmlen)
+int  fd_rtd_candidate_add(struct rt_data * rtd, DiamId_t peerid, size_t peeridlen, DiamId_t realm, size_t realmlen, void * peer)
 {
 	struct fd_list * prev;
 	struct rtd_candidate * new;
 	
-	TRACE_ENTRY("%p %p %zd %p %zd", rtd, peerid, peeridlen, realm, realmlen);
+	TRACE_ENTRY("%p %p %zd %p %zd %p", rtd, peerid, peeridlen, realm, realmlen, peer);
 	CHECK_PARAMS(rtd && peerid && peeridlen);
 	
 	/* Since the peers are ordered when they are added (fd_g_activ_peers) we search for the position from the end -- this should be efficient */
@@ -138,6 +138,7 @@ int  fd_rtd_candidate_add(struct rt_data * rtd, DiamId_t peerid, size_t peeridle
 		CHECK_MALLOC( new->realm = os0dup(realm, realmlen) )
 		new->realmlen = realmlen;
 	}
+	new->peer = peer;
 	
 	/* insert in the list at the correct position */
 	fd_list_insert_after(prev, &new->chain);
@@ -182,6 +183,103 @@ void fd_rtd_candidate_del(struct rt_data * rtd, uint8_t * id, size_t idsz)
 	return;
 }
 
+/* Size of the hash table used in fd_rtd_candidate_del_set on the stack; bigger sets are allocated. Must be a power of 2. */
+#define RTD_IDSET_STACK_SIZE	32
+
+/* Case-insensitive hash of a Diameter Identity, consistent with fd_os_almostcasesrch matching.
+ Valid identities contain only letters, digits, '-' and '.', for which setting the 0x20 bit is the same as converting to lowercase,
+ so we can process 8 bytes at a time. */
+static uint32_t rtd_id_hash(uint8_t * id, size_t idsz)
+{
+	uint64_t h = idsz, w;
+	
+	for ( ; idsz >= 8; id += 8, idsz -= 8) {
+		memcpy(&w, id, 8);
+		h = (h ^ (w | 0x2020202020202020ULL)) * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 29;
+	}
+	if (idsz) {
+		w = 0;
+		memcpy(&w, id, idsz);
+		h = (h ^ (w | 0x2020202020202020ULL)) * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 29;
+	}
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+/* Remove all peers listed in ids (typically the Route-Record values of a message) from the candidates.
+ The set is hashed once, then the candidates list is processed in a single pass. Case insensitive, as fd_rtd_candidate_del. */
+int  fd_rtd_candidate_del_set(struct rt_data * rtd, uint8_t ** ids, size_t * idsz, int nb)
+{
+	struct {
+		uint8_t * id;
+		size_t    sz;
+	} stack_tbl[RTD_IDSET_STACK_SIZE], *tbl = stack_tbl;
+	uint32_t mask = RTD_IDSET_STACK_SIZE - 1;
+	uint64_t filter = 0;
+	struct fd_list * li;
+	int i, stored = 0;
+
+	TRACE_ENTRY("%p %p %p %d", rtd, ids, idsz, nb);
+	CHECK_PARAMS( rtd && (nb >= 0) && ((nb == 0) || (ids && idsz)) );
+
+	if ((nb == 0) || FD_IS_LIST_EMPTY(&rtd->candidates))
+		return 0;
+
+	/* Keep the table at most half full */
+	if (nb > RTD_IDSET_STACK_SIZE / 2) {
+		size_t sz = RTD_IDSET_STACK_SIZE;
+		while (sz < 2 * (size_t)nb)
+			sz <<= 1;
+		CHECK_MALLOC( tbl = malloc(sz * sizeof(stack_tbl[0])) );
+		mask = sz - 1;
+	}
+	memset(tbl, 0, (mask + 1) * sizeof(stack_tbl[0]));
+
+	/* Build the set (open addressing, linear probing). Duplicates are harmless. */
+	for (i = 0; i < nb; i++) {
+		uint32_t h;
+		if (!ids[i] || !idsz[i] || !fd_os_is_valid_DiameterIdentity(ids[i], idsz[i]))
+			/* it cannot be in the list */
+			continue;
+		h = rtd_id_hash(ids[i], idsz[i]);
+		filter |= (uint64_t)1 << (h >> 26);
+		while (tbl[h & mask].id)
+			h++;
+		tbl[h & mask].id = ids[i];
+		tbl[h & mask].sz = idsz[i];
+		stored++;
+	}
+
+	/* Now a single pass on the candidates */
+	for (li = rtd->candidates.next; stored && (li != &rtd->candidates); ) {
+		struct rtd_candidate * c = (struct rtd_candidate *) li;
+		uint32_t h = rtd_id_hash((uint8_t *)c->diamid, c->diamidlen);
+
+		li = li->next;
+
+		/* Quick reject for candidates that are not in the set at all */
+		if (!(filter & ((uint64_t)1 << (h >> 26))))
+			continue;
+
+		for ( ; tbl[h & mask].id; h++) {
+			if (!fd_os_almostcasesrch(tbl[h & mask].id, tbl[h & mask].sz, c->diamid, c->diamidlen, NULL)) {
+				/* Found it! Remove it */
+				fd_list_unlink(&c->chain);
+				free(c->diamid);
+				free(c->realm);
+				free(c);
+				break;
+			}
+		}
+	}
+
+	if (tbl != stack_tbl)
+		free(tbl);
+
+	return 0;
+}
+
 /* If a peer returned a protocol error for this message, save it so that we don't try to send it there again.
  Case insensitive search since the names are received from other peers*/
 int  fd_rtd_error_add(struct rt_data * rtd, DiamId_t sentto, size_t senttolen, uint8_t * origin, size_t originsz, uint32_t rcode, struct fd_list ** candidates, int * sendingattemtps)
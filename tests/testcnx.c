@@ -35,6 +35,8 @@
 
 #include "tests.h"
 
+#include <cnxctx.h>
+
 #ifndef TEST_PORT
 #define TEST_PORT	3868
 #endif /* TEST_PORT */
@@ -43,6 +45,9 @@
 #define NB_STREAMS	10
 #endif /* NB_STREAMS */
 
+/* The maximum number of messages in the incoming queue of a connection (cnxctx.c) */
+#define INCOMING_MAX	5
+
 #ifndef GNUTLS_DEFAULT_PRIORITY
 # define GNUTLS_DEFAULT_PRIORITY "NORMAL"
 #endif /* GNUTLS_DEFAULT_PRIORITY */
@@ -569,6 +574,12 @@ static void * destroy_thr(void * arg)
 	fd_cnx_destroy(cnx);
 	return NULL;
 }
+
+/* A fast path callback that lets every message go to the queue, under the limit */
+static int fastpath_busy(void * data, struct fd_cnx_rcvdata * rcv_data)
+{
+	return EBUSY;
+}
 	
 /* Main test routine */
 int main(int argc, char *argv[])
@@ -735,7 +746,7 @@ int main(int argc, char *argv[])
 		/* Accept the connection of the client */
 		server_side = fd_cnx_serv_accept(listener);
 		CHECK( 1, server_side ? 1 : 0 );
-		CHECK( 0, fd_cnx_start_clear(server_side, 0) );
+		CHECK( 0, fd_cnx_start_clear(server_side, 1) );
 		
 		/* Retrieve the client connection object */
 		CHECK( 0, pthread_join( thr, (void *)&client_side ) );
@@ -756,6 +767,23 @@ int main(int argc, char *argv[])
 		CHECK( 0, memcmp( rcv_buf, cer_buf, cer_sz ) );
 		free(rcv_buf);
 		
+		/* The receiver stops reading while 2 messages wait, when the fast path callback asks so */
+		{
+			int i;
+			CHECK( 0, fd_cnx_recv_setfastpath(server_side, fastpath_busy, NULL, 2) );
+			for (i = 0; i < 4; i++) {
+				CHECK( 0, fd_cnx_send(client_side, cer_buf, cer_sz));
+			}
+			usleep(100000);
+			CHECK( 2, fd_fifo_length(server_side->cc_incoming) );
+			for (i = 0; i < 4; i++) {
+				CHECK( 0, fd_cnx_receive(server_side, NULL, &rcv_buf, &rcv_sz));
+				CHECK( cer_sz, rcv_sz );
+				free(rcv_buf);
+			}
+			CHECK( 0, fd_cnx_recv_setfastpath(server_side, NULL, NULL, 0) );
+		}
+		
 		/* Now close the connections */
 		fd_cnx_destroy(client_side);
 		fd_cnx_destroy(server_side);
@@ -805,6 +833,64 @@ int main(int argc, char *argv[])
 		CHECK( 0, memcmp( rcv_buf, cer_buf, cer_sz ) );
 		free(rcv_buf);
 		
+		/* A batch of messages of 2 sessions: with unordered delivery, the messages of a session are sent on the stream given by the hash of its Session-Id */
+		{
+			struct dict_object * model = NULL;
+			unsigned char * bufs[4];
+			size_t lens[4];
+			char * sids[2] = { "client.side;1;1", "client.side;1;2" };
+			unsigned long before[NB_STREAMS];
+			uint16_t str;
+			int sent = 0;
+			
+			CHECK( 0, fd_dict_search ( fd_g_config->cnf_dict, DICT_COMMAND, CMD_BY_NAME, "Accounting-Request", &model, ENOENT ) );
+			for (i = 0; i < 4; i++) {
+				struct msg * msg = NULL;
+				struct dict_object * sid_model = NULL;
+				struct avp * avp = NULL;
+				union avp_value value;
+				
+				CHECK( 0, fd_msg_new ( model, MSGFL_ALLOC_ETEID, &msg ) );
+				CHECK( 0, fd_dict_search ( fd_g_config->cnf_dict, DICT_AVP, AVP_BY_NAME, "Session-Id", &sid_model, ENOENT ) );
+				CHECK( 0, fd_msg_avp_new ( sid_model, 0, &avp ) );
+				value.os.data = (uint8_t *)sids[i % 2];
+				value.os.len = strlen(sids[i % 2]);
+				CHECK( 0, fd_msg_avp_setvalue ( avp, &value ) );
+				CHECK( 0, fd_msg_avp_add( msg, MSG_BRW_FIRST_CHILD, avp) );
+				CHECK( 0, fd_msg_bufferize( msg, &bufs[i], &lens[i] ) );
+				CHECK( 0, fd_msg_free(msg) );
+			}
+			
+			CHECK( 1, client_side->cc_sctp_para.str_out <= NB_STREAMS ? 1 : 0 );
+			for (str = 0; str < client_side->cc_sctp_para.str_out; str++)
+				before[str] = client_side->cc_sctp_para.stats_out[str].msgs;
+			
+			CHECK( 0, fd_cnx_unordered_delivery(client_side, 1) );
+			CHECK( 0, fd_cnx_send_batch(client_side, bufs, lens, 4, &sent) );
+			CHECK( 4, sent );
+			CHECK( 0, fd_cnx_unordered_delivery(client_side, 0) );
+			
+			/* The messages of different streams may be received in any order */
+			for (i = 0; i < 4; i++) {
+				CHECK( 0, fd_cnx_receive(server_side, NULL, &rcv_buf, &rcv_sz));
+				CHECK( lens[0], rcv_sz );
+				CHECK( 1, (!memcmp(rcv_buf, bufs[0], rcv_sz) || !memcmp(rcv_buf, bufs[1], rcv_sz) || !memcmp(rcv_buf, bufs[2], rcv_sz) || !memcmp(rcv_buf, bufs[3], rcv_sz)) ? 1 : 0 );
+				free(rcv_buf);
+			}
+			
+			/* Each session used a single stream */
+			for (i = 0; i < 2; i++) {
+				str = fd_os_hash((uint8_t *)sids[i], strlen(sids[i])) % client_side->cc_sctp_para.str_out;
+				CHECK( 1, client_side->cc_sctp_para.stats_out[str].msgs - before[str] >= 2 ? 1 : 0 );
+			}
+			for (str = 0; str < client_side->cc_sctp_para.str_out; str++) {
+				CHECK( 0, (client_side->cc_sctp_para.stats_out[str].msgs - before[str]) % 2 );
+			}
+			
+			for (i = 0; i < 4; i++)
+				free(bufs[i]);
+		}
+		
 		/* Now close the connection */
 		fd_cnx_destroy(client_side);
 		fd_cnx_destroy(server_side);
@@ -1170,6 +1256,21 @@ int main(int argc, char *argv[])
 			free(rcv_buf);
 		}
 		
+		/* A burst of messages on the stream 0, more than the incoming queue of the connection holds: the demuxer drains the
+		  session of the stream 0 (its pull function returns EAGAIN) and waits until the messages are received */
+		CHECK( 0, fd_cnx_unordered_delivery(client_side, 0) );
+		for (i = 0; i < 3 * INCOMING_MAX; i++) {
+			CHECK( 0, fd_cnx_send(client_side, cer_buf, cer_sz));
+		}
+		usleep(100000);
+		CHECK( 1, fd_fifo_length(server_side->cc_incoming) <= INCOMING_MAX ? 1 : 0 );
+		for (i = 0; i < 3 * INCOMING_MAX; i++) {
+			CHECK( 0, fd_cnx_receive(server_side, NULL, &rcv_buf, &rcv_sz));
+			CHECK( cer_sz, rcv_sz );
+			CHECK( 0, memcmp( rcv_buf, cer_buf, cer_sz ) );
+			free(rcv_buf);
+		}
+		
 		
 		/* Now close the connection */
 		CHECK( 0, pthread_create(&thr, NULL, destroy_thr, client_side) );
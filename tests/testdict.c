@@ -165,6 +165,225 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* Test the snapshots */
+	{
+		char path[] = "/tmp/testdict.XXXXXX";
+		struct dictionary * dict = NULL;
+		struct dict_object * obj = NULL;
+		struct dict_object * avp = NULL;
+		struct fd_list * sentinel = NULL, * li;
+		vendor_id_t vid = 735671;
+		int nbr = 0, count1 = 0, count2 = 0;
+		int fd;
+
+		CHECK( 1, (fd = mkstemp(path)) >= 0 ? 1 : 0 );
+		close(fd);
+		CHECK( 0, fd_dict_snapshot_save(fd_g_config->cnf_dict, path) );
+
+		/* The types with callbacks must be already defined */
+		CHECK( 0, fd_dict_init(&dict) );
+		CHECK( ENOTSUP, fd_dict_snapshot_load(dict, path) );
+		CHECK( 0, fd_dict_fini(&dict) );
+
+		/* Load in a dictionary containing the base protocol */
+		CHECK( 0, fd_dict_init(&dict) );
+		CHECK( 0, fd_dict_base_protocol(dict) );
+		CHECK( 0, fd_dict_snapshot_load(dict, path) );
+
+		CHECK( 0, fd_dict_search ( dict, DICT_VENDOR, VENDOR_BY_ID, &vid, &obj, ENOENT ) );
+		CHECK( 0, fd_dict_search ( dict, DICT_APPLICATION, APPLICATION_BY_NAME, "Application test 1", &obj, ENOENT ) );
+		CHECK( 0, fd_dict_search ( dict, DICT_AVP, AVP_BY_NAME, "Example-AVP", &avp, ENOENT ) );
+		CHECK( 0, fd_dict_iterate_rules ( avp, &nbr, iter_test) );
+		CHECK( 2, nbr );
+		{
+			struct dict_enumval_request req;
+			memset(&req, 0, sizeof(req));
+			req.type_name = "Enumerated(Disconnect-Cause)";
+			req.search.enum_name = "BUSY";
+			CHECK( 0, fd_dict_search ( dict, DICT_ENUMVAL, ENUMVAL_BY_STRUCT, &req, &obj, ENOENT ) );
+		}
+
+		/* Same contents as the original dictionary */
+		CHECK( 0, fd_dict_getlistof(CMD_BY_CODE_R, fd_g_config->cnf_dict, &sentinel));
+		for (li = sentinel->next; li != sentinel; li = li->next)
+			count1++;
+		CHECK( 0, fd_dict_getlistof(CMD_BY_CODE_R, dict, &sentinel));
+		for (li = sentinel->next; li != sentinel; li = li->next)
+			count2++;
+		CHECK( count1, count2 );
+
+		/* Loading again does not change anything */
+		CHECK( 0, fd_dict_snapshot_load(dict, path) );
+		count2 = 0;
+		for (li = sentinel->next; li != sentinel; li = li->next)
+			count2++;
+		CHECK( count1, count2 );
+		CHECK( 0, fd_dict_fini(&dict) );
+
+		/* Conflicting definitions are detected */
+		{
+			struct dict_avp_data avp_data = { 999999, 0, "Other-AVP", 0, 0, AVP_TYPE_OCTETSTRING };
+			CHECK( 0, fd_dict_init(&dict) );
+			CHECK( 0, fd_dict_base_protocol(dict) );
+			CHECK( 0, fd_dict_new ( dict, DICT_AVP, &avp_data , NULL, NULL ) );
+			CHECK( EEXIST, fd_dict_snapshot_load(dict, path) );
+			CHECK( 0, fd_dict_fini(&dict) );
+		}
+
+		unlink(path);
+	}
+
+	/* Test the bulk load */
+	{
+		struct dictionary * dict = NULL;
+		struct dict_object * vnd = NULL, * type = NULL, * obj = NULL, * obj2 = NULL;
+		struct fd_list * sentinel = NULL, * li;
+		struct dict_vendor_data vendor_data = { 735680, "Vendor bulk" };
+		struct dict_type_data type_data = { AVP_TYPE_INTEGER32, "Enumerated(Bulk)" };
+		struct dict_avp_data avp_data = { 0, 735680, NULL, AVP_FLAG_VENDOR, AVP_FLAG_VENDOR, AVP_TYPE_INTEGER32 };
+		struct dict_avp_data avp0_data = { 999990, 0, "Bulk-Vendor-0", 0, 0, AVP_TYPE_OCTETSTRING };
+		struct dict_enumval_data enum_data = { NULL, { .i32 = 0 } };
+		struct dict_avp_request req = { 735680, 0, "Bulk-C" };
+		struct dict_enumval_request ereq;
+		char * names[] = { "Bulk-D", "Bulk-B", "Bulk-E", "Bulk-A", "Bulk-C" };
+		avp_code_t codes[] = { 9, 3, 7, 1, 5 };
+		char * enames[] = { "THREE", "ONE", "TWO" };
+		int32_t values[] = { 3, 1, 2 };
+		int i, prev;
+		
+		CHECK( 0, fd_dict_init(&dict) );
+		CHECK( 0, fd_dict_base_protocol(dict) );
+		CHECK( EINVAL, fd_dict_bulk_commit(dict) );
+		
+		/* The bulk loads can be nested */
+		CHECK( 0, fd_dict_bulk_begin(dict) );
+		CHECK( 0, fd_dict_bulk_begin(dict) );
+		
+		CHECK( 0, fd_dict_new ( dict, DICT_VENDOR, &vendor_data, NULL, &vnd ) );
+		CHECK( 0, fd_dict_new ( dict, DICT_TYPE, &type_data, NULL, &type ) );
+		for (i = 0; i < sizeof(codes) / sizeof(codes[0]); i++) {
+			avp_data.avp_code = codes[i];
+			avp_data.avp_name = names[i];
+			CHECK( 0, fd_dict_new ( dict, DICT_AVP, &avp_data, type, NULL ) );
+		}
+		for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+			enum_data.enum_name = enames[i];
+			enum_data.enum_value.i32 = values[i];
+			CHECK( 0, fd_dict_new ( dict, DICT_ENUMVAL, &enum_data, type, NULL ) );
+		}
+		CHECK( 0, fd_dict_new ( dict, DICT_AVP, &avp0_data, NULL, NULL ) );
+		
+		/* The searches work during the bulk load */
+		CHECK( 0, fd_dict_search ( dict, DICT_AVP, AVP_BY_NAME_AND_VENDOR, &req, &obj, ENOENT ) );
+		CHECK( 0, fd_dict_getval ( obj, &avp_data ) );
+		CHECK( 5, avp_data.avp_code );
+		CHECK( 0, fd_dict_search ( dict, DICT_AVP, AVP_BY_NAME_ALL_VENDORS, "Bulk-Vendor-0", &obj2, ENOENT ) );
+		CHECK( 0, fd_dict_search ( dict, DICT_AVP, AVP_BY_NAME_ALL_VENDORS, "Origin-Host", &obj2, ENOENT ) );
+		memset(&ereq, 0, sizeof(ereq));
+		ereq.type_obj = type;
+		ereq.search.enum_value.i32 = 2;
+		CHECK( 0, fd_dict_search ( dict, DICT_ENUMVAL, ENUMVAL_BY_STRUCT, &ereq, &obj2, ENOENT ) );
+		
+		/* The duplicates are detected immediately */
+		CHECK( 0, fd_dict_new ( dict, DICT_AVP, &avp_data, type, &obj2 ) );
+		CHECK( obj, obj2 );
+		avp_data.avp_code = 11;
+		CHECK( EEXIST, fd_dict_new ( dict, DICT_AVP, &avp_data, type, NULL ) );
+		
+		/* The lists are ordered when the outermost bulk load is committed */
+		CHECK( 0, fd_dict_bulk_commit(dict) );
+		CHECK( 0, fd_dict_bulk_commit(dict) );
+		CHECK( EINVAL, fd_dict_bulk_commit(dict) );
+		
+		CHECK( 0, fd_dict_getlistof(AVP_BY_CODE, vnd, &sentinel));
+		for (li = sentinel->next, prev = 0, i = 0; li != sentinel; li = li->next, i++) {
+			CHECK( 0, fd_dict_getval(li->o, &avp_data) );
+			CHECK( 1, (int)avp_data.avp_code > prev ? 1 : 0 );
+			prev = avp_data.avp_code;
+		}
+		CHECK( 5, i );
+		CHECK( 0, fd_dict_getlistof(AVP_BY_NAME, vnd, &sentinel));
+		CHECK( 0, fd_dict_getval(sentinel->next->o, &avp_data) );
+		CHECK( 0, strcmp(avp_data.avp_name, "Bulk-A") );
+		CHECK( 0, fd_dict_getval(sentinel->prev->o, &avp_data) );
+		CHECK( 0, strcmp(avp_data.avp_name, "Bulk-E") );
+		CHECK( 0, fd_dict_search ( dict, DICT_VENDOR, VENDOR_OF_AVP, obj, &obj2, ENOENT ) );
+		CHECK( vnd, obj2 );
+		
+		CHECK( 0, fd_dict_getlistof(ENUMVAL_BY_VALUE, type, &sentinel));
+		for (li = sentinel->next, prev = 0, i = 0; li != sentinel; li = li->next, i++) {
+			CHECK( 0, fd_dict_getval(li->o, &enum_data) );
+			CHECK( prev + 1, enum_data.enum_value.i32 );
+			prev = enum_data.enum_value.i32;
+		}
+		CHECK( 3, i );
+		
+		/* The vendor 0 AVPs are merged with the base protocol ones */
+		CHECK( 0, fd_dict_search ( dict, DICT_AVP, AVP_BY_NAME, "Bulk-Vendor-0", &obj, ENOENT ) );
+		CHECK( 0, fd_dict_search ( dict, DICT_VENDOR, VENDOR_OF_AVP, obj, &obj2, ENOENT ) );
+		CHECK( 0, fd_dict_getlistof(AVP_BY_CODE, obj2, &sentinel));
+		for (li = sentinel->next, prev = -1; li != sentinel; li = li->next) {
+			CHECK( 0, fd_dict_getval(li->o, &avp_data) );
+			CHECK( 1, (int)avp_data.avp_code > prev ? 1 : 0 );
+			prev = avp_data.avp_code;
+		}
+		CHECK( 999990, prev );
+		
+		CHECK( 0, fd_dict_fini(&dict) );
+	}
+	
+	/* Test the searches of enumerated values */
+	{
+		struct dictionary * dict = NULL;
+		struct dict_object * type = NULL, * enu1 = NULL, * enu2 = NULL, * obj = NULL;
+		struct dict_type_data type_data = { AVP_TYPE_OCTETSTRING, "Enumerated(OS test)" };
+		struct dict_enumval_data enu1_data = { "OS one", { .os = { (unsigned char *)"a\0b", 3 } } };
+		struct dict_enumval_data enu2_data = { "OS two", { .os = { (unsigned char *)"a", 1 } } };
+		struct dict_enumval_request req;
+		
+		CHECK( 0, fd_dict_init(&dict) );
+		CHECK( 0, fd_dict_new ( dict, DICT_TYPE, &type_data, NULL, &type ) );
+		CHECK( 0, fd_dict_new ( dict, DICT_ENUMVAL, &enu1_data, type, &enu1 ) );
+		CHECK( 0, fd_dict_new ( dict, DICT_ENUMVAL, &enu2_data, type, &enu2 ) );
+		CHECK( 0, fd_dict_new ( dict, DICT_ENUMVAL, &enu2_data, type, &obj ) );
+		CHECK( enu2, obj );
+		
+		/* By value, the octetstrings may contain 0 */
+		memset(&req, 0, sizeof(req));
+		req.type_obj = type;
+		req.search.enum_value.os.data = (unsigned char *)"a\0b";
+		req.search.enum_value.os.len = 3;
+		CHECK( 0, fd_dict_search ( dict, DICT_ENUMVAL, ENUMVAL_BY_STRUCT, &req, &obj, ENOENT ) );
+		CHECK( enu1, obj );
+		req.search.enum_value.os.len = 2;
+		CHECK( ENOENT, fd_dict_search ( dict, DICT_ENUMVAL, ENUMVAL_BY_STRUCT, &req, &obj, ENOENT ) );
+		CHECK( NULL, obj );
+		
+		/* By name, and the not found cases */
+		req.search.enum_name = "OS two";
+		CHECK( 0, fd_dict_search ( dict, DICT_ENUMVAL, ENUMVAL_BY_STRUCT, &req, &obj, ENOENT ) );
+		CHECK( enu2, obj );
+		req.search.enum_name = "OS three";
+		obj = enu1;
+		CHECK( 0, fd_dict_search ( dict, DICT_ENUMVAL, ENUMVAL_BY_STRUCT, &req, &obj, 0 ) );
+		CHECK( NULL, obj );
+		CHECK( ENOENT, fd_dict_search ( dict, DICT_ENUMVAL, ENUMVAL_BY_STRUCT, &req, NULL, 0 ) );
+		
+		/* A deleted value is removed from the indexes */
+		CHECK( 0, fd_dict_delete(enu2) );
+		req.search.enum_name = "OS two";
+		CHECK( ENOENT, fd_dict_search ( dict, DICT_ENUMVAL, ENUMVAL_BY_STRUCT, &req, &obj, ENOENT ) );
+		req.search.enum_name = NULL;
+		req.search.enum_value.os.data = (unsigned char *)"a";
+		req.search.enum_value.os.len = 1;
+		CHECK( ENOENT, fd_dict_search ( dict, DICT_ENUMVAL, ENUMVAL_BY_STRUCT, &req, &obj, ENOENT ) );
+		CHECK( 0, fd_dict_new ( dict, DICT_ENUMVAL, &enu2_data, type, &enu2 ) );
+		CHECK( 0, fd_dict_search ( dict, DICT_ENUMVAL, ENUMVAL_BY_STRUCT, &req, &obj, ENOENT ) );
+		CHECK( enu2, obj );
+		
+		CHECK( 0, fd_dict_fini(&dict) );
+	}
+	
 	/* Test delete function */
 	{
 		struct fd_list * li = NULL;
@@ -705,6 +705,40 @@ int main(int argc, char *argv[])
 		#endif
 	}
 	
+	/* Test the resolution of the application */
+	{
+		/* An application referenced by a handler (from the dispatch table), and one that is not */
+		when.app = app2;
+		CHECK( 0, fd_disp_register( cb_1, DISP_HOW_APPID, &when, NULL, &hdl[1] ) );
+		when.app = app1;
+		CHECK( 0, fd_disp_register( cb_2, DISP_HOW_APPID, &when, NULL, &hdl[2] ) );
+		CHECK( 0, fd_disp_unregister( &hdl[2], NULL ) );
+		
+		memset(cbcalled, 0, sizeof(cbcalled));
+		msg = new_msg( 2, cmd1, avp1, NULL, 0 );
+		CHECK( 0, fd_msg_dispatch ( &msg, sess, &action, &ec, &em, &error ) );
+		CHECK( 1, cbcalled[1] );
+		CHECK( DISP_ACT_CONT, action );
+		CHECK( 0, fd_msg_free( msg ) );
+		
+		memset(cbcalled, 0, sizeof(cbcalled));
+		msg = new_msg( 1, cmd1, avp1, NULL, 0 );
+		CHECK( 0, fd_msg_dispatch ( &msg, sess, &action, &ec, &em, &error ) );
+		CHECK( 0, cbcalled[1] );
+		CHECK( 0, cbcalled[2] );
+		CHECK( DISP_ACT_CONT, action );
+		CHECK( 0, fd_msg_free( msg ) );
+		
+		/* An application unknown in the dictionary */
+		msg = new_msg( 735, cmd1, avp1, NULL, 0 );
+		CHECK( 0, fd_msg_dispatch ( &msg, sess, &action, &ec, &em, &error ) );
+		CHECK( DISP_ACT_ERROR, action );
+		CHECK( 0, strcmp(ec, "DIAMETER_APPLICATION_UNSUPPORTED") );
+		CHECK( 0, fd_msg_free( msg ) );
+		
+		CHECK( 0, fd_disp_unregister( &hdl[1], NULL ) );
+	}
+	
 	/* Test opaque pointer management */
 	{
 		void * ptr;
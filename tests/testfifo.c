@@ -283,6 +283,94 @@ int main(int argc, char *argv[])
 		CHECK( 0, fd_fifo_del(&queue) );
 	}
 	
+	/* Tagged items and events */
+	{
+		struct fifo * queue = NULL;
+		struct msg * msg  = NULL;
+		void * data = NULL;
+		int tag = 0, i;
+		size_t size = 0;
+		
+		/* Create the queue */
+		CHECK( 0, fd_fifo_new(&queue, 0) );
+		
+		/* The values are stored inline, including a NULL pointer */
+		CHECK( 0, fd_fifo_post_tagged(queue, 1, 10, msg1) );
+		CHECK( 0, fd_fifo_post_tagged_noblock(queue, 2, 0, NULL) );
+		CHECK( 0, fd_event_send(queue, 3, 30, msg3) );
+		CHECK( 3, fd_fifo_length(queue) );
+		
+		CHECK( 0, fd_fifo_get_tagged(queue, &tag, &size, &data) );
+		CHECK( 1, tag );
+		CHECK( 10, size );
+		CHECK( msg1, data );
+		CHECK( 0, fd_fifo_tryget_tagged(queue, &tag, NULL, &data) );
+		CHECK( 2, tag );
+		CHECK( NULL, data );
+		CHECK( 0, fd_event_get(queue, &tag, &size, &data) );
+		CHECK( 3, tag );
+		CHECK( 30, size );
+		CHECK( msg3, data );
+		CHECK( EWOULDBLOCK, fd_fifo_tryget_tagged(queue, &tag, &size, &data) );
+		
+		/* Check the timeout code is returned */
+		CHECK(0, clock_gettime(CLOCK_REALTIME, &ts));
+		ts.tv_nsec += 1000000; /* 1 millisecond */
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_nsec -= 1000000000L;
+			ts.tv_sec += 1;
+		}
+		CHECK( 0, fd_event_timedget(queue, &ts, 42, &tag, &size, &data) );
+		CHECK( 42, tag );
+		CHECK( NULL, data );
+		
+		/* Recycled list items must not leak values of the previous items */
+		for (i = 0; i < 100; i++) {
+			CHECK( 0, fd_event_send(queue, i, i, NULL) );
+		}
+		for (i = 0; i < 100; i++) {
+			CHECK( 0, fd_fifo_get_tagged(queue, &tag, &size, &data) );
+			CHECK( i, tag );
+			CHECK( i, size );
+			CHECK( NULL, data );
+		}
+		msg = msg2;
+		CHECK( 0, fd_fifo_post(queue, &msg) );
+		CHECK( 0, fd_fifo_get(queue, &msg) );
+		CHECK( msg2, msg );
+		
+		/* Destroy the queue with its spare items */
+		CHECK( 0, fd_fifo_del(&queue) );
+		
+		/* fd_fifo_trypost_tagged respects the maximum, fd_fifo_post_tagged_noblock does not */
+		CHECK( 0, fd_fifo_new(&queue, 2) );
+		CHECK( 0, fd_fifo_trypost_tagged(queue, 1, 0, NULL) );
+		CHECK( 0, fd_fifo_trypost_tagged(queue, 2, 0, NULL) );
+		CHECK( EWOULDBLOCK, fd_fifo_trypost_tagged(queue, 3, 0, NULL) );
+		CHECK( 2, fd_fifo_length(queue) );
+		CHECK( 0, fd_fifo_post_tagged_noblock(queue, 3, 0, NULL) );
+		CHECK( 3, fd_fifo_length(queue) );
+		for (i = 1; i <= 3; i++) {
+			CHECK( 0, fd_fifo_tryget_tagged(queue, &tag, NULL, &data) );
+			CHECK( i, tag );
+		}
+		
+		/* A lower limit applies to some items only, the other ones still go up to the maximum */
+		CHECK( 0, fd_fifo_trypost_tagged_lim(queue, 1, 1, 0, NULL) );
+		CHECK( EWOULDBLOCK, fd_fifo_trypost_tagged_lim(queue, 1, 2, 0, NULL) );
+		CHECK( 0, fd_fifo_trypost_tagged(queue, 2, 0, NULL) );
+		CHECK( EWOULDBLOCK, fd_fifo_trypost_tagged(queue, 3, 0, NULL) );
+		CHECK( 0, fd_fifo_tryget_tagged(queue, &tag, NULL, &data) );
+		CHECK( 1, tag );
+		CHECK( 0, fd_fifo_post_tagged_lim(queue, 2, 3, 0, NULL) );
+		CHECK( 2, fd_fifo_length(queue) );
+		for (i = 2; i <= 3; i++) {
+			CHECK( 0, fd_fifo_tryget_tagged(queue, &tag, NULL, &data) );
+			CHECK( i, tag );
+		}
+		CHECK( 0, fd_fifo_del(&queue) );
+	}
+	
 	/* Test robustness, ensure no messages are lost */
 	{
 #define NBR_MSG		200
@@ -516,6 +604,20 @@ int main(int argc, char *argv[])
 		CHECK( 3, thrh_td.h_calls );
 		CHECK( 3, thrh_td.l_calls );
 		
+		/* Thresholds with a data pointer can be removed, then the callbacks are not called anymore */
+		CHECK( 0, fd_fifo_setthrhd ( queue, &thrh_td, 6, thrh_cb_h, 4, thrh_cb_l ) );
+		CHECK( EINVAL, fd_fifo_setthrhd ( queue, NULL, 6, thrh_cb_h, 4, thrh_cb_l ) );
+		CHECK( 0, fd_fifo_setthrhd ( queue, NULL, 0, NULL, 0, NULL ) );
+		for (i=0; i<6; i++) {
+			msg = msg1;
+			CHECK( 0, fd_fifo_post(queue, &msg) );
+		} /* 6 msg in queue */
+		for (i=0; i<6; i++) {
+			CHECK( 0, fd_fifo_get(queue, &msg) );
+		} /* 0 msg in queue */
+		CHECK( 3, thrh_td.h_calls );
+		CHECK( 3, thrh_td.l_calls );
+		
 		/* We're done for this test */
 		CHECK( 0, fd_fifo_del(&queue) );
 	}
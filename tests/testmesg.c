@@ -700,6 +700,310 @@ int main(int argc, char *argv[])
 				
 		}
 		
+		/* Test the fd_msg_search_avps function */
+		{
+			struct dict_avp_request req_grouped = { 73565, 0, "AVP Test - grouped" };
+			struct dict_avp_request req_os = { 73565, 0, "AVP Test - os" };
+			struct msg_avp_search srch[5];
+			struct avp_hdr     * avpdata = NULL;
+			
+			memset(srch, 0, sizeof(srch));
+			CHECK( 0, fd_dict_search ( fd_g_config->cnf_dict, DICT_AVP, AVP_BY_NAME, "AVP Test - no vendor - f32", &srch[0].model, ENOENT ) );
+			CHECK( 0, fd_dict_search ( fd_g_config->cnf_dict, DICT_AVP, AVP_BY_NAME_AND_VENDOR, &req_grouped, &srch[1].model, ENOENT ) );
+			CHECK( 0, fd_dict_search ( fd_g_config->cnf_dict, DICT_AVP, AVP_BY_NAME_AND_VENDOR, &req_os, &srch[2].model, ENOENT ) );
+			CHECK( 0, fd_dict_search ( fd_g_config->cnf_dict, DICT_AVP, AVP_BY_NAME, "AVP Test - no vendor - f32", &srch[3].model, ENOENT ) );
+			CHECK( 0, fd_dict_search ( fd_g_config->cnf_dict, DICT_AVP, AVP_BY_NAME, "Session-Id", &srch[4].model, ENOENT ) );
+			srch[0].parent = -1;
+			srch[1].parent = -1;
+			srch[2].parent = 1;  /* inside the grouped AVP */
+			srch[3].parent = 1;  /* not inside the grouped AVP */
+			srch[4].parent = -1; /* not in the message */
+			
+			CPYBUF();
+			CHECK( 0, fd_msg_parse_buffer( &buf_cpy, 344, &msg) );
+			
+			/* Invalid parameters */
+			srch[2].parent = 2;
+			CHECK( EINVAL, fd_msg_search_avps( msg, srch, 5 ) );
+			srch[2].parent = 1;
+			CHECK( EINVAL, fd_msg_search_avps( msg, srch, 0 ) );
+			
+			CHECK( 0, fd_msg_search_avps( msg, srch, 5 ) );
+			CHECK( 0, fd_msg_avp_hdr ( srch[0].avp, &avpdata ) );
+			CHECK( 3.1415F, avpdata->avp_value->f32 );
+			CHECK( 1, srch[1].avp ? 1 : 0 );
+			CHECK( 0, fd_msg_avp_hdr ( srch[2].avp, &avpdata ) );
+			CHECK( 8, avpdata->avp_value->os.len );
+			CHECK( NULL, srch[3].avp );
+			CHECK( NULL, srch[4].avp );
+			
+			/* reinit the msg */
+			CHECK( 0, fd_msg_free ( msg ) );
+		}
+		
+		/* Test the message templates */
+		{
+			struct msg_tmpl * tmpl = NULL;
+			struct msg * msg2 = NULL;
+			struct msg_hdr * hdr1 = NULL, * hdr2 = NULL;
+			struct avp * avp = NULL;
+			struct avp_hdr * avpdata = NULL;
+			unsigned char * buf1 = NULL, * buf2 = NULL;
+			size_t len1, len2;
+			union avp_value value;
+			
+			CPYBUF();
+			CHECK( 0, fd_msg_parse_buffer( &buf_cpy, 344, &msg) );
+			CHECK( 0, fd_msg_parse_dict( msg, fd_g_config->cnf_dict, NULL ) );
+			
+			/* Invalid parameters */
+			CHECK( EINVAL, fd_msg_tmpl_new( NULL, &tmpl ) );
+			CHECK( EINVAL, fd_msg_tmpl_add( NULL, msg ) );
+			
+			CHECK( 0, fd_msg_tmpl_new( msg, &tmpl ) );
+			
+			/* Apply it to an empty message with the same header */
+			CHECK( 0, fd_msg_new ( NULL, 0, &msg2 ) );
+			CHECK( 0, fd_msg_hdr ( msg, &hdr1 ) );
+			CHECK( 0, fd_msg_hdr ( msg2, &hdr2 ) );
+			memcpy(hdr2, hdr1, sizeof(struct msg_hdr));
+			CHECK( 0, fd_msg_tmpl_add( tmpl, msg2 ) );
+			
+			/* The template is not needed by the message */
+			CHECK( 0, fd_msg_tmpl_free( tmpl ) );
+			
+			/* The encoded messages are identical */
+			CHECK( 0, fd_msg_bufferize( msg, &buf1, &len1 ) );
+			CHECK( 0, fd_msg_bufferize( msg2, &buf2, &len2 ) );
+			CHECK( len1, len2 );
+			CHECK( 0, memcmp(buf1, buf2, len1) );
+			free(buf2);
+			
+			/* The AVPs are parsed and can be patched */
+			CHECK( 0, fd_msg_browse ( msg2, MSG_BRW_FIRST_CHILD, &avp, NULL) );
+			CHECK( 0, fd_msg_avp_hdr ( avp, &avpdata ) );
+			CHECK( 1, avpdata->avp_value ? 1 : 0 );
+			CHECK( 0, fd_msg_parse_dict( msg2, fd_g_config->cnf_dict, NULL ) );
+			CHECK( 0, fd_msg_parse_rules( msg2, fd_g_config->cnf_dict, NULL ) );
+			memset(&value, 0, sizeof(value));
+			value.os.data = (os0_t)"patched";
+			value.os.len = 7;
+			CHECK( 0, fd_msg_avp_setvalue ( avp, &value ) );
+			CHECK( 0, fd_msg_bufferize( msg2, &buf2, &len2 ) );
+			CHECK( 1, ((len2 != len1) || memcmp(buf1, buf2, len1)) ? 1 : 0 );
+			free(buf2);
+			
+			/* Several templates can be applied to the same message */
+			CHECK( 0, fd_msg_tmpl_new( msg, &tmpl ) );
+			CHECK( 0, fd_msg_free ( msg2 ) );
+			CHECK( 0, fd_msg_new ( NULL, 0, &msg2 ) );
+			CHECK( 0, fd_msg_tmpl_add( tmpl, msg2 ) );
+			CHECK( 0, fd_msg_tmpl_add( tmpl, msg2 ) );
+			CHECK( 0, fd_msg_tmpl_free( tmpl ) );
+			CHECK( 0, fd_msg_update_length( msg2 ) );
+			CHECK( 0, fd_msg_hdr ( msg2, &hdr2 ) );
+			CHECK( 2 * (len1 - 20) + 20, hdr2->msg_length );
+			
+			/* The AVPs can be moved to another message, which does not depend on the first one */
+			{
+				struct msg * msg3 = NULL;
+				struct msg_hdr * hdr3 = NULL;
+				
+				CHECK( EINVAL, fd_msg_avp_unlink( NULL ) );
+				CHECK( 0, fd_msg_new ( NULL, 0, &msg3 ) );
+				CHECK( 0, fd_msg_hdr ( msg3, &hdr3 ) );
+				memcpy(hdr3, hdr1, sizeof(struct msg_hdr));
+				while (1) {
+					CHECK( 0, fd_msg_browse ( msg2, MSG_BRW_FIRST_CHILD, &avp, NULL) );
+					if (!avp)
+						break;
+					CHECK( 0, fd_msg_avp_unlink( avp ) );
+					CHECK( 0, fd_msg_avp_unlink( avp ) ); /* no effect when the AVP is not linked */
+					CHECK( 0, fd_msg_avp_add( msg3, MSG_BRW_LAST_CHILD, avp ) );
+				}
+				CHECK( 0, fd_msg_free ( msg2 ) );
+				
+				CHECK( 0, fd_msg_bufferize( msg3, &buf2, &len2 ) );
+				CHECK( 2 * (len1 - 20) + 20, len2 );
+				CHECK( 0, memcmp(buf1 + 20, buf2 + 20, len1 - 20) );
+				CHECK( 0, memcmp(buf1 + 20, buf2 + len1, len1 - 20) );
+				free(buf2);
+				msg2 = msg3;
+			}
+			
+			free(buf1);
+			CHECK( 0, fd_msg_free ( msg2 ) );
+			CHECK( 0, fd_msg_free ( msg ) );
+		}
+
+		/* Test the cached lengths */
+		{
+			struct msg_hdr * hdr = NULL;
+			struct avp * gavp = NULL, * avp = NULL;
+			struct avp_hdr * ghdr = NULL, * avpdata = NULL;
+			unsigned char * buf1 = NULL;
+			size_t len1;
+			uint32_t glen, clen;
+
+			CPYBUF();
+			CHECK( 0, fd_msg_parse_buffer( &buf_cpy, 344, &msg) );
+			CHECK( 0, fd_msg_parse_dict( msg, fd_g_config->cnf_dict, NULL ) );
+
+			/* Nothing changed, the buffer is the same (including the padding) */
+			CHECK( 0, fd_msg_bufferize( msg, &buf1, &len1 ) );
+			CHECK( 344, len1 );
+			CHECK( 0, memcmp(buf, buf1, len1) );
+			free(buf1);
+
+			/* Find a grouped AVP */
+			CHECK( 0, fd_msg_browse ( msg, MSG_BRW_FIRST_CHILD, &gavp, NULL) );
+			while (gavp) {
+				CHECK( 0, fd_msg_browse ( gavp, MSG_BRW_FIRST_CHILD, &avp, NULL) );
+				if (avp)
+					break;
+				CHECK( 0, fd_msg_browse ( gavp, MSG_BRW_NEXT, &gavp, NULL) );
+			}
+			CHECK( 1, avp ? 1 : 0 );
+			CHECK( 0, fd_msg_avp_hdr ( gavp, &ghdr ) );
+			CHECK( 0, fd_msg_avp_hdr ( avp, &avpdata ) );
+			glen = ghdr->avp_len;
+			clen = PAD4(avpdata->avp_len);
+
+			/* Removing a child changes the length of the parents */
+			CHECK( 0, fd_msg_free ( avp ) );
+			CHECK( 0, fd_msg_update_length( msg ) );
+			CHECK( glen - clen, ghdr->avp_len );
+			CHECK( 0, fd_msg_hdr ( msg, &hdr ) );
+			CHECK( 344 - clen, hdr->msg_length );
+
+			/* And the new buffer can be parsed again */
+			CHECK( 0, fd_msg_bufferize( msg, &buf1, &len1 ) );
+			CHECK( 344 - clen, len1 );
+			CHECK( 0, fd_msg_free ( msg ) );
+			CHECK( 0, fd_msg_parse_buffer( &buf1, len1, &msg) );
+			CHECK( 0, fd_msg_parse_dict( msg, fd_g_config->cnf_dict, NULL ) );
+			CHECK( 0, fd_msg_free ( msg ) );
+		}
+
+		/* Test the message cloning */
+		{
+			struct msg * msg2 = NULL;
+			struct avp * avp = NULL;
+			unsigned char * buf1 = NULL;
+			size_t len1;
+
+			/* A message that was not parsed with the dictionary does not depend on the original buffer */
+			CPYBUF();
+			CHECK( 0, fd_msg_parse_buffer( &buf_cpy, 344, &msg) );
+			CHECK( EINVAL, fd_msg_clone( NULL, &msg2 ) );
+			CHECK( 0, fd_msg_clone( msg, &msg2 ) );
+			CHECK( 0, fd_msg_free ( msg ) );
+			CHECK( 0, fd_msg_parse_dict( msg2, fd_g_config->cnf_dict, NULL ) );
+			CHECK( 0, fd_msg_bufferize( msg2, &buf1, &len1 ) );
+			CHECK( 344, len1 );
+			CHECK( 0, memcmp(buf, buf1, len1) );
+			free(buf1);
+
+			/* Cloning a parsed message, then changing the copy. The shared AVPs are browsed in place and are read-only. */
+			CHECK( 0, fd_msg_clone( msg2, &msg ) );
+			CHECK( 0, fd_msg_browse ( msg, MSG_BRW_FIRST_CHILD, &avp, NULL) );
+			{
+				struct avp * avp2 = NULL;
+				CHECK( 0, fd_msg_browse ( msg2, MSG_BRW_FIRST_CHILD, &avp2, NULL) );
+				CHECK( avp2, avp );
+				CHECK( 0, fd_msg_browse ( avp, MSG_BRW_PARENT, &avp2, NULL) );
+				CHECK( NULL, avp2 );
+			}
+			CHECK( EBUSY, fd_msg_free ( avp ) );
+			CHECK( 0, fd_msg_unshare ( msg ) );
+			CHECK( 0, fd_msg_browse ( msg, MSG_BRW_FIRST_CHILD, &avp, NULL) );
+			CHECK( 0, fd_msg_free ( avp ) );
+			CHECK( 0, fd_msg_bufferize( msg, &buf1, &len1 ) );
+			CHECK( 1, len1 < 344 ? 1 : 0 );
+			free(buf1);
+			CHECK( 0, fd_msg_free ( msg ) );
+
+			/* The original is not affected */
+			CHECK( 0, fd_msg_bufferize( msg2, &buf1, &len1 ) );
+			CHECK( 344, len1 );
+			CHECK( 0, memcmp(buf, buf1, len1) );
+			free(buf1);
+			
+			/* The AVPs are shared until a message is modified, an AVP retrieved before the clone is shared too */
+			{
+				struct msg * msg3 = NULL;
+				struct avp_hdr * avpdata = NULL;
+				union avp_value value;
+				unsigned char * buf2 = NULL;
+				size_t len2;
+				
+				CHECK( 0, fd_msg_browse ( msg2, MSG_BRW_FIRST_CHILD, &avp, NULL) );
+				CHECK( 0, fd_msg_clone( msg2, &msg ) );
+				CHECK( 0, fd_msg_clone( msg, &msg3 ) );
+				
+				/* The clones are encoded without being copied */
+				CHECK( 0, fd_msg_bufferize( msg3, &buf1, &len1 ) );
+				CHECK( 344, len1 );
+				CHECK( 0, memcmp(buf, buf1, len1) );
+				free(buf1);
+				
+				/* Modify the original: the AVP must be retrieved again once the message has its own copy */
+				memset(&value, 0, sizeof(value));
+				value.os.data = (os0_t)"modified";
+				value.os.len = 8;
+				CHECK( EBUSY, fd_msg_avp_setvalue ( avp, &value ) );
+				CHECK( 0, fd_msg_unshare ( msg2 ) );
+				{
+					struct avp * avp2 = NULL;
+					CHECK( 0, fd_msg_browse ( msg2, MSG_BRW_FIRST_CHILD, &avp2, NULL) );
+					CHECK( 1, avp2 != avp ? 1 : 0 );
+					CHECK( 0, fd_msg_browse ( msg3, MSG_BRW_FIRST_CHILD, &avp2, NULL) );
+					CHECK( avp, avp2 );
+				}
+				CHECK( 0, fd_msg_browse ( msg2, MSG_BRW_FIRST_CHILD, &avp, NULL) );
+				CHECK( 0, fd_msg_avp_setvalue ( avp, &value ) );
+				CHECK( 0, fd_msg_avp_hdr ( avp, &avpdata ) );
+				CHECK( 8, avpdata->avp_value->os.len );
+				CHECK( 0, fd_msg_bufferize( msg2, &buf2, &len2 ) );
+				CHECK( 1, ((len2 != 344) || memcmp(buf, buf2, len2)) ? 1 : 0 );
+				
+				/* The clones still have the initial value */
+				CHECK( 0, fd_msg_bufferize( msg, &buf1, &len1 ) );
+				CHECK( 344, len1 );
+				CHECK( 0, memcmp(buf, buf1, len1) );
+				free(buf1);
+				CHECK( 0, fd_msg_free ( msg ) );
+				
+				/* The last clone takes the shared AVPs */
+				CHECK( 0, fd_msg_browse ( msg3, MSG_BRW_FIRST_CHILD, &avp, NULL) );
+				CHECK( 0, fd_msg_avp_hdr ( avp, &avpdata ) );
+				CHECK( 1, avpdata->avp_value->os.len != 8 ? 1 : 0 );
+				{
+					struct avp * avp2 = NULL;
+					CHECK( 0, fd_msg_unshare ( msg3 ) );
+					CHECK( 0, fd_msg_browse ( msg3, MSG_BRW_FIRST_CHILD, &avp2, NULL) );
+					CHECK( avp, avp2 );
+				}
+				CHECK( 0, fd_msg_bufferize( msg3, &buf1, &len1 ) );
+				CHECK( 344, len1 );
+				CHECK( 0, memcmp(buf, buf1, len1) );
+				free(buf1);
+				
+				/* The original can be freed before its clones */
+				CHECK( 0, fd_msg_clone( msg3, &msg ) );
+				CHECK( 0, fd_msg_free ( msg3 ) );
+				CHECK( 0, fd_msg_bufferize( msg, &buf1, &len1 ) );
+				CHECK( 344, len1 );
+				CHECK( 0, memcmp(buf, buf1, len1) );
+				free(buf1);
+				CHECK( 0, fd_msg_clone( msg, &msg3 ) );
+				CHECK( 0, fd_msg_free ( msg ) );
+				CHECK( 0, fd_msg_free ( msg3 ) );
+				free(buf2);
+			}
+			CHECK( 0, fd_msg_free ( msg2 ) );
+		}
+
 		/* Test the msg_parse_dict function */
 		{
 			/* Test with an unknown command code */
@@ -970,6 +1274,85 @@ int main(int argc, char *argv[])
 					/* Now remove this AVP */
 					CHECK( 0, fd_msg_free ( childavp ) );
 				}
+				
+				{
+					/* The rules are checked in a single pass on the children, with a compiled index of the rules.
+					   AVPs that are not covered by any rule must be skipped without affecting the positions checks */
+					CHECK( 0, fd_msg_browse ( tavp, MSG_BRW_LAST_CHILD, &childavp, NULL) );	/* childavp is the grouped avp */
+					ADD_AVP( childavp, MSG_BRW_PREV, tempavp, 73565, "AVP Test - os2" );
+					CHECK( 0, fd_msg_parse_rules( msg, fd_g_config->cnf_dict, &pei ) );
+					CHECK( 0, fd_msg_free ( tempavp ) );
+				}
+				
+				{
+					/* When several rules are broken, the first one in the dictionary order is reported */
+					CHECK( 0, fd_msg_browse ( tavp, MSG_BRW_FIRST_CHILD, &tempavp, NULL) ); /* tempavp is the novendor avp */
+					CHECK( 0, fd_msg_browse ( tempavp, MSG_BRW_NEXT, &tempavp, NULL) );     /* tempavp is the i64 avp */
+					CHECK( 0, fd_msg_browse ( tempavp, MSG_BRW_NEXT, &childavp, NULL) );    /* childavp is the enumi32 avp */
+					CHECK( 0, fd_msg_free ( childavp ) );
+					ADD_AVP( tempavp, MSG_BRW_NEXT, childavp, 73565, "AVP Test - os" );
+					ADD_AVP( tempavp, MSG_BRW_NEXT, childavp, 73565, "AVP Test - os" );
+					
+					CHECK_CONFLICT( msg, "DIAMETER_MISSING_AVP", "AVP Test - enumi32", 73565 );
+					
+					/* Restore the missing fixed AVP, the excess os AVPs are now reported */
+					ADD_AVP( tempavp, MSG_BRW_NEXT, childavp, 73565, "AVP Test - enumi32" );
+					CHECK_CONFLICT( msg, "DIAMETER_AVP_OCCURS_TOO_MANY_TIMES", "AVP Test - os", 73565 );
+					
+					/* Remove them */
+					CHECK( 0, fd_msg_browse ( childavp, MSG_BRW_NEXT, &tempavp, NULL) );
+					CHECK( 0, fd_msg_free ( tempavp ) );
+					CHECK( 0, fd_msg_browse ( childavp, MSG_BRW_NEXT, &tempavp, NULL) );
+					CHECK( 0, fd_msg_free ( tempavp ) );
+					CHECK( 0, fd_msg_parse_rules( msg, fd_g_config->cnf_dict, &pei ) );
+				}
+			}
+			
+			/* The index of the rules is rebuilt when the rules change, and handles more rules than fit on the stack */
+			{
+				struct dict_object * gavp = NULL;
+				struct dict_avp_data avp_data = { 73576, 73565, "AVP Test - rules index", AVP_FLAG_VENDOR, AVP_FLAG_VENDOR, AVP_TYPE_GROUPED };
+				struct avp * tavp = NULL, * childavp = NULL;
+				char name[32];
+				int i;
+				
+				CHECK( 0, fd_dict_new ( fd_g_config->cnf_dict, DICT_AVP, &avp_data , NULL, &gavp ) );
+				CHECK( 0, fd_msg_avp_new ( gavp, 0, &tavp ) );
+				
+				/* No rule yet: the empty AVP is conform, and the (empty) index is built */
+				CHECK( 0, fd_msg_parse_rules( tavp, fd_g_config->cnf_dict, &pei ) );
+				
+				/* Now add a required AVP, the index must be rebuilt */
+				ADD_RULE(gavp, 73565, "AVP Test - os", RULE_REQUIRED, 1, 2, 0);
+				CHECK_CONFLICT( tavp, "DIAMETER_MISSING_AVP", "AVP Test - os", 73565 );
+				ADD_AVP( tavp, MSG_BRW_LAST_CHILD, childavp, 73565, "AVP Test - os" );
+				CHECK( 0, fd_msg_parse_rules( tavp, fd_g_config->cnf_dict, &pei ) );
+				
+				/* Add more rules than PARSERULES_STACK_RULES, the last one fixed in head position */
+				for (i = 0; i < 80; i++) {
+					struct dict_avp_data ad = { 73600 + i, 73565, name, AVP_FLAG_VENDOR, AVP_FLAG_VENDOR, AVP_TYPE_UNSIGNED32 };
+					snprintf(name, sizeof(name), "AVP Test - rules index %d", i);
+					CHECK( 0, fd_dict_new ( fd_g_config->cnf_dict, DICT_AVP, &ad , NULL, NULL ) );
+					ADD_RULE(gavp, 73565, name, (i == 79) ? RULE_FIXED_HEAD : RULE_OPTIONAL, (i == 79) ? 1 : 0, 1, (i == 79) ? 1 : 0);
+				}
+				CHECK_CONFLICT( tavp, "DIAMETER_MISSING_AVP", "AVP Test - rules index 79", 73565 );
+				
+				/* Add the fixed AVP in the wrong position */
+				ADD_AVP( tavp, MSG_BRW_LAST_CHILD, childavp, 73565, "AVP Test - rules index 79" );
+				CHECK_CONFLICT( tavp, "DIAMETER_MISSING_AVP", "AVP Test - rules index 79", 73565 );
+				
+				/* Now put it in the first position */
+				CHECK( 0, fd_msg_free ( childavp ) );
+				ADD_AVP( tavp, MSG_BRW_FIRST_CHILD, childavp, 73565, "AVP Test - rules index 79" );
+				CHECK( 0, fd_msg_parse_rules( tavp, fd_g_config->cnf_dict, &pei ) );
+				
+				/* Break an optional rule beyond the stack size */
+				ADD_AVP( tavp, MSG_BRW_LAST_CHILD, childavp, 73565, "AVP Test - rules index 70" );
+				CHECK( 0, fd_msg_parse_rules( tavp, fd_g_config->cnf_dict, &pei ) );
+				ADD_AVP( tavp, MSG_BRW_LAST_CHILD, childavp, 73565, "AVP Test - rules index 70" );
+				CHECK_CONFLICT( tavp, "DIAMETER_AVP_OCCURS_TOO_MANY_TIMES", "AVP Test - rules index 70", 73565 );
+				
+				CHECK( 0, fd_msg_free ( tavp ) );
 			}
 		}
 		
@@ -1449,6 +1832,61 @@ int main(int argc, char *argv[])
 		}
 	}
 	
+	/* Test the pools of messages, AVPs and values */
+	{
+		struct dict_object * avp_model = NULL;
+		struct dict_avp_request req = { 73565, 0, "AVP Test - os" };
+		struct msg * msg = NULL;
+		struct avp * avp = NULL;
+		struct avp_hdr * avpdata = NULL;
+		union avp_value value;
+		unsigned char os[301];
+		size_t sizes[] = { 0, 5, 31, 32, 63, 64, 127, 128, 300 };
+		char * buf = NULL;
+		size_t len = 0;
+		int i, j;
+		
+		CHECK( 0, fd_dict_search ( fd_g_config->cnf_dict, DICT_AVP, AVP_BY_NAME_AND_VENDOR, &req, &avp_model, ENOENT ) );
+		for (i = 0; i < sizeof(os); i++)
+			os[i] = (unsigned char)i;
+		
+		/* Create and free more objects than a magazine holds, several times, with values of all the sizes */
+		for (j = 0; j < 3; j++) {
+			CHECK( 0, fd_msg_new ( NULL, 0, &msg ) );
+			for (i = 0; i < 100; i++) {
+				size_t sz = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+				CHECK( 0, fd_msg_avp_new ( avp_model, 0, &avp ) );
+				value.os.data = os;
+				value.os.len = sz;
+				CHECK( 0, fd_msg_avp_setvalue ( avp, &value ) );
+				/* Replace the value, to release the first one */
+				value.os.data = os + 1;
+				CHECK( 0, fd_msg_avp_setvalue ( avp, &value ) );
+				CHECK( 0, fd_msg_avp_add ( msg, MSG_BRW_LAST_CHILD, avp ) );
+			}
+			
+			/* Check the values */
+			CHECK( 0, fd_msg_browse ( msg, MSG_BRW_FIRST_CHILD, &avp, NULL) );
+			for (i = 0; i < 100; i++) {
+				size_t sz = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+				CHECK( 0, fd_msg_avp_hdr ( avp, &avpdata ) );
+				CHECK( sz, avpdata->avp_value->os.len );
+				CHECK( 0, memcmp(avpdata->avp_value->os.data, os + 1, sz) );
+				CHECK( 0, avpdata->avp_value->os.data[sz] );
+				CHECK( 0, fd_msg_browse ( avp, MSG_BRW_NEXT, &avp, NULL) );
+			}
+			CHECK( NULL, avp );
+			
+			CHECK( 0, fd_msg_free( msg ) );
+		}
+		
+		CHECK( 1, fd_msg_pools_dump(&buf, &len, NULL) ? 1 : 0 );
+		#if 0
+		fd_log_debug("%s", buf);
+		#endif
+		free(buf);
+	}
+	
 	/* That's all for the tests yet */
 	PASSTEST();
 } 
@@ -545,6 +545,31 @@ redo:
 		}
 		CHECK( test_parameter, i ); /* if false, a malloc failed */
 		
+	/* fd_event_send + fd_event_get, as done for each buffer received on a connection */
+		{
+			struct fifo * queue = NULL;
+			int code;
+			size_t sz;
+			uint8_t * b;
+			
+			CHECK( 0, fd_fifo_new(&queue, 0) );
+			
+			CHECK( 0, clock_gettime(CLOCK_REALTIME, &start) );
+			
+			for (i=0; i < test_parameter; i++) {
+				if (0 != fd_event_send( queue, FDEVP_CNX_MSG_RECV, 344, stress_array[i].b) )
+					break;
+				if ((0 != fd_event_get( queue, &code, &sz, (void *)&b) ) || (b != stress_array[i].b))
+					break;
+			}
+			CHECK( test_parameter, i ); /* if false, a call failed */
+			
+			CHECK( 0, clock_gettime(CLOCK_REALTIME, &end) );
+			display_result(test_parameter, &start, &end, "fd_event_send+get", "buffers", "queued");
+			
+			CHECK( 0, fd_fifo_del(&queue) );
+		}
+		
 	/* fd_msg_parse_buffer */
 		
 		CHECK( 0, clock_gettime(CLOCK_REALTIME, &start) );
@@ -655,8 +680,25 @@ redo:
 		
 		CHECK( 0, clock_gettime(CLOCK_REALTIME, &end) );
 		display_result(test_parameter, &start, &end, "fd_msg_bufferize", "buffers", "created");
-		
-		
+
+
+	/* fd_msg_clone */
+
+		CHECK( 0, clock_gettime(CLOCK_REALTIME, &start) );
+
+		/* Test the fd_msg_clone function, the copies replace the originals */
+		for (i=0; i < test_parameter; i++) {
+			struct msg * orig = stress_array[i].m;
+			if (0 != fd_msg_clone( orig, &stress_array[i].m ) )
+				break;
+			fd_msg_free( orig );
+		}
+		CHECK( test_parameter, i ); /* if false, a call failed */
+
+		CHECK( 0, clock_gettime(CLOCK_REALTIME, &end) );
+		display_result(test_parameter, &start, &end, "fd_msg_clone+free", "messages", "copied");
+
+
 	/* fd_msg_free */
 		
 		CHECK( 0, clock_gettime(CLOCK_REALTIME, &start) );
@@ -682,7 +724,61 @@ redo:
 		printf("Loaded all dictionary extensions, restarting...\n");
 		goto redo;
 	}
-	
+
+	/* Test the rules validation on a command with many rules and AVPs (CCA-like) */
+	{
+		#define WIDE_NB_RULES 40
+		struct dict_object * application = NULL;
+		struct dict_object * command = NULL;
+		struct dict_cmd_data cmd_data = { 73575, "Wide-Command-Request", CMD_FLAG_REQUEST, CMD_FLAG_REQUEST };
+		struct msg * msg = NULL;
+		struct timespec start, end;
+		int i, j;
+
+		CHECK( 0, fd_dict_search ( fd_g_config->cnf_dict, DICT_APPLICATION, APPLICATION_BY_NAME, "Application test", &application, ENOENT ) );
+		CHECK( 0, fd_dict_new ( fd_g_config->cnf_dict, DICT_COMMAND, &cmd_data , application, &command ) );
+
+		/* Create the AVPs and the rules: <Wide-Command-Request> ::= < AVP 0 > *[ AVP 1..39 ] */
+		for (i = 0; i < WIDE_NB_RULES; i++) {
+			char name[64];
+			struct dict_avp_data avp_data = { 73600 + i, 73565, name, AVP_FLAG_VENDOR, AVP_FLAG_VENDOR, AVP_TYPE_UNSIGNED32 };
+			struct dict_rule_data rule_data = { NULL, i ? RULE_OPTIONAL : RULE_FIXED_HEAD, i ? 0 : 1, -1, i ? -1 : 1 };
+			snprintf(name, sizeof(name), "AVP Test - wide %d", i);
+			CHECK( 0, fd_dict_new ( fd_g_config->cnf_dict, DICT_AVP, &avp_data , NULL, &rule_data.rule_avp ) );
+			CHECK( 0, fd_dict_new ( fd_g_config->cnf_dict, DICT_RULE, &rule_data , command, NULL ) );
+		}
+
+		/* Create a message with two instances of each AVP (one for the fixed head) */
+		CHECK( 0, fd_msg_new ( command, 0, &msg ) );
+		for (j = 0; j < 2; j++) {
+			for (i = j; i < WIDE_NB_RULES; i++) {
+				struct dict_object * model = NULL;
+				struct dict_avp_request req = { 73565, 73600 + i, NULL };
+				struct avp * avp = NULL;
+				union avp_value value;
+				CHECK( 0, fd_dict_search( fd_g_config->cnf_dict, DICT_AVP, AVP_BY_CODE_AND_VENDOR, &req, &model, ENOENT));
+				CHECK( 0, fd_msg_avp_new ( model, 0, &avp ) );
+				value.u32 = i;
+				CHECK( 0, fd_msg_avp_setvalue ( avp, &value ) );
+				CHECK( 0, fd_msg_avp_add ( msg, MSG_BRW_LAST_CHILD, avp ) );
+			}
+		}
+
+		CHECK( 0, clock_gettime(CLOCK_REALTIME, &start) );
+
+		for (i=0; i < test_parameter; i++) {
+			if (0 != fd_msg_parse_rules( msg, fd_g_config->cnf_dict, NULL ) )
+				break;
+		}
+		CHECK( test_parameter, i ); /* if false, a call failed */
+
+		CHECK( 0, clock_gettime(CLOCK_REALTIME, &end) );
+		display_result(test_parameter, &start, &end, "fd_msg_parse_rules (wide)", "messages", "parsed");
+
+		CHECK( 0, fd_msg_free( msg ) );
+		#undef WIDE_NB_RULES
+	}
+
 	/* That's all for the tests yet */
 	PASSTEST();
 } 
@@ -38,6 +38,31 @@
 const char * ids[] = { "b11", "b14", "b1", "b4" };
 #define DomainName "localdomain"
 
+/* Build the buffer of a message with no AVP, as received from a peer (with the room for the hooks data, see fd_cnx_alloc_msg_buffer) */
+static void fastpath_rcvdata(uint32_t appl, uint32_t code, uint8_t flags, struct fd_cnx_rcvdata * rcv_data)
+{
+	struct msg * msg = NULL;
+	struct msg_hdr * hdr;
+	struct fd_msg_pmdl * pmdl;
+	uint8_t * buf;
+	
+	CHECK( 0, fd_msg_new( NULL, MSGFL_ALLOC_ETEID, &msg ) );
+	CHECK( 0, fd_msg_hdr( msg, &hdr ) );
+	hdr->msg_appl = appl;
+	hdr->msg_code = code;
+	hdr->msg_flags = flags;
+	hdr->msg_hbhid = 0x12345678;
+	CHECK( 0, fd_msg_bufferize( msg, &buf, &rcv_data->length ) );
+	CHECK( 0, fd_msg_free( msg ) );
+	
+	CHECK( 1, (rcv_data->buffer = malloc(fd_msg_pmdl_sizewithoverhead(rcv_data->length))) ? 1 : 0 );
+	memcpy(rcv_data->buffer, buf, rcv_data->length);
+	free(buf);
+	pmdl = fd_msg_pmdl_get_inbuf(rcv_data->buffer, rcv_data->length);
+	fd_list_init(&pmdl->sentinel, NULL);
+	CHECK( 0, pthread_mutex_init(&pmdl->lock, NULL) );
+}
+
 /* Main test routine */
 int main(int argc, char *argv[])
 {
@@ -71,6 +96,230 @@ int main(int argc, char *argv[])
 		}
 	}
 	
+	/* Test the reception of messages directly in the receiver thread (fd_psm_fastpath) */
+	{
+		struct fd_peer * peer = NULL;
+		struct fd_cnx_rcvdata rcv_data;
+		struct msg * msg;
+		struct msg_hdr * hdr;
+		DiamId_t source;
+		size_t sourcelen;
+		uint32_t linklocal[] = { 257 /* CER */, 280 /* DWR */, 282 /* DPR */ };
+		void * dummy[20];
+		int i;
+		
+		CHECK( 0, fd_queues_init() );
+		CHECK( 0, fd_peer_alloc(&peer) );
+		peer->p_hdr.info.pi_diamid = "fast." DomainName;
+		peer->p_hdr.info.pi_diamidlen = strlen(peer->p_hdr.info.pi_diamid);
+		CHECK( 0, fd_fifo_new(&peer->p_events, 0) );
+		peer->p_state = STATE_OPEN;
+		
+		/* A routable request bypasses the PSM */
+		fastpath_rcvdata(3, 271, CMD_FLAG_REQUEST | CMD_FLAG_PROXIABLE, &rcv_data);
+		CHECK( 0, fd_psm_fastpath(peer, &rcv_data) );
+		CHECK( 1, fd_fifo_length(fd_g_incoming) );
+		CHECK( 0, fd_fifo_length(peer->p_events) );
+		CHECK( 1, peer->p_reqin_count );
+		CHECK( 0, fd_fifo_tryget(fd_g_incoming, &msg) );
+		CHECK( 0, fd_msg_hdr( msg, &hdr ) );
+		CHECK( 271, hdr->msg_code );
+		CHECK( 0, fd_msg_source_get( msg, &source, &sourcelen ) );
+		CHECK( 0, strcmp((char *)source, "fast." DomainName) );
+		CHECK( 0, fd_msg_free( msg ) );
+		
+		/* The CER / DWR / DPR exchanges stay in the PSM, even in OPEN state */
+		for (i = 0; i < sizeof(linklocal) / sizeof(linklocal[0]); i++) {
+			fastpath_rcvdata(0, linklocal[i], CMD_FLAG_REQUEST, &rcv_data);
+			CHECK( EAGAIN, fd_psm_fastpath(peer, &rcv_data) );
+			free(rcv_data.buffer);
+			fastpath_rcvdata(0, linklocal[i], 0, &rcv_data);
+			CHECK( EAGAIN, fd_psm_fastpath(peer, &rcv_data) );
+			free(rcv_data.buffer);
+		}
+		
+		/* Routable messages go to the PSM in the other states */
+		peer->p_state = STATE_SUSPECT;
+		fastpath_rcvdata(3, 271, CMD_FLAG_REQUEST | CMD_FLAG_PROXIABLE, &rcv_data);
+		CHECK( EAGAIN, fd_psm_fastpath(peer, &rcv_data) );
+		peer->p_state = STATE_WAITCEA;
+		CHECK( EAGAIN, fd_psm_fastpath(peer, &rcv_data) );
+		peer->p_state = STATE_OPEN;
+		
+		/* ... and behind the messages already queued for the PSM */
+		CHECK( 0, fd_event_send(peer->p_events, FDEVP_CNX_MSG_RECV, 0, NULL) );
+		CHECK( EAGAIN, fd_psm_fastpath(peer, &rcv_data) );
+		{
+			int code;
+			void * data;
+			CHECK( 0, fd_fifo_tryget_tagged(peer->p_events, &code, NULL, &data) );
+			CHECK( FDEVP_CNX_MSG_RECV, code );
+		}
+		
+		/* ... and when fd_g_incoming is full, since the receiver thread must not block */
+		for (i = 0; i < sizeof(dummy) / sizeof(dummy[0]); i++) {
+			dummy[i] = &dummy[i];
+			CHECK( 0, fd_fifo_post_noblock(fd_g_incoming, &dummy[i]) );
+		}
+		CHECK( EAGAIN, fd_psm_fastpath(peer, &rcv_data) );
+		for (i = 0; i < sizeof(dummy) / sizeof(dummy[0]); i++) {
+			void * item;
+			CHECK( 0, fd_fifo_tryget(fd_g_incoming, &item) );
+		}
+		CHECK( 0, fd_psm_fastpath(peer, &rcv_data) );
+		CHECK( 0, fd_fifo_tryget(fd_g_incoming, &msg) );
+		CHECK( 0, fd_msg_free( msg ) );
+	}
+	
+	/* Test the throttling of the peers that send the most messages (p_flow.c) */
+	{
+		struct fd_peer * noisy = NULL, * quiet = NULL;
+		struct fd_cnx_rcvdata rcv_data;
+		struct msg * msg;
+		struct msg_hdr * hdr;
+		char * buf = NULL;
+		size_t len = 0;
+		uint32_t order[] = { 201, 202, 200 };
+		int i;
+		
+		fd_g_config->cnf_flow_high = 5;
+		fd_g_config->cnf_flow_low  = 2;
+		CHECK( 0, fd_p_flow_init() );
+		
+		CHECK( 0, fd_peer_alloc(&noisy) );
+		noisy->p_hdr.info.pi_diamid = "noisy." DomainName;
+		noisy->p_hdr.info.pi_diamidlen = strlen(noisy->p_hdr.info.pi_diamid);
+		CHECK( 0, fd_peer_alloc(&quiet) );
+		quiet->p_hdr.info.pi_diamid = "quiet." DomainName;
+		quiet->p_hdr.info.pi_diamidlen = strlen(quiet->p_hdr.info.pi_diamid);
+		CHECK( 0, pthread_rwlock_wrlock(&fd_g_peers_rw) );
+		fd_list_insert_before(&fd_g_peers, &noisy->p_hdr.chain);
+		fd_list_insert_before(&fd_g_peers, &quiet->p_hdr.chain);
+		CHECK( 0, pthread_rwlock_unlock(&fd_g_peers_rw) );
+		
+		/* Reaching the high watermark throttles the peers above the average */
+		for (i = 0; i < 5; i++) {
+			CHECK( 0, fd_msg_new( NULL, 0, &msg ) );
+			CHECK( 0, fd_msg_hdr( msg, &hdr ) );
+			hdr->msg_flags = CMD_FLAG_REQUEST;
+			hdr->msg_code = 100 + i;
+			CHECK( 0, fd_p_flow_incoming( i ? noisy : quiet, &msg, 1 ) );
+		}
+		CHECK( 5, fd_fifo_length(fd_g_incoming) );
+		CHECK( 1, noisy->p_flow_paused );
+		CHECK( 0, quiet->p_flow_paused );
+		CHECK( 1, noisy->p_flow_pauses );
+		
+		/* The requests of the throttled peer go through the PSM thread, not its answers */
+		fastpath_rcvdata(3, 271, CMD_FLAG_REQUEST | CMD_FLAG_PROXIABLE, &rcv_data);
+		CHECK( EBUSY, fd_p_flow_check(noisy, &rcv_data) );
+		CHECK( 0, fd_p_flow_check(quiet, &rcv_data) );
+		free(rcv_data.buffer);
+		fastpath_rcvdata(3, 271, CMD_FLAG_PROXIABLE, &rcv_data);
+		CHECK( 0, fd_p_flow_check(noisy, &rcv_data) );
+		free(rcv_data.buffer);
+		
+		/* There, its requests are held, the answers and the other peers' messages are not */
+		CHECK( 0, fd_msg_new( NULL, 0, &msg ) );
+		CHECK( 0, fd_msg_hdr( msg, &hdr ) );
+		hdr->msg_flags = CMD_FLAG_REQUEST;
+		hdr->msg_code = 200;
+		CHECK( 0, fd_p_flow_incoming( noisy, &msg, 0 ) );
+		CHECK( 5, fd_fifo_length(fd_g_incoming) );
+		CHECK( 1, fd_fifo_length(noisy->p_flow_heldq) );
+		CHECK( 1, noisy->p_flow_held );
+		
+		CHECK( 0, fd_msg_new( NULL, 0, &msg ) );
+		CHECK( 0, fd_msg_hdr( msg, &hdr ) );
+		hdr->msg_code = 201;
+		CHECK( 0, fd_p_flow_incoming( noisy, &msg, 0 ) );
+		CHECK( 0, fd_msg_new( NULL, 0, &msg ) );
+		CHECK( 0, fd_msg_hdr( msg, &hdr ) );
+		hdr->msg_flags = CMD_FLAG_REQUEST;
+		hdr->msg_code = 202;
+		CHECK( 0, fd_p_flow_incoming( quiet, &msg, 0 ) );
+		CHECK( 7, fd_fifo_length(fd_g_incoming) );
+		
+		CHECK( 1, fd_p_flow_dump(&buf, &len, NULL, noisy) ? 1 : 0 );
+		CHECK( 1, strstr(buf, "THROTTLED(1)") && strstr(buf, "1held") ? 1 : 0 );
+		
+		/* Reaching the low watermark resumes the peer, and releases its request after the queued messages */
+		for (i = 0; i < 5; i++) {
+			CHECK( 0, fd_fifo_tryget(fd_g_incoming, &msg) );
+			CHECK( 0, fd_msg_free( msg ) );
+		}
+		CHECK( 0, noisy->p_flow_paused );
+		CHECK( 0, fd_fifo_length(noisy->p_flow_heldq) );
+		CHECK( 3, fd_fifo_length(fd_g_incoming) );
+		for (i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+			CHECK( 0, fd_fifo_tryget(fd_g_incoming, &msg) );
+			CHECK( 0, fd_msg_hdr( msg, &hdr ) );
+			CHECK( order[i], hdr->msg_code );
+			CHECK( 0, fd_msg_free( msg ) );
+		}
+		
+		CHECK( 1, fd_p_flow_dump(&buf, &len, NULL, noisy) ? 1 : 0 );
+		CHECK( 1, strstr(buf, "flow:ok") ? 1 : 0 );
+		free(buf);
+		
+		/* The released requests are requeued only as fd_g_incoming has room for them */
+		{
+			struct fifo * incoming = fd_g_incoming;
+			
+			CHECK( 0, fd_fifo_setthrhd(fd_g_incoming, NULL, 0, NULL, 0, NULL) );
+			CHECK( 0, fd_fifo_new(&fd_g_incoming, 8) );
+			CHECK( 0, fd_p_flow_init() );
+			noisy->p_flow_rcvd = quiet->p_flow_rcvd = 0;
+			
+			for (i = 0; i < 15; i++) {
+				CHECK( 0, fd_msg_new( NULL, 0, &msg ) );
+				CHECK( 0, fd_msg_hdr( msg, &hdr ) );
+				hdr->msg_flags = CMD_FLAG_REQUEST;
+				hdr->msg_code = ((i < 5) ? 300 : 400) + i;
+				CHECK( 0, fd_p_flow_incoming( noisy, &msg, (i < 5) ? 1 : 0 ) );
+			}
+			CHECK( 1, noisy->p_flow_paused );
+			CHECK( 10, fd_fifo_length(noisy->p_flow_heldq) );
+			for (i = 0; i < 3; i++) {
+				CHECK( 0, fd_msg_new( NULL, 0, &msg ) );
+				CHECK( 0, fd_msg_hdr( msg, &hdr ) );
+				hdr->msg_flags = CMD_FLAG_REQUEST;
+				hdr->msg_code = 500 + i;
+				CHECK( 0, fd_p_flow_incoming( quiet, &msg, 1 ) );
+			}
+			CHECK( 8, fd_fifo_length(fd_g_incoming) );
+			
+			/* The queue holds 2 messages when the peer is resumed, 6 of its requests fit */
+			for (i = 0; i < 6; i++) {
+				CHECK( 0, fd_fifo_tryget(fd_g_incoming, &msg) );
+				CHECK( 0, fd_msg_free( msg ) );
+			}
+			CHECK( 0, fd_fifo_length(noisy->p_flow_heldq) );
+			CHECK( 8, fd_fifo_length(fd_g_incoming) );
+			
+			/* The other ones come at the next low watermark, in order */
+			for (i = 0; i < 12; i++) {
+				uint32_t code = (i < 2) ? 501 + i : 405 + i - 2;
+				CHECK( 0, fd_fifo_tryget(fd_g_incoming, &msg) );
+				CHECK( 0, fd_msg_hdr( msg, &hdr ) );
+				CHECK( code, hdr->msg_code );
+				CHECK( 0, fd_msg_free( msg ) );
+			}
+			CHECK( 0, fd_fifo_length(fd_g_incoming) );
+			
+			CHECK( 0, fd_fifo_setthrhd(fd_g_incoming, NULL, 0, NULL, 0, NULL) );
+			CHECK( 0, fd_fifo_del(&fd_g_incoming) );
+			fd_g_incoming = incoming;
+		}
+		
+		CHECK( 0, pthread_rwlock_wrlock(&fd_g_peers_rw) );
+		fd_list_unlink(&noisy->p_hdr.chain);
+		fd_list_unlink(&quiet->p_hdr.chain);
+		CHECK( 0, pthread_rwlock_unlock(&fd_g_peers_rw) );
+		CHECK( 0, fd_fifo_setthrhd(fd_g_incoming, NULL, 0, NULL, 0, NULL) );
+		fd_g_config->cnf_flow_high = 0;
+		fd_g_config->cnf_flow_low  = 0;
+	}
 	
 	/* That's all for the tests yet */
 	PASSTEST();
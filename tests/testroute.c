@@ -0,0 +1,383 @@
+/*********************************************************************************************************
+* Software License Agreement (BSD License)                                                               *
+* Author: Sebastien Decugis <sdecugis@freediameter.net>							 *
+*													 *
+* Copyright (c) 2011, WIDE Project and NICT								 *
+* All rights reserved.											 *
+* 													 *
+* Redistribution and use of this software in source and binary forms, with or without modification, are  *
+* permitted provided that the following conditions are met:						 *
+* 													 *
+* * Redistributions of source code must retain the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer.										 *
+*    													 *
+* * Redistributions in binary form must reproduce the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer in the documentation and/or other						 *
+*   materials provided with the distribution.								 *
+* 													 *
+* * Neither the name of the WIDE Project or NICT nor the 						 *
+*   names of its contributors may be used to endorse or 						 *
+*   promote products derived from this software without 						 *
+*   specific prior written permission of WIDE Project and 						 *
+*   NICT.												 *
+* 													 *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED *
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A *
+* PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR *
+* ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 	 *
+* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 	 *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR *
+* TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF   *
+* ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.								 *
+*********************************************************************************************************/
+
+
+#include "tests.h"
+
+/* Test the caches of the routing module of the daemon */
+
+#define TARGET	"target.example.net"
+#define AGENT	"agent.example.net"
+#define OTHER	"other.example.net"
+
+static struct dict_object * cmd_rar;
+
+static void add_avp_os(struct msg * msg, char * name, char * str)
+{
+	struct dict_object * model;
+	struct avp * avp;
+	union avp_value value;
+	
+	CHECK( 0, fd_dict_search( fd_g_config->cnf_dict, DICT_AVP, AVP_BY_NAME, name, &model, ENOENT ) );
+	CHECK( 0, fd_msg_avp_new ( model, 0, &avp ) );
+	value.os.data = (uint8_t *)str;
+	value.os.len = strlen(str);
+	CHECK( 0, fd_msg_avp_setvalue ( avp, &value ) );
+	CHECK( 0, fd_msg_avp_add ( msg, MSG_BRW_LAST_CHILD, avp ) );
+}
+
+static void add_avp_u32(struct msg * msg, char * name, uint32_t u32)
+{
+	struct dict_object * model;
+	struct avp * avp;
+	union avp_value value;
+	
+	CHECK( 0, fd_dict_search( fd_g_config->cnf_dict, DICT_AVP, AVP_BY_NAME, name, &model, ENOENT ) );
+	CHECK( 0, fd_msg_avp_new ( model, 0, &avp ) );
+	value.u32 = u32;
+	CHECK( 0, fd_msg_avp_setvalue ( avp, &value ) );
+	CHECK( 0, fd_msg_avp_add ( msg, MSG_BRW_LAST_CHILD, avp ) );
+}
+
+/* A request with the given Session-Id and Destination-Realm */
+static struct msg * new_req(char * sid, char * realm)
+{
+	struct msg * msg;
+	struct msg_hdr * hdr;
+	
+	CHECK( 0, fd_msg_new ( cmd_rar, 0, &msg ) );
+	CHECK( 0, fd_msg_hdr ( msg, &hdr ) );
+	hdr->msg_appl = 4;
+	add_avp_os(msg, "Session-Id", sid);
+	add_avp_os(msg, "Destination-Realm", realm);
+	return msg;
+}
+
+/* Pass a redirect answer to the request with these keys to the cache */
+static void learn_redirect(char * sid, char * realm, uint32_t usage, uint32_t cachetime)
+{
+	struct msg * msg = new_req(sid, realm);
+	
+	CHECK( 0, fd_msg_new_answer_from_req ( fd_g_config->cnf_dict, &msg, 0 ) );
+	add_avp_u32(msg, "Result-Code", ER_DIAMETER_REDIRECT_INDICATION);
+	add_avp_os(msg, "Origin-Host", AGENT);
+	add_avp_os(msg, "Redirect-Host", "aaa://" TARGET ":3868");
+	add_avp_u32(msg, "Redirect-Host-Usage", usage);
+	add_avp_u32(msg, "Redirect-Max-Cache-Time", cachetime);
+	
+	CHECK( 0, fd_rtredir_learn(msg) );
+	CHECK( 0, fd_msg_free(msg) );
+}
+
+/* Routing data with the first nb candidates of: target, agent, other, new */
+static struct rt_data * new_rtd(int nb)
+{
+	char * ids[] = { TARGET, AGENT, OTHER, "new.example.net" };
+	struct rt_data * rtd = NULL;
+	int i;
+	
+	CHECK( 0, fd_rtd_init(&rtd) );
+	for (i = 0; i < nb; i++) {
+		CHECK( 0, fd_rtd_candidate_add(rtd, ids[i], strlen(ids[i]), "example.net", CONSTSTRLEN("example.net"), NULL) );
+	}
+	return rtd;
+}
+
+/* Apply the cache to a request with these keys, and return the scores of the target and the agent */
+static void apply_redirect(char * sid, char * realm, int * target, int * agent)
+{
+	struct msg * msg = new_req(sid, realm);
+	struct rt_data * rtd = new_rtd(3);
+	struct fd_list * candidates, * li;
+	
+	fd_rtd_candidate_extract(rtd, &candidates, 0);
+	
+	CHECK( 0, fd_rtredir_apply(msg, candidates) );
+	
+	*target = *agent = -1000;
+	for (li = candidates->next; li != candidates; li = li->next) {
+		struct rtd_candidate * c = (struct rtd_candidate *) li;
+		if (!strcmp(c->diamid, TARGET))
+			*target = c->score;
+		if (!strcmp(c->diamid, AGENT))
+			*agent = c->score;
+		if (!strcmp(c->diamid, OTHER)) {
+			CHECK( 0, c->score );
+		}
+	}
+	
+	fd_rtd_free(&rtd);
+	CHECK( 0, fd_msg_free(msg) );
+}
+
+/* Callbacks registered and unregistered while the routing-out thread uses the list */
+#define CHURN_MAGIC	0x5EED5EED
+struct churn_data {
+	uint32_t magic;
+};
+static int churn_stop = 0;
+static int churn_calls = 0;
+static int routed = 0;
+
+static int churn_cb(void * cbdata, struct msg ** pmsg, struct fd_list * candidates)
+{
+	struct churn_data * d = cbdata;
+	/* The callback must never be called after it was unregistered and its data freed */
+	CHECK( CHURN_MAGIC, d->magic );
+	__atomic_add_fetch(&churn_calls, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Consumes the requests, last called (lowest priority) */
+static int sink_cb(void * cbdata, struct msg ** pmsg, struct fd_list * candidates)
+{
+	CHECK( 0, fd_msg_free(*pmsg) );
+	*pmsg = NULL;
+	__atomic_add_fetch(&routed, 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+static void * churn_thr(void * arg)
+{
+	fd_log_threadname("churn");
+	while (!__atomic_load_n(&churn_stop, __ATOMIC_RELAXED)) {
+		struct fd_rt_out_hdl * hdl;
+		struct churn_data * d;
+		
+		CHECK( 1, (d = malloc(sizeof(struct churn_data))) ? 1 : 0 );
+		d->magic = CHURN_MAGIC;
+		CHECK( 0, fd_rt_out_register( churn_cb, d, 100, &hdl ) );
+		CHECK( 0, fd_rt_out_unregister( hdl, NULL ) );
+		d->magic = 0;
+		free(d);
+	}
+	return NULL;
+}
+
+/* Main test routine */
+int main(int argc, char *argv[])
+{
+	int target, agent, i;
+	char sid[32];
+	
+	/* First, initialize the daemon modules */
+	INIT_FD();
+	
+	CHECK( 0, fd_dict_search( fd_g_config->cnf_dict, DICT_COMMAND, CMD_BY_NAME, "Re-Auth-Request", &cmd_rar, ENOENT ) );
+	
+	/* Redirect answers cache */
+	{
+		CHECK( 0, fd_rtredir_init() );
+		
+		/* Nothing learnt yet */
+		apply_redirect("sid1", "example.net", &target, &agent);
+		CHECK( 0, target );
+		CHECK( 0, agent );
+		
+		/* DONT_CACHE and a zero cache time are not saved */
+		learn_redirect("sid1", "example.net", 0 /* DONT_CACHE */, 60);
+		learn_redirect("sid1", "example.net", 1 /* ALL_SESSION */, 0);
+		apply_redirect("sid1", "example.net", &target, &agent);
+		CHECK( 0, target );
+		
+		/* ALL_SESSION: only the requests of this session are redirected, and the agent is avoided */
+		learn_redirect("sid1", "example.net", 1 /* ALL_SESSION */, 1);
+		apply_redirect("sid1", "example.net", &target, &agent);
+		CHECK( FD_SCORE_REDIR_SESSION, target );
+		CHECK( FD_SCORE_SENT_REDIRECT, agent );
+		apply_redirect("sid2", "example.net", &target, &agent);
+		CHECK( 0, target );
+		CHECK( 0, agent );
+		
+		/* ALL_REALM, matched without case. The huge cache time is clamped, but the entry stays long enough for this test. */
+		learn_redirect("sid3", "Example.NET", 2 /* ALL_REALM */, 0xFFFFFFFF);
+		apply_redirect("sid2", "example.net", &target, &agent);
+		CHECK( FD_SCORE_REDIR_REALM, target );
+		apply_redirect("sid2", "other.net", &target, &agent);
+		CHECK( 0, target );
+		
+		/* The most specific entry is used */
+		apply_redirect("sid1", "example.net", &target, &agent);
+		CHECK( FD_SCORE_REDIR_SESSION, target );
+		
+		/* Expiry of the session entry */
+		sleep(2);
+		apply_redirect("sid1", "example.net", &target, &agent);
+		CHECK( FD_SCORE_REDIR_REALM, target );
+		
+		/* The number of entries is bound (4096): the entry which expires first is replaced */
+		for (i = 0; i < 4096; i++) {
+			snprintf(sid, sizeof(sid), "cap%d", i);
+			learn_redirect(sid, "other.net", 1 /* ALL_SESSION */, 60);
+		}
+		apply_redirect("cap0", "other.net", &target, &agent);
+		CHECK( 0, target );
+		apply_redirect("cap1", "other.net", &target, &agent);
+		CHECK( FD_SCORE_REDIR_SESSION, target );
+		apply_redirect("cap4095", "other.net", &target, &agent);
+		CHECK( FD_SCORE_REDIR_SESSION, target );
+		/* The realm entry, which expires last, is still there */
+		apply_redirect("sid1", "example.net", &target, &agent);
+		CHECK( FD_SCORE_REDIR_REALM, target );
+		
+		CHECK( 0, fd_rtredir_fini() );
+		apply_redirect("sid1", "example.net", &target, &agent);
+		CHECK( 0, target );
+	}
+	
+	/* Cache of the OUT routing decisions */
+	{
+		struct msg * msg, * msg_dh, * msg_bad;
+		struct rtc_key key, key_dh;
+		struct rt_data * rtd;
+		struct fd_list * candidates, * li;
+		struct dict_object * model;
+		struct avp * avp;
+		uint32_t gen;
+		int delta[3] = { 5, -3, 0 };
+		
+		msg = new_req("sid1", "example.net");
+		CHECK( 0, fd_rtc_get_key(msg, &key) );
+		msg_dh = new_req("sid1", "example.net");
+		add_avp_os(msg_dh, "Destination-Host", TARGET);
+		CHECK( 0, fd_rtc_get_key(msg_dh, &key_dh) );
+		
+		/* A Destination-Realm AVP without value only makes the message not cacheable */
+		msg_bad = new_req("sid1", "example.net");
+		CHECK( 0, fd_msg_browse(msg_bad, MSG_BRW_LAST_CHILD, &avp, NULL) );
+		CHECK( 0, fd_msg_free(avp) );
+		CHECK( 0, fd_dict_search( fd_g_config->cnf_dict, DICT_AVP, AVP_BY_NAME, "Destination-Realm", &model, ENOENT ) );
+		CHECK( 0, fd_msg_avp_new ( model, 0, &avp ) );
+		CHECK( 0, fd_msg_avp_add ( msg_bad, MSG_BRW_LAST_CHILD, avp ) );
+		CHECK( EINVAL, fd_rtc_get_key(msg_bad, &key) );
+		CHECK( 0, fd_msg_free(msg_bad) );
+		CHECK( 0, fd_rtc_get_key(msg, &key) );
+		
+		/* Nothing saved yet. The candidates are ordered by identity: agent, other, target */
+		rtd = new_rtd(3);
+		fd_rtd_candidate_extract(rtd, &candidates, FD_SCORE_INI);
+		gen = fd_rtc_gen();
+		CHECK( 0, fd_rtc_apply(&key, candidates) );
+		
+		/* Save the scores given by the callbacks */
+		for (i = 0, li = candidates->next; li != candidates; li = li->next, i++)
+			((struct rtd_candidate *) li)->score += delta[i];
+		fd_rtc_save(&key, gen, candidates, FD_SCORE_INI);
+		fd_rtd_free(&rtd);
+		
+		/* And replay them */
+		rtd = new_rtd(3);
+		fd_rtd_candidate_extract(rtd, &candidates, FD_SCORE_INI);
+		CHECK( 1, fd_rtc_apply(&key, candidates) );
+		for (i = 0, li = candidates->next; li != candidates; li = li->next, i++) {
+			CHECK( FD_SCORE_INI + delta[i], ((struct rtd_candidate *) li)->score );
+		}
+		fd_rtd_free(&rtd);
+		
+		/* Not for another key */
+		rtd = new_rtd(3);
+		fd_rtd_candidate_extract(rtd, &candidates, FD_SCORE_INI);
+		CHECK( 0, fd_rtc_apply(&key_dh, candidates) );
+		fd_rtd_free(&rtd);
+		
+		/* Less candidates is fine, a new candidate is not */
+		rtd = new_rtd(2);
+		fd_rtd_candidate_extract(rtd, &candidates, FD_SCORE_INI);
+		CHECK( 1, fd_rtc_apply(&key, candidates) );
+		fd_rtd_free(&rtd);
+		rtd = new_rtd(4);
+		fd_rtd_candidate_extract(rtd, &candidates, FD_SCORE_INI);
+		CHECK( 0, fd_rtc_apply(&key, candidates) );
+		fd_rtd_free(&rtd);
+		
+		/* Invalidation */
+		fd_rtdisp_cache_invalidate();
+		rtd = new_rtd(3);
+		fd_rtd_candidate_extract(rtd, &candidates, FD_SCORE_INI);
+		CHECK( 0, fd_rtc_apply(&key, candidates) );
+		
+		/* A decision computed while the cache was invalidated is not saved */
+		gen = fd_rtc_gen();
+		fd_rtdisp_cache_invalidate();
+		fd_rtc_save(&key, gen, candidates, FD_SCORE_INI);
+		CHECK( 0, fd_rtc_apply(&key, candidates) );
+		
+		gen = fd_rtc_gen();
+		fd_rtc_save(&key, gen, candidates, FD_SCORE_INI);
+		CHECK( 1, fd_rtc_apply(&key, candidates) );
+		fd_rtd_free(&rtd);
+		
+		fd_rtc_fini();
+		CHECK( 0, fd_msg_free(msg) );
+		CHECK( 0, fd_msg_free(msg_dh) );
+	}
+	
+	/* Lock-free browsing of the routing callbacks: register and unregister callbacks while requests are routed */
+	{
+		struct fd_rt_out_hdl * sink;
+		pthread_t thr[2];
+		struct msg * msg;
+		int nb = test_parameter ?: 2000, wait;
+		
+		fd_g_config->cnf_dispthr = 1;
+		CHECK( 0, fd_queues_init() );
+		CHECK( 0, fd_rtdisp_init() );
+		CHECK( 0, fd_rt_out_register( sink_cb, NULL, -100, &sink ) );
+		
+		CHECK( 0, pthread_create(&thr[0], NULL, churn_thr, NULL) );
+		CHECK( 0, pthread_create(&thr[1], NULL, churn_thr, NULL) );
+		
+		for (i = 0; i < nb; i++) {
+			msg = new_req("sid1", "example.net");
+			CHECK( 0, fd_fifo_post(fd_g_outgoing, &msg) );
+		}
+		for (wait = 0; (__atomic_load_n(&routed, __ATOMIC_RELAXED) < nb) && (wait < 1000); wait++)
+			usleep(10000);
+		CHECK( nb, __atomic_load_n(&routed, __ATOMIC_RELAXED) );
+		
+		__atomic_store_n(&churn_stop, 1, __ATOMIC_RELAXED);
+		CHECK( 0, pthread_join(thr[0], NULL) );
+		CHECK( 0, pthread_join(thr[1], NULL) );
+		TRACE_DEBUG(INFO, "%d requests routed, %d calls to the registered/unregistered callbacks", nb, churn_calls);
+		
+		CHECK( 0, fd_rt_out_unregister( sink, NULL ) );
+		CHECK( 0, fd_rtdisp_cleanstop() );
+		CHECK( 0, fd_rtdisp_fini() );
+		CHECK( 0, fd_rtdisp_cleanup() );
+	}
+	
+	/* That's all for the tests yet */
+	PASSTEST();
+} 
@@ -0,0 +1,207 @@
+/*********************************************************************************************************
+* Software License Agreement (BSD License)                                                               *
+* Author: Sebastien Decugis <sdecugis@freediameter.net>							 *
+*													 *
+* Copyright (c) 2011, WIDE Project and NICT								 *
+* All rights reserved.											 *
+* 													 *
+* Redistribution and use of this software in source and binary forms, with or without modification, are  *
+* permitted provided that the following conditions are met:						 *
+* 													 *
+* * Redistributions of source code must retain the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer.										 *
+*    													 *
+* * Redistributions in binary form must reproduce the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer in the documentation and/or other						 *
+*   materials provided with the distribution.								 *
+* 													 *
+* * Neither the name of the WIDE Project or NICT nor the 						 *
+*   names of its contributors may be used to endorse or 						 *
+*   promote products derived from this software without 						 *
+*   specific prior written permission of WIDE Project and 						 *
+*   NICT.												 *
+* 													 *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED *
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A *
+* PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR *
+* ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 	 *
+* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 	 *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR *
+* TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF   *
+* ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.								 *
+*********************************************************************************************************/
+
+
+#include "tests.h"
+
+/* The number of times the candidates removal is repeated to measure the average time.
+ Kept small so that the test runs quickly, use -p <samples> (with -n to disable the timeout) for a meaningful benchmark */
+#define DEFAULT_NUMBER_OF_SAMPLES	1000
+
+/* Number of peers in the candidates list, and number of Route-Record in the message */
+#define NB_PEERS	64
+#define NB_RR		10
+
+static void display_result(int nr, struct timespec * start, struct timespec * end, char * fct, char * type, char *op)
+{
+	long double dur = (long double)end->tv_sec + (long double)end->tv_nsec/1000000000;
+	dur -= (long double)start->tv_sec + (long double)start->tv_nsec/1000000000;
+	long double thrp = (long double)nr / dur;
+	printf("%-24s: %d %-8s %-7s in %.6LFs (%.1LFmsg/s)\n", fct, nr, type, op, dur, thrp);
+}
+
+static char peers[NB_PEERS][32];
+
+/* Create the routing data with all the peers as candidates */
+static struct rt_data * new_rtd(void)
+{
+	struct rt_data * rtd = NULL;
+	int i;
+	
+	CHECK( 0, fd_rtd_init(&rtd) );
+	for (i = 0; i < NB_PEERS; i++) {
+		CHECK( 0, fd_rtd_candidate_add(rtd, peers[i], strlen(peers[i]), "example.net", CONSTSTRLEN("example.net"), NULL) );
+	}
+	return rtd;
+}
+
+/* Count the candidates, and check if a given one is still present */
+static int count_candidates(struct rt_data * rtd, char * id, int * found)
+{
+	struct fd_list * candidates, * li;
+	int cnt = 0;
+	
+	fd_rtd_candidate_extract(rtd, &candidates, 0);
+	*found = 0;
+	for (li = candidates->next; li != candidates; li = li->next) {
+		struct rtd_candidate * c = (struct rtd_candidate *) li;
+		if (id && !strcmp(c->diamid, id))
+			*found = 1;
+		cnt++;
+	}
+	return cnt;
+}
+
+/* Main test routine */
+int main(int argc, char *argv[])
+{
+	uint8_t * rr[NB_RR + 2];
+	size_t rr_sz[NB_RR + 2];
+	char rr_buf[NB_RR][32];
+	int i, found;
+	
+	test_parameter = DEFAULT_NUMBER_OF_SAMPLES;
+	
+	/* First, initialize the daemon modules */
+	INIT_FD();
+	
+	for (i = 0; i < NB_PEERS; i++) {
+		snprintf(peers[i], sizeof(peers[i]), "peer%02d.example.net", i);
+	}
+	
+	/* The Route-Record values, received from the network: mixed case */
+	for (i = 0; i < NB_RR; i++) {
+		snprintf(rr_buf[i], sizeof(rr_buf[i]), "PEER%02d.Example.NET", i * 5);
+		rr[i] = (uint8_t *)rr_buf[i];
+		rr_sz[i] = strlen(rr_buf[i]);
+	}
+	/* One value which is not a candidate, and one invalid Diameter Identity */
+	rr[NB_RR] = (uint8_t *)"other.example.net";
+	rr_sz[NB_RR] = CONSTSTRLEN("other.example.net");
+	rr[NB_RR + 1] = (uint8_t *)"peer01.example.net\x01";
+	rr_sz[NB_RR + 1] = CONSTSTRLEN("peer01.example.net\x01");
+	
+	/* Check the single-pass removal gives the same result as the one-by-one removal */
+	{
+		struct rt_data * rtd1, * rtd2;
+		
+		rtd1 = new_rtd();
+		rtd2 = new_rtd();
+		
+		CHECK( NB_PEERS, count_candidates(rtd1, NULL, &found) );
+		
+		for (i = 0; i < NB_RR + 2; i++)
+			fd_rtd_candidate_del(rtd1, rr[i], rr_sz[i]);
+		CHECK( 0, fd_rtd_candidate_del_set(rtd2, rr, rr_sz, NB_RR + 2) );
+		
+		CHECK( NB_PEERS - NB_RR, count_candidates(rtd1, peers[5], &found) );
+		CHECK( 0, found );
+		CHECK( NB_PEERS - NB_RR, count_candidates(rtd2, peers[5], &found) );
+		CHECK( 0, found );
+		CHECK( NB_PEERS - NB_RR, count_candidates(rtd2, peers[1], &found) );
+		CHECK( 1, found );
+		
+		/* Removing again the same set does not change anything, the list is not ordered anymore */
+		CHECK( 0, fd_rtd_candidate_del_set(rtd2, rr, rr_sz, NB_RR) );
+		CHECK( NB_PEERS - NB_RR, count_candidates(rtd2, NULL, &found) );
+		
+		/* Empty set */
+		CHECK( 0, fd_rtd_candidate_del_set(rtd2, NULL, NULL, 0) );
+		CHECK( NB_PEERS - NB_RR, count_candidates(rtd2, NULL, &found) );
+		
+		fd_rtd_free(&rtd1);
+		fd_rtd_free(&rtd2);
+	}
+	
+	/* Check a set bigger than what fits on the stack */
+	{
+		struct rt_data * rtd;
+		uint8_t * all[NB_PEERS];
+		size_t all_sz[NB_PEERS];
+		
+		for (i = 0; i < NB_PEERS; i++) {
+			all[i] = (uint8_t *)peers[NB_PEERS - 1 - i];
+			all_sz[i] = strlen(peers[NB_PEERS - 1 - i]);
+		}
+		
+		rtd = new_rtd();
+		CHECK( 0, fd_rtd_candidate_del_set(rtd, all, all_sz, NB_PEERS - 1) );
+		CHECK( 1, count_candidates(rtd, peers[0], &found) );
+		CHECK( 1, found );
+		fd_rtd_free(&rtd);
+	}
+	
+	/* Measure both methods */
+	{
+		struct rt_data ** rtds;
+		struct timespec start, end;
+		
+		rtds = calloc(test_parameter, sizeof(struct rt_data *));
+		CHECK( rtds ? 1 : 0, 1 );
+		
+		for (i = 0; i < test_parameter; i++)
+			rtds[i] = new_rtd();
+		
+		CHECK( 0, clock_gettime(CLOCK_REALTIME, &start) );
+		for (i = 0; i < test_parameter; i++) {
+			int j;
+			for (j = 0; j < NB_RR; j++)
+				fd_rtd_candidate_del(rtds[i], rr[j], rr_sz[j]);
+		}
+		CHECK( 0, clock_gettime(CLOCK_REALTIME, &end) );
+		display_result(test_parameter, &start, &end, "fd_rtd_candidate_del", "messages", "routed");
+		
+		for (i = 0; i < test_parameter; i++) {
+			fd_rtd_free(&rtds[i]);
+			rtds[i] = new_rtd();
+		}
+		
+		CHECK( 0, clock_gettime(CLOCK_REALTIME, &start) );
+		for (i = 0; i < test_parameter; i++) {
+			if (0 != fd_rtd_candidate_del_set(rtds[i], rr, rr_sz, NB_RR))
+				break;
+		}
+		CHECK( test_parameter, i ); /* if false, a call failed */
+		CHECK( 0, clock_gettime(CLOCK_REALTIME, &end) );
+		display_result(test_parameter, &start, &end, "fd_rtd_candidate_del_set", "messages", "routed");
+		
+		for (i = 0; i < test_parameter; i++)
+			fd_rtd_free(&rtds[i]);
+		free(rtds);
+	}
+	
+	/* That's all for the tests yet */
+	PASSTEST();
+}
@@ -0,0 +1,209 @@
+/*********************************************************************************************************
+* Software License Agreement (BSD License)                                                               *
+* Author: Sebastien Decugis <sdecugis@freediameter.net>							 *
+*													 *
+* Copyright (c) 2011, WIDE Project and NICT								 *
+* All rights reserved.											 *
+* 													 *
+* Redistribution and use of this software in source and binary forms, with or without modification, are  *
+* permitted provided that the following conditions are met:						 *
+* 													 *
+* * Redistributions of source code must retain the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer.										 *
+*    													 *
+* * Redistributions in binary form must reproduce the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer in the documentation and/or other						 *
+*   materials provided with the distribution.								 *
+* 													 *
+* * Neither the name of the WIDE Project or NICT nor the 						 *
+*   names of its contributors may be used to endorse or 						 *
+*   promote products derived from this software without 						 *
+*   specific prior written permission of WIDE Project and 						 *
+*   NICT.												 *
+* 													 *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED *
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A *
+* PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR *
+* ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 	 *
+* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 	 *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR *
+* TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF   *
+* ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.								 *
+*********************************************************************************************************/
+
+
+#include "tests.h"
+
+/* Test the rt_load_balance extension. Its source is included to call the (static) routing callback directly. */
+#include "rt_load_balance.c"
+
+#define NB_TRIES	1000
+
+static struct rt_data * rtd = NULL;
+static struct msg * msg = NULL;
+
+/* Candidates a, b, c of the example.net realm, with the given initial scores, and an additional one if extra is set */
+static struct fd_list * new_candidates_x(int sa, int sb, int sc, char * extra)
+{
+	struct fd_list * candidates, * li;
+	int scores[3] = { sa, sb, sc }, i;
+	
+	if (rtd)
+		fd_rtd_free(&rtd);
+	CHECK( 0, fd_rtd_init(&rtd) );
+	CHECK( 0, fd_rtd_candidate_add(rtd, "a.example.net", CONSTSTRLEN("a.example.net"), "example.net", CONSTSTRLEN("example.net"), NULL) );
+	CHECK( 0, fd_rtd_candidate_add(rtd, "b.example.net", CONSTSTRLEN("b.example.net"), "example.net", CONSTSTRLEN("example.net"), NULL) );
+	CHECK( 0, fd_rtd_candidate_add(rtd, "c.example.net", CONSTSTRLEN("c.example.net"), "example.net", CONSTSTRLEN("example.net"), NULL) );
+	if (extra) {
+		CHECK( 0, fd_rtd_candidate_add(rtd, extra, strlen(extra), "example.net", CONSTSTRLEN("example.net"), NULL) );
+	}
+	fd_rtd_candidate_extract(rtd, &candidates, 0);
+	for (i = 0, li = candidates->next; (li != candidates) && (i < 3); li = li->next, i++)
+		((struct rtd_candidate *)li)->score = scores[i];
+	return candidates;
+}
+#define new_candidates(_sa, _sb, _sc) new_candidates_x(_sa, _sb, _sc, NULL)
+
+/* The score of a candidate, by first letter */
+static int score_of(struct fd_list * candidates, char id)
+{
+	struct fd_list * li;
+	for (li = candidates->next; li != candidates; li = li->next) {
+		struct rtd_candidate * c = (struct rtd_candidate *)li;
+		if (c->diamid[0] == id)
+			return c->score;
+	}
+	FAILTEST("Candidate %c not found", id);
+	return 0;
+}
+
+/* Run the callback, and return the letter of the chosen candidate (the only one with the initial best score) */
+static char balance(struct fd_list * candidates, int best)
+{
+	struct fd_list * li;
+	char chosen = 0;
+	
+	CHECK( 0, rt_load_balancing(NULL, &msg, candidates) );
+	for (li = candidates->next; li != candidates; li = li->next) {
+		struct rtd_candidate * c = (struct rtd_candidate *)li;
+		if (c->score == best) {
+			CHECK( 0, chosen );
+			chosen = c->diamid[0];
+		}
+	}
+	return chosen;
+}
+
+/* Main test routine */
+int main(int argc, char *argv[])
+{
+	struct dict_object * cmd;
+	struct fd_list * candidates, * li;
+	struct rtlb_peer * p;
+	int i, count[3];
+	char c;
+	
+	/* First, initialize the daemon modules */
+	INIT_FD();
+	
+	/* The callback does not use the content of the message */
+	CHECK( 0, fd_dict_search( fd_g_config->cnf_dict, DICT_COMMAND, CMD_BY_NAME, "Re-Auth-Request", &cmd, ENOENT ) );
+	CHECK( 0, fd_msg_new ( cmd, 0, &msg ) );
+	
+	CHECK( 0, rtlb_conf_add_weight(strdup("a.example.net"), 8) );
+	CHECK( 0, rtlb_conf_add_weight(strdup("b.example.net"), 2) );
+	
+	/* The first message sees only unknown peers: the scores are changed once */
+	candidates = new_candidates(0, 0, 0);
+	c = balance(candidates, 0);
+	CHECK( 1, (c >= 'a') && (c <= 'c') ? 1 : 0 );
+	CHECK( 0, score_of(candidates, c) );
+	for (i = 'a'; i <= 'c'; i++) {
+		if (i != c) {
+			CHECK( -FD_SCORE_LOAD_BALANCE, score_of(candidates, i) );
+		}
+	}
+	
+	/* Only the candidates with the best score are balanced, the others are not changed */
+	candidates = new_candidates(5, 10, 10);
+	c = balance(candidates, 10);
+	CHECK( 5, score_of(candidates, 'a') );
+	CHECK( 1, (c == 'b') || (c == 'c') ? 1 : 0 );
+	
+	/* The choice follows the weights (8, 2, 1). The peers are unknown, so their costs are the same. */
+	memset(count, 0, sizeof(count));
+	for (i = 0; i < NB_TRIES; i++) {
+		candidates = new_candidates(0, 0, 0);
+		count[balance(candidates, 0) - 'a']++;
+	}
+	TRACE_DEBUG(INFO, "Chosen: a %d, b %d, c %d", count[0], count[1], count[2]);
+	CHECK( NB_TRIES, count[0] + count[1] + count[2] );
+	CHECK( 1, (count[0] > count[1]) && (count[1] > count[2]) && (count[2] > 0) ? 1 : 0 );
+	
+	/* A busy peer is lowered and never chosen */
+	CHECK( 0, pthread_mutex_lock(&rtlb_lock) );
+	CHECK( 0, rtlb_get("a.example.net", CONSTSTRLEN("a.example.net"), &p) );
+	CHECK( 0, pthread_mutex_unlock(&rtlb_lock) );
+	p->busy_until = time(NULL) + 60;
+	for (i = 0; i < 100; i++) {
+		candidates = new_candidates(0, 0, 0);
+		c = balance(candidates, 0);
+		CHECK( 1, (c == 'b') || (c == 'c') ? 1 : 0 );
+		CHECK( -2 * FD_SCORE_LOAD_BALANCE, score_of(candidates, 'a') );
+	}
+	
+	/* Also when another candidate is seen for the first time: the busy peer is lowered only once */
+	candidates = new_candidates_x(0, 0, 0, "d.example.net");
+	c = balance(candidates, 0);
+	CHECK( 1, (c >= 'b') && (c <= 'd') ? 1 : 0 );
+	CHECK( -2 * FD_SCORE_LOAD_BALANCE, score_of(candidates, 'a') );
+	p->busy_until = 0;
+	
+	/* The peer objects saved in the candidates are compared without searching the peers list: b and c are always 
+	  both picked, and b has the lowest expected delay despite its weight */
+	{
+		struct fd_peer * pb = NULL, * pc = NULL;
+		
+		CHECK( 0, fd_peer_alloc(&pb) );
+		CHECK( 0, fd_peer_alloc(&pc) );
+		pb->p_sr.cnt = 3;
+		pb->p_sr.delay_avg = 1000;
+		pc->p_sr.cnt = 100;
+		pc->p_sr.delay_avg = 1000;
+		for (i = 0; i < 100; i++) {
+			candidates = new_candidates(0, 10, 10);
+			for (li = candidates->next; li != candidates; li = li->next) {
+				struct rtd_candidate * cand = (struct rtd_candidate *)li;
+				if (cand->diamid[0] == 'b')
+					cand->peer = &pb->p_hdr;
+				if (cand->diamid[0] == 'c')
+					cand->peer = &pc->p_hdr;
+			}
+			CHECK( 'b', balance(candidates, 10) );
+		}
+		CHECK( 0, fd_peer_free(&pb) );
+		CHECK( 0, fd_peer_free(&pc) );
+	}
+	
+	/* The sum of the weights does not overflow */
+	CHECK( 0, rtlb_conf_add_weight(strdup("w1.example.net"), INT_MAX) );
+	CHECK( 0, rtlb_conf_add_weight(strdup("w2.example.net"), INT_MAX) );
+	CHECK( 0, rtlb_conf_add_weight(strdup("w3.example.net"), INT_MAX) );
+	for (i = 0; i < 100; i++) {
+		fd_rtd_free(&rtd);
+		CHECK( 0, fd_rtd_init(&rtd) );
+		CHECK( 0, fd_rtd_candidate_add(rtd, "w1.example.net", CONSTSTRLEN("w1.example.net"), "example.net", CONSTSTRLEN("example.net"), NULL) );
+		CHECK( 0, fd_rtd_candidate_add(rtd, "w2.example.net", CONSTSTRLEN("w2.example.net"), "example.net", CONSTSTRLEN("example.net"), NULL) );
+		CHECK( 0, fd_rtd_candidate_add(rtd, "w3.example.net", CONSTSTRLEN("w3.example.net"), "example.net", CONSTSTRLEN("example.net"), NULL) );
+		fd_rtd_candidate_extract(rtd, &candidates, 0);
+		CHECK( 'w', balance(candidates, 0) );
+	}
+	
+	fd_rtd_free(&rtd);
+	CHECK( 0, fd_msg_free(msg) );
+	
+	/* That's all for the tests yet */
+	PASSTEST();
+} 
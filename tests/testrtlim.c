@@ -0,0 +1,189 @@
+/*********************************************************************************************************
+* Software License Agreement (BSD License)                                                               *
+* Author: Sebastien Decugis <sdecugis@freediameter.net>							 *
+*													 *
+* Copyright (c) 2013, WIDE Project and NICT								 *
+* All rights reserved.											 *
+* 													 *
+* Redistribution and use of this software in source and binary forms, with or without modification, are  *
+* permitted provided that the following conditions are met:						 *
+* 													 *
+* * Redistributions of source code must retain the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer.										 *
+*    													 *
+* * Redistributions in binary form must reproduce the above 						 *
+*   copyright notice, this list of conditions and the 							 *
+*   following disclaimer in the documentation and/or other						 *
+*   materials provided with the distribution.								 *
+* 													 *
+* * Neither the name of the WIDE Project or NICT nor the 						 *
+*   names of its contributors may be used to endorse or 						 *
+*   promote products derived from this software without 						 *
+*   specific prior written permission of WIDE Project and 						 *
+*   NICT.												 *
+* 													 *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED *
+* WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A *
+* PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR *
+* ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 	 *
+* LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 	 *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR *
+* TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF   *
+* ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.								 *
+*********************************************************************************************************/
+
+#include "tests.h"
+
+/* The rate limits of the routed requests (ratelimit.c) */
+
+#define CONF_CONTENT						\
+	"Identity = \"rtlim.localdomain\";\n"			\
+	"SecPort = 0;\n"					\
+	"RateLimitIn = \"peer\", \"nas.example.net\", 500, 1000;\n"	\
+	"RateLimitIn = \"app\", \"16777238\", 2000, 0;\n"		\
+	"RateLimitOut = \"realm\", \"example.net\", 1000, 200;\n"
+
+/* Check the dump of the limits contains a string */
+static int dump_has(char * str)
+{
+	char * buf = NULL;
+	size_t len = 0;
+	int ret;
+
+	CHECK( 1, fd_rt_limits_dump(&buf, &len, NULL) ? 1 : 0 );
+	ret = strstr(buf, str) ? 1 : 0;
+	if (!ret) {
+		TRACE_DEBUG(INFO, "'%s' not found in: %s", str, buf);
+	}
+	free(buf);
+	return ret;
+}
+
+/* Check a request received from this peer, for this realm */
+static int check_in(char * src, char * realm)
+{
+	struct msg * msg = NULL;
+	union avp_value dr;
+	int ret;
+
+	CHECK( 0, fd_msg_new( NULL, 0, &msg ) );
+	CHECK( 0, fd_msg_source_set( msg, src, strlen(src) ) );
+	dr.os.data = (uint8_t *)realm;
+	dr.os.len = strlen(realm);
+	ret = fd_rtlim_in(msg, &dr, 3);
+	CHECK( 0, fd_msg_free( msg ) );
+	return ret;
+}
+
+/* Main test routine */
+int main(int argc, char *argv[])
+{
+	/* First, initialize the daemon modules */
+	INIT_FD();
+
+	/* The RateLimitIn / RateLimitOut directives */
+	{
+		char fname[] = "/tmp/testrtlim.conf.XXXXXX";
+		int fd;
+
+		CHECK( 1, (fd = mkstemp(fname)) >= 0 ? 1 : 0 );
+		CHECK( strlen(CONF_CONTENT), write(fd, CONF_CONTENT, strlen(CONF_CONTENT)) );
+		close(fd);
+
+		fd_g_config->cnf_file = fname;
+		CHECK( 0, fd_conf_parse() );
+		unlink(fname);
+		fd_g_config->cnf_file = NULL;
+
+		CHECK( 1, dump_has("{rate limits}") );
+		CHECK( 1, dump_has(": 3") );
+		CHECK( 1, dump_has("in peer 'nas.example.net': 500/s burst:1000 ") );
+		CHECK( 1, dump_has("in app 16777238: 2000/s burst:2000 ") );
+		CHECK( 1, dump_has("out realm 'example.net': 1000/s burst:200 ") );
+		CHECK( 0, fd_rtlim_fini() );
+
+		/* The values refused by the parser */
+		CHECK( EINVAL, fd_rtlim_add(0, "host", "nas.example.net", 10, 10) );
+		CHECK( EINVAL, fd_rtlim_add(0, "app", "diameter", 10, 10) );
+		CHECK( EINVAL, fd_rtlim_add(0, "app", "", 10, 10) );
+		CHECK( EINVAL, fd_rtlim_add(1, "realm", "example.net", 0, 10) );
+		CHECK( EINVAL, fd_rtlim_add(1, "realm", "example.net", 10, -1) );
+		CHECK( 1, dump_has(": 0") );
+
+		/* The kind is not case sensitive, and the app id may be in hexadecimal */
+		CHECK( 0, fd_rtlim_add(0, "App", "0x1000016", 10, 10) );
+		CHECK( 1, dump_has("in app 16777238: 10/s burst:10 ") );
+		CHECK( 0, fd_rtlim_fini() );
+	}
+
+	/* The token buckets */
+	{
+		int i, passed;
+
+		/* 10 tokens per second: a thread takes them one at a time, the bucket is refilled by 1 token every 100ms */
+		CHECK( 0, fd_rtlim_add(0, "peer", "nas.example.net", 10, 5) );
+		CHECK( 0, fd_rtlim_add(0, "realm", "example.net", 10, 2) );
+		CHECK( 0, fd_rtlim_init() );
+
+		/* The realm bucket is empty after 2 requests, the token taken in the peer bucket is given back */
+		CHECK( 0, check_in("nas.example.net", "example.net") );
+		CHECK( 0, check_in("nas.example.net", "example.net") );
+		CHECK( EBUSY, check_in("nas.example.net", "example.net") );
+		CHECK( 1, dump_has("in realm 'example.net': 10/s burst:2 tokens:0 passed:2 rejected:1") );
+
+		/* So 3 requests remain for the peer, in other realms */
+		CHECK( 0, check_in("nas.example.net", "example.org") );
+		CHECK( 0, check_in("nas.example.net", "example.org") );
+		CHECK( 0, check_in("nas.example.net", "example.org") );
+		CHECK( EBUSY, check_in("nas.example.net", "example.org") );
+		CHECK( 1, dump_has("in peer 'nas.example.net': 10/s burst:5 tokens:0 passed:5 rejected:1") );
+
+		/* Other peers are not limited */
+		CHECK( 0, check_in("other.example.net", "example.org") );
+
+		/* The bucket is refilled with the time, up to the burst size */
+		usleep(250000);
+		for (passed = 0, i = 0; i < 5; i++) {
+			if (!check_in("nas.example.net", "example.org"))
+				passed++;
+		}
+		CHECK( 1, (passed >= 2) && (passed <= 3) ? 1 : 0 );
+		usleep(1000000);
+		for (passed = 0, i = 0; i < 10; i++) {
+			if (!check_in("nas.example.net", "example.org"))
+				passed++;
+		}
+		CHECK( 5, passed );
+		CHECK( 0, fd_rtlim_fini() );
+	}
+
+	/* Giving back the token of a request that could not be sent to a peer */
+	{
+		struct fd_peer * peer = NULL;
+
+		CHECK( 0, fd_peer_alloc(&peer) );
+		peer->p_hdr.info.pi_diamid = "nas.example.net";
+		peer->p_hdr.info.pi_diamidlen = strlen(peer->p_hdr.info.pi_diamid);
+
+		/* Chunks of 10 tokens (10ms worth) */
+		CHECK( 0, fd_rtlim_add(1, "peer", "nas.example.net", 1000, 20) );
+		CHECK( 0, fd_rtlim_init() );
+
+		/* The token goes back to the chunk of this thread while it is valid... */
+		CHECK( 0, fd_rtlim_out_peer(peer) );
+		CHECK( 1, dump_has("tokens:10 passed:1 ") );
+		fd_rtlim_out_peer_cancel(peer);
+		CHECK( 1, dump_has("tokens:10 passed:0 ") );
+
+		/* ... and to the shared bucket with the rest of the chunk once it expired */
+		CHECK( 0, fd_rtlim_out_peer(peer) );
+		usleep(150000);
+		fd_rtlim_out_peer_cancel(peer);
+		CHECK( 1, dump_has("tokens:20 passed:0 ") );
+		CHECK( 0, fd_rtlim_fini() );
+	}
+
+	/* That's all for the tests yet */
+	PASSTEST();
+}
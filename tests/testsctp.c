@@ -137,6 +137,38 @@ redo2:
 	CHECK( 0, memcmp(buf1, buf2, sz) );
 	free(buf2); buf2 = NULL;
 	
+	/* Send several messages with one call, each on its stream, and receive them. Each message received has its own buffer. */
+	{
+		uint16_t strids[3] = { 0, 3, 3 };
+		char bufs[3][8] = { "first", "second", "third" };
+		struct iovec iovs[3];
+		uint8_t * rcvd[3];
+		int i;
+		
+		for (i = 0; i < 3; i++) {
+			iovs[i].iov_base = bufs[i];
+			iovs[i].iov_len = strlen(bufs[i]) + 1;
+		}
+		CHECK( 3, fd_sctp_sendstrmv(&cli, strids, iovs, 3) );
+		CHECK( 0, cli.cc_state);
+		
+		srv.cc_loop = 1;
+		for (i = 0; i < 3; i++) {
+			do {
+				CHECK( 0, fd_sctp_recvmeta(&srv, &str, &rcvd[i], &sz, &ev) );
+			} while (ev == FDEVP_CNX_EP_CHANGE);
+			CHECK( FDEVP_CNX_MSG_RECV, ev);
+			CHECK( strids[i], str);
+			CHECK( iovs[i].iov_len, sz );
+			CHECK( 0, memcmp(bufs[i], rcvd[i], sz) );
+		}
+		CHECK( 1, (rcvd[0] != rcvd[1]) && (rcvd[1] != rcvd[2]) ? 1 : 0 );
+		for (i = 0; i < 3; i++)
+			free(rcvd[i]);
+		fd_sctp_rcvbatch_free(&srv);
+		fd_sctp_rcvbatch_free(&cli);
+	}
+	
 	/* That's all for the tests yet */
 	PASSTEST();
 #endif /* DISABLE_SCTP */